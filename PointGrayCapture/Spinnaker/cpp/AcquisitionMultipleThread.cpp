@@ -31,7 +31,31 @@
 #include <iostream>
 #include <fstream>
 #include <sstream> 
+#include <algorithm>
 #include "SpinVideo.h"
+#include "FrameQueue.h"
+#include "FrameBufferPool.h"
+#include "FrameSource.h"
+#include "ChunkLog.h"
+#include "FrameSetAssembler.h"
+#include "ColorEngine.h"
+#include "JpegEncoderPool.h"
+#include "StorageScheduler.h"
+#include "FrameContainer.h"
+#include "StreamBuffers.h"
+#include "CaptureProfile.h"
+#include "CaptureStats.h"
+#include "FrameDropDetector.h"
+#include "CaptureLog.h"
+#include "DeviceClock.h"
+#include "ThreadPlacement.h"
+#include "CameraBringUp.h"
+#include "StartBarrier.h"
+#include "SegmentedVideo.h"
+#include "X264Encoder.h"
+#include "LosslessCodec.h"
+#include "PreviewPublisher.h"
+#include "FrameBus.h"
 
 #ifndef _WIN32
 #include <pthread.h>
@@ -49,7 +73,18 @@ enum videoType
 {
 	UNCOMPRESSED,
 	MJPG,
-	H264
+	H264,
+	SOFTWARE_H264 // libx264 segments, needs USE_X264 (X264Encoder.h)
+};
+
+// Use the following enum to select whether frames are recorded as video files
+// or as one JPEG per frame (<serial>\img_%06d.jpg, as extract_videos2images.py
+// would produce).
+enum recordType
+{
+	RECORD_VIDEO,
+	RECORD_JPEG,
+	RECORD_CONTAINER // all cameras in one indexed file, see FrameContainer.h
 };
 
 // Use the following enum and global constant to select whether chunk data is 
@@ -70,28 +105,89 @@ enum bufferType
 	OldestFirstOverwrite,
 };
 
+// Name of the StreamBufferHandlingMode entry of a bufferType
+const char* GetBufferHandlingName(bufferType type)
+{
+	static const char* names[] = { "NewestFirst", "NewestFirstOverwrite", "NewestOnly", "OldestFirst", "OldestFirstOverwrite" };
+	return names[type];
+}
+
+// Use the following enum to select whether the primary starts the rig on its
+// own as soon as every camera is armed, or waits for Enter after that.
+enum startModeType
+{
+	START_WHEN_ARMED,
+	START_ON_ENTER
+};
+
+// Use the following enum to select whether the camera ISP produces BGR8
+// (3 bytes/pixel on the link) or raw BayerBG8 (1 byte/pixel) is captured and
+// the colour processing is reproduced offline from the saved colour state.
+enum captureModeType
+{
+	PROCESSED_BGR8,
+	RAW_BAYER
+};
+
 
 // ===================================================================================
 // ==================================== SELECT =======================================
 // ===================================================================================
 const chunkDataType chosenChunkData = IMAGE;
 const PixelFormatEnums savePixelFormat = PixelFormat_RGB8;// PixelFormat_BGR8; // PixelFormat_Mono8;
-const unsigned int numBuffers = 10; // Total number of buffers
+const unsigned int numBuffers = 10; // Minimum number of stream buffers; the count is planned at startup
 const bufferType chosenBufferType = OldestFirstOverwrite;
 
 const string serialNumberPrimary = "18565847"; // "18566303";
-const gcstring grabPixelFormatName = "BGR8"; // BayerBG8
+const startModeType chosenStartMode = START_WHEN_ARMED; // START_ON_ENTER
+const unsigned int k_armTimeoutMs = 30000; // longest the primary waits for all cameras to arm; after that the operator decides
+const captureModeType chosenCaptureMode = PROCESSED_BGR8; // RAW_BAYER
+const gcstring grabPixelFormatName = (chosenCaptureMode == RAW_BAYER) ? "BayerBG8" : "BGR8";
+const bool hostColorProcessing = false; // RAW_BAYER only: develop frames with ColorEngine before encoding
+const unsigned int k_colorEngineThreads = 8; // shared by all cameras
 
 const ColorProcessingAlgorithm interpolationAlgo = HQ_LINEAR; // WEIGHTED_DIRECTIONAL_FILTER; // DIRECTIONAL_FILTER; // HQ_LINEAR
 
 const int selectFrameRate = 20;
-const videoType chosenVideoType = MJPG; // UNCOMPRESSED;
+const string captureProfilesName = "CaptureProfiles.txt"; // per-camera ROI, binning and frame rate (CaptureProfile.h); without it full frame at selectFrameRate
+const bool diffApplyConfig = true; // write only settings the camera does not hold already, and leave chunk data on at exit
+const bool saveConfigToUserSet = false; // store the settings in UserSet1 and load it at power-up, so a warm start writes nothing
+const string configSnapshotName = "ConfigSnapshot"; // + serial + ".txt" in the working directory, settings of the last session (ConfigSnapshot.h)
+#if defined(USE_X264)
+const videoType chosenVideoType = (chosenCaptureMode == RAW_BAYER && !hostColorProcessing) ? UNCOMPRESSED : SOFTWARE_H264; // lossy codecs would smear the Bayer mosaic
+#else
+const videoType chosenVideoType = (chosenCaptureMode == RAW_BAYER && !hostColorProcessing) ? UNCOMPRESSED : MJPG; // MJPEG would smear the Bayer mosaic
+#endif
+const string encoderSettingsName = "EncoderSettings.txt"; // SOFTWARE_H264: per-camera preset, CRF or bitrate and threading (X264Encoder.h); without it veryfast at CRF 23
+const unsigned int k_encoderCoreBudget = 12; // SOFTWARE_H264: encoder threads of all cameras together, shared by pixel rate
+const unsigned int k_segmentFrames = 0; // trigger pulses per video segment; 0 derives it from k_segmentSeconds
+const double k_segmentSeconds = 60.0; // video segment length at the acquisition frame rate; 0 writes one segment
 const unsigned int k_numImages = 9000;
 const unsigned int k_numPrintInfo = 20;
+const LogLevel grabThreadLogLevel = Log_Info; // Log_Warning hides the per-camera setup and progress lines
+const double streamSlackSeconds = 3.0; // encoder/disk stall the frame queue between grab and writer thread must cover
+const double streamRamFraction = 0.5; // share of the free RAM that stream buffers and frame queues of all cameras may use
+const unsigned int k_streamStatsIntervalMs = 1000; // how often the driver's stream counters are sampled
+const unsigned int k_clockSampleIntervalMs = 1000; // how often the device clock is latched for the common time base
+const unsigned int k_clockLatchTries = 3; // latches per sample, the most tightly bracketed one is kept
+const bool placeThreads = true; // pin grab, writer and encoder threads to cores near each camera (ThreadPlacement.h)
+const string threadPlacementName = "ThreadPlacement.txt"; // per-camera NUMA node and grab core, encoder node, realtime priority; without it all automatic
+const unsigned int k_framePoolSpare = 8; // preallocated frame buffers per camera beyond the grown queue depth
+const unsigned int k_developBuffers = 8; // preallocated BGR8 buffers per camera for host colour processing
+
+const recordType chosenRecordType = RECORD_VIDEO; // RECORD_JPEG
+const unsigned int k_jpegEncoderThreads = 12; // shared by all cameras
+const unsigned int k_jpegQueueDepth = 24; // images waiting for an encoder before writer threads block
+const unsigned int k_jpegQuality = 90;
+const string containerName = "Recording.mcr"; // RECORD_CONTAINER, written next to the frame-set index
+const bool losslessContainer = false; // RECORD_CONTAINER: compress frames losslessly (LosslessCodec.h) instead of JPEG, e.g. for calibration
+const bool losslessBayerPrediction = true; // predict raw Bayer samples from neighbours of the same colour
+const unsigned int k_losslessStripes = 8; // independently coded row stripes per frame, compressed in parallel
+const unsigned int k_losslessThreads = 8; // shared by all cameras
 
 // const unsigned int k_savePerNumImages = 100;
 // const unsigned int k_threadPerCameraForSaving = 3;
-const unsigned int imageHeight = 1024; //???
+const unsigned int imageHeight = 1024; // full sensor; the cameras are sized from their capture profiles
 const unsigned int imageWidth = 1280;
 
 // const float gainSet = 6.8;
@@ -117,15 +213,108 @@ const string outputFolders[k_numCameras] = {
 };
 
 const string subfolderName = "022819_calib_pointgrey";
+
+// Storage scheduling: measure the output volumes before capturing and move a
+// camera off its drive in outputFolders if that drive cannot keep up or fill up
+const bool scheduleStorage = true;
+const unsigned int k_storageProbeMB = 256; // written to each volume in parallel, then deleted
+const double storageHeadroom = 0.7; // plan with at most this fraction of the measured bandwidth
+const double storageCompressionRatio = 0.15; // MJPEG/JPEG bytes per raw byte, rough for our scenes
+const double losslessCompressionRatio = 0.5; // lossless container bytes per raw byte
+const string storageLayoutName = "StorageLayout.txt";
+
+// Online frame-set assembly; the index is written next to the first camera's recording
+const string syncIndexName = "SyncIndex.csv";
+const double syncSkewToleranceUs = 15000; // allowed spread of frame times within a set (common time, or host grab time without a clock model)
+const double syncMaxWaitMs = 1000; // give up on a set this long after its first frame
+
+// Stage latency histograms and counters of all cameras, rewritten next to the
+// frame-set index while capturing
+const string statsFileName = "CaptureStats.json";
+const unsigned int k_statsIntervalMs = 5000;
+
+// Live preview: every Nth frame of each camera, downscaled and published to
+// shared memory for PreviewSnapshot or another viewer (PreviewPublisher.h).
+// Frames the preview cannot take at once are dropped, never waited for.
+const bool livePreview = true;
+const string previewRegionName = "MultiCameraPreview"; // shared-memory name viewers open (/dev/shm on Linux)
+const unsigned int k_previewEveryN = 4; // per camera, e.g. 5 Hz at 20 fps
+const unsigned int k_previewMaxWidth = 640;
+const unsigned int k_previewMaxHeight = 512;
+const double previewCpuBudget = 0.25; // cores the preview thread may use on average; beyond that frames are skipped
+
+// Frame bus: every recorded frame with its chunk record, live in a shared-memory
+// ring per camera for other processes (FrameBus.h). Readers that hold frames
+// too long lose them; the writer thread never waits for a reader.
+const bool publishFrameBus = false;
+const string frameBusName = "MultiCameraFrames"; // + "-" + serial
+const unsigned int k_frameBusSlots = 8; // full frames per camera, in RAM for the whole run
+
+// Synthetic camera benchmark (run with --benchmark, see main)
+const string benchmarkSubfolderName = "benchmark_synthetic";
+const unsigned int k_benchmarkNumImages = 1200;
 // ===================================================================================
 // add ctrl c handle
 volatile bool is_running = true;
 
+// Collects frames from all camera threads into synchronized frame sets
+FrameSetAssembler* frameSetAssembler = NULL;
+
+// Develops raw Bayer frames on the host when hostColorProcessing is set
+ColorEngine* colorEngine = NULL;
+
+// Encodes the frames of all cameras when chosenRecordType is RECORD_JPEG
+JpegEncoderPool* jpegEncoderPool = NULL;
+
+// Receives the frames of all cameras when chosenRecordType is RECORD_CONTAINER
+FrameContainerWriter* frameContainer = NULL;
+
+// Compresses the stripes of lossless container frames when losslessContainer is set
+ColorThreadPool* losslessPool = NULL;
+
+// Publishes decimated frames of all cameras for a live view when livePreview is set
+PreviewPublisher* previewPublisher = NULL;
+
+// Per-stage latencies of all cameras, dumped to statsFileName
+CaptureStatsRegistry* captureStats = NULL;
+
+// Rate the cameras are triggered at, i.e. the frame period FrameDropDetector expects
+float captureFrameRate = selectFrameRate;
+
+// Every camera arms it once acquisition runs; the primary starts the rig after
+StartBarrier* startBarrier = NULL;
+
+// Per-phase bring-up times of all cameras, printed once the last one is up
+BringUpReport* bringUpReport = NULL;
+
+// Cores and NUMA node of each camera's threads when placeThreads is set
+ThreadPlacementPlan* threadPlacement = NULL;
+
+// Output folder of each camera in serialNumbers, chosen by PlanStorage
+string cameraOutputFolders[k_numCameras];
+
+// Per-camera ROI, binning and frame rate, loaded from captureProfilesName
+vector<CaptureProfile> captureProfiles;
+
+// Per-camera software encoder settings with each camera's share of the
+// encoder core budget, see PlanEncoders
+vector<EncoderSettings> encoderSettings;
+
+// Inputs of PlanStreamBufferCount, measured once before the cameras start
+struct StreamResources {
+	double fullFrameEncodeMs;
+	uint64_t availableRam;
+	unsigned int numCameras;
+
+	StreamResources() : fullFrameEncodeMs(0), availableRam(0), numCameras(1) {}
+};
+StreamResources streamResources;
+
 BOOL WINAPI CtrlCHandler(DWORD fdwCtrlType) 
 {
 	if (fdwCtrlType == CTRL_C_EVENT) {
 		is_running = false;
-		cout << "End Capture" << endl;
+		CAPTURE_LOG(Log_Info) << "End Capture";
 		return true;
 	}
 	return false;
@@ -154,7 +343,7 @@ int PrintDeviceInfo(INodeMap & nodeMap, std::string camSerial)
 {
 	int result = 0;
 
-	cout << "[" << camSerial << "] Printing device information ..." << endl << endl;
+	CAPTURE_LOG(Log_Info) << "[" << camSerial << "] Printing device information ..." << endl;
 
 	FeatureList_t features;
 	CCategoryPtr category = nodeMap.GetNode("DeviceInformation");
@@ -167,116 +356,92 @@ int PrintDeviceInfo(INodeMap & nodeMap, std::string camSerial)
 		{
 			CNodePtr pfeatureNode = *it;
 			CValuePtr pValue = (CValuePtr)pfeatureNode;
-			cout << "[" << camSerial << "] " << pfeatureNode->GetName() << " : " << (IsReadable(pValue) ? pValue->ToString() : "Node not readable") << endl;
+			CAPTURE_LOG(Log_Info) << "[" << camSerial << "] " << pfeatureNode->GetName() << " : " << (IsReadable(pValue) ? pValue->ToString() : "Node not readable");
 		}
 	}
 	else
 	{
-		cout << "[" << camSerial << "] " << "Device control information not available." << endl;
+		CAPTURE_LOG(Log_Warning) << "[" << camSerial << "] " << "Device control information not available.";
 	}
 
-	cout << endl;
+	CAPTURE_LOG(Log_Info) << endl;
 
 	return result;
 }
 
-int ConfigureBuffer(INodeMap & sNodeMap)
+int ConfigureBuffer(CameraNodes & nodes, unsigned int bufferCount)
 {
-	// Retrieve Stream Parameters device nodemap 
-	// Spinnaker::GenApi::INodeMap & sNodeMap = pCam->GetTLStreamNodeMap();
-
 	try
 	{
 		// Retrieve Buffer Handling Mode Information
-		CEnumerationPtr ptrHandlingMode = sNodeMap.GetNode("StreamBufferHandlingMode");
+		CEnumerationPtr ptrHandlingMode = nodes.bufferHandlingMode;
 		if (!IsAvailable(ptrHandlingMode) || !IsWritable(ptrHandlingMode))
 		{
-			cout << "Unable to set Buffer Handling mode (node retrieval). Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to set Buffer Handling mode (node retrieval). Aborting..." << endl;
 			return -1;
 		}
 		CEnumEntryPtr ptrHandlingModeEntry = ptrHandlingMode->GetCurrentEntry();
 		if (!IsAvailable(ptrHandlingModeEntry) || !IsReadable(ptrHandlingModeEntry))
 		{
-			cout << "Unable to set Buffer Handling mode (Entry retrieval). Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to set Buffer Handling mode (Entry retrieval). Aborting..." << endl;
 			return -1;
 		}
 
 		// Set stream buffer Count Mode to manual
-		CEnumerationPtr ptrStreamBufferCountMode = sNodeMap.GetNode("StreamBufferCountMode");
+		CEnumerationPtr ptrStreamBufferCountMode = nodes.bufferCountMode;
 		if (!IsAvailable(ptrStreamBufferCountMode) || !IsWritable(ptrStreamBufferCountMode))
 		{
-			cout << "Unable to set Buffer Count Mode (node retrieval). Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to set Buffer Count Mode (node retrieval). Aborting..." << endl;
 			return -1;
 		}
 
-		CEnumEntryPtr ptrStreamBufferCountModeManual = ptrStreamBufferCountMode->GetEntryByName("Manual"); //  Original: Auto
+		CEnumEntryPtr ptrStreamBufferCountModeManual = nodes.bufferCountModeManual; //  Original: Auto
 		if (!IsAvailable(ptrStreamBufferCountModeManual) || !IsReadable(ptrStreamBufferCountModeManual))
 		{
-			cout << "Unable to set Buffer Count Mode entry (Entry retrieval). Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to set Buffer Count Mode entry (Entry retrieval). Aborting..." << endl;
 			return -1;
 		}
 
 		ptrStreamBufferCountMode->SetIntValue(ptrStreamBufferCountModeManual->GetValue());
 
-		cout << "Stream Buffer Count Mode set to manual..." << endl;
+		CAPTURE_LOG(Log_Info) << "Stream Buffer Count Mode set to manual...";
 
 		// Retrieve and modify Stream Buffer Count
-		CIntegerPtr ptrBufferCount = sNodeMap.GetNode("StreamBufferCountManual");
+		CIntegerPtr ptrBufferCount = nodes.bufferCountManual;
 		if (!IsAvailable(ptrBufferCount) || !IsWritable(ptrBufferCount))
 		{
-			cout << "Unable to set Buffer Count (Integer node retrieval). Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to set Buffer Count (Integer node retrieval). Aborting..." << endl;
 			return -1;
 		}
 
 		// Display Buffer Info
-		cout << endl << "Default Buffer Handling Mode: " << ptrHandlingModeEntry->GetDisplayName() << endl;
-		cout << "Default Buffer Count: " << ptrBufferCount->GetValue() << endl;
-		cout << "Maximum Buffer Count: " << ptrBufferCount->GetMax() << endl;
+		CAPTURE_LOG(Log_Info) << endl << "Default Buffer Handling Mode: " << ptrHandlingModeEntry->GetDisplayName();
+		CAPTURE_LOG(Log_Info) << "Default Buffer Count: " << ptrBufferCount->GetValue();
+		CAPTURE_LOG(Log_Info) << "Maximum Buffer Count: " << ptrBufferCount->GetMax();
 
-		ptrBufferCount->SetValue(numBuffers);
+		int64_t count = max(static_cast<int64_t>(bufferCount), static_cast<int64_t>(numBuffers));
+		ptrBufferCount->SetValue(min(count, ptrBufferCount->GetMax()));
 
-		cout << "Buffer count now set to: " << ptrBufferCount->GetValue() << endl;
+		CAPTURE_LOG(Log_Info) << "Buffer count now set to: " << ptrBufferCount->GetValue();
+		nodes.applied.Set("StreamBufferCountManual", ptrBufferCount->GetValue());
 
-		switch (chosenBufferType)
+		// The entry of chosenBufferType, resolved with the other nodes
+		ptrHandlingModeEntry = nodes.bufferHandlingModeChosen;
+		if (IsAvailable(ptrHandlingModeEntry) && IsReadable(ptrHandlingModeEntry))
 		{
-		case NewestFirst:
-			ptrHandlingModeEntry = ptrHandlingMode->GetEntryByName("NewestFirst");
-			ptrHandlingMode->SetIntValue(ptrHandlingModeEntry->GetValue());
-			cout << endl << endl << "Buffer Handling Mode has been set to " << ptrHandlingModeEntry->GetDisplayName() << endl;
-			break;
-
-		case NewestFirstOverwrite:
-			ptrHandlingModeEntry = ptrHandlingMode->GetEntryByName("NewestFirstOverwrite");
-			ptrHandlingMode->SetIntValue(ptrHandlingModeEntry->GetValue());
-			cout << endl << endl << "Buffer Handling Mode has been set to " << ptrHandlingModeEntry->GetDisplayName() << endl;
-			break;
-		
-		case NewestOnly:
-			ptrHandlingModeEntry = ptrHandlingMode->GetEntryByName("NewestOnly"); // Default setting
-			ptrHandlingMode->SetIntValue(ptrHandlingModeEntry->GetValue());
-			cout << endl << endl << "Buffer Handling Mode has been set to " << ptrHandlingModeEntry->GetDisplayName() << endl;
-			break;
-
-		case OldestFirst:
-			ptrHandlingModeEntry = ptrHandlingMode->GetEntryByName("OldestFirst");
-			ptrHandlingMode->SetIntValue(ptrHandlingModeEntry->GetValue());
-			cout << endl << endl << "Buffer Handling Mode has been set to " << ptrHandlingModeEntry->GetDisplayName() << endl;
-			break;
-
-		case OldestFirstOverwrite:
-			ptrHandlingModeEntry = ptrHandlingMode->GetEntryByName("OldestFirstOverwrite");
 			ptrHandlingMode->SetIntValue(ptrHandlingModeEntry->GetValue());
-			cout << endl << endl << "Buffer Handling Mode has been set to " << ptrHandlingModeEntry->GetDisplayName() << endl;
-			break;
-
-		default:
-			break;
+			nodes.applied.Set("StreamBufferHandlingMode", ptrHandlingModeEntry->GetSymbolic().c_str());
+			CAPTURE_LOG(Log_Info) << endl << endl << "Buffer Handling Mode has been set to " << ptrHandlingModeEntry->GetDisplayName();
+		}
+		else
+		{
+			CAPTURE_LOG(Log_Warning) << "Buffer Handling Mode " << GetBufferHandlingName(chosenBufferType) << " not available";
 		}
 
 	}
 	catch (Spinnaker::Exception &e)
 	{
-		cout << "Error: " << e.what() << endl;
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
 		return -1;
 	}
 
@@ -285,83 +450,72 @@ int ConfigureBuffer(INodeMap & sNodeMap)
 
 
 // This function disables each type of chunk data before disabling chunk data mode. 
-int DisableChunkData(INodeMap & nodeMap)
+int DisableChunkData(CameraNodes & nodes)
 {
 	int result = 0;
 	try
 	{
-		NodeList_t entries;
-
 		// Retrieve the selector node
-		CEnumerationPtr ptrChunkSelector = nodeMap.GetNode("ChunkSelector");
+		CEnumerationPtr ptrChunkSelector = nodes.chunkSelector;
 
 		if (!IsAvailable(ptrChunkSelector) || !IsReadable(ptrChunkSelector))
 		{
-			cout << "Unable to retrieve chunk selector. Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to retrieve chunk selector. Aborting..." << endl;
 			return -1;
 		}
 
-		// Retrieve entries
-		ptrChunkSelector->GetEntries(entries);
+		// Entries and boolean as resolved by CameraNodes
+		CBooleanPtr ptrChunkEnable = nodes.chunkEnable;
 
-		cout << "Disabling entries..." << endl;
+		CAPTURE_LOG(Log_Info) << "Disabling entries...";
 
-		for (int i = 0; i < entries.size(); i++)
+		for (size_t i = 0; i < nodes.chunkEntries.size(); i++)
 		{
 			// Select entry to be disabled
-			CEnumEntryPtr ptrChunkSelectorEntry = entries.at(i);
-
-			// Go to next node if problem occurs
-			if (!IsAvailable(ptrChunkSelectorEntry) || !IsReadable(ptrChunkSelectorEntry))
-			{
-				continue;
-			}
+			CEnumEntryPtr ptrChunkSelectorEntry = nodes.chunkEntries[i];
 
 			ptrChunkSelector->SetIntValue(ptrChunkSelectorEntry->GetValue());
 
-			cout << "\t" << ptrChunkSelectorEntry->GetSymbolic() << ": ";
-
-			// Retrieve corresponding boolean
-			CBooleanPtr ptrChunkEnable = nodeMap.GetNode("ChunkEnable");
+			const gcstring entryName = ptrChunkSelectorEntry->GetSymbolic();
 
 			// Disable the boolean, thus disabling the corresponding chunk data
 			if (!IsAvailable(ptrChunkEnable))
 			{
-				cout << "not available" << endl;
+				CAPTURE_LOG(Log_Warning) << "\t" << entryName << ": not available";
 				result = -1;
 			}
 			else if (!ptrChunkEnable->GetValue())
 			{
-				cout << "disabled" << endl;
+				CAPTURE_LOG(Log_Info) << "\t" << entryName << ": disabled";
 			}
 			else if (IsWritable(ptrChunkEnable))
 			{
 				ptrChunkEnable->SetValue(false);
-				cout << "disabled" << endl;
+				CAPTURE_LOG(Log_Info) << "\t" << entryName << ": disabled";
 			}
 			else
 			{
-				cout << "not writable" << endl;
+				CAPTURE_LOG(Log_Warning) << "\t" << entryName << ": not writable";
 			}
 		}
-		cout << endl;
+		CAPTURE_LOG(Log_Info) << endl;
 
 		//Deactivate ChunkMode
-		CBooleanPtr ptrChunkModeActive = nodeMap.GetNode("ChunkModeActive");
+		CBooleanPtr ptrChunkModeActive = nodes.chunkModeActive;
 
 		if (!IsAvailable(ptrChunkModeActive) || !IsWritable(ptrChunkModeActive))
 		{
-			cout << "Unable to deactivate chunk mode. Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to deactivate chunk mode. Aborting..." << endl;
 			return -1;
 		}
 
 		ptrChunkModeActive->SetValue(false);
 
-		cout << "Chunk mode deactivated..." << endl;
+		CAPTURE_LOG(Log_Info) << "Chunk mode deactivated...";
 	}
 	catch (Spinnaker::Exception &e)
 	{
-		cout << "Error: " << e.what() << endl;
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
 		result = -1;
 	}
 
@@ -369,89 +523,11 @@ int DisableChunkData(INodeMap & nodeMap)
 }
 
 
-// This function displays a select amount of chunk data from the image. Unlike
-// accessing chunk data via the nodemap, there is no way to loop through all 
-// available data.
-int DisplayChunkData(ImagePtr pImage, ofstream& logFile, int frame_id)
-{
-	int result = 0;
-
-	logFile << "Frame ID " << frame_id << "\n";
-	try
-	{
-		//
-		// Retrieve chunk data from image
-		//
-		// *** NOTES ***
-		// When retrieving chunk data from an image, the data is stored in a
-		// a ChunkData object and accessed with getter functions.
-		//
-		ChunkData chunkData = pImage->GetChunkData();
-
-		//
-		// Retrieve exposure time; exposure time recorded in microseconds
-		//
-		// *** NOTES ***
-		// Floating point numbers are returned as a float64_t. This can safely
-		// and easily be statically cast to a double.
-		//
-		double exposureTime = static_cast<double>(chunkData.GetExposureTime());
-		logFile << "\tExposure time: " << exposureTime << "\n";
-
-		//
-		// Retrieve frame ID
-		//
-		// *** NOTES ***
-		// Integers are returned as an int64_t. As this is the typical integer
-		// data type used in the Spinnaker SDK, there is no need to cast it.
-		//
-		int64_t frameID = chunkData.GetFrameID();
-		logFile << "\tFrame ID: " << frameID << "\n";
-
-		// Retrieve gain; gain recorded in decibels
-		double gain = chunkData.GetGain();
-		logFile << "\tGain: " << gain << "\n";
-
-		// Retrieve height; height recorded in pixels
-		int64_t height = chunkData.GetHeight();
-		logFile << "\tHeight: " << height << "\n";
-
-		// Retrieve width; width recorded in pixels
-		int64_t width = chunkData.GetWidth();
-		logFile << "\tWidth: " << width << "\n";
-
-		// Retrieve offset X; offset X recorded in pixels
-		int64_t offsetX = chunkData.GetOffsetX();
-		logFile << "\tOffset X: " << offsetX << "\n";
-
-		// Retrieve offset Y; offset Y recorded in pixels
-		int64_t offsetY = chunkData.GetOffsetY();
-		logFile << "\tOffset Y: " << offsetY << "\n";
-
-		// Retrieve sequencer set active
-		int64_t sequencerSetActive = chunkData.GetSequencerSetActive();
-		logFile << "\tSequencer set active: " << sequencerSetActive << "\n";
-
-		// Retrieve timestamp
-		uint64_t timestamp = chunkData.GetTimestamp();
-		logFile << "\tTimestamp: " << timestamp / long int(1e9) << "." << timestamp % long int(1e9) << "\n";
-
-		logFile << endl;
-	}
-	catch (Spinnaker::Exception &e)
-	{
-		cout << "Error: " << e.what() << endl;
-		result = -1;
-	}
-
-	return result;
-}
-
 #ifdef _DEBUG
 // Disables heartbeat on GEV cameras so debugging does not incur timeout errors
 int DisableHeartbeat(CameraPtr pCam, INodeMap & nodeMap, INodeMap & nodeMapTLDevice)
 {
-	cout << "Checking device type to see if we need to disable the camera's heartbeat..." << endl << endl;
+	CAPTURE_LOG(Log_Info) << "Checking device type to see if we need to disable the camera's heartbeat..." << endl;
 	//
 	// Write to boolean node controlling the camera's heartbeat
 	// 
@@ -472,29 +548,29 @@ int DisableHeartbeat(CameraPtr pCam, INodeMap & nodeMap, INodeMap & nodeMapTLDev
 	CEnumerationPtr ptrDeviceType = nodeMapTLDevice.GetNode("DeviceType");
 	if (!IsAvailable(ptrDeviceType) && !IsReadable(ptrDeviceType))
 	{
-		cout << "Error with reading the device's type. Aborting..." << endl << endl;
+		CAPTURE_LOG(Log_Error) << "Error with reading the device's type. Aborting..." << endl;
 		return -1;
 	}
 	else
 	{
 		if (ptrDeviceType->GetIntValue() == DeviceType_GEV)
 		{
-			cout << "Working with a GigE camera. Attempting to disable heartbeat before continuing..." << endl << endl;
+			CAPTURE_LOG(Log_Info) << "Working with a GigE camera. Attempting to disable heartbeat before continuing..." << endl;
 			CBooleanPtr ptrDeviceHeartbeat = nodeMap.GetNode("GevGVCPHeartbeatDisable");
 			if (!IsAvailable(ptrDeviceHeartbeat) || !IsWritable(ptrDeviceHeartbeat))
 			{
-				cout << "Unable to disable heartbeat on camera. Continuing with execution as this may be non-fatal..." << endl << endl;
+				CAPTURE_LOG(Log_Warning) << "Unable to disable heartbeat on camera. Continuing with execution as this may be non-fatal..." << endl;
 			}
 			else
 			{
 				ptrDeviceHeartbeat->SetValue(true);
-				cout << "WARNING: Heartbeat on GigE camera disabled for the rest of Debug Mode." << endl;
-				cout << "         Power cycle camera when done debugging to re-enable the heartbeat..." << endl << endl;
+				CAPTURE_LOG(Log_Info) << "WARNING: Heartbeat on GigE camera disabled for the rest of Debug Mode.";
+				CAPTURE_LOG(Log_Info) << "         Power cycle camera when done debugging to re-enable the heartbeat..." << endl;
 			}
 		}
 		else
 		{
-			cout << "Camera does not use GigE interface. Resuming normal execution..." << endl << endl;
+			CAPTURE_LOG(Log_Info) << "Camera does not use GigE interface. Resuming normal execution..." << endl;
 		}
 	}
 	return 0;
@@ -506,11 +582,11 @@ int DisableHeartbeat(CameraPtr pCam, INodeMap & nodeMap, INodeMap & nodeMapTLDev
 // this by enabling each type of chunk data before enabling chunk data mode. 
 // When chunk data is turned on, the data is made available in both the nodemap 
 // and each image.
-int ConfigureChunkData(INodeMap & nodeMap)
+int ConfigureChunkData(CameraNodes & nodes)
 {
 	int result = 0;
 
-	cout << endl << endl << "*** CONFIGURING CHUNK DATA ***" << endl << endl;
+	CAPTURE_LOG(Log_Info) << endl << endl << "*** CONFIGURING CHUNK DATA ***" << endl;
 
 	try
 	{
@@ -522,17 +598,17 @@ int ConfigureChunkData(INodeMap & nodeMap)
 		// of every image captured until it is disabled. Chunk data can also be 
 		// retrieved from the nodemap.
 		//
-		CBooleanPtr ptrChunkModeActive = nodeMap.GetNode("ChunkModeActive");
+		CBooleanPtr ptrChunkModeActive = nodes.chunkModeActive;
 
 		if (!IsAvailable(ptrChunkModeActive) || !IsWritable(ptrChunkModeActive))
 		{
-			cout << "Unable to activate chunk mode. Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to activate chunk mode. Aborting..." << endl;
 			return -1;
 		}
 
-		ptrChunkModeActive->SetValue(true);
+		nodes.SetBool(ptrChunkModeActive, true, "ChunkModeActive");
 
-		cout << "Chunk mode activated..." << endl;
+		CAPTURE_LOG(Log_Info) << "Chunk mode activated...";
 
 		//
 		// Enable all types of chunk data
@@ -548,65 +624,59 @@ int ConfigureChunkData(INodeMap & nodeMap)
 		// performed in a loop. Once this is complete, chunk mode still needs to
 		// be activated.
 		//
-		NodeList_t entries;
 
 		// Retrieve the selector node
-		CEnumerationPtr ptrChunkSelector = nodeMap.GetNode("ChunkSelector");
+		CEnumerationPtr ptrChunkSelector = nodes.chunkSelector;
 
 		if (!IsAvailable(ptrChunkSelector) || !IsReadable(ptrChunkSelector))
 		{
-			cout << "Unable to retrieve chunk selector. Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to retrieve chunk selector. Aborting..." << endl;
 			return -1;
 		}
 
-		// Retrieve entries
-		ptrChunkSelector->GetEntries(entries);
+		// The available entries and the boolean were resolved with the other
+		// nodes; the boolean follows the selector
+		CBooleanPtr ptrChunkEnable = nodes.chunkEnable;
 
-		cout << "Enabling entries..." << endl;
+		CAPTURE_LOG(Log_Info) << "Enabling entries...";
 
-		for (int i = 0; i < entries.size(); i++)
+		for (size_t i = 0; i < nodes.chunkEntries.size(); i++)
 		{
 			// Select entry to be enabled
-			CEnumEntryPtr ptrChunkSelectorEntry = entries.at(i);
-
-			// Go to next node if problem occurs
-			if (!IsAvailable(ptrChunkSelectorEntry) || !IsReadable(ptrChunkSelectorEntry))
-			{
-				continue;
-			}
+			CEnumEntryPtr ptrChunkSelectorEntry = nodes.chunkEntries[i];
 
 			ptrChunkSelector->SetIntValue(ptrChunkSelectorEntry->GetValue());
 
-			cout << "\t" << ptrChunkSelectorEntry->GetSymbolic() << ": ";
-
-			// Retrieve corresponding boolean
-			CBooleanPtr ptrChunkEnable = nodeMap.GetNode("ChunkEnable");
+			const gcstring entryName = ptrChunkSelectorEntry->GetSymbolic();
+			const string settingName = string("ChunkEnable[") + entryName.c_str() + "]";
 
 			// Enable the boolean, thus enabling the corresponding chunk data
 			if (!IsAvailable(ptrChunkEnable))
 			{
-				cout << "not available" << endl;
+				CAPTURE_LOG(Log_Warning) << "\t" << entryName << ": not available";
 				result = -1;
 			}
 			else if (ptrChunkEnable->GetValue())
 			{
-				cout << "enabled" << endl;
+				nodes.applied.Set(settingName, "1");
+				nodes.numUnchanged++;
+				CAPTURE_LOG(Log_Info) << "\t" << entryName << ": enabled";
 			}
 			else if (IsWritable(ptrChunkEnable))
 			{
-				ptrChunkEnable->SetValue(true);
-				cout << "enabled" << endl;
+				nodes.SetBool(ptrChunkEnable, true, settingName);
+				CAPTURE_LOG(Log_Info) << "\t" << entryName << ": enabled";
 			}
 			else
 			{
-				cout << "not writable" << endl;
+				CAPTURE_LOG(Log_Warning) << "\t" << entryName << ": not writable";
 				result = -1;
 			}
 		}
 	}
 	catch (Spinnaker::Exception &e)
 	{
-		cout << "Error: " << e.what() << endl;
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
 		result = -1;
 	}
 
@@ -619,11 +689,11 @@ int ConfigureChunkData(INodeMap & nodeMap)
 // set to off in order to select the trigger source. Once the trigger source
 // has been selected, trigger mode is then enabled, which has the camera 
 // capture only a single image upon the execution of the chosen trigger.
-int ConfigureTrigger(INodeMap & nodeMap, bool is_primary)
+int ConfigureTrigger(CameraNodes & nodes, bool is_primary)
 {
 	int result = 0;
 
-	cout << endl << endl << "*** CONFIGURING TRIGGER ***" << endl << endl;
+	CAPTURE_LOG(Log_Info) << endl << endl << "*** CONFIGURING TRIGGER ***" << endl;
 
 	try
 	{
@@ -635,96 +705,103 @@ int ConfigureTrigger(INodeMap & nodeMap, bool is_primary)
 		// The trigger must be disabled in order to configure whether the source
 		// is software or hardware.
 		//
-		CEnumerationPtr ptrTriggerMode = nodeMap.GetNode("TriggerMode");
+		CEnumerationPtr ptrTriggerMode = nodes.triggerMode;
 		if (!IsAvailable(ptrTriggerMode) || !IsReadable(ptrTriggerMode))
 		{
-			cout << "Unable to disable trigger mode (node retrieval). Aborting..." << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to disable trigger mode (node retrieval). Aborting...";
 			return -1;
 		}
 
-		CEnumEntryPtr ptrTriggerModeOff = ptrTriggerMode->GetEntryByName("Off");
+		CEnumEntryPtr ptrTriggerModeOff = nodes.triggerModeOff;
 		if (!IsAvailable(ptrTriggerModeOff) || !IsReadable(ptrTriggerModeOff))
 		{
-			cout << "Unable to disable trigger mode (enum entry retrieval). Aborting..." << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to disable trigger mode (enum entry retrieval). Aborting...";
 			return -1;
 		}
 
-		ptrTriggerMode->SetIntValue(ptrTriggerModeOff->GetValue());
-
-		cout << "Trigger mode disabled..." << endl;
+		// With diff-only writes the trigger stays on if the camera already has
+		// the right source (and overlap), saving two mode switches
+		const bool triggerSet = nodes.diffOnly && nodes.Holds(ptrTriggerMode, nodes.triggerModeOn) &&
+			nodes.Holds(nodes.triggerSource, is_primary ? nodes.triggerSourceSoftware : nodes.triggerSourceLine3) &&
+			(is_primary || nodes.Holds(nodes.triggerOverlap, nodes.triggerOverlapReadOut));
+		if (!triggerSet)
+		{
+			nodes.SetEnum(ptrTriggerMode, ptrTriggerModeOff, "TriggerMode");
+			CAPTURE_LOG(Log_Info) << "Trigger mode disabled...";
+		}
 
 		// If primary camra
 		if (is_primary) {
 			// Config the digital IO control
-			CEnumerationPtr ptrLineSelector = nodeMap.GetNode("LineSelector");
+			CEnumerationPtr ptrLineSelector = nodes.lineSelector;
 			if (!IsAvailable(ptrLineSelector) || !IsWritable(ptrLineSelector)) {
-				cout << "Unable to set line selector (node retriecal). Aborting" << endl;
+				CAPTURE_LOG(Log_Error) << "Unable to set line selector (node retriecal). Aborting";
 				return -1;
 			}
-			CEnumEntryPtr ptrLineSelectorLine2 = ptrLineSelector->GetEntryByName("Line2");
+			CEnumEntryPtr ptrLineSelectorLine2 = nodes.lineSelectorLine2;
 			if (!IsAvailable(ptrLineSelectorLine2) || !IsReadable(ptrLineSelectorLine2)) {
-				cout << "Unable to set line selector (enum entry retrieval). Aborting" << endl;
+				CAPTURE_LOG(Log_Error) << "Unable to set line selector (enum entry retrieval). Aborting";
 				return -1;
 			}
 			ptrLineSelector->SetIntValue(ptrLineSelectorLine2->GetValue());
 
-			cout << "Digital IO Control line selection select Line2" << endl;
+			CAPTURE_LOG(Log_Info) << "Digital IO Control line selection select Line2";
 		}
 
 		//
 		// Select trigger source
 		//
 		// *** NOTES ***
-		CEnumerationPtr ptrTriggerSource = nodeMap.GetNode("TriggerSource");
+		CEnumerationPtr ptrTriggerSource = nodes.triggerSource;
 		if (!IsAvailable(ptrTriggerSource) || !IsWritable(ptrTriggerSource))
 		{
-			cout << "Unable to set trigger mode (node retrieval). Aborting..." << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to set trigger mode (node retrieval). Aborting...";
 			return -1;
 		}
 
 		if (is_primary)
 		{
 			// Set trigger mode to software
-			CEnumEntryPtr ptrTriggerSourceSoftware = ptrTriggerSource->GetEntryByName("Software");
+			CEnumEntryPtr ptrTriggerSourceSoftware = nodes.triggerSourceSoftware;
 			if (!IsAvailable(ptrTriggerSourceSoftware) || !IsReadable(ptrTriggerSourceSoftware))
 			{
-				cout << "Unable to set trigger mode (enum entry retrieval). Aborting..." << endl;
+				CAPTURE_LOG(Log_Error) << "Unable to set trigger mode (enum entry retrieval). Aborting...";
 				return -1;
 			}
 
-			ptrTriggerSource->SetIntValue(ptrTriggerSourceSoftware->GetValue());
+			nodes.SetEnum(ptrTriggerSource, ptrTriggerSourceSoftware, "TriggerSource");
 
-			cout << "Trigger source set to software..." << endl;
+			CAPTURE_LOG(Log_Info) << "Trigger source set to software...";
 		}
 		else
 		{
 			// Set trigger mode to hardware ('Line3')
-			CEnumEntryPtr ptrTriggerSourceHardware = ptrTriggerSource->GetEntryByName("Line3");
+			CEnumEntryPtr ptrTriggerSourceHardware = nodes.triggerSourceLine3;
 			if (!IsAvailable(ptrTriggerSourceHardware) || !IsReadable(ptrTriggerSourceHardware))
 			{
-				cout << "Unable to set trigger mode (enum entry retrieval). Aborting..." << endl;
+				CAPTURE_LOG(Log_Error) << "Unable to set trigger mode (enum entry retrieval). Aborting...";
 				return -1;
 			}
 
-			ptrTriggerSource->SetIntValue(ptrTriggerSourceHardware->GetValue());
-			cout << "Trigger source set to Line 3..." << endl;
+			nodes.SetEnum(ptrTriggerSource, ptrTriggerSourceHardware, "TriggerSource");
+			CAPTURE_LOG(Log_Info) << "Trigger source set to Line 3...";
 
 			// Set trigger overlap to read out
-			CEnumerationPtr ptrTiggerOverlap = nodeMap.GetNode("TriggerOverlap");
+			CEnumerationPtr ptrTiggerOverlap = nodes.triggerOverlap;
 			if (!IsAvailable(ptrTiggerOverlap) || !IsReadable(ptrTiggerOverlap))
 			{
-				cout << "Unable to set trigger overlap (mode retrieval). Aborting..." << endl;
+				CAPTURE_LOG(Log_Error) << "Unable to set trigger overlap (mode retrieval). Aborting...";
 				return -1;
 			}
-			CEnumEntryPtr ptrTiggerOverlapReadOut = ptrTiggerOverlap->GetEntryByName("ReadOut");
+			CEnumEntryPtr ptrTiggerOverlapReadOut = nodes.triggerOverlapReadOut;
 			if (!IsAvailable(ptrTiggerOverlapReadOut) || !IsReadable(ptrTiggerOverlapReadOut))
 			{
-				cout << "Unable to set trigger overlap (enum entry retrieval). Aborting..." << endl;
+				CAPTURE_LOG(Log_Error) << "Unable to set trigger overlap (enum entry retrieval). Aborting...";
 				return -1;
 			}
 
-			ptrTiggerOverlap->SetIntValue(ptrTiggerOverlapReadOut->GetValue());
-			cout << "Trigger overlap set to Readout..." << endl;
+			nodes.SetEnum(ptrTiggerOverlap, ptrTiggerOverlapReadOut, "TriggerOverlap");
+			CAPTURE_LOG(Log_Info) << "Trigger overlap set to Readout...";
 
 		}
 
@@ -736,22 +813,22 @@ int ConfigureTrigger(INodeMap & nodeMap, bool is_primary)
 		// on in order to retrieve images using the trigger.
 		//
 
-		CEnumEntryPtr ptrTriggerModeOn = ptrTriggerMode->GetEntryByName("On");
+		CEnumEntryPtr ptrTriggerModeOn = nodes.triggerModeOn;
 		if (!IsAvailable(ptrTriggerModeOn) || !IsReadable(ptrTriggerModeOn))
 		{
-			cout << "Unable to enable trigger mode (enum entry retrieval). Aborting..." << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to enable trigger mode (enum entry retrieval). Aborting...";
 			return -1;
 		}
 
-		ptrTriggerMode->SetIntValue(ptrTriggerModeOn->GetValue());
+		nodes.SetEnum(ptrTriggerMode, ptrTriggerModeOn, "TriggerMode");
 
 		// TODO: Blackfly and Flea3 GEV cameras need 1 second delay after trigger mode is turned on 
 
-		cout << "Trigger mode turned back on..." << endl << endl;
+		CAPTURE_LOG(Log_Info) << "Trigger mode turned back on..." << endl;
 	}
 	catch (Spinnaker::Exception &e)
 	{
-		cout << "Error: " << e.what() << endl;
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
 		result = -1;
 	}
 
@@ -822,11 +899,11 @@ return result;
 // important to note that settings are applied immediately. This means if you plan
 // to reduce the width and move the x offset accordingly, you need to apply such
 // changes in the appropriate order.
-int ConfigureCustomImageSettings(INodeMap & nodeMap)
+int ConfigureCustomImageSettings(CameraNodes & nodes, const CaptureProfile & profile, CaptureGeometry & geometry)
 {
 	int result = 0;
 
-	cout << endl << endl << "*** CONFIGURING CUSTOM IMAGE SETTINGS ***" << endl << endl;
+	CAPTURE_LOG(Log_Info) << endl << endl << "*** CONFIGURING CUSTOM IMAGE SETTINGS ***" << endl;
 
 	try
 	{
@@ -845,30 +922,27 @@ int ConfigureCustomImageSettings(INodeMap & nodeMap)
 		// the integer value from the entry node.
 		//
 		// Retrieve the enumeration node from the nodemap
-		CEnumerationPtr ptrPixelFormat = nodeMap.GetNode("PixelFormat");
+		CEnumerationPtr ptrPixelFormat = nodes.pixelFormat;
 		if (IsAvailable(ptrPixelFormat) && IsWritable(ptrPixelFormat))
 		{
 			// Retrieve the desired entry node from the enumeration node
-			CEnumEntryPtr ptrPixelFormatSelect = ptrPixelFormat->GetEntryByName(grabPixelFormatName); // Mono8
+			CEnumEntryPtr ptrPixelFormatSelect = nodes.pixelFormatGrab; // grabPixelFormatName
 			if (IsAvailable(ptrPixelFormatSelect) && IsReadable(ptrPixelFormatSelect))
 			{
-				// Retrieve the integer value from the entry node
-				int64_t pixelFormatSelect = ptrPixelFormatSelect->GetValue();
-
-				// Set integer as new value for enumeration node
-				ptrPixelFormat->SetIntValue(pixelFormatSelect);
+				// Set the entry's integer value as new value for the enumeration node
+				nodes.SetEnum(ptrPixelFormat, ptrPixelFormatSelect, "PixelFormat");
 
-				cout << "Pixel format set to " << ptrPixelFormat->GetCurrentEntry()->GetSymbolic() << "..." << "\n";
+				CAPTURE_LOG(Log_Info) << "Pixel format set to " << ptrPixelFormat->GetCurrentEntry()->GetSymbolic() << "..." << "\n";
 			}
 			else
 			{
-				cout << "Pixel specific format not available..." << endl;
+				CAPTURE_LOG(Log_Warning) << "Pixel specific format not available...";
 				return -1;
 			}
 		}
 		else
 		{
-			cout << "Pixel format not available..." << endl;
+			CAPTURE_LOG(Log_Warning) << "Pixel format not available...";
 			return -1;
 		}
 
@@ -918,82 +992,43 @@ int ConfigureCustomImageSettings(INodeMap & nodeMap)
 		*/
 
 		//==========================================================================
-		// Set maximum width
+		// Set ROI, binning, decimation and frame rate from the camera's profile
 		//
 		// *** NOTES ***
-		// Other nodes, such as those corresponding to image width and height, 
-		// might have an increment other than 1. In these cases, it can be
-		// important to check that the desired value is a multiple of the
-		// increment. However, as these values are being set to the maximum,
-		// there is no reason to check against the increment.
+		// Width and height might have an increment other than 1, and their
+		// maxima depend on binning and decimation. ApplyCaptureProfile sets the
+		// nodes in dependency order and moves every value to the nearest one
+		// the node accepts.
 		//
-
-		//Set to bayer (raw) pixel format 
-		//Set to a RG color space if you want to enable onboard color processing 
-		
-
-
-		CIntegerPtr ptrWidth = nodeMap.GetNode("Width");
-		if (IsAvailable(ptrWidth) && IsWritable(ptrWidth))
-		{
-			int64_t widthToSet = ptrWidth->GetMax();
-
-			ptrWidth->SetValue(widthToSet);
-
-			cout << "Width set to " << ptrWidth->GetValue() << "..." << "\n";
-		}
-		else
-		{
-			cout << "Width not available..." << endl;
+		if (ApplyCaptureProfile(nodes, profile, selectFrameRate, geometry) < 0)
 			return -1;
-		}
 
-
-		//==========================================================================
-		// Set maximum height
-		//
-		// *** NOTES ***
-		// A maximum is retrieved with the method GetMax(). A node's minimum and
-		// maximum should always be a multiple of its increment.
-		//
-
-
-		CIntegerPtr ptrHeight = nodeMap.GetNode("Height");
-		if (IsAvailable(ptrHeight) && IsWritable(ptrHeight))
-		{
-			int64_t heightToSet = ptrHeight->GetMax();
-
-			ptrHeight->SetValue(heightToSet);
-
-			cout << "Height set to " << ptrHeight->GetValue() << "... \n";
-		}
-		else
-		{
-			cout << "Height not available..." << endl;
-			return -1;
-		}
+		ostringstream geometryText;
+		geometryText << geometry.width << "x" << geometry.height << " at " << geometry.offsetX << "," << geometry.offsetY << ", binning "
+			<< geometry.binning << ", decimation " << geometry.decimation << ", " << geometry.frameRate << " fps";
+		nodes.applied.Set("CaptureGeometry", geometryText.str());
 
 		//==========================================================================
 		//Enabling Auto White Balance setting limits and damping constant. 
-		CEnumerationPtr ptrBalanceWhiteAuto = nodeMap.GetNode("BalanceWhiteAuto");
+		CEnumerationPtr ptrBalanceWhiteAuto = nodes.balanceWhiteAuto;
 
 		if (IsAvailable(ptrBalanceWhiteAuto) && IsWritable(ptrBalanceWhiteAuto)) {
 
-			CEnumEntryPtr ptrBalanceWhiteAutoEntry = ptrBalanceWhiteAuto->GetEntryByName("Off");
+			CEnumEntryPtr ptrBalanceWhiteAutoEntry = nodes.balanceWhiteAutoOff;
 
 			if (IsAvailable(ptrBalanceWhiteAutoEntry) && IsReadable(ptrBalanceWhiteAutoEntry)) {
-				ptrBalanceWhiteAuto->SetIntValue(ptrBalanceWhiteAutoEntry->GetValue());
-				cout << "White balance turn auto off..." << "\n";
+				nodes.SetEnum(ptrBalanceWhiteAuto, ptrBalanceWhiteAutoEntry, "BalanceWhiteAuto");
+				CAPTURE_LOG(Log_Info) << "White balance turn auto off..." << "\n";
 			}
 			else 
 			{
-				cout << "White Balance Auto Off not available ..." << endl;
+				CAPTURE_LOG(Log_Warning) << "White Balance Auto Off not available ...";
 				return -1;
 			}
 		}
 		else 
 		{
-			cout << "Balance White Auto not available ... " << endl;
+			CAPTURE_LOG(Log_Warning) << "Balance White Auto not available ... ";
 			return -1;
 		}
 
@@ -1001,66 +1036,71 @@ int ConfigureCustomImageSettings(INodeMap & nodeMap)
 		// default enabled if using BGR8
 		if (grabPixelFormatName == "BGR8") 
 		{
-			cout << "default enabled if using BGR8 \n" << endl;
+			CAPTURE_LOG(Log_Info) << "default enabled if using BGR8 \n";
+		}
+		else if (chosenCaptureMode == RAW_BAYER)
+		{
+			// Raw Bayer bypasses the ISP; white balance and colour transform
+			// below are still set so they can be saved and applied offline
+			CAPTURE_LOG(Log_Info) << "ISP bypassed for raw Bayer capture \n";
 		}
 		else 
 		{
-			CBooleanPtr ptrIspEnable = nodeMap.GetNode("IspEnable");
+			CBooleanPtr ptrIspEnable = nodes.ispEnable;
 
 			// if (IsAvailable(ptrIspEnable) && IsWritable(ptrIspEnable)) {
 			if (!IsAvailable(ptrIspEnable))
 			{
-				cout << "ISP Enable not avalibale" << endl;
+				CAPTURE_LOG(Log_Info) << "ISP Enable not avalibale";
 				return -1;
 			}
 			else if (!IsWritable(ptrIspEnable))
 			{
-				cout << "ISP Enable not writable" << endl;
+				CAPTURE_LOG(Log_Warning) << "ISP Enable not writable";
 				return -1;
 			}
 			else {
-				ptrIspEnable->SetValue(1);
-				cout << "ISP is enabled" << "\n";
+				nodes.SetBool(ptrIspEnable, true, "IspEnable");
+				CAPTURE_LOG(Log_Info) << "ISP is enabled" << "\n";
 			}
 		}
 		//************************************************************************
 		// First enable color transformation
 		// Green room set to be cool environment setting
 
-		CBooleanPtr ptrColorTransformEnable = nodeMap.GetNode("ColorTransformationEnable");
+		CBooleanPtr ptrColorTransformEnable = nodes.colorTransformationEnable;
 
 		if (IsAvailable(ptrColorTransformEnable) && IsWritable(ptrColorTransformEnable)) {
-			ptrColorTransformEnable->SetValue(1);
-			cout << "Color transformation is enabled." << endl;
+			nodes.SetBool(ptrColorTransformEnable, true, "ColorTransformationEnable");
+			CAPTURE_LOG(Log_Info) << "Color transformation is enabled.";
 		}
 		else 
 		{
-			cout << "Color transformation not available..." << endl;
+			CAPTURE_LOG(Log_Warning) << "Color transformation not available...";
 			return -1;
 		}
 
 		//************************************************************************
 		// Green room set to be cool environment setting
-		CEnumerationPtr ptrRgbTransformLightSource = nodeMap.GetNode("RgbTransformLightSource");
+		CEnumerationPtr ptrRgbTransformLightSource = nodes.rgbTransformLightSource;
 
 		if (IsAvailable(ptrRgbTransformLightSource) && IsWritable(ptrRgbTransformLightSource)) {
 
-			CEnumEntryPtr ptrRgbTransformationLightSourceCool = ptrRgbTransformLightSource->
-				GetEntryByName("CoolFluorescent4000K");//WarmFluorescent3000K
+			CEnumEntryPtr ptrRgbTransformationLightSourceCool = nodes.rgbTransformLightSourceCool; // CoolFluorescent4000K, or WarmFluorescent3000K
 			
 			if (IsAvailable(ptrRgbTransformationLightSourceCool) && IsReadable(ptrRgbTransformationLightSourceCool)) {
-				ptrRgbTransformLightSource->SetIntValue(ptrRgbTransformationLightSourceCool->GetValue());
-				cout << "Rgb Transfomation from light source: changed to CoolFluorescent4000K..." << endl << endl;
+				nodes.SetEnum(ptrRgbTransformLightSource, ptrRgbTransformationLightSourceCool, "RgbTransformLightSource");
+				CAPTURE_LOG(Log_Info) << "Rgb Transfomation from light source: changed to CoolFluorescent4000K..." << endl;
 			}
 			else 
 			{
-				cout << "RgbTransformLightSource  CoolFluorescent4000K not availble ... " << endl;
+				CAPTURE_LOG(Log_Warning) << "RgbTransformLightSource  CoolFluorescent4000K not availble ... ";
 				return -1;
 			}
 		}
 		else 
 		{
-			cout << "Rgb Transform Light Source not available ... " << endl;
+			CAPTURE_LOG(Log_Warning) << "Rgb Transform Light Source not available ... ";
 			return -1;
 		}
 
@@ -1103,7 +1143,7 @@ int ConfigureCustomImageSettings(INodeMap & nodeMap)
 	}
 	catch (Spinnaker::Exception &e)
 	{
-		cout << "Error: " << e.what() << endl;
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
 		result = -1;
 	}
 
@@ -1111,45 +1151,207 @@ int ConfigureCustomImageSettings(INodeMap & nodeMap)
 }
 
 
-// Configure Video Settings
-int ConfigureVideoAndOpen(SpinVideo & video, INodeMap & nodeMap, INodeMap & nodeMapTLDevice, string outputFolder)
+// This function writes the value of one node as "name = value", or
+// "name = n/a" if the node cannot be read
+void WriteNodeValue(INodeMap & nodeMap, const gcstring & nodeName, ofstream & stateFile)
 {
-	int result = 0;
+	CValuePtr ptrValue = nodeMap.GetNode(nodeName);
+	stateFile << nodeName << " = " << (IsAvailable(ptrValue) && IsReadable(ptrValue) ? ptrValue->ToString() : gcstring("n/a")) << "\n";
+}
 
-	cout << endl << endl << "*** CREATING VIDEO ***" << endl << endl;
 
-	try
+// This function writes the value of a node for every entry of its selector,
+// e.g. BalanceRatio for BalanceRatioSelector = Red and Blue
+void WriteSelectedNodeValues(INodeMap & nodeMap, const gcstring & selectorName, const gcstring & nodeName, ofstream & stateFile)
+{
+	CEnumerationPtr ptrSelector = nodeMap.GetNode(selectorName);
+	if (!IsAvailable(ptrSelector) || !IsWritable(ptrSelector))
 	{
-		// Retrieve device serial number for filename
-		string deviceSerialNumber = "";
+		stateFile << selectorName << " = n/a\n";
+		return;
+	}
 
-		CStringPtr ptrStringSerial = nodeMapTLDevice.GetNode("DeviceSerialNumber");
-		if (IsAvailable(ptrStringSerial) && IsReadable(ptrStringSerial))
-		{
-			deviceSerialNumber = ptrStringSerial->GetValue();
+	CEnumEntryPtr ptrOriginalEntry = ptrSelector->GetCurrentEntry();
+
+	NodeList_t entries;
+	ptrSelector->GetEntries(entries);
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		CEnumEntryPtr ptrEntry = entries.at(i);
+		if (!IsAvailable(ptrEntry) || !IsReadable(ptrEntry))
+			continue;
+
+		ptrSelector->SetIntValue(ptrEntry->GetValue());
+
+		CValuePtr ptrValue = nodeMap.GetNode(nodeName);
+		stateFile << nodeName << "[" << ptrEntry->GetSymbolic() << "] = "
+			<< (IsAvailable(ptrValue) && IsReadable(ptrValue) ? ptrValue->ToString() : gcstring("n/a")) << "\n";
+	}
 
-			cout << "Device serial number retrieved as " << deviceSerialNumber << "..." << endl;
+	// Leave the selector as it was
+	if (IsAvailable(ptrOriginalEntry) && IsReadable(ptrOriginalEntry))
+		ptrSelector->SetIntValue(ptrOriginalEntry->GetValue());
+}
+
+
+// This function saves the camera's current settings into UserSet1 and makes
+// it the set the camera loads at power-up. Acquisition must be stopped.
+int SaveUserSet(CameraNodes & nodes)
+{
+	try
+	{
+		if (!IsAvailable(nodes.userSetSelector) || !IsWritable(nodes.userSetSelector) || !IsAvailable(nodes.userSetSelectorUser1) ||
+			!IsAvailable(nodes.userSetSave) || !IsWritable(nodes.userSetSave))
+		{
+			CAPTURE_LOG(Log_Warning) << "User set UserSet1 not available...";
+			return -1;
 		}
 
-		//
-		// Get the current frame rate; acquisition frame rate recorded in hertz
-		//
-		// *** NOTES ***
-		// The video frame rate can be set to anything; however, in order to
-		// have videos play in real-time, the acquisition frame rate can be
-		// retrieved from the camera.
-		//
-		CFloatPtr ptrAcquisitionFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
-		if (!IsAvailable(ptrAcquisitionFrameRate) || !IsReadable(ptrAcquisitionFrameRate))
+		nodes.userSetSelector->SetIntValue(nodes.userSetSelectorUser1->GetValue());
+		nodes.userSetSave->Execute();
+
+		if (!IsAvailable(nodes.userSetDefault) || !IsWritable(nodes.userSetDefault) || !IsAvailable(nodes.userSetDefaultUser1))
 		{
-			cout << "Unable to retrieve frame rate. Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Warning) << "UserSet1 saved, but it cannot be made the power-up default...";
 			return -1;
 		}
+		nodes.userSetDefault->SetIntValue(nodes.userSetDefaultUser1->GetValue());
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
+		return -1;
+	}
 
-		float frameRateToSet = static_cast<float>(ptrAcquisitionFrameRate->GetValue());
+	return 0;
+}
+
+
+// This function compares the settings just applied with those of the last
+// session, saves them into the camera's user set when saveConfigToUserSet is
+// set and they changed, and writes the new snapshot.
+void UpdateConfigSnapshot(CameraNodes & nodes, const string & serialNumber)
+{
+	const string filename = configSnapshotName + serialNumber + ".txt";
+	ConfigSnapshot previous;
+	const bool havePrevious = previous.Load(filename) >= 0;
+	const vector<string> changes = nodes.applied.Diff(previous);
+
+	ostringstream summary;
+	summary << "[" << serialNumber << "] " << "Configuration: " << nodes.numWritten << " settings written, " << nodes.numUnchanged << " already set; ";
+	if (!havePrevious)
+		summary << "no snapshot of a previous session";
+	else if (changes.empty())
+		summary << "unchanged since the last session";
+	else
+		summary << changes.size() << " changed since the last session";
+	for (size_t i = 0; i < changes.size() && havePrevious; i++)
+		summary << "\n[" << serialNumber << "]   " << changes[i];
+	CAPTURE_LOG(Log_Info) << summary.str();
+
+	if (saveConfigToUserSet)
+	{
+		// A camera that needed writes did not start from the saved set
+		const bool userSetCurrent = nodes.numWritten == 0 && changes.empty() && previous.Get("UserSet") == "UserSet1";
+		if (userSetCurrent || SaveUserSet(nodes) == 0)
+		{
+			nodes.applied.Set("UserSet", "UserSet1");
+			if (!userSetCurrent)
+				CAPTURE_LOG(Log_Info) << "[" << serialNumber << "] " << "Settings saved to UserSet1, loaded at power-up";
+		}
+	}
+
+	if (nodes.applied.Save(filename, serialNumber) < 0)
+		CAPTURE_LOG(Log_Warning) << "[" << serialNumber << "] " << "Unable to write " << filename;
+}
+
+
+// This function saves the white-balance and colour-transform state of the
+// camera next to the recording. In RAW_BAYER mode this is what is needed to
+// reproduce the camera's ISP output offline; in BGR8 mode it documents how
+// the recording was processed.
+int WriteColorState(INodeMap & nodeMap, const string & filename)
+{
+	int result = 0;
+
+	ofstream stateFile(filename.c_str());
+	if (!stateFile.is_open())
+	{
+		CAPTURE_LOG(Log_Warning) << "Unable to write colour state to " << filename;
+		return -1;
+	}
+
+	try
+	{
+		WriteNodeValue(nodeMap, "PixelFormat", stateFile);
+		WriteNodeValue(nodeMap, "PixelColorFilter", stateFile);
+		WriteNodeValue(nodeMap, "IspEnable", stateFile);
+		WriteNodeValue(nodeMap, "BlackLevel", stateFile);
+
+		// The ROI offset decides which Bayer phase the first pixel has
+		WriteNodeValue(nodeMap, "Width", stateFile);
+		WriteNodeValue(nodeMap, "Height", stateFile);
+		WriteNodeValue(nodeMap, "OffsetX", stateFile);
+		WriteNodeValue(nodeMap, "OffsetY", stateFile);
+		WriteNodeValue(nodeMap, "BinningHorizontal", stateFile);
+		WriteNodeValue(nodeMap, "BinningVertical", stateFile);
+		WriteNodeValue(nodeMap, "DecimationHorizontal", stateFile);
+		WriteNodeValue(nodeMap, "DecimationVertical", stateFile);
+
+		WriteNodeValue(nodeMap, "BalanceWhiteAuto", stateFile);
+		WriteSelectedNodeValues(nodeMap, "BalanceRatioSelector", "BalanceRatio", stateFile);
+
+		WriteNodeValue(nodeMap, "GammaEnable", stateFile);
+		WriteNodeValue(nodeMap, "Gamma", stateFile);
+		WriteNodeValue(nodeMap, "SaturationEnable", stateFile);
+		WriteNodeValue(nodeMap, "Saturation", stateFile);
+
+		WriteNodeValue(nodeMap, "ColorTransformationEnable", stateFile);
+		WriteNodeValue(nodeMap, "RgbTransformLightSource", stateFile);
+		WriteNodeValue(nodeMap, "ColorTransformationSelector", stateFile);
+		WriteSelectedNodeValues(nodeMap, "ColorTransformationValueSelector", "ColorTransformationValue", stateFile);
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
+		result = -1;
+	}
+
+	return result;
+}
+
+
+// This function creates the folder for per-frame JPEGs of one camera,
+// <outputFolder>\<serial>\, which is where extract_videos2images.py puts the
+// frames it extracts from the videos
+int CreateJpegFolder(const string & outputFolder, const string & deviceSerialNumber, string & jpegFolder)
+{
+	jpegFolder = outputFolder + deviceSerialNumber + "\\";
+
+	if (!CreateDirectoryA(jpegFolder.c_str(), NULL) && ERROR_ALREADY_EXISTS != GetLastError())
+	{
+		CAPTURE_LOG(Log_Warning) << "[" << deviceSerialNumber << "] " << "Unable to create image folder " << jpegFolder;
+		return -1;
+	}
+
+	CAPTURE_LOG(Log_Info) << "[" << deviceSerialNumber << "] " << "Saving JPEG images to " << jpegFolder;
+
+	return 0;
+}
 
-		cout << "Frame rate to be set to " << frameRateToSet << "..." << endl;
 
+// Open a segmented video named after the camera serial number in the output
+// folder, with its manifest next to it
+int OpenVideo(SegmentedVideo & video, string deviceSerialNumber, float frameRateToSet, string outputFolder,
+	unsigned int width, unsigned int height)
+{
+	int result = 0;
+
+	CAPTURE_LOG(Log_Info) << endl << endl << "*** CREATING VIDEO ***" << endl;
+
+	try
+	{
 		//==========================================================================
 		// Create a unique filename
 		//
@@ -1188,6 +1390,11 @@ int ConfigureVideoAndOpen(SpinVideo & video, INodeMap & nodeMap, INodeMap & node
 			{
 				videoFilename = videoFilename + "-" + deviceSerialNumber.c_str();
 			}
+
+			break;
+
+		case SOFTWARE_H264:
+			videoFilename += deviceSerialNumber;
 		}
 
 		//==========================================================================
@@ -1199,56 +1406,152 @@ int ConfigureVideoAndOpen(SpinVideo & video, INodeMap & nodeMap, INodeMap & node
 		// have the video frame rate set whereas videos with MJPG or H264
 		// compressions should have more values set.
 		//
-		// Once the desired option object is configured, open the video file
-		// with the option in order to create the video file.
+		// Every segment is opened with the same option, on the segment
+		// writer's background thread from the second segment on.
 		//
 		// *** LATER ***
 		// Once all images have been added, it is important to close the file -
 		// this is similar to many other standard file streams.
 		//
-		// SpinVideo video;
 
-		// Set maximum video file size to 2GB.
-		// A new video file is generated when 2GB
-		// limit is reached. Setting maximum file
-		// size to 0 indicates no limit.
+		// SpinVideo starts a new file when 2GB are reached; segments are
+		// sized to stay below that, so the manifest names every file.
 		const unsigned int k_videoFileSize = 2048;
 
-		video.SetMaximumFileSize(k_videoFileSize);
+		const EncoderSettings encoder = FindEncoderSettings(encoderSettings, deviceSerialNumber);
 
-		if (chosenVideoType == UNCOMPRESSED)
+		SegmentedVideo::OpenFunction openSegment = [frameRateToSet, width, height, encoder](const string & filename) -> VideoSegment*
 		{
-			Video::AVIOption option;
+			if (chosenVideoType == SOFTWARE_H264)
+				return X264Segment::Open(filename, width, height, frameRateToSet, encoder);
 
-			option.frameRate = frameRateToSet;
+			SpinVideoSegment* segment = new SpinVideoSegment(filename, chosenVideoType == H264 ? ".mp4" : ".avi");
+			SpinVideo & spinVideo = segment->GetVideo();
+			try
+			{
+				spinVideo.SetMaximumFileSize(k_videoFileSize);
 
-			video.Open(videoFilename.c_str(), option);
-		}
-		else if (chosenVideoType == MJPG)
-		{
-			Video::MJPGOption option;
+				if (chosenVideoType == UNCOMPRESSED)
+				{
+					Video::AVIOption option;
 
-			option.frameRate = frameRateToSet;
-			option.quality = 75;
+					option.frameRate = frameRateToSet;
 
-			video.Open(videoFilename.c_str(), option);
-		}
-		else if (chosenVideoType == H264)
-		{
-			Video::H264Option option;
+					spinVideo.Open(filename.c_str(), option);
+				}
+				else if (chosenVideoType == MJPG)
+				{
+					Video::MJPGOption option;
 
-			option.frameRate = frameRateToSet;
-			option.bitrate = 1000000;
-			option.height = static_cast<unsigned int>(imageHeight);
-			option.width = static_cast<unsigned int>(imageWidth);
+					option.frameRate = frameRateToSet;
+					option.quality = 75;
 
-			video.Open(videoFilename.c_str(), option);
-		}
+					spinVideo.Open(filename.c_str(), option);
+				}
+				else if (chosenVideoType == H264)
+				{
+					Video::H264Option option;
+
+					option.frameRate = frameRateToSet;
+					option.bitrate = 1000000;
+					option.height = height;
+					option.width = width;
+
+					spinVideo.Open(filename.c_str(), option);
+				}
+			}
+			catch (Spinnaker::Exception &)
+			{
+				delete segment;
+				throw;
+			}
+			return segment;
+		};
+
+		// Segment length in trigger pulses, so all cameras roll over on the
+		// same frame set
+		int64_t framesPerSegment = k_segmentFrames > 0 ? k_segmentFrames : static_cast<int64_t>(k_segmentSeconds * frameRateToSet + 0.5);
+		if (chosenVideoType == UNCOMPRESSED)
+		{
+			// At most 3 bytes per pixel, with some room for the AVI index
+			const uint64_t frameBytes = static_cast<uint64_t>(width) * height * 3;
+			const int64_t maxFrames = static_cast<int64_t>(k_videoFileSize * 1024.0 * 1024.0 * 0.95 / (frameBytes > 0 ? frameBytes : 1));
+			if (framesPerSegment == 0 || framesPerSegment > maxFrames)
+			{
+				framesPerSegment = maxFrames > 1 ? maxFrames : 1;
+				CAPTURE_LOG(Log_Info) << "[" << deviceSerialNumber << "] " << "Video segments shortened to " << framesPerSegment << " frames to stay below " << k_videoFileSize << " MB";
+			}
+		}
+
+		// Encoder threads started by the segment writer land on the encoder cores
+		if (threadPlacement != NULL)
+			video.SetWorkerCpus(threadPlacement->GetEncoderCpus());
+
+		string manifestFilename = outputFolder + "\\" + "VideoManifest" + deviceSerialNumber + ".txt";
+		result = video.Open(videoFilename, manifestFilename, framesPerSegment, openSegment);
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
+		result = -1;
+	}
+
+	return result;
+}
+
+
+// Configure Video Settings
+int ConfigureVideoAndOpen(SegmentedVideo & video, INodeMap & nodeMap, INodeMap & nodeMapTLDevice, string outputFolder)
+{
+	int result = 0;
+
+	try
+	{
+		// Retrieve device serial number for filename
+		string deviceSerialNumber = "";
+
+		CStringPtr ptrStringSerial = nodeMapTLDevice.GetNode("DeviceSerialNumber");
+		if (IsAvailable(ptrStringSerial) && IsReadable(ptrStringSerial))
+		{
+			deviceSerialNumber = ptrStringSerial->GetValue();
 
+			CAPTURE_LOG(Log_Info) << "Device serial number retrieved as " << deviceSerialNumber << "...";
+		}
+
+		//
+		// Get the current frame rate; acquisition frame rate recorded in hertz
+		//
+		// *** NOTES ***
+		// The video frame rate can be set to anything; however, in order to
+		// have videos play in real-time, the acquisition frame rate can be
+		// retrieved from the camera.
+		//
+		CFloatPtr ptrAcquisitionFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
+		if (!IsAvailable(ptrAcquisitionFrameRate) || !IsReadable(ptrAcquisitionFrameRate))
+		{
+			CAPTURE_LOG(Log_Error) << "Unable to retrieve frame rate. Aborting..." << endl;
+			return -1;
+		}
+
+		float frameRateToSet = static_cast<float>(ptrAcquisitionFrameRate->GetValue());
+
+		CAPTURE_LOG(Log_Info) << "Frame rate to be set to " << frameRateToSet << "...";
+
+		// The frame size follows the capture profile
+		CIntegerPtr ptrWidth = nodeMap.GetNode("Width");
+		CIntegerPtr ptrHeight = nodeMap.GetNode("Height");
+		if (!IsAvailable(ptrWidth) || !IsReadable(ptrWidth) || !IsAvailable(ptrHeight) || !IsReadable(ptrHeight))
+		{
+			CAPTURE_LOG(Log_Error) << "Unable to retrieve frame size. Aborting..." << endl;
+			return -1;
+		}
+
+		result = OpenVideo(video, deviceSerialNumber, frameRateToSet, outputFolder,
+			static_cast<unsigned int>(ptrWidth->GetValue()), static_cast<unsigned int>(ptrHeight->GetValue()));
 	}
 	catch (Spinnaker::Exception &e)
 	{
-		cout << "Error: " << e.what() << endl;
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
 		result = -1;
 	}
 
@@ -1262,7 +1565,7 @@ int SaveVectorToVideo(INodeMap & nodeMap, INodeMap & nodeMapTLDevice, vector<Ima
 {
 	int result = 0;
 
-	cout << endl << endl << "*** CREATING VIDEO ***" << endl << endl;
+	CAPTURE_LOG(Log_Info) << endl << endl << "*** CREATING VIDEO ***" << endl;
 
 	try
 	{
@@ -1274,7 +1577,7 @@ int SaveVectorToVideo(INodeMap & nodeMap, INodeMap & nodeMapTLDevice, vector<Ima
 		{
 			deviceSerialNumber = ptrStringSerial->GetValue();
 
-			cout << "Device serial number retrieved as " << deviceSerialNumber << "..." << endl;
+			CAPTURE_LOG(Log_Info) << "Device serial number retrieved as " << deviceSerialNumber << "...";
 		}
 
 		//
@@ -1288,13 +1591,13 @@ int SaveVectorToVideo(INodeMap & nodeMap, INodeMap & nodeMapTLDevice, vector<Ima
 		CFloatPtr ptrAcquisitionFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
 		if (!IsAvailable(ptrAcquisitionFrameRate) || !IsReadable(ptrAcquisitionFrameRate))
 		{
-			cout << "Unable to retrieve frame rate. Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to retrieve frame rate. Aborting..." << endl;
 			return -1;
 		}
 
 		float frameRateToSet = static_cast<float>(ptrAcquisitionFrameRate->GetValue());
 
-		cout << "Frame rate to be set to " << frameRateToSet << "..." << endl;
+		CAPTURE_LOG(Log_Info) << "Frame rate to be set to " << frameRateToSet << "...";
 
 		//==========================================================================
 		// Create a unique filename
@@ -1336,6 +1639,12 @@ int SaveVectorToVideo(INodeMap & nodeMap, INodeMap & nodeMapTLDevice, vector<Ima
 			{
 				videoFilename = videoFilename + "-" + deviceSerialNumber.c_str() + "-" + video_id;
 			}
+			break;
+
+		case SOFTWARE_H264:
+			// Only written through the segmented video
+			CAPTURE_LOG(Log_Error) << "Software H.264 is not supported when saving from a vector of images";
+			return -1;
 		}
 
 		//==========================================================================
@@ -1400,7 +1709,7 @@ int SaveVectorToVideo(INodeMap & nodeMap, INodeMap & nodeMapTLDevice, vector<Ima
 		// Although the video file has been opened, images must be individually
 		// appended in order to construct the video.
 		//
-		cout << "Appending " << images.size() << " images to video file: " << videoFilename << ".avi... " << endl << endl;
+		CAPTURE_LOG(Log_Info) << "Appending " << images.size() << " images to video file: " << videoFilename << ".avi... " << endl;
 
 		for (unsigned int imageCnt = 0; imageCnt < images.size(); imageCnt++)
 		{
@@ -1418,11 +1727,11 @@ int SaveVectorToVideo(INodeMap & nodeMap, INodeMap & nodeMapTLDevice, vector<Ima
 		//
 		video.Close();
 
-		cout << endl << "Video saved at " << videoFilename << ".avi" << endl << endl;
+		CAPTURE_LOG(Log_Info) << endl << "Video saved at " << videoFilename << ".avi" << endl;
 	}
 	catch (Spinnaker::Exception &e)
 	{
-		cout << "Error: " << e.what() << endl;
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
 		result = -1;
 	}
 
@@ -1436,7 +1745,7 @@ struct SaveVectorToVideoParam {
 	vector<ImagePtr> images;
 	unsigned int id; // video id if take several videos
 
-	SaveVectorToVideoParam(CameraPtr _pCam, vector<ImagePtr> _images, unsigned int _id) :
+	SaveVectorToVideoParam(CameraPtr _pCam, const vector<ImagePtr> & _images, unsigned int _id) :
 		pCam(_pCam), images(_images), id(_id) {}
 };
 
@@ -1445,7 +1754,7 @@ struct SaveVectorToVideoParam {
 // only takes care of the WIN32 env
 DWORD WINAPI SaveVectorToVideoThread(LPVOID lpParam)
 {
-	SaveVectorToVideoParam param = *((SaveVectorToVideoParam*)lpParam);
+	SaveVectorToVideoParam & param = *((SaveVectorToVideoParam*)lpParam);
 	CameraPtr pCam = param.pCam;
 
 	try
@@ -1455,7 +1764,7 @@ DWORD WINAPI SaveVectorToVideoThread(LPVOID lpParam)
 
 		int result = SaveVectorToVideo(nodeMap, nodeMap, param.images, param.id);
 		if (result < 0) {
-			cout << "Failed to save the images to AVI" << endl;
+			CAPTURE_LOG(Log_Error) << "Failed to save the images to AVI";
 			return result;
 		}
 
@@ -1463,43 +1772,764 @@ DWORD WINAPI SaveVectorToVideoThread(LPVOID lpParam)
 	}
 	catch (Spinnaker::Exception &e)
 	{
-		cout << "Error: " << e.what() << endl;
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
 		return 0;
 	}
-}
+}
+
+
+// A frame handed from the grab thread to the writer thread. The image is a
+// host-side copy, so the camera buffer is returned to the stream right away.
+// Incomplete frames are passed on without an image so they still get logged.
+struct GrabbedFrame {
+	ImagePtr image;
+	FrameBufferRef buffer; // holds the image's pixels if they are in the frame buffer pool
+	FrameChunkData chunkData;
+	unsigned int imageCnt;
+	HostClock::time_point grabTime;
+	uint64_t commonTimestamp; // chunk timestamp on the host clock, 0 without a clock model
+	bool incomplete;
+	uint64_t numDroppedBefore; // frame queue drops counted before this frame
+
+	GrabbedFrame() : imageCnt(0), commonTimestamp(0), incomplete(false), numDroppedBefore(0) {}
+};
+
+
+// This struct is design for run the thread function WriteFramesThread
+struct FrameWriterParam {
+	FrameQueue<GrabbedFrame>* queue;
+	SegmentedVideo* video;
+	string jpegFolder; // used when jpegEncoderPool is set
+	ChunkLogWriter* chunkLog;
+	string serialNumber;
+	uint64_t numWritten;
+	vector<float> latenciesUs; // grab to written, per frame
+	ColorParams colorParams; // used when colorEngine is set
+	FrameBufferPool* developPool;
+	vector<unsigned char> developBuffer; // when developPool has no free buffer
+	CameraStats* stats;
+	LosslessEncoder losslessEncoder; // used when frameContainer is set and losslessContainer
+	FrameBusWriter* frameBus; // NULL unless publishFrameBus
+#if defined(USE_TURBOJPEG)
+	tjhandle jpegCompressor; // used when frameContainer is set
+#endif
+
+	FrameWriterParam(FrameQueue<GrabbedFrame>* _queue, SegmentedVideo* _video, ChunkLogWriter* _chunkLog, string _serialNumber) :
+		queue(_queue), video(_video), chunkLog(_chunkLog), serialNumber(_serialNumber), numWritten(0), developPool(NULL), stats(NULL), frameBus(NULL)
+	{
+#if defined(USE_TURBOJPEG)
+		jpegCompressor = tjInitCompress();
+#endif
+	}
+
+	~FrameWriterParam()
+	{
+#if defined(USE_TURBOJPEG)
+		tjDestroy(jpegCompressor);
+#endif
+	}
+};
+
+
+// This function fills the chunk log record of one frame. captureIndex is the
+// frame's index in the recording, which downstream tools use as img_%06d, or
+// k_chunkLogNotRecorded for a frame that is not recorded.
+void FillChunkLogRecord(const GrabbedFrame & frame, uint32_t captureIndex, uint32_t statusFlags, ChunkLogRecord & record)
+{
+	record.captureIndex = captureIndex;
+	record.statusFlags = statusFlags;
+	record.frameID = frame.chunkData.frameID;
+	record.deviceTimestamp = frame.chunkData.timestamp;
+	record.hostTimestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(frame.grabTime.time_since_epoch()).count());
+	record.exposureTime = frame.chunkData.exposureTime;
+	record.gain = frame.chunkData.gain;
+	record.width = static_cast<uint32_t>(frame.chunkData.width);
+	record.height = static_cast<uint32_t>(frame.chunkData.height);
+	record.offsetX = static_cast<uint32_t>(frame.chunkData.offsetX);
+	record.offsetY = static_cast<uint32_t>(frame.chunkData.offsetY);
+	record.grabIndex = frame.imageCnt;
+	record.sequencerSetActive = static_cast<int32_t>(frame.chunkData.sequencerSetActive);
+	record.commonTimestamp = frame.commonTimestamp;
+}
+
+
+// This function develops a raw Bayer frame into BGR8 with the shared colour
+// engine, into a buffer from the develop pool (returned in buffer) if one is
+// free. Frames in other formats are returned unchanged.
+ImagePtr DevelopFrame(FrameWriterParam* pParam, const ImagePtr & image, FrameBufferRef & buffer)
+{
+	PixelFormatEnums pixelFormat = image->GetPixelFormat();
+	if (pixelFormat != PixelFormat_BayerBG8 && pixelFormat != PixelFormat_BayerRG8 &&
+		pixelFormat != PixelFormat_BayerGB8 && pixelFormat != PixelFormat_BayerGR8)
+		return image;
+
+	const size_t width = image->GetWidth();
+	const size_t height = image->GetHeight();
+
+	buffer.Reset();
+	if (pParam->developPool != NULL)
+		buffer = pParam->developPool->Acquire();
+
+	unsigned char* out;
+	if (buffer.IsValid() && buffer.GetSize() >= width * height * 3)
+	{
+		out = buffer.GetData();
+	}
+	else
+	{
+		buffer.Reset();
+		pParam->developBuffer.resize(width * height * 3);
+		out = &pParam->developBuffer[0];
+	}
+
+	// The frame itself says which mosaic it carries
+	ColorParams & params = pParam->colorParams;
+	params.pattern = (pixelFormat == PixelFormat_BayerRG8) ? BAYER_RG : (pixelFormat == PixelFormat_BayerGB8) ? BAYER_GB :
+		(pixelFormat == PixelFormat_BayerGR8) ? BAYER_GR : BAYER_BG;
+	params.outputBGR = true;
+	colorEngine->Process(static_cast<const unsigned char*>(image->GetData()), image->GetStride(),
+		out, width * 3, static_cast<unsigned int>(width), static_cast<unsigned int>(height), params);
+
+	return Image::Create(width, height, 0, 0, PixelFormat_BGR8, out);
+}
+
+
+// Maps a Spinnaker pixel format to the container's pixel format
+ContainerPixelFormat ToContainerPixelFormat(PixelFormatEnums pixelFormat)
+{
+	switch (pixelFormat)
+	{
+	case PixelFormat_BGR8: return ContainerPixel_BGR8;
+	case PixelFormat_RGB8: return ContainerPixel_RGB8;
+	case PixelFormat_BayerRG8: return ContainerPixel_BayerRG8;
+	case PixelFormat_BayerGR8: return ContainerPixel_BayerGR8;
+	case PixelFormat_BayerGB8: return ContainerPixel_BayerGB8;
+	case PixelFormat_BayerBG8: return ContainerPixel_BayerBG8;
+	default: return ContainerPixel_Mono8;
+	}
+}
+
+
+// This function appends one frame to the multi-camera container. With
+// losslessContainer every frame is compressed losslessly; otherwise colour
+// frames are stored as JPEG when built with USE_TURBOJPEG, everything else
+// uncompressed.
+int AppendToContainer(FrameWriterParam* pParam, int cameraIndex, int64_t setId, const ImagePtr & image, const ChunkLogRecord & record)
+{
+	const uint32_t width = static_cast<uint32_t>(image->GetWidth());
+	const uint32_t height = static_cast<uint32_t>(image->GetHeight());
+	const ContainerPixelFormat pixelFormat = ToContainerPixelFormat(image->GetPixelFormat());
+
+	if (losslessContainer)
+	{
+		unsigned int sampleStep, rowStep, bytesPerPixel;
+		GetLosslessSteps(pixelFormat, losslessBayerPrediction, sampleStep, rowStep, bytesPerPixel);
+
+		ParallelForFunction parallelFor;
+		if (losslessPool != NULL)
+			parallelFor = [](unsigned int count, const std::function<void(unsigned int)> & task) { losslessPool->ParallelFor(count, task); };
+
+		const vector<unsigned char> & payload = pParam->losslessEncoder.Encode(static_cast<const unsigned char*>(image->GetData()),
+			image->GetStride(), width * bytesPerPixel, height, sampleStep, rowStep, k_losslessStripes, parallelFor);
+		return frameContainer->Append(cameraIndex, setId, record, Container_Lossless, pixelFormat, width, height, &payload[0], payload.size());
+	}
+
+#if defined(USE_TURBOJPEG)
+	unsigned char* jpegBuffer = NULL;
+	unsigned long jpegSize = 0;
+	if (CompressJpeg(pParam->jpegCompressor, image, k_jpegQuality, &jpegBuffer, &jpegSize) == 0)
+	{
+		int result = frameContainer->Append(cameraIndex, setId, record, Container_Jpeg, pixelFormat, width, height, jpegBuffer, jpegSize);
+		tjFree(jpegBuffer);
+		return result;
+	}
+#endif
+
+	return frameContainer->Append(cameraIndex, setId, record, Container_Raw, pixelFormat, width, height,
+		image->GetData(), static_cast<uint64_t>(image->GetStride()) * height);
+}
+
+
+// This function drains one camera's frame queue into its video and log file,
+// so encoding and disk stalls never hold up GetNextImage() on the grab thread.
+#if defined (_WIN32)
+DWORD WINAPI WriteFramesThread(LPVOID lpParam)
+{
+	FrameWriterParam* pParam = (FrameWriterParam*)lpParam;
+#else
+void* WriteFramesThread(void* arg)
+{
+	FrameWriterParam* pParam = (FrameWriterParam*)arg;
+#endif
+	int result = 1;
+	GrabbedFrame frame;
+	uint64_t numDropped = 0;
+	int cameraIndex = frameSetAssembler != NULL ? frameSetAssembler->GetCameraIndex(pParam->serialNumber) : -1;
+
+	if (threadPlacement != NULL)
+		threadPlacement->ApplyToWriterThread(pParam->serialNumber);
+
+	while (!pParam->queue->IsDrained())
+	{
+		if (!pParam->queue->TryPop(frame))
+		{
+			SleepyWrapper(1);
+			continue;
+		}
+
+		CameraStats & stats = *pParam->stats;
+		HostClock::time_point stageStart = HostClock::now();
+		stats.stages[Stage_QueueWait].Record(stageStart - frame.grabTime);
+
+		try
+		{
+			uint32_t statusFlags = 0;
+			if (frame.numDroppedBefore > numDropped)
+			{
+				statusFlags |= ChunkLog_DroppedBefore;
+				numDropped = frame.numDroppedBefore;
+			}
+			if (frame.incomplete)
+				statusFlags |= ChunkLog_Incomplete;
+			else if (!frame.chunkData.valid)
+				statusFlags |= ChunkLog_NoChunkData;
+
+			ChunkLogRecord record;
+			FillChunkLogRecord(frame, frame.incomplete ? k_chunkLogNotRecorded : static_cast<uint32_t>(pParam->numWritten), statusFlags, record);
+
+			// Report the recorded frame for cross-camera frame-set assembly
+			int64_t setId = k_containerNoSet;
+			if (cameraIndex >= 0 && !frame.incomplete && frame.chunkData.valid)
+				setId = frameSetAssembler->AddFrame(cameraIndex, record.frameID, record.hostTimestamp, record.commonTimestamp, record.captureIndex);
+			HostClock::duration metadataTime = HostClock::now() - stageStart;
+
+			if (!frame.incomplete)
+			{
+				FrameBufferRef imageBuffer = frame.buffer;
+				ImagePtr image = frame.image;
+				if (colorEngine != NULL)
+				{
+					stageStart = HostClock::now();
+					image = DevelopFrame(pParam, frame.image, imageBuffer);
+					stats.stages[Stage_Develop].Record(HostClock::now() - stageStart);
+				}
+
+				// Live consumers get the frame before it is encoded
+				if (pParam->frameBus != NULL)
+				{
+					pParam->frameBus->Publish(static_cast<const unsigned char*>(image->GetData()), image->GetStride(),
+						static_cast<unsigned int>(image->GetWidth()), static_cast<unsigned int>(image->GetHeight()),
+						ToContainerPixelFormat(image->GetPixelFormat()), record, setId);
+				}
+
+				// With the JPEG pool this is the submit, which blocks while the
+				// encoders are behind
+				stageStart = HostClock::now();
+
+				if (frameContainer != NULL && cameraIndex >= 0)
+				{
+					if (AppendToContainer(pParam, cameraIndex, setId, image, record) < 0)
+						CAPTURE_LOG(Log_Warning) << "[" << pParam->serialNumber << "] " << "Unable to append frame " << record.captureIndex << " to the container";
+				}
+				else if (jpegEncoderPool != NULL)
+				{
+					// A frame developed into the reused fallback buffer needs its
+					// own copy; pool buffers stay alive through imageBuffer
+					if (colorEngine != NULL && !imageBuffer.IsValid())
+						image = Image::Create(image);
+
+					char buffer[32]; sprintf(buffer, "img_%06u.jpg", static_cast<unsigned int>(pParam->numWritten));
+					jpegEncoderPool->Submit(image, pParam->jpegFolder + buffer, imageBuffer);
+				}
+				else
+				{
+					// Append image to video; the segment follows the frame set
+					pParam->video->Append(image, cameraIndex >= 0 ? setId : static_cast<int64_t>(record.captureIndex));
+				}
+				stats.stages[Stage_Write].Record(HostClock::now() - stageStart);
+				pParam->numWritten++;
+				stats.numWritten++;
+			}
+
+			stageStart = HostClock::now();
+			pParam->chunkLog->Append(record);
+			HostClock::time_point writtenTime = HostClock::now();
+			stats.stages[Stage_Metadata].Record(metadataTime + (writtenTime - stageStart));
+
+			if (!frame.incomplete)
+			{
+				pParam->latenciesUs.push_back(std::chrono::duration<float, std::micro>(writtenTime - frame.grabTime).count());
+				stats.stages[Stage_Total].Record(writtenTime - frame.grabTime);
+			}
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			CAPTURE_LOG(Log_Error) << "[" << pParam->serialNumber << "] " << "Write Error: " << e.what();
+			result = 0;
+		}
+
+		frame = GrabbedFrame();
+	}
+
+	if (cameraIndex >= 0)
+		frameSetAssembler->CameraFinished(cameraIndex);
+
+#if defined (_WIN32)
+	return result;
+#else
+	return (void*)(intptr_t)result;
+#endif
+}
+
+
+// Per-camera results of one capture run
+struct CaptureReport {
+	string serialNumber;
+	uint64_t numGrabbed;
+	uint64_t numIncomplete;
+	uint64_t numFrameIdGaps; // frames the camera produced but we never received
+	uint64_t frameEvents[k_numFrameEventTypes]; // FrameDropDetector totals
+	uint64_t numFrameAlarms;
+	uint64_t numQueued;
+	uint64_t numDropped; // frames dropped because the frame queue was full
+	uint64_t numWritten;
+	unsigned int queueHighWater;
+	unsigned int queueCapacity;
+	unsigned int queueGrowths; // times the frame queue was enlarged during the run
+	uint64_t numPoolMisses; // frames copied to a heap image because every pool buffer was in use
+	size_t poolMinFree;
+	size_t poolSize;
+	StreamStats streamStats; // driver counters at the end of the run
+	int64_t maxPendingBuffers; // most filled stream buffers seen waiting for the grab thread
+	uint64_t numClockSamples; // device clock latches, 0 if the camera has none
+	double clockDriftPpm;
+	double clockResidualUs;
+	int64_t clockOffsetNs; // host minus device clock at the end of the run
+	double elapsedSeconds;
+	vector<float> latenciesUs;
+
+	CaptureReport() : numGrabbed(0), numIncomplete(0), numFrameIdGaps(0), numFrameAlarms(0), numQueued(0), numDropped(0),
+		numWritten(0), queueHighWater(0), queueCapacity(0), queueGrowths(0), numPoolMisses(0), poolMinFree(0), poolSize(0),
+		maxPendingBuffers(-1), numClockSamples(0), clockDriftPpm(0), clockResidualUs(0), clockOffsetNs(0), elapsedSeconds(0)
+	{
+		for (int i = 0; i < k_numFrameEventTypes; i++)
+			frameEvents[i] = 0;
+	}
+};
+
+
+// Returns the p-th percentile (0..1) of a sorted sample, 0 if empty
+float Percentile(const vector<float> & sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0f;
+
+	size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+
+// This function prints the summary of one camera's capture run
+void PrintCaptureReport(const CaptureReport & report)
+{
+	vector<float> latencies = report.latenciesUs;
+	sort(latencies.begin(), latencies.end());
+
+	double fps = report.elapsedSeconds > 0 ? report.numWritten / report.elapsedSeconds : 0.0;
+
+	CAPTURE_LOG(Log_Info) << "[" << report.serialNumber << "] " << "Frame queue: " << report.numQueued << " queued, "
+		<< report.numWritten << " written, " << report.numDropped << " dropped, high-water mark "
+		<< report.queueHighWater << "/" << report.queueCapacity << (report.queueGrowths > 0 ? " (enlarged during the run)" : "");
+	ostringstream frameEvents;
+	for (int i = 0; i < k_numFrameEventTypes; i++)
+		frameEvents << (i > 0 ? ", " : "") << report.frameEvents[i] << " " << GetFrameEventName(i);
+	CAPTURE_LOG(Log_Info) << "[" << report.serialNumber << "] " << "Frame events: " << frameEvents.str() << " (" << report.numFrameAlarms << " alarms)";
+	CAPTURE_LOG(Log_Info) << "[" << report.serialNumber << "] " << "Stream: " << report.streamStats.overwritten << " overwritten, "
+		<< report.streamStats.lost << " lost, " << report.streamStats.underruns << " underruns, "
+		<< report.streamStats.failed << " failed buffers, at most " << report.maxPendingBuffers << " buffers pending (-1: not reported)";
+	if (report.numClockSamples > 0)
+		CAPTURE_LOG(Log_Info) << "[" << report.serialNumber << "] " << "Clock: device runs " << report.clockDriftPpm << " ppm fast, offset to host "
+			<< report.clockOffsetNs / 1e9 << " s, fit residual " << report.clockResidualUs << " us over " << report.numClockSamples << " samples";
+	else
+		CAPTURE_LOG(Log_Info) << "[" << report.serialNumber << "] " << "Clock: no timestamp latch, frames logged without common time";
+	CAPTURE_LOG(Log_Info) << "[" << report.serialNumber << "] " << "Frame buffers: " << report.poolSize - report.poolMinFree << "/" << report.poolSize
+		<< " in use at most, " << report.numPoolMisses << " frames allocated outside the pool";
+	CAPTURE_LOG(Log_Info) << "[" << report.serialNumber << "] " << "Grabbed " << report.numGrabbed << " (" << report.numIncomplete
+		<< " incomplete, " << report.numFrameIdGaps << " missing frame IDs) in " << report.elapsedSeconds << " s, "
+		<< fps << " fps written, latency p50/p99/max " << Percentile(latencies, 0.5) / 1000 << "/"
+		<< Percentile(latencies, 0.99) / 1000 << "/" << Percentile(latencies, 1.0) / 1000 << " ms";
+}
+
+
+// This function latches the device clock k_clockLatchTries times and adds
+// the most tightly bracketed latch to the clock model. Returns false if the
+// source has no timestamp latch.
+bool SampleDeviceClock(FrameSource & source, DeviceClockModel & clockModel)
+{
+	ClockSample best;
+	bool haveSample = false;
+	for (unsigned int i = 0; i < k_clockLatchTries; i++)
+	{
+		ClockSample sample;
+		const HostClock::time_point before = HostClock::now();
+		if (!source.LatchDeviceClock(sample.deviceNs))
+			return haveSample;
+		const HostClock::time_point after = HostClock::now();
+
+		const uint64_t beforeNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(before.time_since_epoch()).count());
+		const uint64_t afterNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(after.time_since_epoch()).count());
+		sample.hostNs = beforeNs + (afterNs - beforeNs) / 2;
+		sample.uncertaintyNs = (afterNs - beforeNs) / 2;
+
+		if (!haveSample || sample.uncertaintyNs < best.uncertaintyNs)
+			best = sample;
+		haveSample = true;
+	}
+
+	clockModel.AddSample(best);
+	return true;
+}
+
+
+// This function grabs frames from a frame source and hands them to a writer
+// thread that appends them to the video and the chunk log. Acquisition must
+// already have begun on the source; buffers are sized from its frame size.
+int RunCaptureLoop(FrameSource & source, const StreamBufferPlan & bufferPlan, SegmentedVideo & video, const string & jpegFolder,
+	ChunkLogWriter & chunkLog, unsigned int numImages, const ColorParams & colorParams, CaptureReport & report)
+{
+	int result = 0;
+	string serialNumber = source.GetSerialNumber();
+
+	//==================================================================================
+	// Start the writer thread; it owns video.Append() and the log file from here on
+	FrameQueue<GrabbedFrame> frameQueue(bufferPlan.queueDepth, bufferPlan.maxQueueDepth);
+
+	// Preallocated buffers for the frame copies and developed frames; the frame
+	// pool covers the queue at its grown depth, so a disk stall does not fall
+	// back to heap copies on the grab thread
+	const bool rawFrames = chosenCaptureMode == RAW_BAYER;
+	const size_t numPixels = static_cast<size_t>(source.GetWidth()) * source.GetHeight();
+	FrameBufferPool framePool(bufferPlan.maxQueueDepth + k_framePoolSpare, numPixels * (rawFrames ? 1 : 3));
+	FrameBufferPool developPool(colorEngine != NULL ? k_developBuffers : 0, numPixels * 3);
+
+	// Stage latencies; kept locally when no registry collects them
+	CameraStats localStats(serialNumber);
+	CameraStats & stats = captureStats != NULL ? *captureStats->Add(serialNumber) : localStats;
+
+	FrameWriterParam writerParam(&frameQueue, &video, &chunkLog, serialNumber);
+	writerParam.developPool = &developPool;
+	writerParam.stats = &stats;
+	writerParam.jpegFolder = jpegFolder;
+	writerParam.colorParams = colorParams;
+	writerParam.latenciesUs.reserve(numImages);
+
+	// Full-resolution frames for live consumers in other processes
+	FrameBusWriter frameBus;
+	if (publishFrameBus && frameBus.Open(frameBusName + "-" + serialNumber, serialNumber, k_frameBusSlots, numPixels * 3) == 0)
+		writerParam.frameBus = &frameBus;
+
+#if defined(_WIN32)
+	HANDLE writerThread = CreateThread(NULL, 0, WriteFramesThread, &writerParam, 0, NULL);
+	assert(writerThread != NULL);
+#else
+	pthread_t writerThread;
+	int err = pthread_create(&writerThread, NULL, &WriteFramesThread, &writerParam);
+	assert(err == 0);
+#endif
+
+	//==================================================================================
+	// Retrieve images for each camera and hand them to the writer thread
+
+	CAPTURE_LOG(Log_Info) << endl;
+
+	HostClock::time_point firstGrabTime;
+	FrameDropDetector dropDetector(serialNumber, captureFrameRate);
+
+	HostClock::time_point lastStatsTime = HostClock::now();
+	StreamStats lastStats;
+	bool hasStreamStats = source.GetStreamStats(lastStats);
+
+	// Device-to-host clock model for the frames' common timestamps
+	DeviceClockModel clockModel;
+	const bool hasDeviceClock = SampleDeviceClock(source, clockModel);
+	HostClock::time_point lastClockSampleTime = HostClock::now();
+
+	const int previewIndex = previewPublisher != NULL ? previewPublisher->GetCameraIndex(serialNumber) : -1;
+
+	for (unsigned int imageCnt = 0; imageCnt < numImages; imageCnt++)
+	{
+		try
+		{
+			// Retrieve next received image and ensure image completion
+			SourceFrame sourceFrame;
+			HostClock::time_point waitStart = HostClock::now();
+			source.GrabNextFrame(sourceFrame);
+
+			HostClock::time_point grabTime = HostClock::now();
+			stats.stages[Stage_Grab].Record(grabTime - waitStart);
+			stats.numGrabbed++;
+			if (report.numGrabbed++ == 0)
+				firstGrabTime = grabTime;
+
+			if (sourceFrame.incomplete)
+			{
+				CAPTURE_LOG_LIMITED(Log_Warning) << "[" << serialNumber << "] " << "Image incomplete with image status " << sourceFrame.imageStatus << "..." << endl;
+				report.numIncomplete++;
+				stats.numIncomplete++;
+				dropDetector.OnIncomplete(grabTime);
+				stats.numFrameAlarms = dropDetector.GetNumAlarms();
+
+				// Log the incomplete frame without an image
+				GrabbedFrame frame;
+				frame.imageCnt = imageCnt;
+				frame.grabTime = grabTime;
+				frame.incomplete = true;
+				frame.numDroppedBefore = frameQueue.DroppedCount();
+				if (!frameQueue.TryPush(frame))
+					stats.numDropped++;
+			}
+			else
+			{
+				if (sourceFrame.chunkData.valid)
+				{
+					dropDetector.OnFrame(sourceFrame.chunkData.frameID, sourceFrame.chunkData.timestamp, grabTime);
+					stats.numDriverDrops = dropDetector.GetTotal(FrameEvent_DriverDrop);
+					stats.numTriggerMisses = dropDetector.GetTotal(FrameEvent_TriggerMiss);
+					stats.numTimingEvents = dropDetector.GetTotal(FrameEvent_Timing);
+					stats.numFrameAlarms = dropDetector.GetNumAlarms();
+				}
+
+				// Copy the frame out of the camera buffer so the buffer can go
+				// back to the stream while the writer thread encodes the copy.
+				GrabbedFrame frame;
+				const size_t imageSize = sourceFrame.image->GetStride() * sourceFrame.image->GetHeight();
+				frame.buffer = framePool.Acquire();
+				if (frame.buffer.IsValid() && imageSize <= frame.buffer.GetSize())
+				{
+					memcpy(frame.buffer.GetData(), sourceFrame.image->GetData(), imageSize);
+					frame.image = Image::Create(sourceFrame.image->GetWidth(), sourceFrame.image->GetHeight(),
+						sourceFrame.image->GetOffsetX(), sourceFrame.image->GetOffsetY(), sourceFrame.image->GetPixelFormat(), frame.buffer.GetData());
+				}
+				else
+				{
+					// Pool exhausted or frame larger than configured
+					frame.buffer.Reset();
+					frame.image = Image::Create(sourceFrame.image);
+				}
+				frame.chunkData = sourceFrame.chunkData;
+				frame.imageCnt = imageCnt;
+				frame.grabTime = grabTime;
+				if (sourceFrame.chunkData.valid)
+					frame.commonTimestamp = clockModel.Map(sourceFrame.chunkData.timestamp);
+				frame.numDroppedBefore = frameQueue.DroppedCount();
+
+				// Hand every Nth pooled copy to the live preview, or drop it
+				if (previewIndex >= 0)
+				{
+					previewPublisher->Offer(previewIndex, frame.buffer, sourceFrame.image->GetStride(),
+						static_cast<unsigned int>(sourceFrame.image->GetWidth()), static_cast<unsigned int>(sourceFrame.image->GetHeight()),
+						ToContainerPixelFormat(sourceFrame.image->GetPixelFormat()), sourceFrame.chunkData.frameID,
+						static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(grabTime.time_since_epoch()).count()), imageCnt);
+				}
+
+				// Queue the frame; a full queue drops it and counts the drop
+				if (!frameQueue.TryPush(frame))
+					stats.numDropped++;
+				stats.stages[Stage_Copy].Record(HostClock::now() - grabTime);
+
+				// Print image information
+				if ((imageCnt + 1) % k_numPrintInfo == 0)
+					CAPTURE_LOG(Log_Info) << "[" << serialNumber << "] " << "Grabbed image " << imageCnt << ", width = " << sourceFrame.image->GetWidth() << ", height = " << sourceFrame.image->GetHeight() << ", queued = " << frameQueue.Size(); //". Image saved at " << filename.str() << endl;
+			}
+
+			source.ReleaseFrame(sourceFrame);
+
+			// Sample the driver's counters and give the frame queue more room
+			// when the writer falls behind
+			HostClock::time_point now = HostClock::now();
+			if (now - lastStatsTime >= std::chrono::milliseconds(k_streamStatsIntervalMs))
+			{
+				lastStatsTime = now;
+				dropDetector.Poll(now);
+				stats.numFrameAlarms = dropDetector.GetNumAlarms();
+
+				StreamStats streamStats;
+				bool streamLosing = false;
+				if (hasStreamStats && source.GetStreamStats(streamStats))
+				{
+					const int64_t overwritten = streamStats.overwritten - lastStats.overwritten;
+					const int64_t lost = streamStats.lost - lastStats.lost;
+					const int64_t underruns = streamStats.underruns - lastStats.underruns;
+					if (overwritten > 0 || lost > 0 || underruns > 0)
+					{
+						CAPTURE_LOG(Log_Warning) << "[" << serialNumber << "] " << "Stream: +" << overwritten << " overwritten, +" << lost << " lost, +"
+							<< underruns << " underruns, " << streamStats.pending << " buffers pending";
+						streamLosing = overwritten > 0 || underruns > 0;
+					}
+					report.maxPendingBuffers = max(report.maxPendingBuffers, streamStats.pending);
+					lastStats = streamStats;
+				}
+
+				const unsigned int capacity = frameQueue.Capacity();
+				if ((streamLosing || frameQueue.HighWaterMark() * 4 >= capacity * 3) && capacity < frameQueue.MaxCapacity())
+				{
+					frameQueue.SetCapacity(capacity + max(capacity / 2, 1u));
+					report.queueGrowths++;
+					CAPTURE_LOG(Log_Info) << "[" << serialNumber << "] " << "Frame queue enlarged to " << frameQueue.Capacity() << " frames";
+				}
+			}
+
+			if (hasDeviceClock && now - lastClockSampleTime >= std::chrono::milliseconds(k_clockSampleIntervalMs))
+			{
+				lastClockSampleTime = now;
+				SampleDeviceClock(source, clockModel);
+			}
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			CAPTURE_LOG(Log_Error) << "[" << serialNumber << "] " << "Error: " << e.what();
+			result = -1;
+			break;
+		}
+
+		if (!is_running) break;
+	}
+
+	//==================================================================================
+	// Let the writer thread drain the queue before the video and log are closed
+	frameQueue.Close();
+
+#if defined(_WIN32)
+	WaitForSingleObject(writerThread, INFINITE);
+	CloseHandle(writerThread);
+#else
+	pthread_join(writerThread, NULL);
+#endif
+	frameBus.Close();
+
+	// Encoder threads may still hold frames of this camera
+	while (framePool.GetNumFree() < framePool.GetNumBuffers() ||
+		developPool.GetNumFree() < developPool.GetNumBuffers())
+	{
+		SleepyWrapper(1);
+	}
+
+	report.serialNumber = serialNumber;
+	report.numFrameIdGaps = dropDetector.GetMissingFrameIDs();
+	for (int i = 0; i < k_numFrameEventTypes; i++)
+		report.frameEvents[i] = dropDetector.GetTotal(static_cast<FrameEventType>(i));
+	report.numFrameAlarms = dropDetector.GetNumAlarms();
+	report.numQueued = frameQueue.PushedCount();
+	report.numDropped = frameQueue.DroppedCount();
+	report.numWritten = writerParam.numWritten;
+	report.queueHighWater = frameQueue.HighWaterMark();
+	report.queueCapacity = frameQueue.Capacity();
+	if (hasStreamStats)
+		source.GetStreamStats(report.streamStats);
+	report.numClockSamples = clockModel.GetNumSamples();
+	report.clockDriftPpm = clockModel.GetDriftPpm();
+	report.clockResidualUs = clockModel.GetResidualNs() / 1000.0;
+	report.clockOffsetNs = clockModel.GetOffsetNs();
+	report.numPoolMisses = framePool.GetNumMisses();
+	report.poolMinFree = framePool.GetMinFree();
+	report.poolSize = framePool.GetNumBuffers();
+	report.elapsedSeconds = report.numGrabbed > 0 ? std::chrono::duration<double>(HostClock::now() - firstGrabTime).count() : 0.0;
+	report.latenciesUs.swap(writerParam.latenciesUs);
+
+	PrintCaptureReport(report);
+
+	return result;
+}
+
+
+// This function times what the writer thread does with one frame (host
+// colour processing and JPEG encoding) on a synthetic frame, median of a few
+// runs. MJPEG video is timed as JPEG; uncompressed video counts as free.
+double MeasureEncodeLatencyMs(const string & folder)
+{
+	const unsigned int k_numRuns = 5;
+
+	SyntheticCameraOptions options;
+	options.serialNumber = "PROBE";
+	options.width = imageWidth;
+	options.height = imageHeight;
+	options.pixelFormat = (grabPixelFormatName == "BGR8") ? PixelFormat_BGR8 : PixelFormat_BayerBG8;
+	SyntheticFrameSource source(options);
+	source.BeginAcquisition();
+
+	SourceFrame sourceFrame;
+	source.GrabNextFrame(sourceFrame);
+
+	FrameWriterParam param(NULL, NULL, NULL, options.serialNumber);
+	const bool encodes = chosenRecordType != RECORD_VIDEO || chosenVideoType != UNCOMPRESSED;
+	vector<double> latencies;
+
+	for (unsigned int i = 0; i < k_numRuns; i++)
+	{
+		HostClock::time_point start = HostClock::now();
+		try
+		{
+			FrameBufferRef buffer;
+			ImagePtr image = (colorEngine != NULL) ? DevelopFrame(&param, sourceFrame.image, buffer) : sourceFrame.image;
+			if (encodes)
+			{
+#if defined(USE_TURBOJPEG)
+				unsigned char* jpegBuffer = NULL;
+				unsigned long jpegSize = 0;
+				if (CompressJpeg(param.jpegCompressor, image, k_jpegQuality, &jpegBuffer, &jpegSize) == 0)
+					tjFree(jpegBuffer);
+#else
+				JPEGOption option;
+				option.quality = k_jpegQuality;
+				image->Save((folder + "encode_probe.jpg").c_str(), option);
+#endif
+			}
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			CAPTURE_LOG(Log_Error) << "Encode probe error: " << e.what();
+			break;
+		}
+		latencies.push_back(std::chrono::duration<double, std::milli>(HostClock::now() - start).count());
+	}
+	remove((folder + "encode_probe.jpg").c_str());
+	source.ReleaseFrame(sourceFrame);
 
+	if (latencies.empty())
+		return 0.0;
+	sort(latencies.begin(), latencies.end());
+	return latencies[latencies.size() / 2];
+}
 
-// This struct is design for run the thread function SaveImageThread
-struct SaveImageParam {
-	ImagePtr img;
-	string name;
-
-	SaveImageParam() {
-		img = Image::Create();
-	}
 
-	void releaseImg() {
-		img->Release();
-	}
-};
+// This function measures what PlanStreamBufferCount needs: the full-frame
+// encode latency and the free RAM, to be shared by numCameras. Call it after
+// colorEngine is set up and before the cameras allocate their buffers.
+void MeasureStreamResources(unsigned int numCameras, const string & folder)
+{
+	streamResources.fullFrameEncodeMs = MeasureEncodeLatencyMs(folder);
+	streamResources.availableRam = GetAvailablePhysicalMemory();
+	streamResources.numCameras = numCameras > 0 ? numCameras : 1;
+}
 
 
-// This function save images use one thread
-DWORD WINAPI SaveImageThread(LPVOID lpParam)
+// This function sizes the stream buffers and frame queue of one camera from
+// its configured frame size and rate, the measured encode latency (scaled to
+// the frame size) and its share of the free RAM.
+StreamBufferPlan PlanStreamBufferCount(const string & serialNumber, unsigned int width, unsigned int height, float frameRate)
 {
-	SaveImageParam* pParam = (SaveImageParam*)lpParam;
-
-	try
-	{
-		pParam->img->Save(pParam->name.c_str());
-		// cout << "Saving image " << pParam->name << endl;
-		return 1;
-	}
-	catch (Spinnaker::Exception &e)
-	{
-		cout << "Save Error: " << e.what() << endl;
-		return 0;
-	}
+	const size_t numPixels = static_cast<size_t>(width) * height;
+	const size_t frameBytes = numPixels * (chosenCaptureMode == RAW_BAYER ? 1 : 3);
+	const double encodeLatencyMs = streamResources.fullFrameEncodeMs * numPixels / (static_cast<double>(imageWidth) * imageHeight);
+
+	StreamBufferOptions options;
+	options.minDriverBuffers = numBuffers;
+	options.hostSlackSeconds = streamSlackSeconds;
+	options.ramFraction = streamRamFraction;
+
+	StreamBufferPlan plan = PlanStreamBuffers(frameBytes, frameRate, encodeLatencyMs, streamResources.availableRam, streamResources.numCameras, options);
+	PrintStreamBufferPlan(serialNumber, plan, frameBytes, frameRate, encodeLatencyMs);
+	return plan;
 }
 
 
@@ -1515,6 +2545,7 @@ void* AcquireImages(void* arg)
 #endif
 	int err = 0;
 	int result = 0;
+	SetThreadLogLevel(grabThreadLogLevel);
 
 	try
 	{
@@ -1531,7 +2562,16 @@ void* AcquireImages(void* arg)
 			serialNumber = ptrStringSerial->GetValue();
 		}
 
-		cout << endl << "[" << serialNumber << "] " << "*** IMAGE ACQUISITION THREAD STARTING" << " ***" << endl << endl;
+		CAPTURE_LOG(Log_Info) << endl << "[" << serialNumber << "] " << "*** IMAGE ACQUISITION THREAD STARTING" << " ***" << endl;
+
+		// Reports the camera to the start barrier as failed on any return
+		// before it is armed
+		StartBarrierGuard armState(startBarrier, serialNumber);
+
+		// Pin before Init() and the buffer allocations, so the driver's stream
+		// buffers and the frame pools are first touched on the camera's node
+		if (threadPlacement != NULL)
+			threadPlacement->ApplyToGrabThread(serialNumber);
 
 		bool is_primary = (serialNumber == serialNumberPrimary);
 
@@ -1540,29 +2580,46 @@ void* AcquireImages(void* arg)
 
 		// ===========================================================================================================
 		// Initialize camera
+		BringUpTimer bringUpTimer;
 		pCam->Init();
+		bringUpTimer.Mark(BringUp_Init);
+
+		// Prepare: look up every node the configuration below writes, once
+		CameraNodes nodes;
+		const int numMissingNodes = nodes.Resolve(pCam->GetNodeMap(), pCam->GetTLStreamNodeMap(), grabPixelFormatName, GetBufferHandlingName(chosenBufferType));
+		nodes.diffOnly = diffApplyConfig;
+		if (numMissingNodes > 0)
+			CAPTURE_LOG(Log_Info) << "[" << serialNumber << "] " << numMissingNodes << " configuration nodes not present on this camera";
+		bringUpTimer.Mark(BringUp_Prepare);
 
 		// Configure chuck data setting
-		err = ConfigureChunkData(pCam->GetNodeMap());
+		err = ConfigureChunkData(nodes);
 		// pCam->TimestampReset();
 		if (err < 0) return err;
+		bringUpTimer.Mark(BringUp_Chunk);
 
-		// Configure Buffer
-		err = ConfigureBuffer(pCam->GetTLStreamNodeMap());
+		// Configure custom image settings: pixel format, ROI, binning and frame
+		// rate from the camera's profile. Everything below sizes itself from
+		// the resulting geometry.
+		CaptureGeometry geometry;
+		err = ConfigureCustomImageSettings(nodes, FindCaptureProfile(captureProfiles, serialNumber), geometry);
 		if (err < 0) return err;
+		bringUpTimer.Mark(BringUp_Image);
 
-		// Change Camera settings
-		pCam->AcquisitionFrameRateEnable = true;
-		pCam->AcquisitionFrameRate = selectFrameRate;
+		// Configure Buffer
+		StreamBufferPlan bufferPlan = PlanStreamBufferCount(serialNumber, geometry.width, geometry.height, static_cast<float>(geometry.frameRate));
+		err = ConfigureBuffer(nodes, bufferPlan.driverBuffers);
+		if (err < 0) return err;
+		bringUpTimer.Mark(BringUp_Buffers);
 
 		// ===========================================================================================================
 		// Configure trigger
 
-		err = ConfigureTrigger(pCam->GetNodeMap(), is_primary);
+		err = ConfigureTrigger(nodes, is_primary);
 		if (err < 0) return err;
 
 #ifdef _DEBUG
-		cout << endl << endl << "*** DEBUG ***" << endl << endl;
+		CAPTURE_LOG(Log_Info) << endl << endl << "*** DEBUG ***" << endl;
 
 		// If using a GEV camera and debugging, should disable heartbeat first to prevent further issues
 		if (DisableHeartbeat(pCam, pCam->GetNodeMap(), pCam->GetTLDeviceNodeMap()) != 0)
@@ -1574,15 +2631,15 @@ void* AcquireImages(void* arg)
 #endif
 		}
 
-		cout << endl << endl << "*** END OF DEBUG ***" << endl << endl;
+		CAPTURE_LOG(Log_Info) << endl << endl << "*** END OF DEBUG ***" << endl;
 #endif
 
 		// ===========================================================================================================
 		// Set acquisition mode to continuous
-		CEnumerationPtr ptrAcquisitionMode = pCam->GetNodeMap().GetNode("AcquisitionMode");
+		CEnumerationPtr ptrAcquisitionMode = nodes.acquisitionMode;
 		if (!IsAvailable(ptrAcquisitionMode) || !IsWritable(ptrAcquisitionMode))
 		{
-			cout << "Unable to set acquisition mode to continuous (node retrieval; camera " << serialNumber << "). Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to set acquisition mode to continuous (node retrieval; camera " << serialNumber << "). Aborting..." << endl;
 #if defined (_WIN32)
 			return 0;
 #else
@@ -1590,10 +2647,10 @@ void* AcquireImages(void* arg)
 #endif
 		}
 
-		CEnumEntryPtr ptrAcquisitionModeContinuous = ptrAcquisitionMode->GetEntryByName("Continuous");
+		CEnumEntryPtr ptrAcquisitionModeContinuous = nodes.acquisitionModeContinuous;
 		if (!IsAvailable(ptrAcquisitionModeContinuous) || !IsReadable(ptrAcquisitionModeContinuous))
 		{
-			cout << "Unable to set acquisition mode to continuous (entry 'continuous' retrieval " << serialNumber << "). Aborting..." << endl << endl;
+			CAPTURE_LOG(Log_Error) << "Unable to set acquisition mode to continuous (entry 'continuous' retrieval " << serialNumber << "). Aborting..." << endl;
 #if defined (_WIN32)
 			return 0;
 #else
@@ -1601,151 +2658,125 @@ void* AcquireImages(void* arg)
 #endif
 		}
 
-		int64_t acquisitionModeContinuous = ptrAcquisitionModeContinuous->GetValue();
-		ptrAcquisitionMode->SetIntValue(acquisitionModeContinuous);
+		nodes.SetEnum(ptrAcquisitionMode, ptrAcquisitionModeContinuous, "AcquisitionMode");
 
-		cout << "[" << serialNumber << "] " << "Acquisition mode set to continuous..." << endl;
+		CAPTURE_LOG(Log_Info) << "[" << serialNumber << "] " << "Acquisition mode set to continuous...";
+		UpdateConfigSnapshot(nodes, serialNumber);
+		bringUpTimer.Mark(BringUp_Trigger);
 
 		//
 		int camId = 0;
 		for (int idx = 0; idx < k_numCameras; ++idx) {
 			if (serialNumber == serialNumbers[idx]) camId = idx;
 		}
-		string outputFolder = outputFolders[camId] + "\\" + subfolderName + "\\";
+		string outputFolder = cameraOutputFolders[camId] + "\\" + subfolderName + "\\";
 
 		if (CreateDirectoryA(outputFolder.c_str(), NULL) ||
 			ERROR_ALREADY_EXISTS == GetLastError())
-			cout << "[" << serialNumber << "] " << "Output at path: " << outputFolder << endl;
+			CAPTURE_LOG(Log_Info) << "[" << serialNumber << "] " << "Output at path: " << outputFolder;
 
 		//=================================================================================
-		// Init and open Video
-		SpinVideo video;
-		result = ConfigureVideoAndOpen(video, pCam->GetNodeMap(), nodeMapTLDevice, outputFolder);
+		// Init and open Video, or the folder for per-frame JPEGs
+		SegmentedVideo video;
+		string jpegFolder;
+		if (chosenRecordType == RECORD_JPEG)
+			result = CreateJpegFolder(outputFolder, serialNumber, jpegFolder);
+		else if (chosenRecordType == RECORD_VIDEO)
+			result = ConfigureVideoAndOpen(video, pCam->GetNodeMap(), nodeMapTLDevice, outputFolder);
+		if (result < 0)
+		{
+			CAPTURE_LOG(Log_Error) << "[" << serialNumber << "] " << "Unable to open the output in " << outputFolder << ", not starting acquisition";
+#if defined (_WIN32)
+			return 0;
+#else
+			return (void*)0;
+#endif
+		}
 
 		//=================================================================================
-		// Open log file
-		ofstream logFile;
-		logFile.open(outputFolder + "Log" + serialNumber + ".txt");
+		// Open chunk log
+		ChunkLogWriter chunkLog;
+		if (chunkLog.Open(outputFolder + "Log" + serialNumber + ".bin", serialNumber) < 0)
+			CAPTURE_LOG(Log_Warning) << "[" << serialNumber << "] " << "Unable to create chunk log in " << outputFolder;
 
 
 		//=================================================================================
-		// Configure custom image settings
-		err = ConfigureCustomImageSettings(pCam->GetNodeMap());
-		if (err < 0) return err;
+		// Save the colour processing state needed to develop raw frames offline,
+		// and load it back for the host colour engine
+		string colorStateFilename = outputFolder + "ColorState" + serialNumber + ".txt";
+		WriteColorState(pCam->GetNodeMap(), colorStateFilename);
+
+		ColorParams colorParams;
+		LoadColorState(colorStateFilename, colorParams);
 
 
 		//=================================================================================
 		// Begin acquiring images
-		pCam->BeginAcquisition();
+		bringUpTimer.Mark(BringUp_Outputs);
+		SpinnakerFrameSource source(pCam, serialNumber);
+		source.BeginAcquisition();
+		bringUpTimer.Mark(BringUp_Begin);
 
-		cout << "[" << serialNumber << "] " << "Started acquiring images..." << endl;
+		CAPTURE_LOG(Log_Info) << "[" << serialNumber << "] " << "Started acquiring images...";
+		if (bringUpReport != NULL)
+			bringUpReport->Add(serialNumber, bringUpTimer);
+
+		// Acquisition runs and the trigger is configured: this camera catches
+		// the first trigger pulse from now on
+		armState.Arm();
 
 		//==================================================================================
-		// Trigger the primary camera
+		// Trigger the primary camera once every camera is armed
 		if (is_primary) {
-			cout << "Press Enter to start Capture. Wait about 1-2 Second to make sure  that all configurations are finished" << endl;
-			cin.get();
+			const bool allArmed = startBarrier == NULL || startBarrier->WaitForAll(k_armTimeoutMs);
+			if (chosenStartMode == START_ON_ENTER || !allArmed)
+			{
+				CAPTURE_LOG(Log_Info) << (allArmed ? "Press Enter to start Capture" : "Press Enter to start Capture without the cameras that are not armed");
+				GetCaptureLog().Flush();
+				cin.get();
+			}
 
-			CEnumerationPtr ptrTriggerMode = pCam->GetNodeMap().GetNode("TriggerMode");
+			CEnumerationPtr ptrTriggerMode = nodes.triggerMode;
 			if (!IsAvailable(ptrTriggerMode) || !IsReadable(ptrTriggerMode))
 			{
-				cout << "Unable to disable trigger mode (node retrieval). Aborting..." << endl;
+				CAPTURE_LOG(Log_Error) << "Unable to disable trigger mode (node retrieval). Aborting...";
 				return -1;
 			}
 
-			CEnumEntryPtr ptrTriggerModeOff = ptrTriggerMode->GetEntryByName("Off");
+			CEnumEntryPtr ptrTriggerModeOff = nodes.triggerModeOff;
 			if (!IsAvailable(ptrTriggerModeOff) || !IsReadable(ptrTriggerModeOff))
 			{
-				cout << "Unable to disable trigger mode (enum entry retrieval). Aborting..." << endl;
+				CAPTURE_LOG(Log_Error) << "Unable to disable trigger mode (enum entry retrieval). Aborting...";
 				return -1;
 			}
 
 			ptrTriggerMode->SetIntValue(ptrTriggerModeOff->GetValue());
 
-			cout << "Trigger mode disabled... And Start Capture" << endl;
+			CAPTURE_LOG(Log_Info) << "Trigger mode disabled... And Start Capture";
 		}
 
 
 		//==================================================================================
 		// Retrieve, convert, and save images for each camera
-
-		cout << endl;
-
-		for (unsigned int imageCnt = 0; imageCnt < k_numImages; imageCnt++)
-		{
-			try
-			{
-				// Retrieve next received image and ensure image completion
-				ImagePtr pResultImage = pCam->GetNextImage();
-
-				if (pResultImage->IsIncomplete())
-				{
-					cout << "[" << serialNumber << "] " << "Image incomplete with image status " << pResultImage->GetImageStatus() << "..." << endl << endl;
-				}
-				else
-				{
-					// ImagePtr convertedImage = pResultImage->Convert(savePixelFormat, interpolationAlgo);
-					ImagePtr convertedImage = pResultImage;
-
-					//=============================
-					// Save to an image file
-					
-					/*
-					// Create a unique filename
-					string filename = outputFolder;
-
-					if (serialNumber != "") {
-					filename += serialNumber.c_str();
-					}
-
-					char buffer[256]; sprintf(buffer, "%06d", imageCnt);
-					string img_id(buffer);
-					filename +=  "/img_" +  img_id +  ".jpg";
-					
-					// Save image
-					convertedImage->Save(filename.c_str());
-					*/
-					// Append image to video
-					video.Append(convertedImage);
-
-					result = DisplayChunkData(pResultImage, logFile, imageCnt);
-
-					// Print image information
-					if ((imageCnt + 1) % k_numPrintInfo == 0)
-						cout << "[" << serialNumber << "] " << "Grabbed image " << imageCnt << ", width = " << pResultImage->GetWidth() << ", height = " << pResultImage->GetHeight() << endl; //". Image saved at " << filename.str() << endl;
-
-
-				}
-
-
-			}
-			catch (Spinnaker::Exception &e)
-			{
-				// End acquisition
-				pCam->EndAcquisition();
-				// Deinitialize camera
-				pCam->DeInit();
-
-				video.Close();
-				logFile.close();
-
-				cout << "[" << serialNumber << "] " << "Error: " << e.what() << endl;
-			}
-
-			if (!is_running) break;
-		}
+		CaptureReport report;
+		RunCaptureLoop(source, bufferPlan, video, jpegFolder, chunkLog, k_numImages, colorParams, report);
 
 		// End acquisition
-		pCam->EndAcquisition();
+		source.EndAcquisition();
 		
-		err = DisableChunkData(pCam->GetNodeMap());
-		if (err < 0) return err;
+		// Chunk data stays on for the next session when settings are diff-applied
+		if (!diffApplyConfig)
+		{
+			err = DisableChunkData(nodes);
+			if (err < 0) return err;
+		}
 
 		// Deinitialize camera
 		pCam->DeInit();
 
-		video.Close();
-		logFile.close();
+		if (chosenRecordType == RECORD_VIDEO)
+			video.Close();
+		chunkLog.Close();
 
 
 
@@ -1757,7 +2788,7 @@ void* AcquireImages(void* arg)
 	}
 	catch (Spinnaker::Exception &e)
 	{
-		cout << "Error: " << e.what() << endl;
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
 #if defined (_WIN32)
 		return 0;
 #else
@@ -1767,6 +2798,145 @@ void* AcquireImages(void* arg)
 }
 
 
+// This function estimates the disk write rate of one camera stream with the
+// selected capture and record settings
+double EstimateStreamBytesPerSecond(unsigned int width, unsigned int height, float frameRate)
+{
+	const bool rawFrames = chosenCaptureMode == RAW_BAYER && !hostColorProcessing;
+	double bytesPerSecond = static_cast<double>(width) * height * (rawFrames ? 1 : 3) * frameRate;
+
+#if defined(USE_TURBOJPEG)
+	const bool containerJpeg = !rawFrames && !losslessContainer;
+#else
+	const bool containerJpeg = false;
+#endif
+
+	if (chosenRecordType == RECORD_JPEG || (chosenRecordType == RECORD_CONTAINER && containerJpeg) ||
+		(chosenRecordType == RECORD_VIDEO && chosenVideoType == MJPG))
+		bytesPerSecond *= storageCompressionRatio;
+	else if (chosenRecordType == RECORD_VIDEO && (chosenVideoType == H264 || chosenVideoType == SOFTWARE_H264))
+		bytesPerSecond *= storageCompressionRatio / 5;
+	else if (chosenRecordType == RECORD_CONTAINER && losslessContainer)
+		bytesPerSecond *= losslessCompressionRatio;
+
+	return bytesPerSecond;
+}
+
+
+// This function picks an output folder (one of outputFolders) for every
+// stream. preferredVolumes gives each stream's usual entry in outputFolders,
+// which is kept unless that volume is too slow or too full for the capture.
+int PlanStorage(const vector<string> & streamNames, const vector<int> & preferredVolumes, const vector<double> & bytesPerSecond,
+	double durationSeconds, vector<string> & assignedFolders)
+{
+	assignedFolders.resize(streamNames.size());
+	for (size_t i = 0; i < streamNames.size(); i++)
+		assignedFolders[i] = outputFolders[preferredVolumes[i]];
+
+	if (!scheduleStorage)
+		return 0;
+
+	CAPTURE_LOG(Log_Info) << endl << "*** MEASURING OUTPUT VOLUMES ***" << endl;
+
+	StorageScheduler scheduler(vector<string>(outputFolders, outputFolders + k_numCameras));
+	scheduler.Probe(static_cast<uint64_t>(k_storageProbeMB) << 20);
+
+	vector<StorageStream> streams(streamNames.size());
+	for (size_t i = 0; i < streams.size(); i++)
+	{
+		streams[i].name = streamNames[i];
+		streams[i].bytesPerSecond = bytesPerSecond[i];
+		streams[i].preferredVolume = preferredVolumes[i];
+	}
+
+	int result = scheduler.Assign(streams, durationSeconds, storageHeadroom);
+	scheduler.PrintReport(streams, durationSeconds);
+	if (result < 0)
+		CAPTURE_LOG(Log_Warning) << "[storage] Warning: the output volumes cannot sustain all streams, expect dropped frames";
+
+	for (size_t i = 0; i < streams.size(); i++)
+	{
+		if (streams[i].volume >= 0)
+			assignedFolders[i] = outputFolders[streams[i].volume];
+	}
+
+	return result;
+}
+
+
+// This function records which folder each camera was written to, since it
+// may differ from outputFolders
+void WriteStorageLayout(const string & filename, const vector<string> & streamNames, const vector<string> & folders)
+{
+	ofstream layoutFile(filename.c_str());
+	if (!layoutFile.is_open())
+	{
+		CAPTURE_LOG(Log_Warning) << "Unable to write storage layout to " << filename;
+		return;
+	}
+
+	for (size_t i = 0; i < streamNames.size(); i++)
+		layoutFile << streamNames[i] << " " << folders[i] << "\n";
+}
+
+
+// This function plans the cores of the capture threads from the CPU topology
+// and threadPlacementName, prints the plan and pins the shared encoder
+// workers. The grab and writer threads pin themselves through
+// threadPlacement.
+void SetupThreadPlacement(ThreadPlacementPlan & plan, const vector<string> & streamNames, ColorEngine & engine, JpegEncoderPool & encoderPool)
+{
+	if (plan.Load(threadPlacementName) < 0)
+		CAPTURE_LOG(Log_Info) << "No " << threadPlacementName << ", placing threads automatically";
+
+	plan.Plan(GetCpuTopology(), streamNames);
+	plan.Print();
+
+	if (!engine.SetWorkerAffinity(plan.GetEncoderCpus()) || !encoderPool.SetWorkerAffinity(plan.GetEncoderCpus()))
+		CAPTURE_LOG(Log_Warning) << "[placement] Encoder workers could not be pinned to CPU " << FormatCpuList(plan.GetEncoderCpus());
+
+	threadPlacement = &plan;
+}
+
+
+// This function loads the software encoder settings and shares the encoder
+// core budget between the cameras by pixel rate (width x height x fps).
+// Returns -1 if the budget does not cover one thread per camera.
+int PlanEncoders(const vector<string> & streamNames, const vector<double> & pixelRates)
+{
+	vector<EncoderSettings> table;
+	if (LoadEncoderSettings(encoderSettingsName, table) < 0)
+		CAPTURE_LOG(Log_Info) << "No " << encoderSettingsName << ", encoding with the default preset";
+
+	encoderSettings.clear();
+	for (size_t i = 0; i < streamNames.size(); i++)
+	{
+		EncoderSettings settings = FindEncoderSettings(table, streamNames[i]);
+		settings.serialNumber = streamNames[i];
+		encoderSettings.push_back(settings);
+	}
+	if (PlanEncoderThreads(k_encoderCoreBudget, pixelRates, encoderSettings) < 0)
+	{
+		CAPTURE_LOG(Log_Error) << "[encoder] Core budget of " << k_encoderCoreBudget << " threads is below one per camera ("
+			<< streamNames.size() << "); raise k_encoderCoreBudget or record fewer cameras with SOFTWARE_H264";
+		return -1;
+	}
+
+	for (size_t i = 0; i < encoderSettings.size(); i++)
+	{
+		const EncoderSettings & settings = encoderSettings[i];
+		ostringstream rate;
+		if (settings.bitrateKbps > 0)
+			rate << settings.bitrateKbps << " kbps";
+		else
+			rate << "CRF " << settings.crf;
+		CAPTURE_LOG(Log_Info) << "[encoder] " << settings.serialNumber << ": " << settings.preset << ", " << rate.str() << ", "
+			<< settings.threads << (settings.slicedThreads ? " slice" : " frame") << " threads of " << k_encoderCoreBudget;
+	}
+	return 0;
+}
+
+
 // This function acts as the body of the example
 int RunMultipleCameras(CameraList camList)
 {
@@ -1781,6 +2951,104 @@ int RunMultipleCameras(CameraList camList)
 		// Create an array of CameraPtrs. This array maintenances smart pointer's reference
 		// count when CameraPtr is passed into grab thread as void pointer
 
+		// Per-camera ROI and frame rate; the primary's rate is the rate of the rig
+		if (LoadCaptureProfiles(captureProfilesName, captureProfiles) < 0)
+			CAPTURE_LOG(Log_Info) << "No " << captureProfilesName << ", capturing full frame at " << selectFrameRate << " fps";
+
+		const CaptureProfile primaryProfile = FindCaptureProfile(captureProfiles, serialNumberPrimary);
+		const float rigFrameRate = static_cast<float>(primaryProfile.frameRate > 0 ? primaryProfile.frameRate : selectFrameRate);
+		captureFrameRate = rigFrameRate;
+
+		// Place each camera on an output volume that can take its stream
+		vector<string> cameraSerials(serialNumbers, serialNumbers + k_numCameras);
+		vector<int> preferredVolumes;
+		vector<double> streamBytesPerSecond;
+		vector<double> pixelRates;
+		for (int i = 0; i < k_numCameras; i++)
+		{
+			preferredVolumes.push_back(i);
+
+			// Cropped or binned cameras write less; "max" is the full sensor
+			const CaptureProfile profile = FindCaptureProfile(captureProfiles, serialNumbers[i]);
+			const unsigned int binning = static_cast<unsigned int>(profile.binning * profile.decimation);
+			const unsigned int width = profile.width > 0 ? static_cast<unsigned int>(profile.width) : imageWidth / binning;
+			const unsigned int height = profile.height > 0 ? static_cast<unsigned int>(profile.height) : imageHeight / binning;
+			streamBytesPerSecond.push_back(EstimateStreamBytesPerSecond(width, height, rigFrameRate));
+			pixelRates.push_back(static_cast<double>(width) * height * (profile.frameRate > 0 ? profile.frameRate : rigFrameRate));
+		}
+		if (chosenRecordType == RECORD_VIDEO && chosenVideoType == SOFTWARE_H264 && PlanEncoders(cameraSerials, pixelRates) < 0)
+			return -1;
+
+		BringUpReport bringUp(camListSize);
+		BringUpTimer::Clock::time_point hostPhaseStart = BringUpTimer::Clock::now();
+
+		vector<string> assignedFolders;
+		PlanStorage(cameraSerials, preferredVolumes, streamBytesPerSecond, static_cast<double>(k_numImages) / rigFrameRate, assignedFolders);
+		bringUp.AddHostPhase("storage", hostPhaseStart);
+		for (int i = 0; i < k_numCameras; i++)
+		{
+			cameraOutputFolders[i] = assignedFolders[i];
+		}
+
+		// Assemble synchronized frame sets across all cameras while capturing
+		string syncFolder = outputFolders[0] + "\\" + subfolderName + "\\";
+		CreateDirectoryA(syncFolder.c_str(), NULL);
+		WriteStorageLayout(syncFolder + storageLayoutName, cameraSerials, assignedFolders);
+
+		CaptureStatsRegistry statsRegistry;
+		statsRegistry.Start(syncFolder + statsFileName, k_statsIntervalMs);
+		captureStats = &statsRegistry;
+
+		FrameSetAssembler assembler(cameraSerials, rigFrameRate, syncSkewToleranceUs, syncMaxWaitMs);
+		if (assembler.Open(syncFolder + syncIndexName) < 0)
+			CAPTURE_LOG(Log_Warning) << "Unable to create frame-set index in " << syncFolder;
+		frameSetAssembler = &assembler;
+
+		ColorEngine engine(chosenCaptureMode == RAW_BAYER && hostColorProcessing ? k_colorEngineThreads : 1);
+		if (chosenCaptureMode == RAW_BAYER && hostColorProcessing)
+			colorEngine = &engine;
+
+		JpegEncoderPool encoderPool(chosenRecordType == RECORD_JPEG ? k_jpegEncoderThreads : 0, k_jpegQueueDepth, k_jpegQuality);
+		if (chosenRecordType == RECORD_JPEG)
+			jpegEncoderPool = &encoderPool;
+
+		ColorThreadPool losslessWorkers(chosenRecordType == RECORD_CONTAINER && losslessContainer ? k_losslessThreads : 0);
+		if (chosenRecordType == RECORD_CONTAINER && losslessContainer)
+			losslessPool = &losslessWorkers;
+
+		ThreadPlacementPlan placement;
+		if (placeThreads)
+		{
+			SetupThreadPlacement(placement, cameraSerials, engine, encoderPool);
+			losslessWorkers.SetWorkerAffinity(placement.GetEncoderCpus());
+		}
+
+		FrameContainerWriter container;
+		if (chosenRecordType == RECORD_CONTAINER)
+		{
+			if (container.Open(syncFolder + containerName, cameraSerials, rigFrameRate) < 0)
+				CAPTURE_LOG(Log_Warning) << "Unable to create recording container in " << syncFolder;
+			else
+				frameContainer = &container;
+		}
+
+		PreviewPublisher preview(cameraSerials, k_previewEveryN, k_previewMaxWidth, k_previewMaxHeight, previewCpuBudget);
+		if (livePreview)
+		{
+			if (placeThreads)
+				preview.SetWorkerCpus(placement.GetEncoderCpus());
+			if (preview.Open(previewRegionName) == 0)
+				previewPublisher = &preview;
+		}
+
+		hostPhaseStart = BringUpTimer::Clock::now();
+		MeasureStreamResources(camListSize, syncFolder);
+		bringUp.AddHostPhase("stream resources", hostPhaseStart);
+		bringUpReport = &bringUp;
+
+		StartBarrier barrier(camListSize);
+		startBarrier = &barrier;
+
 		// Create an array of handles
 		CameraPtr* pCamList = new CameraPtr[camListSize];
 #if defined(_WIN32)
@@ -1820,12 +3088,12 @@ int RunMultipleCameras(CameraList camList)
 			BOOL rc = GetExitCodeThread(grabThreads[i], &exitcode);
 			if (!rc)
 			{
-				cout << "Handle error from GetExitCodeThread() returned for camera at index " << i << endl;
+				CAPTURE_LOG(Log_Error) << "Handle error from GetExitCodeThread() returned for camera at index " << i;
 			}
 			else if (!exitcode)
 			{
-				cout << "Grab thread for camera at index " << i << " exited with errors."
-					"Please check onscreen print outs for error details" << endl;
+				CAPTURE_LOG(Log_Error) << "Grab thread for camera at index " << i << " exited with errors."
+					"Please check onscreen print outs for error details";
 			}
 		}
 
@@ -1837,12 +3105,12 @@ int RunMultipleCameras(CameraList camList)
 			int rc = pthread_join(grabThreads[i], &exitcode);
 			if (rc != 0)
 			{
-				cout << "Handle error from pthread_join returned for camera at index " << i << endl;
+				CAPTURE_LOG(Log_Error) << "Handle error from pthread_join returned for camera at index " << i;
 			}
 			else if ((int)(intptr_t)exitcode == 0)// check thread return code for each camera
 			{
-				cout << "Grab thread for camera at index " << i << " exited with errors."
-					"Please check onscreen print outs for error details" << endl;
+				CAPTURE_LOG(Log_Error) << "Grab thread for camera at index " << i << " exited with errors."
+					"Please check onscreen print outs for error details";
 			}
 		}
 #endif
@@ -1861,10 +3129,27 @@ int RunMultipleCameras(CameraList camList)
 
 		// Delete array pointer
 		delete[] grabThreads;
+
+		startBarrier = NULL;
+		bringUpReport = NULL;
+		threadPlacement = NULL;
+		previewPublisher = NULL;
+		preview.Close();
+		frameContainer = NULL;
+		container.Close();
+		losslessPool = NULL;
+		jpegEncoderPool = NULL;
+		encoderPool.Close();
+		colorEngine = NULL;
+		frameSetAssembler = NULL;
+		assembler.Close();
+		captureStats = NULL;
+		statsRegistry.Stop();
+		statsRegistry.PrintSummary();
 	}
 	catch (Spinnaker::Exception &e)
 	{
-		cout << "Error: " << e.what() << endl;
+		CAPTURE_LOG(Log_Error) << "Error: " << e.what();
 		result = -1;
 	}
 
@@ -1872,25 +3157,303 @@ int RunMultipleCameras(CameraList camList)
 }
 
 
+// This struct is design for run the thread function AcquireSyntheticImages
+struct SyntheticCaptureParam {
+	SyntheticFrameSource* source;
+	string outputFolder;
+	unsigned int numImages;
+	CaptureReport report;
+
+	SyntheticCaptureParam() : source(NULL), numImages(0) {}
+};
+
+
+// This function runs the capture pipeline on a synthetic camera: the same
+// grab loop, writer thread, video encoder and chunk log as AcquireImages.
+#if defined (_WIN32)
+DWORD WINAPI AcquireSyntheticImages(LPVOID lpParam)
+{
+	SyntheticCaptureParam* pParam = (SyntheticCaptureParam*)lpParam;
+#else
+void* AcquireSyntheticImages(void* arg)
+{
+	SyntheticCaptureParam* pParam = (SyntheticCaptureParam*)arg;
+#endif
+	SyntheticFrameSource & source = *pParam->source;
+	string serialNumber = source.GetSerialNumber();
+	int result = 0;
+	SetThreadLogLevel(grabThreadLogLevel);
+
+	if (threadPlacement != NULL)
+		threadPlacement->ApplyToGrabThread(serialNumber);
+
+	try
+	{
+		SegmentedVideo video;
+		string jpegFolder;
+		if (chosenRecordType == RECORD_JPEG)
+			result = CreateJpegFolder(pParam->outputFolder, serialNumber, jpegFolder);
+		else if (chosenRecordType == RECORD_VIDEO)
+			result = OpenVideo(video, serialNumber, source.GetFrameRate(), pParam->outputFolder, source.GetWidth(), source.GetHeight());
+
+		ChunkLogWriter chunkLog;
+		if (chunkLog.Open(pParam->outputFolder + "Log" + serialNumber + ".bin", serialNumber) < 0)
+			CAPTURE_LOG(Log_Warning) << "[" << serialNumber << "] " << "Unable to create chunk log in " << pParam->outputFolder;
+
+		if (result == 0)
+		{
+			source.BeginAcquisition();
+			StreamBufferPlan bufferPlan = PlanStreamBufferCount(serialNumber, source.GetWidth(), source.GetHeight(), source.GetFrameRate());
+			result = RunCaptureLoop(source, bufferPlan, video, jpegFolder, chunkLog, pParam->numImages, ColorParams(), pParam->report);
+			source.EndAcquisition();
+		}
+
+		if (chosenRecordType == RECORD_VIDEO)
+			video.Close();
+		chunkLog.Close();
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		CAPTURE_LOG(Log_Error) << "[" << serialNumber << "] " << "Error: " << e.what();
+		result = -1;
+	}
+
+#if defined (_WIN32)
+	return result == 0 ? 1 : 0;
+#else
+	return (void*)(intptr_t)(result == 0 ? 1 : 0);
+#endif
+}
+
+
+// This function drives N synthetic cameras through the full capture pipeline
+// and reports sustained frame rate, grab-to-disk latency and dropped frames,
+// to measure the host's headroom without cameras attached.
+int RunSyntheticBenchmark(unsigned int numCameras, float frameRate, unsigned int numImages)
+{
+	if (numCameras == 0 || frameRate <= 0)
+	{
+		CAPTURE_LOG(Log_Info) << "Benchmark needs at least one camera and a positive frame rate";
+		return -1;
+	}
+
+	CAPTURE_LOG(Log_Info) << endl << "*** SYNTHETIC BENCHMARK: " << numCameras << " cameras, " << frameRate << " fps, "
+		<< numImages << " images ***" << endl;
+
+	SyntheticFrameSource** sources = new SyntheticFrameSource*[numCameras];
+	SyntheticCaptureParam* params = new SyntheticCaptureParam[numCameras];
+#if defined(_WIN32)
+	HANDLE* grabThreads = new HANDLE[numCameras];
+#else
+	pthread_t* grabThreads = new pthread_t[numCameras];
+#endif
+
+	// Spread the simulated cameras over the same drives as the real ones
+	vector<string> syntheticSerials;
+	vector<int> preferredVolumes;
+	vector<double> streamBytesPerSecond;
+	for (unsigned int i = 0; i < numCameras; i++)
+	{
+		char buffer[32]; sprintf(buffer, "SIM%02u", i);
+		syntheticSerials.push_back(buffer);
+		preferredVolumes.push_back(i % k_numCameras);
+		streamBytesPerSecond.push_back(EstimateStreamBytesPerSecond(imageWidth, imageHeight, frameRate));
+	}
+
+	vector<string> assignedFolders;
+	PlanStorage(syntheticSerials, preferredVolumes, streamBytesPerSecond, numImages / frameRate, assignedFolders);
+
+	if (chosenRecordType == RECORD_VIDEO && chosenVideoType == SOFTWARE_H264 &&
+		PlanEncoders(syntheticSerials, vector<double>(numCameras, static_cast<double>(imageWidth) * imageHeight * frameRate)) < 0)
+	{
+		delete[] sources;
+		delete[] params;
+		delete[] grabThreads;
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < numCameras; i++)
+	{
+
+		SyntheticCameraOptions options;
+		options.serialNumber = syntheticSerials[i];
+		options.width = imageWidth;
+		options.height = imageHeight;
+		options.pixelFormat = (grabPixelFormatName == "BGR8") ? PixelFormat_BGR8 : PixelFormat_BayerBG8;
+		options.frameRate = frameRate;
+
+		sources[i] = new SyntheticFrameSource(options);
+
+		params[i].source = sources[i];
+		params[i].numImages = numImages;
+		params[i].outputFolder = assignedFolders[i] + "\\" + benchmarkSubfolderName + "\\";
+		CreateDirectoryA(params[i].outputFolder.c_str(), NULL);
+	}
+
+	CaptureStatsRegistry statsRegistry;
+	statsRegistry.Start(params[0].outputFolder + statsFileName, k_statsIntervalMs);
+	captureStats = &statsRegistry;
+	captureFrameRate = frameRate;
+
+	FrameSetAssembler assembler(syntheticSerials, frameRate, syncSkewToleranceUs, syncMaxWaitMs);
+	if (assembler.Open(params[0].outputFolder + syncIndexName) < 0)
+		CAPTURE_LOG(Log_Warning) << "Unable to create frame-set index in " << params[0].outputFolder;
+	frameSetAssembler = &assembler;
+
+	ColorEngine engine(chosenCaptureMode == RAW_BAYER && hostColorProcessing ? k_colorEngineThreads : 1);
+	if (chosenCaptureMode == RAW_BAYER && hostColorProcessing)
+		colorEngine = &engine;
+
+	JpegEncoderPool encoderPool(chosenRecordType == RECORD_JPEG ? k_jpegEncoderThreads : 0, k_jpegQueueDepth, k_jpegQuality);
+	if (chosenRecordType == RECORD_JPEG)
+		jpegEncoderPool = &encoderPool;
+
+	ColorThreadPool losslessWorkers(chosenRecordType == RECORD_CONTAINER && losslessContainer ? k_losslessThreads : 0);
+	if (chosenRecordType == RECORD_CONTAINER && losslessContainer)
+		losslessPool = &losslessWorkers;
+
+	ThreadPlacementPlan placement;
+	if (placeThreads)
+	{
+		SetupThreadPlacement(placement, syntheticSerials, engine, encoderPool);
+		losslessWorkers.SetWorkerAffinity(placement.GetEncoderCpus());
+	}
+
+	FrameContainerWriter container;
+	if (chosenRecordType == RECORD_CONTAINER)
+	{
+		if (container.Open(params[0].outputFolder + containerName, syntheticSerials, frameRate) < 0)
+			CAPTURE_LOG(Log_Warning) << "Unable to create recording container in " << params[0].outputFolder;
+		else
+			frameContainer = &container;
+	}
+
+	PreviewPublisher preview(syntheticSerials, k_previewEveryN, k_previewMaxWidth, k_previewMaxHeight, previewCpuBudget);
+	if (livePreview)
+	{
+		if (placeThreads)
+			preview.SetWorkerCpus(placement.GetEncoderCpus());
+		if (preview.Open(previewRegionName) == 0)
+			previewPublisher = &preview;
+	}
+
+	MeasureStreamResources(numCameras, params[0].outputFolder);
+
+	for (unsigned int i = 0; i < numCameras; i++)
+	{
+#if defined(_WIN32)
+		grabThreads[i] = CreateThread(NULL, 0, AcquireSyntheticImages, &params[i], 0, NULL);
+		assert(grabThreads[i] != NULL);
+#else
+		int err = pthread_create(&(grabThreads[i]), NULL, &AcquireSyntheticImages, &params[i]);
+		assert(err == 0);
+#endif
+	}
+
+#if defined(_WIN32)
+	WaitForMultipleObjects(numCameras, grabThreads, TRUE, INFINITE);
+	for (unsigned int i = 0; i < numCameras; i++)
+	{
+		CloseHandle(grabThreads[i]);
+	}
+#else
+	for (unsigned int i = 0; i < numCameras; i++)
+	{
+		pthread_join(grabThreads[i], NULL);
+	}
+#endif
+
+	threadPlacement = NULL;
+	previewPublisher = NULL;
+	preview.Close();
+	frameContainer = NULL;
+	container.Close();
+	losslessPool = NULL;
+	jpegEncoderPool = NULL;
+	encoderPool.Close();
+	colorEngine = NULL;
+	frameSetAssembler = NULL;
+	captureStats = NULL;
+	statsRegistry.Stop();
+
+	//==================================================================================
+	// Report
+	CAPTURE_LOG(Log_Info) << endl << "*** BENCHMARK RESULTS ***" << endl;
+
+	assembler.Close();
+	statsRegistry.PrintSummary();
+
+	uint64_t totalWritten = 0;
+	uint64_t totalDropped = 0;
+	uint64_t totalMissing = 0;
+	double totalFps = 0.0;
+	vector<float> latencies;
+
+	for (unsigned int i = 0; i < numCameras; i++)
+	{
+		const CaptureReport & report = params[i].report;
+		PrintCaptureReport(report);
+
+		totalWritten += report.numWritten;
+		totalDropped += report.numDropped;
+		totalMissing += report.numFrameIdGaps;
+		if (report.elapsedSeconds > 0)
+			totalFps += report.numWritten / report.elapsedSeconds;
+		latencies.insert(latencies.end(), report.latenciesUs.begin(), report.latenciesUs.end());
+	}
+
+	sort(latencies.begin(), latencies.end());
+
+	CAPTURE_LOG(Log_Info) << endl << "Sustained: " << totalFps << " fps written over " << numCameras << " cameras (target "
+		<< frameRate * numCameras << " fps)";
+	CAPTURE_LOG(Log_Info) << "Frames written: " << totalWritten << ", dropped in queue: " << totalDropped
+		<< ", missed by grab threads: " << totalMissing;
+	CAPTURE_LOG(Log_Info) << "Grab-to-disk latency (ms): p50 " << Percentile(latencies, 0.5) / 1000
+		<< ", p90 " << Percentile(latencies, 0.9) / 1000
+		<< ", p99 " << Percentile(latencies, 0.99) / 1000
+		<< ", max " << Percentile(latencies, 1.0) / 1000 << endl;
+
+	for (unsigned int i = 0; i < numCameras; i++)
+	{
+		delete sources[i];
+	}
+	delete[] sources;
+	delete[] params;
+	delete[] grabThreads;
+
+	return (totalDropped == 0 && totalMissing == 0) ? 0 : 1;
+}
+
+
 // Example entry point; please see Enumeration example for more in-depth 
 // comments on preparing and cleaning up the system.
-int main(int /*argc*/, char** /*argv*/)
+//
+// Usage:
+//   AcquisitionMultipleThread                          capture from the configured cameras
+//   AcquisitionMultipleThread --benchmark [N] [fps] [images]
+//                                                      run N synthetic cameras (default 6 at
+//                                                      selectFrameRate) through the pipeline
+int main(int argc, char** argv)
 {
+	// Console output of all threads goes through the log thread
+	GetCaptureLog().Start();
+
 	// Since this application saves images in the current folder
 	// we must ensure that we have permission to write to this folder.
 	// If we do not have permission, fail right away.
 
 	if (!SetConsoleCtrlHandler(CtrlCHandler, TRUE))
 	{
-		cout << "Cannot set the ctrl+c handler" << endl;
+		CAPTURE_LOG(Log_Error) << "Cannot set the ctrl+c handler";
 		return 1;
 	}
 
 	FILE *tempFile = fopen("test.txt", "w+");
 	if (tempFile == NULL)
 	{
-		cout << "Failed to create file in current folder.  Please check permissions." << endl;
-		cout << "Press Enter to exit..." << endl;
+		CAPTURE_LOG(Log_Error) << "Failed to create file in current folder.  Please check permissions.";
+		CAPTURE_LOG(Log_Info) << "Press Enter to exit...";
+		GetCaptureLog().Flush();
 		getchar();
 		return -1;
 	}
@@ -1901,25 +3464,39 @@ int main(int /*argc*/, char** /*argv*/)
 	int result = 0;
 
 	// Print application build information
-	cout << "Application build date: " << __DATE__ << " " << __TIME__ << endl << endl;
+	CAPTURE_LOG(Log_Info) << "Application build date: " << __DATE__ << " " << __TIME__ << endl;
 
 	// Retrieve singleton reference to system object
 	SystemPtr system = System::GetInstance();
 
 	// Print out current library version
 	const LibraryVersion spinnakerLibraryVersion = system->GetLibraryVersion();
-	cout << "Spinnaker library version: "
+	CAPTURE_LOG(Log_Info) << "Spinnaker library version: "
 		<< spinnakerLibraryVersion.major << "."
 		<< spinnakerLibraryVersion.minor << "."
 		<< spinnakerLibraryVersion.type << "."
-		<< spinnakerLibraryVersion.build << endl << endl;
+		<< spinnakerLibraryVersion.build << endl;
+
+	// Benchmark the capture pipeline with synthetic cameras
+	if (argc > 1 && string(argv[1]) == "--benchmark")
+	{
+		unsigned int numSynthetic = argc > 2 ? static_cast<unsigned int>(atoi(argv[2])) : k_numCameras;
+		float frameRate = argc > 3 ? static_cast<float>(atof(argv[3])) : static_cast<float>(selectFrameRate);
+		unsigned int numImages = argc > 4 ? static_cast<unsigned int>(atoi(argv[4])) : k_benchmarkNumImages;
+
+		result = RunSyntheticBenchmark(numSynthetic, frameRate, numImages);
+
+		system->ReleaseInstance();
+
+		return result;
+	}
 
 	// Retrieve list of cameras from the system
 	CameraList camList = system->GetCameras();
 
 	unsigned int numCameras = camList.GetSize();
 
-	cout << "Number of cameras detected: " << numCameras << endl << endl;
+	CAPTURE_LOG(Log_Info) << "Number of cameras detected: " << numCameras << endl;
 
 	// Finish if there are no cameras
 	if (numCameras < k_numCameras)
@@ -1930,19 +3507,20 @@ int main(int /*argc*/, char** /*argv*/)
 		// Release system
 		system->ReleaseInstance();
 
-		cout << "Not enough cameras!" << endl;
-		cout << "Done! Press Enter to exit..." << endl;
+		CAPTURE_LOG(Log_Info) << "Not enough cameras!";
+		CAPTURE_LOG(Log_Info) << "Done! Press Enter to exit...";
+		GetCaptureLog().Flush();
 		getchar();
 
 		return -1;
 	}
 
 	// Run example on all cameras
-	cout << endl << "Running example for all cameras..." << endl;
+	CAPTURE_LOG(Log_Info) << endl << "Running example for all cameras...";
 
 	result = RunMultipleCameras(camList);
 
-	cout << "Example complete..." << endl << endl;
+	CAPTURE_LOG(Log_Info) << "Example complete..." << endl;
 
 	// Clear camera list before releasing system
 	camList.Clear();
@@ -1950,7 +3528,8 @@ int main(int /*argc*/, char** /*argv*/)
 	// Release system
 	system->ReleaseInstance();
 
-	cout << endl << "Done! Press Enter to exit..." << endl;
+	CAPTURE_LOG(Log_Info) << endl << "Done! Press Enter to exit...";
+	GetCaptureLog().Flush();
 	getchar();
 
 	return result;
@@ -0,0 +1,360 @@
+//=============================================================================
+// CameraBringUp.h
+//
+// Camera bring-up in two phases. CameraNodes::Resolve() is the prepare phase:
+// right after Init() it looks up every node and enumeration entry the
+// configuration touches, once, by name. The Configure functions are the
+// apply phase and only write through the cached handles, so no step repeats
+// a string-keyed GetNode() lookup (the chunk loop used to do one per chunk
+// type). With diffOnly set, a camera setting is only written if the camera
+// does not hold it already; every setting is recorded in a ConfigSnapshot.
+//
+// BringUpTimer measures each phase on a camera's thread; BringUpReport
+// collects the timings of all cameras, which configure concurrently, and
+// prints one table once the last camera is up.
+//=============================================================================
+
+#ifndef CAMERA_BRING_UP_H
+#define CAMERA_BRING_UP_H
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+#include "CaptureLog.h"
+#include "ConfigSnapshot.h"
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+enum BringUpPhase
+{
+	BringUp_Init, // Init(): opens the device and loads the nodemap
+	BringUp_Prepare, // node handles resolved
+	BringUp_Chunk,
+	BringUp_Image, // pixel format, ROI, frame rate, colour
+	BringUp_Buffers,
+	BringUp_Trigger,
+	BringUp_Outputs, // video, chunk log, colour state
+	BringUp_Begin, // BeginAcquisition()
+	k_numBringUpPhases
+};
+
+inline const char* GetBringUpPhaseName(int phase)
+{
+	static const char* names[k_numBringUpPhases] = { "init", "prepare", "chunk", "image", "buffers", "trigger", "outputs", "begin" };
+	return phase >= 0 && phase < k_numBringUpPhases ? names[phase] : "unknown";
+}
+
+
+// Handles of one camera's configuration nodes. A handle whose node the
+// camera does not have stays NULL; the Configure functions report that with
+// the same checks as before, so a missing node fails the same way.
+struct CameraNodes {
+	Spinnaker::GenApi::INodeMap* nodeMap;
+	Spinnaker::GenApi::INodeMap* streamNodeMap;
+
+	// Chunk data
+	Spinnaker::GenApi::CBooleanPtr chunkModeActive;
+	Spinnaker::GenApi::CEnumerationPtr chunkSelector;
+	Spinnaker::GenApi::CBooleanPtr chunkEnable;
+	std::vector<Spinnaker::GenApi::CEnumEntryPtr> chunkEntries; // available and readable ones
+
+	// Trigger
+	Spinnaker::GenApi::CEnumerationPtr triggerMode;
+	Spinnaker::GenApi::CEnumEntryPtr triggerModeOff;
+	Spinnaker::GenApi::CEnumEntryPtr triggerModeOn;
+	Spinnaker::GenApi::CEnumerationPtr triggerSource;
+	Spinnaker::GenApi::CEnumEntryPtr triggerSourceSoftware;
+	Spinnaker::GenApi::CEnumEntryPtr triggerSourceLine3;
+	Spinnaker::GenApi::CEnumerationPtr triggerOverlap;
+	Spinnaker::GenApi::CEnumEntryPtr triggerOverlapReadOut;
+	Spinnaker::GenApi::CEnumerationPtr lineSelector;
+	Spinnaker::GenApi::CEnumEntryPtr lineSelectorLine2;
+
+	// Image and colour
+	Spinnaker::GenApi::CEnumerationPtr pixelFormat;
+	Spinnaker::GenApi::CEnumEntryPtr pixelFormatGrab;
+	Spinnaker::GenApi::CEnumerationPtr balanceWhiteAuto;
+	Spinnaker::GenApi::CEnumEntryPtr balanceWhiteAutoOff;
+	Spinnaker::GenApi::CBooleanPtr ispEnable;
+	Spinnaker::GenApi::CBooleanPtr colorTransformationEnable;
+	Spinnaker::GenApi::CEnumerationPtr rgbTransformLightSource;
+	Spinnaker::GenApi::CEnumEntryPtr rgbTransformLightSourceCool;
+	Spinnaker::GenApi::CEnumerationPtr acquisitionMode;
+	Spinnaker::GenApi::CEnumEntryPtr acquisitionModeContinuous;
+
+	// Region of interest; binning and decimation are optional
+	Spinnaker::GenApi::CIntegerPtr width;
+	Spinnaker::GenApi::CIntegerPtr height;
+	Spinnaker::GenApi::CIntegerPtr offsetX;
+	Spinnaker::GenApi::CIntegerPtr offsetY;
+	Spinnaker::GenApi::CIntegerPtr binningHorizontal;
+	Spinnaker::GenApi::CIntegerPtr binningVertical;
+	Spinnaker::GenApi::CIntegerPtr decimationHorizontal;
+	Spinnaker::GenApi::CIntegerPtr decimationVertical;
+
+	// Stream
+	Spinnaker::GenApi::CEnumerationPtr bufferHandlingMode;
+	Spinnaker::GenApi::CEnumEntryPtr bufferHandlingModeChosen;
+	Spinnaker::GenApi::CEnumerationPtr bufferCountMode;
+	Spinnaker::GenApi::CEnumEntryPtr bufferCountModeManual;
+	Spinnaker::GenApi::CIntegerPtr bufferCountManual;
+
+	// User sets
+	Spinnaker::GenApi::CEnumerationPtr userSetSelector;
+	Spinnaker::GenApi::CEnumEntryPtr userSetSelectorUser1;
+	Spinnaker::GenApi::CCommandPtr userSetSave;
+	Spinnaker::GenApi::CEnumerationPtr userSetDefault; // UserSetDefaultSelector on older models
+	Spinnaker::GenApi::CEnumEntryPtr userSetDefaultUser1;
+
+	// Settings applied through SetEnum/SetBool/SetInt, written or not
+	ConfigSnapshot applied;
+	bool diffOnly;
+	unsigned int numWritten;
+	unsigned int numUnchanged;
+
+	CameraNodes() : nodeMap(NULL), streamNodeMap(NULL), diffOnly(false), numWritten(0), numUnchanged(0) {}
+
+	// This function resolves all handles. pixelFormatName and
+	// bufferHandlingName are the entries the configuration selects. Returns
+	// the number of nodes the camera does not have.
+	int Resolve(Spinnaker::GenApi::INodeMap & deviceNodeMap, Spinnaker::GenApi::INodeMap & tlStreamNodeMap,
+		const Spinnaker::GenICam::gcstring & pixelFormatName, const Spinnaker::GenICam::gcstring & bufferHandlingName)
+	{
+		nodeMap = &deviceNodeMap;
+		streamNodeMap = &tlStreamNodeMap;
+		int numMissing = 0;
+
+		chunkModeActive = Node(deviceNodeMap, "ChunkModeActive", numMissing);
+		chunkSelector = Node(deviceNodeMap, "ChunkSelector", numMissing);
+		chunkEnable = Node(deviceNodeMap, "ChunkEnable", numMissing);
+		chunkEntries.clear();
+		if (Spinnaker::GenApi::IsAvailable(chunkSelector) && Spinnaker::GenApi::IsReadable(chunkSelector))
+		{
+			Spinnaker::GenApi::NodeList_t entries;
+			chunkSelector->GetEntries(entries);
+			for (size_t i = 0; i < entries.size(); i++)
+			{
+				Spinnaker::GenApi::CEnumEntryPtr ptrEntry = entries.at(i);
+				if (Spinnaker::GenApi::IsAvailable(ptrEntry) && Spinnaker::GenApi::IsReadable(ptrEntry))
+					chunkEntries.push_back(ptrEntry);
+			}
+		}
+
+		triggerMode = Node(deviceNodeMap, "TriggerMode", numMissing);
+		triggerModeOff = Entry(triggerMode, "Off");
+		triggerModeOn = Entry(triggerMode, "On");
+		triggerSource = Node(deviceNodeMap, "TriggerSource", numMissing);
+		triggerSourceSoftware = Entry(triggerSource, "Software");
+		triggerSourceLine3 = Entry(triggerSource, "Line3");
+		triggerOverlap = Node(deviceNodeMap, "TriggerOverlap", numMissing);
+		triggerOverlapReadOut = Entry(triggerOverlap, "ReadOut");
+		lineSelector = Node(deviceNodeMap, "LineSelector", numMissing);
+		lineSelectorLine2 = Entry(lineSelector, "Line2");
+
+		pixelFormat = Node(deviceNodeMap, "PixelFormat", numMissing);
+		pixelFormatGrab = Entry(pixelFormat, pixelFormatName);
+		balanceWhiteAuto = Node(deviceNodeMap, "BalanceWhiteAuto", numMissing);
+		balanceWhiteAutoOff = Entry(balanceWhiteAuto, "Off");
+		ispEnable = Node(deviceNodeMap, "IspEnable", numMissing);
+		colorTransformationEnable = Node(deviceNodeMap, "ColorTransformationEnable", numMissing);
+		rgbTransformLightSource = Node(deviceNodeMap, "RgbTransformLightSource", numMissing);
+		rgbTransformLightSourceCool = Entry(rgbTransformLightSource, "CoolFluorescent4000K");
+		acquisitionMode = Node(deviceNodeMap, "AcquisitionMode", numMissing);
+		acquisitionModeContinuous = Entry(acquisitionMode, "Continuous");
+
+		width = Node(deviceNodeMap, "Width", numMissing);
+		height = Node(deviceNodeMap, "Height", numMissing);
+		offsetX = Node(deviceNodeMap, "OffsetX", numMissing);
+		offsetY = Node(deviceNodeMap, "OffsetY", numMissing);
+		binningHorizontal = deviceNodeMap.GetNode("BinningHorizontal");
+		binningVertical = deviceNodeMap.GetNode("BinningVertical");
+		decimationHorizontal = deviceNodeMap.GetNode("DecimationHorizontal");
+		decimationVertical = deviceNodeMap.GetNode("DecimationVertical");
+
+		bufferHandlingMode = Node(tlStreamNodeMap, "StreamBufferHandlingMode", numMissing);
+		bufferHandlingModeChosen = Entry(bufferHandlingMode, bufferHandlingName);
+		bufferCountMode = Node(tlStreamNodeMap, "StreamBufferCountMode", numMissing);
+		bufferCountModeManual = Entry(bufferCountMode, "Manual");
+		bufferCountManual = Node(tlStreamNodeMap, "StreamBufferCountManual", numMissing);
+
+		userSetSelector = Node(deviceNodeMap, "UserSetSelector", numMissing);
+		userSetSelectorUser1 = Entry(userSetSelector, "UserSet1");
+		userSetSave = Node(deviceNodeMap, "UserSetSave", numMissing);
+		userSetDefault = deviceNodeMap.GetNode("UserSetDefault");
+		if (!Spinnaker::GenApi::IsAvailable(userSetDefault))
+			userSetDefault = Node(deviceNodeMap, "UserSetDefaultSelector", numMissing);
+		userSetDefaultUser1 = Entry(userSetDefault, "UserSet1");
+
+		return numMissing;
+	}
+
+	// True if the enumeration is readable and set to entry
+	bool Holds(const Spinnaker::GenApi::CEnumerationPtr & node, const Spinnaker::GenApi::CEnumEntryPtr & entry) const
+	{
+		return Spinnaker::GenApi::IsAvailable(node) && Spinnaker::GenApi::IsReadable(node) &&
+			Spinnaker::GenApi::IsAvailable(entry) && node->GetIntValue() == entry->GetValue();
+	}
+
+	// These functions write a setting and record it as name. The node must
+	// be writable. With diffOnly a node that already holds the value is not
+	// written; a write can make the camera re-validate dependent features.
+	void SetEnum(const Spinnaker::GenApi::CEnumerationPtr & node, const Spinnaker::GenApi::CEnumEntryPtr & entry, const std::string & name)
+	{
+		if (diffOnly && Holds(node, entry))
+			numUnchanged++;
+		else
+		{
+			node->SetIntValue(entry->GetValue());
+			numWritten++;
+		}
+		applied.Set(name, entry->GetSymbolic().c_str());
+	}
+
+	void SetBool(const Spinnaker::GenApi::CBooleanPtr & node, bool value, const std::string & name)
+	{
+		if (diffOnly && Spinnaker::GenApi::IsReadable(node) && node->GetValue() == value)
+			numUnchanged++;
+		else
+		{
+			node->SetValue(value);
+			numWritten++;
+		}
+		applied.Set(name, value ? "1" : "0");
+	}
+
+	void SetInt(const Spinnaker::GenApi::CIntegerPtr & node, int64_t value, const std::string & name)
+	{
+		if (diffOnly && Spinnaker::GenApi::IsReadable(node) && node->GetValue() == value)
+			numUnchanged++;
+		else
+		{
+			node->SetValue(value);
+			numWritten++;
+		}
+		applied.Set(name, value);
+	}
+
+private:
+	static Spinnaker::GenApi::INode* Node(Spinnaker::GenApi::INodeMap & map, const char* name, int & numMissing)
+	{
+		Spinnaker::GenApi::INode* pNode = map.GetNode(name);
+		if (!Spinnaker::GenApi::IsAvailable(pNode))
+			numMissing++;
+		return pNode;
+	}
+
+	static Spinnaker::GenApi::CEnumEntryPtr Entry(const Spinnaker::GenApi::CEnumerationPtr & ptrEnumeration, const Spinnaker::GenICam::gcstring & name)
+	{
+		if (!Spinnaker::GenApi::IsAvailable(ptrEnumeration))
+			return Spinnaker::GenApi::CEnumEntryPtr();
+		return ptrEnumeration->GetEntryByName(name);
+	}
+};
+
+
+// Phase durations of one camera's bring-up
+class BringUpTimer
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	BringUpTimer() : m_start(Clock::now()), m_last(m_start)
+	{
+		for (int i = 0; i < k_numBringUpPhases; i++)
+			m_phaseMs[i] = 0;
+	}
+
+	// Ends a phase; its time is everything since the previous Mark()
+	void Mark(BringUpPhase phase)
+	{
+		const Clock::time_point now = Clock::now();
+		m_phaseMs[phase] += std::chrono::duration<double, std::milli>(now - m_last).count();
+		m_last = now;
+	}
+
+	double GetPhaseMs(int phase) const { return m_phaseMs[phase]; }
+	double GetTotalMs() const { return std::chrono::duration<double, std::milli>(m_last - m_start).count(); }
+
+private:
+	Clock::time_point m_start;
+	Clock::time_point m_last;
+	double m_phaseMs[k_numBringUpPhases];
+};
+
+
+// Bring-up timings of all cameras. Threadsafe.
+class BringUpReport
+{
+public:
+	explicit BringUpReport(unsigned int numCameras) : m_numCameras(numCameras), m_start(BringUpTimer::Clock::now()), m_printed(false) {}
+
+	// Cameras that failed during bring-up never Add(); show the rest
+	~BringUpReport()
+	{
+		if (!m_printed && !m_cameras.empty())
+			Print();
+	}
+
+	// Host-side setup before the camera threads start, e.g. storage probing,
+	// from start until now
+	void AddHostPhase(const std::string & name, BringUpTimer::Clock::time_point start)
+	{
+		const double ms = std::chrono::duration<double, std::milli>(BringUpTimer::Clock::now() - start).count();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_hostPhases.push_back(std::make_pair(name, ms));
+	}
+
+	// Records a camera that finished bring-up; the table is printed when
+	// the last one does
+	void Add(const std::string & serialNumber, const BringUpTimer & timer)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cameras.push_back(std::make_pair(serialNumber, timer));
+		if (m_cameras.size() == m_numCameras)
+			Print();
+	}
+
+private:
+	void Print()
+	{
+		std::ostringstream table;
+		table << std::fixed << std::setprecision(0);
+		table << "[bring-up] " << m_cameras.size() << " cameras up after "
+			<< std::chrono::duration<double, std::milli>(BringUpTimer::Clock::now() - m_start).count() << " ms";
+		for (size_t i = 0; i < m_hostPhases.size(); i++)
+			table << (i == 0 ? "; host: " : ", ") << m_hostPhases[i].first << " " << m_hostPhases[i].second << " ms";
+
+		table << "\n[bring-up] " << std::setw(10) << "camera";
+		for (int phase = 0; phase < k_numBringUpPhases; phase++)
+			table << std::setw(9) << GetBringUpPhaseName(phase);
+		table << std::setw(9) << "total";
+
+		size_t slowest = 0;
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			const BringUpTimer & timer = m_cameras[i].second;
+			table << "\n[bring-up] " << std::setw(10) << m_cameras[i].first;
+			for (int phase = 0; phase < k_numBringUpPhases; phase++)
+				table << std::setw(9) << timer.GetPhaseMs(phase);
+			table << std::setw(9) << timer.GetTotalMs();
+			if (timer.GetTotalMs() > m_cameras[slowest].second.GetTotalMs())
+				slowest = i;
+		}
+		table << "\n[bring-up] times in ms, slowest camera " << m_cameras[slowest].first;
+		CAPTURE_LOG(Log_Info) << table.str();
+		m_printed = true;
+	}
+
+	unsigned int m_numCameras;
+	BringUpTimer::Clock::time_point m_start;
+	bool m_printed;
+
+	std::mutex m_mutex;
+	std::vector<std::pair<std::string, double> > m_hostPhases;
+	std::vector<std::pair<std::string, BringUpTimer> > m_cameras;
+};
+
+#endif // CAMERA_BRING_UP_H
@@ -0,0 +1,357 @@
+//=============================================================================
+// CaptureLog.h
+//
+// Asynchronous console log for the capture threads. Messages are formatted on
+// the calling thread into a fixed-size slot of a lock-free multi-producer
+// ring and printed by one background drain thread, so a grab thread never
+// waits on the console or on another thread's output, and lines of different
+// cameras never interleave. When the ring is full a message is dropped and
+// counted instead of blocking.
+//
+//   CAPTURE_LOG(Log_Info) << "[" << serial << "] Started acquiring images...";
+//   CAPTURE_LOG_LIMITED(Log_Warning) << "[" << serial << "] Image incomplete";
+//
+// A newline is appended unless the message ends with one. Each thread can
+// raise its own minimum level with SetThreadLogLevel(). CAPTURE_LOG_LIMITED
+// allows k_logBurst messages per call site and thread every
+// k_logRateWindowMs and folds the rest into a "suppressed" count shown with
+// the next message that gets through; counts no message got to report are
+// printed by Stop().
+//
+// Until Start() the log writes synchronously, so tools that share headers
+// with the capture program need no log thread.
+//=============================================================================
+
+#ifndef CAPTURE_LOG_H
+#define CAPTURE_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+
+const size_t k_logRingSlots = 2048; // power of two
+const size_t k_logMaxMessage = 1024; // longer messages are truncated
+const unsigned int k_logDrainIntervalMs = 5;
+const unsigned int k_logBurst = 5;
+const unsigned int k_logRateWindowMs = 1000;
+
+enum LogLevel
+{
+	Log_Debug,
+	Log_Info,
+	Log_Warning,
+	Log_Error
+};
+
+
+class CaptureLog
+{
+public:
+	CaptureLog() : m_running(false), m_stopping(false), m_level(Log_Info), m_enqueuePos(0), m_dequeuePos(0), m_numDropped(0), m_numSuppressed(0)
+	{
+		for (size_t i = 0; i < k_logRingSlots; i++)
+			m_slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	~CaptureLog() { Stop(); }
+
+	void Start()
+	{
+		if (m_running)
+			return;
+		m_stopping = false;
+		m_thread = std::thread(&CaptureLog::DrainLoop, this);
+		m_running = true;
+	}
+
+	// Prints everything still queued and returns to synchronous writes.
+	// Call it once the threads that log have finished.
+	void Stop()
+	{
+		if (!m_running)
+			return;
+		m_stopping = true;
+		m_thread.join();
+		m_running = false;
+
+		// Messages queued while the drain thread was exiting
+		std::string batch;
+		Drain(batch);
+
+		const uint64_t numSuppressed = m_numSuppressed.load(std::memory_order_relaxed);
+		if (numSuppressed > 0)
+		{
+			fprintf(stdout, "[log] %llu similar messages suppressed\n", static_cast<unsigned long long>(numSuppressed));
+			fflush(stdout);
+		}
+	}
+
+	// Blocks until every message queued so far is printed, e.g. before
+	// prompting for input
+	void Flush()
+	{
+		const uint64_t target = m_enqueuePos.load(std::memory_order_acquire);
+		while (m_running && m_dequeuePos.load(std::memory_order_acquire) < target)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	void SetLevel(LogLevel level) { m_level = level; }
+
+	bool IsEnabled(LogLevel level) const
+	{
+		const int threadLevel = ThreadLevel();
+		return level >= (threadLevel >= 0 ? threadLevel : m_level.load(std::memory_order_relaxed));
+	}
+
+	// Queues one message. file/line identify the call site for rate limiting;
+	// NULL writes unconditionally.
+	void Write(LogLevel level, const std::string & message, const char* file = NULL, int line = 0)
+	{
+		std::string text;
+		if (file != NULL)
+		{
+			uint64_t suppressed = 0;
+			if (!PassRateLimit(file, line, suppressed))
+			{
+				m_numSuppressed.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			if (suppressed > 0)
+			{
+				m_numSuppressed.fetch_sub(suppressed, std::memory_order_relaxed);
+				std::ostringstream prefix;
+				prefix << "(" << suppressed << " similar messages suppressed) ";
+				text = prefix.str();
+			}
+		}
+		text += message;
+		if (text.empty() || text[text.size() - 1] != '\n')
+			text += '\n';
+
+		if (!m_running)
+		{
+			fwrite(text.data(), 1, text.size(), stdout);
+			fflush(stdout);
+			return;
+		}
+
+		// Claim a slot (Vyukov's bounded queue); a slot whose sequence lags
+		// the position is still being drained, i.e. the ring is full
+		Slot* slot;
+		uint64_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			slot = &m_slots[pos & (k_logRingSlots - 1)];
+			const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+			const int64_t difference = static_cast<int64_t>(sequence - pos);
+			if (difference == 0)
+			{
+				if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+			{
+				m_numDropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else
+			{
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		slot->level = level;
+		slot->length = text.size() < k_logMaxMessage ? text.size() : k_logMaxMessage;
+		memcpy(slot->text, text.data(), slot->length);
+		if (slot->length < text.size())
+			memcpy(slot->text + k_logMaxMessage - 4, "...\n", 4);
+		slot->sequence.store(pos + 1, std::memory_order_release);
+	}
+
+	uint64_t GetNumDropped() const { return m_numDropped.load(std::memory_order_relaxed); }
+
+	// Minimum level of the calling thread's messages; -1 follows SetLevel()
+	static void SetThreadLevel(int level) { ThreadLevel() = level; }
+
+private:
+	struct Slot {
+		std::atomic<uint64_t> sequence;
+		LogLevel level;
+		size_t length;
+		char text[k_logMaxMessage];
+	};
+
+	struct RateState {
+		std::chrono::steady_clock::time_point windowStart;
+		unsigned int count;
+		uint64_t suppressed;
+
+		RateState() : count(0), suppressed(0) {}
+	};
+
+	CaptureLog(const CaptureLog &);
+	CaptureLog & operator=(const CaptureLog &);
+
+	static int & ThreadLevel()
+	{
+		static thread_local int level = -1;
+		return level;
+	}
+
+	// Rate state is per thread, so no locking and one flooding camera does
+	// not silence the others
+	static bool PassRateLimit(const char* file, int line, uint64_t & suppressed)
+	{
+		static thread_local std::map<std::pair<const char*, int>, RateState> sites;
+		RateState & state = sites[std::make_pair(file, line)];
+
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (state.count == 0 || now - state.windowStart >= std::chrono::milliseconds(k_logRateWindowMs))
+		{
+			state.windowStart = now;
+			state.count = 0;
+		}
+
+		if (state.count >= k_logBurst)
+		{
+			state.suppressed++;
+			return false;
+		}
+
+		state.count++;
+		suppressed = state.suppressed;
+		state.suppressed = 0;
+		return true;
+	}
+
+	// Prints all published messages in one write. Returns their number.
+	size_t Drain(std::string & batch)
+	{
+		batch.clear();
+		size_t numMessages = 0;
+		uint64_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot & slot = m_slots[pos & (k_logRingSlots - 1)];
+			if (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+				break;
+
+			batch.append(slot.text, slot.length);
+			slot.sequence.store(pos + k_logRingSlots, std::memory_order_release);
+			pos++;
+			numMessages++;
+		}
+
+		if (!batch.empty())
+		{
+			fwrite(batch.data(), 1, batch.size(), stdout);
+			fflush(stdout);
+		}
+		m_dequeuePos.store(pos, std::memory_order_release);
+		return numMessages;
+	}
+
+	void DrainLoop()
+	{
+		std::string batch;
+		batch.reserve(k_logRingSlots * 64);
+		uint64_t numDroppedReported = 0;
+
+		while (true)
+		{
+			const bool stopping = m_stopping.load();
+			const size_t numMessages = Drain(batch);
+
+			const uint64_t numDropped = GetNumDropped();
+			if (numDropped != numDroppedReported)
+			{
+				fprintf(stdout, "[log] %llu messages dropped, log ring full\n", static_cast<unsigned long long>(numDropped - numDroppedReported));
+				fflush(stdout);
+				numDroppedReported = numDropped;
+			}
+
+			if (numMessages == 0)
+			{
+				// A claimed slot may not be published yet; wait for it
+				if (stopping && m_dequeuePos.load(std::memory_order_relaxed) == m_enqueuePos.load(std::memory_order_acquire))
+					break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(k_logDrainIntervalMs));
+			}
+		}
+	}
+
+	std::thread m_thread;
+	std::atomic<bool> m_running;
+	std::atomic<bool> m_stopping;
+	std::atomic<int> m_level;
+
+	Slot m_slots[k_logRingSlots];
+	std::atomic<uint64_t> m_enqueuePos;
+	std::atomic<uint64_t> m_dequeuePos;
+	std::atomic<uint64_t> m_numDropped;
+	std::atomic<uint64_t> m_numSuppressed; // not yet shown with a later message
+};
+
+
+// The process-wide log
+inline CaptureLog & GetCaptureLog()
+{
+	static CaptureLog log;
+	return log;
+}
+
+inline void SetThreadLogLevel(LogLevel level) { CaptureLog::SetThreadLevel(level); }
+
+
+// One message, formatted with << and queued when the statement ends
+class LogLine
+{
+public:
+	LogLine(LogLevel level, const char* file = NULL, int line = 0) : m_level(level), m_file(file), m_line(line) {}
+	~LogLine() { GetCaptureLog().Write(m_level, m_stream.str(), m_file, m_line); }
+
+	template <typename T>
+	LogLine & operator<<(const T & value)
+	{
+		m_stream << value;
+		return *this;
+	}
+
+	// std::endl and friends
+	LogLine & operator<<(std::ostream & (*manipulator)(std::ostream &))
+	{
+		m_stream << manipulator;
+		return *this;
+	}
+
+private:
+	LogLine(const LogLine &);
+	LogLine & operator=(const LogLine &);
+
+	LogLevel m_level;
+	const char* m_file;
+	int m_line;
+	std::ostringstream m_stream;
+};
+
+// Turns the message expression into void, so the macros below are one
+// expression and safe inside an unbraced if/else; & binds looser than <<
+struct LogVoidify {
+	void operator&(const LogLine &) {}
+};
+
+// The message is only formatted if the level is enabled
+#define CAPTURE_LOG(level) \
+	!GetCaptureLog().IsEnabled(level) ? (void)0 : LogVoidify() & LogLine(level)
+
+#define CAPTURE_LOG_LIMITED(level) \
+	!GetCaptureLog().IsEnabled(level) ? (void)0 : LogVoidify() & LogLine(level, __FILE__, __LINE__)
+
+#endif // CAPTURE_LOG_H
@@ -0,0 +1,294 @@
+//=============================================================================
+// CaptureProfile.h
+//
+// Per-camera capture geometry: region of interest, binning, decimation and
+// frame rate, read from a text file at startup and applied to the camera's
+// node map after validating every value against the node's limits. Cropping
+// or binning on the sensor cuts the link bandwidth, so a camera that only
+// needs the centre of its view can run at a higher frame rate.
+//
+// File format, one camera per line, '#' starts a comment:
+//
+//   # serial   width  height  offsetX  offsetY  binning  decimation  fps
+//   *          max    max     center   center   1        1           0
+//   18565848   640    512     center   center   1        1           60
+//
+// "*" is the default for cameras without a line of their own. width/height
+// "max" (or 0) use the full sensor after binning and decimation, offsets
+// "center" (or -1) centre the ROI. fps 0 leaves the camera's frame-rate
+// nodes as they are; buffers and storage are then sized for the program's
+// frame rate.
+//=============================================================================
+
+#ifndef CAPTURE_PROFILE_H
+#define CAPTURE_PROFILE_H
+
+#include "Spinnaker.h"
+#include "CaptureLog.h"
+#include "CameraBringUp.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+struct CaptureProfile {
+	std::string serialNumber; // "*" for the default profile
+	int64_t width; // 0: maximum
+	int64_t height;
+	int64_t offsetX; // -1: centred
+	int64_t offsetY;
+	int64_t binning; // applied horizontally and vertically, 1: off
+	int64_t decimation;
+	double frameRate; // 0: the program's frame rate
+
+	CaptureProfile() : serialNumber("*"), width(0), height(0), offsetX(-1), offsetY(-1),
+		binning(1), decimation(1), frameRate(0) {}
+};
+
+
+// What the camera was actually set to after ApplyCaptureProfile
+struct CaptureGeometry {
+	unsigned int width;
+	unsigned int height;
+	unsigned int offsetX;
+	unsigned int offsetY;
+	unsigned int binning;
+	unsigned int decimation;
+	double frameRate;
+
+	CaptureGeometry() : width(0), height(0), offsetX(0), offsetY(0), binning(1), decimation(1), frameRate(0) {}
+};
+
+
+// Parses one column; "max" and "center" map to 0 and -1
+inline bool ParseProfileValue(const std::string & text, int64_t & value)
+{
+	if (text == "max")
+		value = 0;
+	else if (text == "center" || text == "centre")
+		value = -1;
+	else
+	{
+		char* end = NULL;
+		value = strtoll(text.c_str(), &end, 10);
+		if (end == text.c_str() || *end != '\0')
+			return false;
+	}
+	return true;
+}
+
+
+// This function reads all profiles from filename. Malformed lines are
+// reported and skipped. Returns the number of profiles, -1 if the file cannot
+// be opened.
+inline int LoadCaptureProfiles(const std::string & filename, std::vector<CaptureProfile> & profiles)
+{
+	profiles.clear();
+
+	std::ifstream profileFile(filename.c_str());
+	if (!profileFile.is_open())
+		return -1;
+
+	std::string line;
+	for (int lineNumber = 1; std::getline(profileFile, line); lineNumber++)
+	{
+		std::string::size_type comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream columns(line);
+		CaptureProfile profile;
+		if (!(columns >> profile.serialNumber))
+			continue; // blank line
+
+		std::string text[6];
+		int64_t values[6];
+		bool ok = true;
+		for (int i = 0; i < 6 && ok; i++)
+			ok = (columns >> text[i]) && ParseProfileValue(text[i], values[i]);
+
+		double frameRate = 0;
+		if (!ok || !(columns >> frameRate) || values[4] < 1 || values[5] < 1 || frameRate < 0)
+		{
+			CAPTURE_LOG(Log_Warning) << filename << ":" << lineNumber << ": expected serial width height offsetX offsetY binning decimation fps, line ignored";
+			continue;
+		}
+
+		profile.width = values[0];
+		profile.height = values[1];
+		profile.offsetX = values[2];
+		profile.offsetY = values[3];
+		profile.binning = values[4];
+		profile.decimation = values[5];
+		profile.frameRate = frameRate;
+		profiles.push_back(profile);
+	}
+
+	return static_cast<int>(profiles.size());
+}
+
+
+// Returns the profile for serialNumber, the "*" profile, or full frame
+inline CaptureProfile FindCaptureProfile(const std::vector<CaptureProfile> & profiles, const std::string & serialNumber)
+{
+	CaptureProfile result;
+	for (size_t i = 0; i < profiles.size(); i++)
+	{
+		if (profiles[i].serialNumber == serialNumber)
+			return profiles[i];
+		if (profiles[i].serialNumber == "*")
+			result = profiles[i];
+	}
+
+	result.serialNumber = serialNumber;
+	return result;
+}
+
+
+// This function sets an integer node to the valid value closest to value
+// (clamped to its range, rounded down to its increment) through the counted
+// setter, recorded as name. Returns the value set, or -1 if the node is not
+// writable.
+inline int64_t SetIntegerNodeClamped(CameraNodes & nodes, const Spinnaker::GenApi::CIntegerPtr & ptrNode, const char* name, int64_t value)
+{
+	if (!Spinnaker::GenApi::IsAvailable(ptrNode) || !Spinnaker::GenApi::IsWritable(ptrNode))
+		return -1;
+
+	const int64_t minimum = ptrNode->GetMin();
+	const int64_t maximum = ptrNode->GetMax();
+	const int64_t increment = ptrNode->GetInc() > 0 ? ptrNode->GetInc() : 1;
+
+	int64_t valid = value < minimum ? minimum : (value > maximum ? maximum : value);
+	valid = minimum + (valid - minimum) / increment * increment;
+	if (valid != value)
+		CAPTURE_LOG(Log_Warning) << name << " " << value << " is not valid, using " << valid << " (range " << minimum << " to "
+			<< maximum << ", increment " << increment << ")";
+
+	nodes.SetInt(ptrNode, valid, name);
+	return ptrNode->GetValue();
+}
+
+
+// Largest value an integer node accepts right now, -1 if not readable
+inline int64_t GetIntegerNodeMax(const Spinnaker::GenApi::CIntegerPtr & ptrNode)
+{
+	if (!Spinnaker::GenApi::IsAvailable(ptrNode) || !Spinnaker::GenApi::IsReadable(ptrNode))
+		return -1;
+	return ptrNode->GetMax();
+}
+
+
+// Current value of an integer node, 0 if not readable
+inline int64_t GetIntegerNodeValue(const Spinnaker::GenApi::CIntegerPtr & ptrNode)
+{
+	if (!Spinnaker::GenApi::IsAvailable(ptrNode) || !Spinnaker::GenApi::IsReadable(ptrNode))
+		return 0;
+	return ptrNode->GetValue();
+}
+
+
+// This function sets width or height to size, 0 for the full sensor. The
+// offset is only moved to 0 first if the size does not fit beside it.
+inline int64_t SetRoiSize(CameraNodes & nodes, const Spinnaker::GenApi::CIntegerPtr & ptrSize, const char* sizeName,
+	const Spinnaker::GenApi::CIntegerPtr & ptrOffset, const char* offsetName, int64_t size)
+{
+	// The size maximum is what is left of the sensor beside the offset
+	const int64_t offset = GetIntegerNodeValue(ptrOffset);
+	const int64_t target = size > 0 ? size : GetIntegerNodeMax(ptrSize) + offset;
+	if (target > GetIntegerNodeMax(ptrSize) && offset > 0)
+		SetIntegerNodeClamped(nodes, ptrOffset, offsetName, 0);
+	return SetIntegerNodeClamped(nodes, ptrSize, sizeName, target);
+}
+
+
+// Prints the geometry a camera was set to
+inline void LogCaptureGeometry(const CaptureGeometry & geometry)
+{
+	CAPTURE_LOG(Log_Info) << "Capture geometry: " << geometry.width << "x" << geometry.height << " at (" << geometry.offsetX << ", "
+		<< geometry.offsetY << "), binning " << geometry.binning << ", decimation " << geometry.decimation << ", "
+		<< geometry.frameRate << " fps";
+}
+
+
+// This function applies a profile to the camera in the order the limits
+// depend on each other: binning and decimation (they shrink the sensor),
+// width and height, offsets, and last the frame rate, whose maximum depends
+// on the ROI. Every ROI node goes through the counted setters, so a camera
+// that already holds the profile is not written with diffOnly.
+// Without a profile frame rate the frame-rate nodes are not touched and
+// geometry.frameRate is defaultFrameRate. Returns 0 on success, -1 if the ROI
+// could not be set.
+inline int ApplyCaptureProfile(CameraNodes & nodes, const CaptureProfile & profile, double defaultFrameRate,
+	CaptureGeometry & geometry)
+{
+	// Some models expose only one direction as writable; the other follows
+	const int64_t binning = std::max(SetIntegerNodeClamped(nodes, nodes.binningHorizontal, "BinningHorizontal", profile.binning),
+		SetIntegerNodeClamped(nodes, nodes.binningVertical, "BinningVertical", profile.binning));
+	if (binning < 0 && profile.binning > 1)
+		CAPTURE_LOG(Log_Warning) << "Binning not available, capturing without";
+	geometry.binning = static_cast<unsigned int>(binning > 0 ? binning : 1);
+
+	const int64_t decimation = std::max(SetIntegerNodeClamped(nodes, nodes.decimationHorizontal, "DecimationHorizontal", profile.decimation),
+		SetIntegerNodeClamped(nodes, nodes.decimationVertical, "DecimationVertical", profile.decimation));
+	if (decimation < 0 && profile.decimation > 1)
+		CAPTURE_LOG(Log_Warning) << "Decimation not available, capturing without";
+	geometry.decimation = static_cast<unsigned int>(decimation > 0 ? decimation : 1);
+
+	const int64_t width = SetRoiSize(nodes, nodes.width, "Width", nodes.offsetX, "OffsetX", profile.width);
+	const int64_t height = SetRoiSize(nodes, nodes.height, "Height", nodes.offsetY, "OffsetY", profile.height);
+	if (width <= 0 || height <= 0)
+	{
+		CAPTURE_LOG(Log_Warning) << "Width/Height not available...";
+		return -1;
+	}
+
+	// Offset maxima now reflect the remaining room around the ROI
+	int64_t offsetX = profile.offsetX >= 0 ? profile.offsetX : GetIntegerNodeMax(nodes.offsetX) / 2;
+	int64_t offsetY = profile.offsetY >= 0 ? profile.offsetY : GetIntegerNodeMax(nodes.offsetY) / 2;
+	offsetX = SetIntegerNodeClamped(nodes, nodes.offsetX, "OffsetX", offsetX > 0 ? offsetX : 0);
+	offsetY = SetIntegerNodeClamped(nodes, nodes.offsetY, "OffsetY", offsetY > 0 ? offsetY : 0);
+	geometry.width = static_cast<unsigned int>(width);
+	geometry.height = static_cast<unsigned int>(height);
+	geometry.offsetX = static_cast<unsigned int>(offsetX > 0 ? offsetX : 0);
+	geometry.offsetY = static_cast<unsigned int>(offsetY > 0 ? offsetY : 0);
+
+	// Frame rate, only when the profile asks for one; triggered cameras run
+	// at the trigger rate anyway
+	geometry.frameRate = profile.frameRate > 0 ? profile.frameRate : defaultFrameRate;
+	if (profile.frameRate <= 0)
+	{
+		LogCaptureGeometry(geometry);
+		return 0;
+	}
+	const double frameRate = profile.frameRate;
+
+	Spinnaker::GenApi::CBooleanPtr ptrFrameRateEnable = nodes.nodeMap->GetNode("AcquisitionFrameRateEnable");
+	if (Spinnaker::GenApi::IsAvailable(ptrFrameRateEnable) && Spinnaker::GenApi::IsWritable(ptrFrameRateEnable) && !ptrFrameRateEnable->GetValue())
+		ptrFrameRateEnable->SetValue(true);
+
+	Spinnaker::GenApi::CFloatPtr ptrFrameRate = nodes.nodeMap->GetNode("AcquisitionFrameRate");
+	if (Spinnaker::GenApi::IsAvailable(ptrFrameRate) && Spinnaker::GenApi::IsWritable(ptrFrameRate))
+	{
+		const double maximum = ptrFrameRate->GetMax();
+		if (frameRate > maximum)
+			CAPTURE_LOG(Log_Warning) << "Frame rate " << frameRate << " is above the maximum of " << maximum << " for this ROI, using the maximum";
+		const double target = frameRate < maximum ? frameRate : maximum;
+		if (std::fabs(ptrFrameRate->GetValue() - target) > 1e-3)
+			ptrFrameRate->SetValue(target);
+		geometry.frameRate = ptrFrameRate->GetValue();
+	}
+	else
+	{
+		CAPTURE_LOG(Log_Warning) << "Frame rate not writable, camera runs at its own rate";
+	}
+
+	LogCaptureGeometry(geometry);
+	return 0;
+}
+
+#endif // CAPTURE_PROFILE_H
@@ -0,0 +1,336 @@
+//=============================================================================
+// CaptureStats.h
+//
+// Per-stage latency histograms and frame counters of every capture thread,
+// so a session that drops frames shows whether the camera, the encoder or
+// the disk was the bottleneck.
+//
+// Each camera gets a CameraStats with one LatencyHistogram per pipeline
+// stage. A histogram has log-linear buckets (16 per power of two, about 6%
+// resolution from 1 us to hours) of relaxed atomic counters, so recording is
+// a few instructions on the hot path and can be read from another thread.
+// CaptureStatsRegistry rewrites a JSON snapshot of all cameras periodically
+// and prints a summary at shutdown.
+//=============================================================================
+
+#ifndef CAPTURE_STATS_H
+#define CAPTURE_STATS_H
+
+#include "CaptureLog.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+
+// Stages of the capture pipeline, in frame order
+enum CaptureStage
+{
+	Stage_Grab, // blocked in GetNextImage
+	Stage_Copy, // copy out of the camera buffer and queue push
+	Stage_QueueWait, // grabbed until the writer thread popped it
+	Stage_Develop, // host colour processing
+	Stage_Write, // video.Append, container append or JPEG submit
+	Stage_Metadata, // frame-set assembly and chunk log
+	Stage_Total, // grabbed until written
+	k_numCaptureStages
+};
+
+inline const char* GetCaptureStageName(int stage)
+{
+	static const char* names[k_numCaptureStages] = { "grab", "copy", "queue_wait", "develop", "write", "metadata", "total" };
+	return stage >= 0 && stage < k_numCaptureStages ? names[stage] : "unknown";
+}
+
+
+class LatencyHistogram
+{
+public:
+	static const unsigned int k_subBucketBits = 4;
+	static const unsigned int k_subBuckets = 1 << k_subBucketBits;
+	static const unsigned int k_numBuckets = k_subBuckets * 40;
+
+	LatencyHistogram() : m_count(0), m_sumUs(0), m_maxUs(0)
+	{
+		for (unsigned int i = 0; i < k_numBuckets; i++)
+			m_buckets[i].store(0, std::memory_order_relaxed);
+	}
+
+	void Record(uint64_t us)
+	{
+		m_buckets[BucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+		m_count.fetch_add(1, std::memory_order_relaxed);
+		m_sumUs.fetch_add(us, std::memory_order_relaxed);
+
+		uint64_t maxUs = m_maxUs.load(std::memory_order_relaxed);
+		while (us > maxUs && !m_maxUs.compare_exchange_weak(maxUs, us, std::memory_order_relaxed)) {}
+	}
+
+	template <typename Duration>
+	void Record(Duration duration)
+	{
+		const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+		Record(static_cast<uint64_t>(us > 0 ? us : 0));
+	}
+
+	uint64_t GetCount() const { return m_count.load(std::memory_order_relaxed); }
+	uint64_t GetMax() const { return m_maxUs.load(std::memory_order_relaxed); }
+	double GetMean() const
+	{
+		const uint64_t count = GetCount();
+		return count > 0 ? static_cast<double>(m_sumUs.load(std::memory_order_relaxed)) / count : 0.0;
+	}
+	double GetTotalSeconds() const { return m_sumUs.load(std::memory_order_relaxed) / 1e6; }
+
+	// Value at quantile p (0..1), middle of its bucket, in microseconds
+	uint64_t GetPercentile(double p) const
+	{
+		const uint64_t count = GetCount();
+		if (count == 0)
+			return 0;
+
+		const uint64_t rank = static_cast<uint64_t>(p * (count - 1)) + 1;
+		uint64_t seen = 0;
+		for (unsigned int i = 0; i < k_numBuckets; i++)
+		{
+			seen += m_buckets[i].load(std::memory_order_relaxed);
+			if (seen >= rank)
+			{
+				const uint64_t value = BucketLow(i) + (BucketLow(i + 1) - BucketLow(i)) / 2;
+				return value < GetMax() ? value : GetMax();
+			}
+		}
+		return GetMax();
+	}
+
+private:
+	LatencyHistogram(const LatencyHistogram &);
+	LatencyHistogram & operator=(const LatencyHistogram &);
+
+	// Values below k_subBuckets get their own bucket; above, every power of
+	// two is split into k_subBuckets linear buckets.
+	static unsigned int BucketIndex(uint64_t us)
+	{
+		if (us < k_subBuckets)
+			return static_cast<unsigned int>(us);
+
+		unsigned int msb = 0;
+		for (uint64_t v = us; v > 1; v >>= 1)
+			msb++;
+
+		const unsigned int shift = msb - k_subBucketBits;
+		const unsigned int index = (shift + 1) * k_subBuckets + static_cast<unsigned int>((us >> shift) - k_subBuckets);
+		return index < k_numBuckets ? index : k_numBuckets - 1;
+	}
+
+	static uint64_t BucketLow(unsigned int index)
+	{
+		if (index < k_subBuckets)
+			return index;
+
+		const unsigned int shift = index / k_subBuckets - 1;
+		return static_cast<uint64_t>(k_subBuckets + index % k_subBuckets) << shift;
+	}
+
+	std::atomic<uint64_t> m_buckets[k_numBuckets];
+	std::atomic<uint64_t> m_count;
+	std::atomic<uint64_t> m_sumUs;
+	std::atomic<uint64_t> m_maxUs;
+};
+
+
+// Counters and stage histograms of one camera
+struct CameraStats {
+	std::string serialNumber;
+	std::atomic<uint64_t> numGrabbed;
+	std::atomic<uint64_t> numIncomplete;
+	std::atomic<uint64_t> numDropped; // frame queue full
+	std::atomic<uint64_t> numWritten;
+	std::atomic<uint64_t> numDriverDrops; // frame events, see FrameDropDetector
+	std::atomic<uint64_t> numTriggerMisses;
+	std::atomic<uint64_t> numTimingEvents;
+	std::atomic<uint64_t> numFrameAlarms;
+	LatencyHistogram stages[k_numCaptureStages];
+
+	explicit CameraStats(const std::string & _serialNumber) :
+		serialNumber(_serialNumber), numGrabbed(0), numIncomplete(0), numDropped(0), numWritten(0),
+		numDriverDrops(0), numTriggerMisses(0), numTimingEvents(0), numFrameAlarms(0) {}
+
+	// The writer-side stage that took the most time in total, i.e. where a
+	// backlog in the frame queue came from
+	int GetSlowestWriterStage() const
+	{
+		int slowest = Stage_Develop;
+		for (int stage = Stage_Develop; stage <= Stage_Metadata; stage++)
+		{
+			if (stages[stage].GetTotalSeconds() > stages[slowest].GetTotalSeconds())
+				slowest = stage;
+		}
+		return slowest;
+	}
+};
+
+
+class CaptureStatsRegistry
+{
+public:
+	CaptureStatsRegistry() : m_stopping(false), m_start(std::chrono::steady_clock::now()) {}
+	~CaptureStatsRegistry() { Stop(); Clear(); }
+
+	// Returns the stats of a camera, creating them on first use. The pointer
+	// stays valid for the registry's lifetime.
+	CameraStats* Add(const std::string & serialNumber)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			if (m_cameras[i]->serialNumber == serialNumber)
+				return m_cameras[i];
+		}
+		m_cameras.push_back(new CameraStats(serialNumber));
+		return m_cameras.back();
+	}
+
+	// Rewrites filename every intervalMs until Stop(), which writes it a
+	// last time.
+	void Start(const std::string & filename, unsigned int intervalMs)
+	{
+		Stop();
+		m_filename = filename;
+		m_stopping = false;
+		m_thread = std::thread(&CaptureStatsRegistry::DumpLoop, this, intervalMs);
+	}
+
+	void Stop()
+	{
+		if (!m_thread.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		m_thread.join();
+		WriteJson(m_filename);
+	}
+
+	// Writes a snapshot to filename via a temporary file, so a reader never
+	// sees a half-written file. Returns 0 on success.
+	int WriteJson(const std::string & filename)
+	{
+		const std::string tempFilename = filename + ".tmp";
+		FILE* file = fopen(tempFilename.c_str(), "w");
+		if (file == NULL)
+			return -1;
+
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+		fprintf(file, "{\n  \"elapsed_s\": %.3f,\n  \"cameras\": [", elapsed);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t c = 0; c < m_cameras.size(); c++)
+		{
+			const CameraStats & camera = *m_cameras[c];
+			fprintf(file, "%s\n    {\n      \"serial\": \"%s\",\n", c > 0 ? "," : "", camera.serialNumber.c_str());
+			fprintf(file, "      \"grabbed\": %llu, \"incomplete\": %llu, \"dropped\": %llu, \"written\": %llu,\n",
+				static_cast<unsigned long long>(camera.numGrabbed.load()), static_cast<unsigned long long>(camera.numIncomplete.load()),
+				static_cast<unsigned long long>(camera.numDropped.load()), static_cast<unsigned long long>(camera.numWritten.load()));
+			fprintf(file, "      \"driver_drops\": %llu, \"trigger_misses\": %llu, \"timing_events\": %llu, \"frame_alarms\": %llu,\n",
+				static_cast<unsigned long long>(camera.numDriverDrops.load()), static_cast<unsigned long long>(camera.numTriggerMisses.load()),
+				static_cast<unsigned long long>(camera.numTimingEvents.load()), static_cast<unsigned long long>(camera.numFrameAlarms.load()));
+			fprintf(file, "      \"slowest_writer_stage\": \"%s\",\n      \"stages_us\": {", GetCaptureStageName(camera.GetSlowestWriterStage()));
+
+			for (int stage = 0; stage < k_numCaptureStages; stage++)
+			{
+				const LatencyHistogram & histogram = camera.stages[stage];
+				fprintf(file, "%s\n        \"%s\": {\"count\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+					stage > 0 ? "," : "", GetCaptureStageName(stage), static_cast<unsigned long long>(histogram.GetCount()), histogram.GetMean(),
+					static_cast<unsigned long long>(histogram.GetPercentile(0.5)), static_cast<unsigned long long>(histogram.GetPercentile(0.9)),
+					static_cast<unsigned long long>(histogram.GetPercentile(0.99)), static_cast<unsigned long long>(histogram.GetPercentile(0.999)),
+					static_cast<unsigned long long>(histogram.GetMax()));
+			}
+			fprintf(file, "\n      }\n    }");
+		}
+		fprintf(file, "\n  ]\n}\n");
+
+		if (fclose(file) != 0)
+			return -1;
+
+#if defined(_WIN32)
+		return MoveFileExA(tempFilename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+		return rename(tempFilename.c_str(), filename.c_str()) == 0 ? 0 : -1;
+#endif
+	}
+
+	// Prints p50/p99/max of every stage per camera
+	void PrintSummary()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		CAPTURE_LOG(Log_Info) << std::endl << "*** STAGE LATENCIES (ms: p50/p99/max) ***";
+		for (size_t c = 0; c < m_cameras.size(); c++)
+		{
+			const CameraStats & camera = *m_cameras[c];
+			std::ostringstream stages;
+			for (int stage = 0; stage < k_numCaptureStages; stage++)
+			{
+				const LatencyHistogram & histogram = camera.stages[stage];
+				if (histogram.GetCount() == 0)
+					continue;
+				stages << " " << GetCaptureStageName(stage) << " " << histogram.GetPercentile(0.5) / 1000.0 << "/"
+					<< histogram.GetPercentile(0.99) / 1000.0 << "/" << histogram.GetMax() / 1000.0;
+			}
+			CAPTURE_LOG(Log_Info) << "[" << camera.serialNumber << "]" << stages.str();
+			CAPTURE_LOG(Log_Info) << "[" << camera.serialNumber << "] " << camera.numDropped.load() << " dropped in queue, writer time mostly in "
+				<< GetCaptureStageName(camera.GetSlowestWriterStage());
+			if (camera.numFrameAlarms.load() > 0)
+				CAPTURE_LOG(Log_Warning) << "[" << camera.serialNumber << "] " << camera.numFrameAlarms.load() << " frame alarms: " << camera.numIncomplete.load()
+					<< " incomplete, " << camera.numDriverDrops.load() << " driver drop, " << camera.numTriggerMisses.load() << " trigger miss, "
+					<< camera.numTimingEvents.load() << " timing";
+		}
+	}
+
+private:
+	CaptureStatsRegistry(const CaptureStatsRegistry &);
+	CaptureStatsRegistry & operator=(const CaptureStatsRegistry &);
+
+	void DumpLoop(unsigned int intervalMs)
+	{
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				if (m_wake.wait_for(lock, std::chrono::milliseconds(intervalMs), [this] { return m_stopping; }))
+					return;
+			}
+			if (WriteJson(m_filename) < 0)
+				CAPTURE_LOG(Log_Warning) << "[stats] Unable to write " << m_filename;
+		}
+	}
+
+	void Clear()
+	{
+		for (size_t i = 0; i < m_cameras.size(); i++)
+			delete m_cameras[i];
+		m_cameras.clear();
+	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::thread m_thread;
+	bool m_stopping;
+	std::string m_filename;
+	std::chrono::steady_clock::time_point m_start;
+	std::vector<CameraStats*> m_cameras;
+};
+
+#endif // CAPTURE_STATS_H
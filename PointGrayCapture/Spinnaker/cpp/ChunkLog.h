@@ -0,0 +1,219 @@
+//=============================================================================
+// ChunkLog.h
+//
+// Binary per-frame chunk metadata log. A file is a 64-byte ChunkLogHeader
+// followed by fixed-size ChunkLogRecords, one per grabbed frame, written in
+// batches by ChunkLogWriter and loaded in one read by ChunkLogReader.
+// Synchronization/sync_pointgrey.py reads the same layout.
+//=============================================================================
+
+#ifndef CHUNK_LOG_H
+#define CHUNK_LOG_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+const char k_chunkLogMagic[8] = { 'C', 'H', 'U', 'N', 'K', 'L', 'O', 'G' };
+const uint32_t k_chunkLogVersion = 2; // 2: commonTimestamp
+const size_t k_chunkLogBatchRecords = 64; // about 3 s at 20 fps
+const uint32_t k_chunkLogNotRecorded = 0xFFFFFFFF; // captureIndex of a frame that is not in the recording
+
+enum ChunkLogFlags
+{
+	// Image was incomplete and is not in the recording; its captureIndex is
+	// k_chunkLogNotRecorded
+	ChunkLog_Incomplete = 1 << 0,
+	// The frame queue dropped frames right before this one
+	ChunkLog_DroppedBefore = 1 << 1,
+	// Chunk data could not be read; only the indices and host timestamp are valid
+	ChunkLog_NoChunkData = 1 << 2
+};
+
+struct ChunkLogHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t recordSize;
+	uint32_t reserved;
+	char serialNumber[32];
+	uint64_t createdUnixTime;
+};
+
+struct ChunkLogRecord {
+	uint32_t captureIndex; // frame index in the recording, i.e. img_%06d after extraction; k_chunkLogNotRecorded if not recorded
+	uint32_t statusFlags; // ChunkLogFlags
+	int64_t frameID; // camera FrameID chunk
+	uint64_t deviceTimestamp; // camera Timestamp chunk, nanoseconds
+	uint64_t hostTimestamp; // host monotonic clock when the frame was grabbed, nanoseconds
+	double exposureTime; // microseconds
+	double gain; // decibels
+	uint32_t width;
+	uint32_t height;
+	uint32_t offsetX;
+	uint32_t offsetY;
+	uint32_t grabIndex; // grab loop iteration, counts incomplete and dropped frames too
+	int32_t sequencerSetActive;
+	uint64_t commonTimestamp; // deviceTimestamp mapped to the host monotonic clock (see DeviceClock.h), nanoseconds; 0 if unknown
+};
+
+static_assert(sizeof(ChunkLogHeader) == 64, "ChunkLogHeader layout is part of the file format");
+static_assert(sizeof(ChunkLogRecord) == 80, "ChunkLogRecord layout is part of the file format");
+
+
+// Appends records to a chunk log. Records are buffered and written in
+// batches of k_chunkLogBatchRecords, so a frame costs a memcpy rather than a
+// formatted write and a flush.
+class ChunkLogWriter
+{
+public:
+	ChunkLogWriter() : m_file(NULL) {}
+	~ChunkLogWriter() { Close(); }
+
+	// Returns 0 on success, -1 if the file cannot be created.
+	int Open(const std::string & filename, const std::string & serialNumber)
+	{
+		Close();
+
+		m_file = fopen(filename.c_str(), "wb");
+		if (m_file == NULL)
+			return -1;
+
+		ChunkLogHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, k_chunkLogMagic, sizeof(header.magic));
+		header.version = k_chunkLogVersion;
+		header.headerSize = sizeof(ChunkLogHeader);
+		header.recordSize = sizeof(ChunkLogRecord);
+		strncpy(header.serialNumber, serialNumber.c_str(), sizeof(header.serialNumber) - 1);
+		header.createdUnixTime = static_cast<uint64_t>(time(NULL));
+
+		if (fwrite(&header, sizeof(header), 1, m_file) != 1)
+		{
+			Close();
+			return -1;
+		}
+
+		m_batch.reserve(k_chunkLogBatchRecords);
+
+		return 0;
+	}
+
+	int Append(const ChunkLogRecord & record)
+	{
+		if (m_file == NULL)
+			return -1;
+
+		m_batch.push_back(record);
+		if (m_batch.size() >= k_chunkLogBatchRecords)
+			return Flush();
+
+		return 0;
+	}
+
+	int Flush()
+	{
+		if (m_file == NULL)
+			return -1;
+
+		int result = 0;
+		if (!m_batch.empty() && fwrite(&m_batch[0], sizeof(ChunkLogRecord), m_batch.size(), m_file) != m_batch.size())
+			result = -1;
+		m_batch.clear();
+
+		if (fflush(m_file) != 0)
+			result = -1;
+
+		return result;
+	}
+
+	void Close()
+	{
+		if (m_file == NULL)
+			return;
+
+		Flush();
+		fclose(m_file);
+		m_file = NULL;
+	}
+
+	bool IsOpen() const { return m_file != NULL; }
+
+private:
+	ChunkLogWriter(const ChunkLogWriter &);
+	ChunkLogWriter & operator=(const ChunkLogWriter &);
+
+	FILE* m_file;
+	std::vector<ChunkLogRecord> m_batch;
+};
+
+
+// Loads a whole chunk log into memory. Logs written with a different record
+// size are read field-compatibly: shorter records are zero-extended and
+// trailing fields unknown to this version are ignored.
+class ChunkLogReader
+{
+public:
+	// Returns 0 on success, -1 on error (see GetError()).
+	int Open(const std::string & filename)
+	{
+		m_records.clear();
+		m_error.clear();
+
+		FILE* file = fopen(filename.c_str(), "rb");
+		if (file == NULL)
+			return Fail("cannot open " + filename);
+
+		fseek(file, 0, SEEK_END);
+		long fileSize = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		std::vector<char> data(fileSize > 0 ? static_cast<size_t>(fileSize) : 0);
+		size_t numRead = data.empty() ? 0 : fread(&data[0], 1, data.size(), file);
+		fclose(file);
+
+		if (numRead < sizeof(ChunkLogHeader))
+			return Fail("file too short for a chunk log header");
+
+		memcpy(&m_header, &data[0], sizeof(ChunkLogHeader));
+		if (memcmp(m_header.magic, k_chunkLogMagic, sizeof(k_chunkLogMagic)) != 0)
+			return Fail("not a chunk log");
+		if (m_header.headerSize < sizeof(ChunkLogHeader) || m_header.recordSize == 0 || m_header.headerSize > numRead)
+			return Fail("corrupt chunk log header");
+
+		// A partially written last record (e.g. after a crash) is ignored
+		const size_t numRecords = (numRead - m_header.headerSize) / m_header.recordSize;
+		const size_t copySize = m_header.recordSize < sizeof(ChunkLogRecord) ? m_header.recordSize : sizeof(ChunkLogRecord);
+
+		m_records.resize(numRecords);
+		for (size_t i = 0; i < numRecords; i++)
+		{
+			memset(&m_records[i], 0, sizeof(ChunkLogRecord));
+			memcpy(&m_records[i], &data[m_header.headerSize + i * m_header.recordSize], copySize);
+		}
+
+		return 0;
+	}
+
+	const ChunkLogHeader & GetHeader() const { return m_header; }
+	const std::vector<ChunkLogRecord> & GetRecords() const { return m_records; }
+	std::string GetSerialNumber() const { return std::string(m_header.serialNumber, strnlen(m_header.serialNumber, sizeof(m_header.serialNumber))); }
+	const std::string & GetError() const { return m_error; }
+
+private:
+	int Fail(const std::string & error)
+	{
+		m_error = error;
+		m_records.clear();
+		return -1;
+	}
+
+	ChunkLogHeader m_header;
+	std::vector<ChunkLogRecord> m_records;
+	std::string m_error;
+};
+
+#endif // CHUNK_LOG_H
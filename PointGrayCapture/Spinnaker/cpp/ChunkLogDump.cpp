@@ -0,0 +1,92 @@
+//=============================================================================
+// ChunkLogDump.cpp
+//
+// Prints a binary chunk log (Log<serial>.bin) written by
+// AcquisitionMultipleThread as text. Only needs ChunkLog.h, no Spinnaker.
+//
+// Usage:
+//   ChunkLogDump <Log.bin>            one tab-separated line per frame
+//   ChunkLogDump <Log.bin> --legacy   the old 11-line Log<serial>.txt blocks
+//=============================================================================
+
+#include "ChunkLog.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+using namespace std;
+
+
+// This function prints the records as a table with a header line
+void DumpTable(const ChunkLogReader & reader)
+{
+	const ChunkLogHeader & header = reader.GetHeader();
+
+	cout << "# serial " << reader.GetSerialNumber() << ", version " << header.version << ", "
+		<< reader.GetRecords().size() << " records" << endl;
+	cout << "captureIndex\tgrabIndex\tflags\tframeID\tdeviceTimestamp\thostTimestamp\texposureTime\tgain\twidth\theight\toffsetX\toffsetY\tsequencerSetActive\tcommonTimestamp" << endl;
+
+	const vector<ChunkLogRecord> & records = reader.GetRecords();
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const ChunkLogRecord & r = records[i];
+		if (r.captureIndex == k_chunkLogNotRecorded)
+			cout << "-";
+		else
+			cout << r.captureIndex;
+		cout << "\t" << r.grabIndex << "\t" << r.statusFlags << "\t" << r.frameID << "\t"
+			<< r.deviceTimestamp << "\t" << r.hostTimestamp << "\t" << r.exposureTime << "\t" << r.gain << "\t"
+			<< r.width << "\t" << r.height << "\t" << r.offsetX << "\t" << r.offsetY << "\t" << r.sequencerSetActive << "\t" << r.commonTimestamp << "\n";
+	}
+}
+
+
+// This function prints the recorded frames in the text format the capture
+// program used to write, for scripts that still parse Log<serial>.txt
+void DumpLegacy(const ChunkLogReader & reader)
+{
+	const vector<ChunkLogRecord> & records = reader.GetRecords();
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const ChunkLogRecord & r = records[i];
+		if (r.statusFlags & ChunkLog_Incomplete)
+			continue;
+
+		cout << "Frame ID " << r.captureIndex << "\n";
+		cout << "\tExposure time: " << r.exposureTime << "\n";
+		cout << "\tFrame ID: " << r.frameID << "\n";
+		cout << "\tGain: " << r.gain << "\n";
+		cout << "\tHeight: " << r.height << "\n";
+		cout << "\tWidth: " << r.width << "\n";
+		cout << "\tOffset X: " << r.offsetX << "\n";
+		cout << "\tOffset Y: " << r.offsetY << "\n";
+		cout << "\tSequencer set active: " << r.sequencerSetActive << "\n";
+		cout << "\tTimestamp: " << r.deviceTimestamp / 1000000000ULL << "." << setw(9) << setfill('0')
+			<< r.deviceTimestamp % 1000000000ULL << setfill(' ') << "\n";
+		cout << "\n";
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		cout << "Usage: ChunkLogDump <Log.bin> [--legacy]" << endl;
+		return 1;
+	}
+
+	ChunkLogReader reader;
+	if (reader.Open(argv[1]) < 0)
+	{
+		cout << "Error: " << reader.GetError() << endl;
+		return -1;
+	}
+
+	if (argc > 2 && string(argv[2]) == "--legacy")
+		DumpLegacy(reader);
+	else
+		DumpTable(reader);
+
+	return 0;
+}
@@ -0,0 +1,536 @@
+//=============================================================================
+// ColorEngine.h
+//
+// Host-side colour pipeline for raw 8-bit Bayer frames. One pass per pixel
+// does bilinear demosaicing, white balance and the 3x3 colour correction
+// matrix, writing interleaved BGR8 or RGB8. Rows are split into tiles that
+// are processed on a shared thread pool; the inner loop has an AVX2 kernel
+// (8 pixels per step, chosen at run time) and a scalar fallback that
+// writes the same bytes.
+//
+// The white balance and matrix can be loaded from the ColorState<serial>.txt
+// file saved by AcquisitionMultipleThread, which reproduces the camera's own
+// colour processing (e.g. RgbTransformLightSource = CoolFluorescent4000K).
+//=============================================================================
+
+#ifndef COLOR_ENGINE_H
+#define COLOR_ENGINE_H
+
+#include "ThreadPlacement.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define COLOR_ENGINE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define COLOR_ENGINE_AVX2_TARGET
+#else
+#define COLOR_ENGINE_AVX2_TARGET __attribute__((target("avx2,sse4.1")))
+#endif
+#endif
+
+// Neither path may be fused into FMAs (e.g. with -march=native), or the
+// scalar and AVX2 results would round differently. MSVC does not fuse under
+// /fp:precise; Clang is switched off inside the functions.
+#if defined(__GNUC__) && !defined(__clang__)
+#define COLOR_ENGINE_NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define COLOR_ENGINE_NO_FP_CONTRACT
+#endif
+
+
+enum BayerPattern
+{
+	BAYER_RG, // first row R G R G ..., second row G B G B ...
+	BAYER_GR,
+	BAYER_GB,
+	BAYER_BG
+};
+
+struct ColorParams {
+	BayerPattern pattern;
+	float whiteBalance[3]; // R, G, B gains applied before the matrix
+	float matrix[9]; // row-major, output RGB from white-balanced input RGB
+	float offset[3]; // added to output R, G, B, in 8-bit units
+	bool outputBGR; // interleave as BGR8 (default, like the camera's BGR8) or RGB8
+
+	ColorParams() : pattern(BAYER_BG), outputBGR(true)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			whiteBalance[i] = 1.0f;
+			offset[i] = 0.0f;
+		}
+		for (int i = 0; i < 9; i++)
+			matrix[i] = (i % 4 == 0) ? 1.0f : 0.0f;
+	}
+};
+
+
+// This function loads pattern, white balance and colour matrix from a
+// ColorState<serial>.txt file. Entries that are missing keep their current
+// value. Returns 0 on success, -1 if the file cannot be read.
+inline int LoadColorState(const std::string & filename, ColorParams & params)
+{
+	std::ifstream stateFile(filename.c_str());
+	if (!stateFile.is_open())
+		return -1;
+
+	bool transformEnabled = true;
+	float matrix[9];
+	memcpy(matrix, params.matrix, sizeof(matrix));
+
+	std::string line;
+	while (std::getline(stateFile, line))
+	{
+		size_t separator = line.find(" = ");
+		if (separator == std::string::npos)
+			continue;
+
+		const std::string key = line.substr(0, separator);
+		const std::string value = line.substr(separator + 3);
+		if (value == "n/a")
+			continue;
+
+		if (key == "PixelFormat" || key == "PixelColorFilter")
+		{
+			if (value.find("BayerRG") == 0) params.pattern = BAYER_RG;
+			else if (value.find("BayerGR") == 0) params.pattern = BAYER_GR;
+			else if (value.find("BayerGB") == 0) params.pattern = BAYER_GB;
+			else if (value.find("BayerBG") == 0) params.pattern = BAYER_BG;
+		}
+		else if (key == "BalanceRatio[Red]")
+			params.whiteBalance[0] = static_cast<float>(atof(value.c_str()));
+		else if (key == "BalanceRatio[Blue]")
+			params.whiteBalance[2] = static_cast<float>(atof(value.c_str()));
+		else if (key == "ColorTransformationEnable")
+			transformEnabled = (value == "1" || value == "true" || value == "True");
+		else if (key.find("ColorTransformationValue[Gain") == 0 && key.size() >= 32)
+		{
+			int row = key[29] - '0';
+			int column = key[30] - '0';
+			if (row >= 0 && row < 3 && column >= 0 && column < 3)
+				matrix[row * 3 + column] = static_cast<float>(atof(value.c_str()));
+		}
+		else if (key.find("ColorTransformationValue[Offset") == 0 && key.size() >= 33)
+		{
+			int channel = key[31] - '0';
+			if (channel >= 0 && channel < 3)
+				params.offset[channel] = static_cast<float>(atof(value.c_str()));
+		}
+	}
+
+	if (transformEnabled)
+		memcpy(params.matrix, matrix, sizeof(matrix));
+
+	return 0;
+}
+
+
+// Small work-sharing pool. ParallelFor() may be called from several threads
+// at once (e.g. one writer thread per camera); the calling thread works on
+// its own job too, so a job always finishes even if every worker is busy.
+class ColorThreadPool
+{
+public:
+	explicit ColorThreadPool(unsigned int numWorkers) : m_stop(false)
+	{
+		for (unsigned int i = 0; i < numWorkers; i++)
+			m_workers.push_back(std::thread(&ColorThreadPool::WorkerLoop, this));
+	}
+
+	~ColorThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+
+		for (size_t i = 0; i < m_workers.size(); i++)
+			m_workers[i].join();
+	}
+
+	unsigned int GetNumWorkers() const { return static_cast<unsigned int>(m_workers.size()); }
+
+	bool SetWorkerAffinity(const std::vector<int> & cpus)
+	{
+		bool ok = true;
+		for (size_t i = 0; i < m_workers.size(); i++)
+			ok = PinThread(m_workers[i], cpus) && ok;
+		return ok;
+	}
+
+	// Runs task(i) for every i in [0, count) and returns when all are done.
+	void ParallelFor(unsigned int count, const std::function<void(unsigned int)> & task)
+	{
+		if (count == 0)
+			return;
+
+		Job job(task, count);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push_back(&job);
+		}
+		m_wake.notify_all();
+
+		RunItems(job);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		RemoveJob(&job);
+		m_done.wait(lock, [&job] { return job.numDone.load() == job.count && job.numActive == 0; });
+	}
+
+private:
+	struct Job {
+		const std::function<void(unsigned int)> & task;
+		unsigned int count;
+		std::atomic<unsigned int> next;
+		std::atomic<unsigned int> numDone;
+		unsigned int numActive; // workers inside RunItems(), guarded by m_mutex
+
+		Job(const std::function<void(unsigned int)> & _task, unsigned int _count) :
+			task(_task), count(_count), next(0), numDone(0), numActive(0) {}
+	};
+
+	ColorThreadPool(const ColorThreadPool &);
+	ColorThreadPool & operator=(const ColorThreadPool &);
+
+	// Claims and runs items of a job until none are left.
+	void RunItems(Job & job)
+	{
+		unsigned int index;
+		while ((index = job.next.fetch_add(1)) < job.count)
+		{
+			job.task(index);
+			if (job.numDone.fetch_add(1) + 1 == job.count)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_done.notify_all();
+			}
+		}
+	}
+
+	void RemoveJob(Job* job)
+	{
+		for (std::deque<Job*>::iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+		{
+			if (*it == job)
+			{
+				m_jobs.erase(it);
+				return;
+			}
+		}
+	}
+
+	void WorkerLoop()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_wake.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+			if (m_stop)
+				return;
+
+			// Take the oldest job; drop it from the list once fully claimed
+			Job* job = m_jobs.front();
+			if (job->next.load() >= job->count)
+			{
+				m_jobs.pop_front();
+				continue;
+			}
+
+			// The job must outlive this worker's last claim attempt
+			job->numActive++;
+			lock.unlock();
+			RunItems(*job);
+			lock.lock();
+			job->numActive--;
+			m_done.notify_all();
+		}
+	}
+
+	std::vector<std::thread> m_workers;
+	std::deque<Job*> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	bool m_stop;
+};
+
+
+class ColorEngine
+{
+public:
+	// numThreads counts the calling thread, so 1 means no worker threads.
+	explicit ColorEngine(unsigned int numThreads, unsigned int tileRows = 64) :
+		m_pool(numThreads > 1 ? numThreads - 1 : 0),
+		m_tileRows(tileRows > 0 ? tileRows : 64),
+		m_useAvx2(CpuHasAvx2()) {}
+
+	unsigned int GetNumThreads() const { return m_pool.GetNumWorkers() + 1; }
+
+	// Restricts the worker threads (not the calling threads) to the given CPUs.
+	bool SetWorkerAffinity(const std::vector<int> & cpus) { return m_pool.SetWorkerAffinity(cpus); }
+
+	bool HasAvx2() const { return CpuHasAvx2(); }
+	bool IsUsingAvx2() const { return m_useAvx2; }
+
+	// Allows forcing the scalar kernel, e.g. for benchmarking.
+	void SetUseAvx2(bool useAvx2) { m_useAvx2 = useAvx2 && CpuHasAvx2(); }
+
+	// This function develops one 8-bit Bayer image into interleaved 8-bit
+	// colour. Strides are in bytes; the image must be at least 2x2.
+	void Process(const unsigned char* bayer, size_t srcStride, unsigned char* out, size_t dstStride,
+		unsigned int width, unsigned int height, const ColorParams & params)
+	{
+		if (width < 2 || height < 2)
+			return;
+
+		Kernel kernel;
+		kernel.Prepare(params);
+
+		const unsigned int numTiles = (height + m_tileRows - 1) / m_tileRows;
+		const bool useAvx2 = m_useAvx2;
+		const unsigned int tileRows = m_tileRows;
+
+		m_pool.ParallelFor(numTiles, [&](unsigned int tile)
+		{
+			const unsigned int yBegin = tile * tileRows;
+			const unsigned int yEnd = (yBegin + tileRows < height) ? yBegin + tileRows : height;
+			for (unsigned int y = yBegin; y < yEnd; y++)
+			{
+				// Reflect at the borders; this keeps the Bayer parity of the row
+				const unsigned char* up = bayer + (y == 0 ? 1 : y - 1) * srcStride;
+				const unsigned char* center = bayer + y * srcStride;
+				const unsigned char* down = bayer + (y + 1 == height ? height - 2 : y + 1) * srcStride;
+				unsigned char* dst = out + y * dstStride;
+
+				kernel.Row(up, center, down, dst, y, width, useAvx2);
+			}
+		});
+	}
+
+	static bool CpuHasAvx2()
+	{
+#if defined(COLOR_ENGINE_X86)
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool fma = (info[2] & (1 << 12)) != 0;
+		if (!osxsave || !fma || (_xgetbv(0) & 0x6) != 0x6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#else
+		return false;
+#endif
+	}
+
+private:
+	struct Kernel {
+		float m[9]; // matrix with white balance folded in
+		float offset[3];
+		int channel[4]; // colour (0 R, 1 G, 2 B) at (y & 1) * 2 + (x & 1)
+		int outIndex[3]; // byte position of R, G, B in an output pixel
+
+		void Prepare(const ColorParams & params)
+		{
+			for (int row = 0; row < 3; row++)
+			{
+				for (int column = 0; column < 3; column++)
+					m[row * 3 + column] = params.matrix[row * 3 + column] * params.whiteBalance[column];
+				offset[row] = params.offset[row];
+			}
+
+			static const int patterns[4][4] = {
+				{ 0, 1, 1, 2 }, // RG
+				{ 1, 0, 2, 1 }, // GR
+				{ 1, 2, 0, 1 }, // GB
+				{ 2, 1, 1, 0 }  // BG
+			};
+			for (int i = 0; i < 4; i++)
+				channel[i] = patterns[params.pattern][i];
+
+			outIndex[0] = params.outputBGR ? 2 : 0;
+			outIndex[1] = 1;
+			outIndex[2] = params.outputBGR ? 0 : 2;
+		}
+
+		static unsigned char Clamp(float value)
+		{
+			value += 0.5f;
+			return static_cast<unsigned char>(value <= 0.0f ? 0 : (value >= 255.0f ? 255 : static_cast<int>(value)));
+		}
+
+		COLOR_ENGINE_NO_FP_CONTRACT void Pixel(const unsigned char* up, const unsigned char* center, const unsigned char* down,
+			unsigned char* dst, unsigned int y, unsigned int x, unsigned int width) const
+		{
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+			const unsigned int left = (x == 0) ? 1 : x - 1;
+			const unsigned int right = (x + 1 == width) ? width - 2 : x + 1;
+
+			const float c = center[x];
+			const float h = (center[left] + center[right]) * 0.5f;
+			const float v = (up[x] + down[x]) * 0.5f;
+			const float d = (up[left] + up[right] + down[left] + down[right]) * 0.25f;
+			const float cross = (h + v) * 0.5f;
+
+			const int site = channel[(y & 1) * 2 + (x & 1)];
+			float rgb[3];
+			if (site == 1)
+			{
+				// Green site: the row's other colour is horizontal, the rest vertical
+				const int rowColor = channel[(y & 1) * 2 + ((x + 1) & 1)];
+				rgb[1] = c;
+				rgb[rowColor] = h;
+				rgb[2 - rowColor] = v;
+			}
+			else
+			{
+				rgb[site] = c;
+				rgb[1] = cross;
+				rgb[2 - site] = d;
+			}
+
+			for (int k = 0; k < 3; k++)
+				dst[outIndex[k]] = Clamp(m[k * 3] * rgb[0] + m[k * 3 + 1] * rgb[1] + m[k * 3 + 2] * rgb[2] + offset[k]);
+		}
+
+		void Row(const unsigned char* up, const unsigned char* center, const unsigned char* down,
+			unsigned char* dst, unsigned int y, unsigned int width, bool useAvx2) const
+		{
+			unsigned int x = 0;
+
+#if defined(COLOR_ENGINE_X86)
+			if (useAvx2 && width >= 11)
+			{
+				// Columns 0 and 1 need the reflected left neighbour
+				Pixel(up, center, down, dst, y, 0, width);
+				Pixel(up, center, down, dst + 3, y, 1, width);
+				x = RowAvx2(up, center, down, dst, y, width);
+			}
+#else
+			(void)useAvx2;
+#endif
+
+			for (; x < width; x++)
+				Pixel(up, center, down, dst + x * 3, y, x, width);
+		}
+
+#if defined(COLOR_ENGINE_X86)
+		static COLOR_ENGINE_AVX2_TARGET __m256 Load8(const unsigned char* p)
+		{
+			return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+		}
+
+		// Rounds like Clamp: add 0.5 and truncate; value must not be negative
+		static COLOR_ENGINE_AVX2_TARGET void Store8(__m256 value, unsigned char* bytes)
+		{
+			__m256i i32 = _mm256_cvttps_epi32(_mm256_add_ps(value, _mm256_set1_ps(0.5f)));
+			__m128i i16 = _mm_packus_epi32(_mm256_castsi256_si128(i32), _mm256_extracti128_si256(i32, 1));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(bytes), _mm_packus_epi16(i16, i16));
+		}
+
+		// Processes columns [2, n) in steps of 8 and returns n. Chunks start on
+		// even columns, so lane parity equals column parity.
+		COLOR_ENGINE_AVX2_TARGET COLOR_ENGINE_NO_FP_CONTRACT unsigned int RowAvx2(const unsigned char* up, const unsigned char* center,
+			const unsigned char* down, unsigned char* dst, unsigned int y, unsigned int width) const
+		{
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+			const int evenSite = channel[(y & 1) * 2];
+			const int oddSite = channel[(y & 1) * 2 + 1];
+			// Colour of the row's non-green sites, and whether they are the even lanes
+			const int rowColor = (evenSite == 1) ? oddSite : evenSite;
+			const __m256 nonGreen = (evenSite == 1) ?
+				_mm256_castsi256_ps(_mm256_set_epi32(-1, 0, -1, 0, -1, 0, -1, 0)) :
+				_mm256_castsi256_ps(_mm256_set_epi32(0, -1, 0, -1, 0, -1, 0, -1));
+
+			const __m256 half = _mm256_set1_ps(0.5f);
+			const __m256 quarter = _mm256_set1_ps(0.25f);
+			const __m256 zero = _mm256_setzero_ps();
+
+			__m256 mv[9];
+			for (int i = 0; i < 9; i++)
+				mv[i] = _mm256_set1_ps(m[i]);
+			const __m256 off0 = _mm256_set1_ps(offset[0]);
+			const __m256 off1 = _mm256_set1_ps(offset[1]);
+			const __m256 off2 = _mm256_set1_ps(offset[2]);
+
+			unsigned char planes[3][16];
+
+			unsigned int x = 2;
+			// Lane 7 reads column x + 8
+			for (; x + 9 <= width; x += 8)
+			{
+				const __m256 c = Load8(center + x);
+				const __m256 h = _mm256_mul_ps(_mm256_add_ps(Load8(center + x - 1), Load8(center + x + 1)), half);
+				const __m256 v = _mm256_mul_ps(_mm256_add_ps(Load8(up + x), Load8(down + x)), half);
+				const __m256 d = _mm256_mul_ps(_mm256_add_ps(
+					_mm256_add_ps(Load8(up + x - 1), Load8(up + x + 1)),
+					_mm256_add_ps(Load8(down + x - 1), Load8(down + x + 1))), quarter);
+				const __m256 cross = _mm256_mul_ps(_mm256_add_ps(h, v), half);
+
+				// Non-green sites: own colour = c, green = cross, other colour = d.
+				// Green sites: green = c, row colour = h, other colour = v.
+				const __m256 own = _mm256_blendv_ps(h, c, nonGreen);
+				const __m256 green = _mm256_blendv_ps(c, cross, nonGreen);
+				const __m256 other = _mm256_blendv_ps(v, d, nonGreen);
+
+				const __m256 r = (rowColor == 0) ? own : other;
+				const __m256 b = (rowColor == 0) ? other : own;
+
+				// Same operations in the same order as Pixel(), no FMA, so both
+				// paths round identically
+				__m256 outR = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mv[0], r), _mm256_mul_ps(mv[1], green)), _mm256_mul_ps(mv[2], b)), off0);
+				__m256 outG = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mv[3], r), _mm256_mul_ps(mv[4], green)), _mm256_mul_ps(mv[5], b)), off1);
+				__m256 outB = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mv[6], r), _mm256_mul_ps(mv[7], green)), _mm256_mul_ps(mv[8], b)), off2);
+
+				// Negative values would wrap in the signed pack
+				Store8(_mm256_max_ps(outR, zero), planes[0]);
+				Store8(_mm256_max_ps(outG, zero), planes[1]);
+				Store8(_mm256_max_ps(outB, zero), planes[2]);
+
+				unsigned char* p = dst + x * 3;
+				for (int i = 0; i < 8; i++, p += 3)
+				{
+					p[outIndex[0]] = planes[0][i];
+					p[outIndex[1]] = planes[1][i];
+					p[outIndex[2]] = planes[2][i];
+				}
+			}
+
+			return x;
+		}
+#endif
+	};
+
+	ColorEngine(const ColorEngine &);
+	ColorEngine & operator=(const ColorEngine &);
+
+	ColorThreadPool m_pool;
+	unsigned int m_tileRows;
+	bool m_useAvx2;
+};
+
+#endif // COLOR_ENGINE_H
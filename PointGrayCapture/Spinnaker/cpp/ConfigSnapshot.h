@@ -0,0 +1,114 @@
+//=============================================================================
+// ConfigSnapshot.h
+//
+// The settings applied to one camera, kept across sessions so a start can
+// tell what changed since the last one. Written by AcquisitionMultipleThread
+// as ConfigSnapshot<serial>.txt in the working directory, one "name = value"
+// line per setting in the order they were applied:
+//
+//   PixelFormat = BGR8
+//   ChunkEnable[Timestamp] = 1
+//   TriggerSource = Line3
+//   UserSet = UserSet1
+//
+// "UserSet" is present when the settings were also saved into the camera's
+// user set, which it then loads at power-up.
+//=============================================================================
+
+#ifndef CONFIG_SNAPSHOT_H
+#define CONFIG_SNAPSHOT_H
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ConfigSnapshot
+{
+public:
+	void Set(const std::string & name, const std::string & value)
+	{
+		for (size_t i = 0; i < m_values.size(); i++)
+		{
+			if (m_values[i].first == name)
+			{
+				m_values[i].second = value;
+				return;
+			}
+		}
+		m_values.push_back(std::make_pair(name, value));
+	}
+
+	void Set(const std::string & name, int64_t value)
+	{
+		std::ostringstream text;
+		text << value;
+		Set(name, text.str());
+	}
+
+	// Value of a setting, empty if it was not recorded
+	std::string Get(const std::string & name) const
+	{
+		for (size_t i = 0; i < m_values.size(); i++)
+		{
+			if (m_values[i].first == name)
+				return m_values[i].second;
+		}
+		return std::string();
+	}
+
+	size_t GetSize() const { return m_values.size(); }
+
+	// Settings whose value differs from previous or that previous lacks, as
+	// "name: old -> new"
+	std::vector<std::string> Diff(const ConfigSnapshot & previous) const
+	{
+		std::vector<std::string> changes;
+		for (size_t i = 0; i < m_values.size(); i++)
+		{
+			const std::string old = previous.Get(m_values[i].first);
+			if (old != m_values[i].second)
+				changes.push_back(m_values[i].first + ": " + (old.empty() ? std::string("-") : old) + " -> " + m_values[i].second);
+		}
+		return changes;
+	}
+
+	// Returns the number of settings read, -1 if the file cannot be opened
+	int Load(const std::string & filename)
+	{
+		std::ifstream snapshotFile(filename.c_str());
+		if (!snapshotFile.is_open())
+			return -1;
+
+		m_values.clear();
+		std::string line;
+		while (std::getline(snapshotFile, line))
+		{
+			if (line.empty() || line[0] == '#')
+				continue;
+			const std::string::size_type separator = line.find(" = ");
+			if (separator != std::string::npos)
+				Set(line.substr(0, separator), line.substr(separator + 3));
+		}
+		return static_cast<int>(m_values.size());
+	}
+
+	int Save(const std::string & filename, const std::string & serialNumber) const
+	{
+		std::ofstream snapshotFile(filename.c_str());
+		if (!snapshotFile.is_open())
+			return -1;
+
+		snapshotFile << "# Settings applied to camera " << serialNumber << "\n";
+		for (size_t i = 0; i < m_values.size(); i++)
+			snapshotFile << m_values[i].first << " = " << m_values[i].second << "\n";
+		return snapshotFile.good() ? 0 : -1;
+	}
+
+private:
+	std::vector<std::pair<std::string, std::string> > m_values;
+};
+
+#endif // CONFIG_SNAPSHOT_H
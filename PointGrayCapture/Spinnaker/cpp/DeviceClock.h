@@ -0,0 +1,147 @@
+//=============================================================================
+// DeviceClock.h
+//
+// Mapping of a camera's device clock (the chunk Timestamp) to the host
+// monotonic clock, so frames of different cameras can be compared in one
+// common time base even though every camera counts from its own power-on
+// epoch and drifts by some ppm.
+//
+// The grab thread latches the device clock periodically and brackets each
+// latch with host clock reads; the midpoint is one (device, host) sample and
+// half the bracket is its uncertainty. DeviceClockModel fits
+//
+//   host = hostRef + (device - deviceRef) * (1 + drift)
+//
+// by least squares over a sliding window of samples, preferring the tightly
+// bracketed ones. Until the window spans k_clockMinDriftSpanSeconds the drift
+// is taken as zero and only the offset is fitted.
+//=============================================================================
+
+#ifndef DEVICE_CLOCK_H
+#define DEVICE_CLOCK_H
+
+#include <cmath>
+#include <cstdint>
+#include <deque>
+
+const unsigned int k_clockModelSamples = 120; // sliding window, 2 min at one sample per second
+const double k_clockMinDriftSpanSeconds = 10.0;
+
+struct ClockSample {
+	uint64_t deviceNs;
+	uint64_t hostNs; // midpoint of the host reads around the latch
+	uint64_t uncertaintyNs; // half the time between those reads
+};
+
+
+class DeviceClockModel
+{
+public:
+	DeviceClockModel() : m_deviceRef(0), m_hostRef(0), m_drift(0), m_residualNs(0), m_valid(false), m_numSamples(0) {}
+
+	void AddSample(const ClockSample & sample)
+	{
+		// A device clock that went backwards was reset; start over
+		if (!m_samples.empty() && sample.deviceNs < m_samples.back().deviceNs)
+			m_samples.clear();
+
+		m_samples.push_back(sample);
+		while (m_samples.size() > k_clockModelSamples)
+			m_samples.pop_front();
+		m_numSamples++;
+
+		Fit();
+	}
+
+	bool IsValid() const { return m_valid; }
+
+	// Host clock time of a device timestamp, nanoseconds; 0 without samples
+	uint64_t Map(uint64_t deviceNs) const
+	{
+		if (!m_valid)
+			return 0;
+
+		const double delta = static_cast<double>(static_cast<int64_t>(deviceNs - m_deviceRef)) * (1.0 + m_drift);
+		return m_hostRef + static_cast<int64_t>(delta < 0 ? delta - 0.5 : delta + 0.5);
+	}
+
+	// How much faster the device clock runs than the host clock, parts per million
+	double GetDriftPpm() const { return (1.0 / (1.0 + m_drift) - 1.0) * 1e6; }
+	// RMS distance of the used samples from the fitted line
+	double GetResidualNs() const { return m_residualNs; }
+	// Host time minus device time at the last sample, i.e. the current offset
+	int64_t GetOffsetNs() const
+	{
+		return m_samples.empty() ? 0 : static_cast<int64_t>(Map(m_samples.back().deviceNs) - m_samples.back().deviceNs);
+	}
+	uint64_t GetNumSamples() const { return m_numSamples; }
+
+private:
+	void Fit()
+	{
+		// Samples bracketed much more loosely than the best one were delayed
+		// by the link or the scheduler and only add noise
+		uint64_t bestUncertainty = m_samples.front().uncertaintyNs;
+		for (size_t i = 1; i < m_samples.size(); i++)
+		{
+			if (m_samples[i].uncertaintyNs < bestUncertainty)
+				bestUncertainty = m_samples[i].uncertaintyNs;
+		}
+		const uint64_t maxUncertainty = bestUncertainty * 3 + 50000;
+
+		// Relative to the newest sample, so doubles keep nanosecond precision
+		const ClockSample & reference = m_samples.back();
+		double n = 0, sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+		double minX = 0, maxX = 0;
+		for (size_t i = 0; i < m_samples.size(); i++)
+		{
+			if (m_samples[i].uncertaintyNs > maxUncertainty)
+				continue;
+
+			const double x = static_cast<double>(static_cast<int64_t>(m_samples[i].deviceNs - reference.deviceNs));
+			const double y = static_cast<double>(static_cast<int64_t>(m_samples[i].hostNs - reference.hostNs)) - x;
+			n++;
+			sumX += x;
+			sumY += y;
+			sumXX += x * x;
+			sumXY += x * y;
+			if (x < minX) minX = x;
+			if (x > maxX) maxX = x;
+		}
+
+		// y is host minus device, so its slope against device time is the drift
+		double drift = 0;
+		const double denominator = n * sumXX - sumX * sumX;
+		if ((maxX - minX) >= k_clockMinDriftSpanSeconds * 1e9 && denominator > 0)
+			drift = (n * sumXY - sumX * sumY) / denominator;
+		const double intercept = (sumY - drift * sumX) / n;
+
+		double sumSquares = 0;
+		for (size_t i = 0; i < m_samples.size(); i++)
+		{
+			if (m_samples[i].uncertaintyNs > maxUncertainty)
+				continue;
+
+			const double x = static_cast<double>(static_cast<int64_t>(m_samples[i].deviceNs - reference.deviceNs));
+			const double y = static_cast<double>(static_cast<int64_t>(m_samples[i].hostNs - reference.hostNs)) - x;
+			const double error = y - (intercept + drift * x);
+			sumSquares += error * error;
+		}
+
+		m_deviceRef = reference.deviceNs;
+		m_hostRef = reference.hostNs + static_cast<int64_t>(std::floor(intercept + 0.5));
+		m_drift = drift;
+		m_residualNs = std::sqrt(sumSquares / n);
+		m_valid = true;
+	}
+
+	std::deque<ClockSample> m_samples;
+	uint64_t m_deviceRef;
+	uint64_t m_hostRef;
+	double m_drift;
+	double m_residualNs;
+	bool m_valid;
+	uint64_t m_numSamples;
+};
+
+#endif // DEVICE_CLOCK_H
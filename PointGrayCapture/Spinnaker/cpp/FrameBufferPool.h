@@ -0,0 +1,193 @@
+//=============================================================================
+// FrameBufferPool.h
+//
+// Fixed set of 64-byte-aligned frame buffers, allocated and touched once at
+// startup so the capture hot path neither calls the allocator nor takes page
+// faults. Acquire() hands out a reference-counted FrameBufferRef; the buffer
+// goes back to the pool when the last reference to it is released, whichever
+// thread (writer, encoder) that happens on.
+//=============================================================================
+
+#ifndef FRAME_BUFFER_POOL_H
+#define FRAME_BUFFER_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+const size_t k_frameBufferAlignment = 64;
+
+class FrameBufferPool;
+
+// Shared handle to one pool buffer; copies share the buffer.
+class FrameBufferRef
+{
+public:
+	FrameBufferRef() : m_pool(NULL), m_index(0) {}
+	FrameBufferRef(const FrameBufferRef & other) : m_pool(other.m_pool), m_index(other.m_index) { AddRef(); }
+	~FrameBufferRef() { Reset(); }
+
+	FrameBufferRef & operator=(const FrameBufferRef & other)
+	{
+		if (this != &other)
+		{
+			FrameBufferRef copy(other);
+			Swap(copy);
+		}
+		return *this;
+	}
+
+	bool IsValid() const { return m_pool != NULL; }
+	inline unsigned char* GetData() const;
+	inline size_t GetSize() const;
+
+	inline void Reset();
+
+private:
+	friend class FrameBufferPool;
+
+	FrameBufferRef(FrameBufferPool* pool, unsigned int index) : m_pool(pool), m_index(index) {}
+
+	void Swap(FrameBufferRef & other)
+	{
+		std::swap(m_pool, other.m_pool);
+		std::swap(m_index, other.m_index);
+	}
+
+	inline void AddRef();
+
+	FrameBufferPool* m_pool;
+	unsigned int m_index;
+};
+
+
+class FrameBufferPool
+{
+public:
+	// Allocates numBuffers buffers of bufferSize bytes each up front.
+	FrameBufferPool(unsigned int numBuffers, size_t bufferSize) :
+		m_bufferSize(bufferSize), m_slots(numBuffers), m_numAllocated(0), m_numMisses(0), m_minFree(numBuffers)
+	{
+		const size_t allocSize = (bufferSize + k_frameBufferAlignment - 1) / k_frameBufferAlignment * k_frameBufferAlignment;
+
+		m_freeList.reserve(numBuffers);
+		for (unsigned int i = 0; i < numBuffers; i++)
+		{
+#if defined(_WIN32)
+			m_slots[i].data = static_cast<unsigned char*>(_aligned_malloc(allocSize, k_frameBufferAlignment));
+#else
+			void* data = NULL;
+			m_slots[i].data = posix_memalign(&data, k_frameBufferAlignment, allocSize) == 0 ? static_cast<unsigned char*>(data) : NULL;
+#endif
+			if (m_slots[i].data == NULL)
+				continue;
+
+			// Touch every page now rather than on the first frame
+			memset(m_slots[i].data, 0, allocSize);
+			m_slots[i].refCount = 0;
+			m_freeList.push_back(i);
+		}
+
+		m_numAllocated = m_freeList.size();
+		m_minFree = m_numAllocated;
+	}
+
+	// All references must have been released before the pool goes away.
+	~FrameBufferPool()
+	{
+		for (size_t i = 0; i < m_slots.size(); i++)
+		{
+#if defined(_WIN32)
+			_aligned_free(m_slots[i].data);
+#else
+			free(m_slots[i].data);
+#endif
+		}
+	}
+
+	// Returns a free buffer, or an invalid reference if all are in use.
+	FrameBufferRef Acquire()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_freeList.empty())
+		{
+			m_numMisses++;
+			return FrameBufferRef();
+		}
+
+		unsigned int index = m_freeList.back();
+		m_freeList.pop_back();
+		if (m_freeList.size() < m_minFree)
+			m_minFree = m_freeList.size();
+
+		m_slots[index].refCount.store(1);
+		return FrameBufferRef(this, index);
+	}
+
+	size_t GetBufferSize() const { return m_bufferSize; }
+	// Buffers actually allocated; fewer than requested if memory ran out
+	size_t GetNumBuffers() const { return m_numAllocated; }
+	size_t GetNumFree() const { std::lock_guard<std::mutex> lock(m_mutex); return m_freeList.size(); }
+
+	// Acquire() calls that found no free buffer
+	uint64_t GetNumMisses() const { std::lock_guard<std::mutex> lock(m_mutex); return m_numMisses; }
+	// Fewest free buffers seen, i.e. how close the pool came to running dry
+	size_t GetMinFree() const { std::lock_guard<std::mutex> lock(m_mutex); return m_minFree; }
+
+private:
+	friend class FrameBufferRef;
+
+	struct Slot {
+		unsigned char* data;
+		std::atomic<int> refCount;
+
+		Slot() : data(NULL), refCount(0) {}
+		Slot(const Slot & other) : data(other.data), refCount(other.refCount.load()) {}
+	};
+
+	FrameBufferPool(const FrameBufferPool &);
+	FrameBufferPool & operator=(const FrameBufferPool &);
+
+	void AddRef(unsigned int index) { m_slots[index].refCount.fetch_add(1); }
+
+	void Release(unsigned int index)
+	{
+		if (m_slots[index].refCount.fetch_sub(1) != 1)
+			return;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_freeList.push_back(index);
+	}
+
+	const size_t m_bufferSize;
+	std::vector<Slot> m_slots;
+	size_t m_numAllocated;
+
+	mutable std::mutex m_mutex;
+	std::vector<unsigned int> m_freeList;
+	uint64_t m_numMisses;
+	size_t m_minFree;
+};
+
+
+inline unsigned char* FrameBufferRef::GetData() const { return m_pool != NULL ? m_pool->m_slots[m_index].data : NULL; }
+inline size_t FrameBufferRef::GetSize() const { return m_pool != NULL ? m_pool->m_bufferSize : 0; }
+inline void FrameBufferRef::AddRef() { if (m_pool != NULL) m_pool->AddRef(m_index); }
+
+inline void FrameBufferRef::Reset()
+{
+	if (m_pool != NULL)
+		m_pool->Release(m_index);
+	m_pool = NULL;
+	m_index = 0;
+}
+
+#endif // FRAME_BUFFER_POOL_H
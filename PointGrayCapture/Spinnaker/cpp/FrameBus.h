@@ -0,0 +1,512 @@
+//=============================================================================
+// FrameBus.h
+//
+// Live full-resolution frames for other processes on the machine, e.g. pose
+// estimation or calibration checks. Each camera's writer thread publishes
+// every recorded frame, with its chunk record and frame set, into a ring of
+// slots in a shared-memory region of its own (SharedMemory.h), named
+// <name>-<serial>. Readers map the region and use the pixels in place, no
+// copy: Acquire*() pins a slot by its reference count, Release() unpins it.
+//
+// The writer never waits for a reader. It fills the oldest slot nobody
+// holds. If readers hold every slot, it takes the oldest one back anyway;
+// the holders find out from Release() returning false, and the writer logs
+// the readers that lag. A reader that falls more than a ring behind skips
+// to the oldest frame still in the ring and counts the frames it missed.
+//
+// Region layout: FrameBusHeader (with the reader table), the frame index at
+// indexOffset, then numSlots slots of slotSize bytes at slotOffset, each a
+// FrameBusSlot followed by the pixels. Frame n's index entry
+// index[n % indexSize] holds n << 8 | slot once it is published.
+//
+// A slot's generation is odd while the writer fills it. The writer makes it
+// odd before it checks the reference count, and a reader counts itself in
+// before it checks the generation, so at least one of them sees the other
+// and backs off; the writer then restores the generation, the slot's frame
+// being untouched.
+//
+// A reader that dies while holding a frame leaves the slot's count raised;
+// the writer keeps reusing that slot when all others are held too. Its
+// reader entry is freed by the next reader that opens the bus.
+//=============================================================================
+
+#ifndef FRAME_BUS_H
+#define FRAME_BUS_H
+
+#include "CaptureLog.h"
+#include "ChunkLog.h"
+#include "FrameContainer.h"
+#include "SharedMemory.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <signal.h>
+#endif
+
+const char k_frameBusMagic[8] = { 'M', 'C', 'F', 'B', 'U', 'S', '0', '2' };
+const unsigned int k_frameBusMaxSlots = 255; // slot number is the low byte of an index entry
+const unsigned int k_frameBusMaxReaders = 8;
+const size_t k_frameBusAlignment = 64;
+
+inline size_t FrameBusAlignUp(size_t size) { return (size + k_frameBusAlignment - 1) & ~(k_frameBusAlignment - 1); }
+
+inline uint64_t FrameBusNowNs()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// False only if the process is known to have exited
+inline bool FrameBusProcessExists(uint32_t processId)
+{
+#if defined(_WIN32)
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, processId);
+	if (process == NULL)
+		return GetLastError() != ERROR_INVALID_PARAMETER;
+	const bool running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return running;
+#else
+	return kill(static_cast<pid_t>(processId), 0) == 0 || errno != ESRCH;
+#endif
+}
+
+// One attached reader, maintained by the reader
+struct FrameBusReaderEntry {
+	std::atomic<uint32_t> processId; // of the reader, 0 if the entry is free
+	uint32_t reserved;
+	char name[24];
+	std::atomic<uint64_t> nextFrame; // the reader has seen every frame before this one
+	std::atomic<uint64_t> numAcquired;
+	std::atomic<uint64_t> numSkipped; // frames it fell too far behind to read
+	std::atomic<uint64_t> numRevoked; // held frames the writer took back
+};
+
+struct FrameBusHeader {
+	char magic[8];
+	char serialNumber[16];
+	uint32_t numSlots;
+	uint32_t indexSize;
+	uint64_t indexOffset;
+	uint64_t slotOffset;
+	uint64_t slotSize;
+	uint64_t maxFrameBytes;
+	std::atomic<uint32_t> publishing; // 0 once the capture process has closed the bus
+	uint32_t reserved;
+	std::atomic<uint64_t> head; // number of frames published
+	std::atomic<uint64_t> numRevoked;
+	FrameBusReaderEntry readers[k_frameBusMaxReaders];
+};
+
+struct FrameBusSlot {
+	std::atomic<uint64_t> generation;
+	std::atomic<uint32_t> refCount;
+	uint32_t pixelFormat; // ContainerPixelFormat
+	uint64_t frameNumber; // position in the bus, counts published frames only
+	int64_t setId; // FrameSetAssembler frame set, k_containerNoSet if none
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride; // bytes per row of the pixels
+	uint32_t reserved;
+	uint64_t dataSize;
+	uint64_t publishTimestamp; // host monotonic clock, nanoseconds
+	ChunkLogRecord record; // hostTimestamp is the grab time on the same clock
+};
+
+
+class FrameBusWriter
+{
+public:
+	FrameBusWriter() : m_header(NULL), m_lastSlot(0), m_numPublished(0), m_numOversize(0), m_numRevoked(0),
+		m_numBackoffs(0), m_publishSeconds(0), m_maxPublishMs(0) {}
+
+	~FrameBusWriter() { Close(); }
+
+	// Creates the ring of numSlots frames of up to maxFrameBytes each.
+	// Returns 0 on success, -1 on error (frames are then not published).
+	int Open(const std::string & name, const std::string & serialNumber, unsigned int numSlots, size_t maxFrameBytes)
+	{
+		Close();
+
+		numSlots = std::max(2u, std::min(numSlots, k_frameBusMaxSlots));
+		const size_t indexSize = numSlots * 2;
+		const size_t indexOffset = FrameBusAlignUp(sizeof(FrameBusHeader));
+		const size_t slotOffset = FrameBusAlignUp(indexOffset + indexSize * sizeof(uint64_t));
+		const size_t slotSize = FrameBusAlignUp(FrameBusAlignUp(sizeof(FrameBusSlot)) + maxFrameBytes);
+		if (m_region.Create(name, slotOffset + numSlots * slotSize) < 0)
+		{
+			CAPTURE_LOG(Log_Warning) << "[" << serialNumber << "] " << "Unable to create frame bus " << SharedMemory::GetPlatformName(name);
+			return -1;
+		}
+
+		m_serialNumber = serialNumber;
+		m_header = reinterpret_cast<FrameBusHeader*>(m_region.GetData());
+		strncpy(m_header->serialNumber, serialNumber.c_str(), sizeof(m_header->serialNumber) - 1);
+		m_header->numSlots = numSlots;
+		m_header->indexSize = static_cast<uint32_t>(indexSize);
+		m_header->indexOffset = indexOffset;
+		m_header->slotOffset = slotOffset;
+		m_header->slotSize = slotSize;
+		m_header->maxFrameBytes = maxFrameBytes;
+		for (size_t i = 0; i < indexSize; i++)
+			GetIndex()[i].store(~0ull);
+		m_lastSlot = numSlots - 1;
+
+		// Readers check the magic last
+		m_header->publishing.store(1);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(m_header->magic, k_frameBusMagic, sizeof(k_frameBusMagic));
+
+		CAPTURE_LOG(Log_Info) << "[" << serialNumber << "] " << "Frame bus " << SharedMemory::GetPlatformName(name) << ", "
+			<< numSlots << " slots of " << maxFrameBytes / 1024 << " KB";
+		return 0;
+	}
+
+	bool IsOpen() const { return m_header != NULL; }
+
+	// Copies one frame into the ring and publishes it; never waits for a
+	// reader. Returns false if the bus is closed or the frame too large.
+	bool Publish(const unsigned char* data, size_t stride, unsigned int width, unsigned int height,
+		ContainerPixelFormat pixelFormat, const ChunkLogRecord & record, int64_t setId)
+	{
+		if (m_header == NULL)
+			return false;
+
+		const uint64_t dataSize = static_cast<uint64_t>(stride) * height;
+		if (dataSize > m_header->maxFrameBytes)
+		{
+			m_numOversize++;
+			return false;
+		}
+
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		const uint64_t frameNumber = m_header->head.load(std::memory_order_relaxed);
+		const unsigned int slotIndex = TakeSlot(frameNumber);
+		FrameBusSlot* slot = GetSlot(slotIndex);
+
+		slot->pixelFormat = pixelFormat;
+		slot->frameNumber = frameNumber;
+		slot->setId = setId;
+		slot->width = width;
+		slot->height = height;
+		slot->stride = static_cast<uint32_t>(stride);
+		slot->dataSize = dataSize;
+		slot->record = record;
+		memcpy(GetSlotData(slot), data, static_cast<size_t>(dataSize));
+		slot->publishTimestamp = FrameBusNowNs();
+
+		// Even again: the slot holds a complete frame
+		slot->generation.fetch_add(1, std::memory_order_release);
+		GetIndex()[frameNumber % m_header->indexSize].store(frameNumber << 8 | slotIndex, std::memory_order_release);
+		m_header->head.store(frameNumber + 1, std::memory_order_release);
+		m_lastSlot = slotIndex;
+
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		m_publishSeconds += seconds;
+		m_maxPublishMs = std::max(m_maxPublishMs, seconds * 1000.0);
+		m_numPublished++;
+		return true;
+	}
+
+	// Marks the bus closed for the readers, logs its totals and unmaps it
+	void Close()
+	{
+		if (m_header == NULL)
+			return;
+
+		m_header->publishing.store(0);
+
+		std::ostringstream readers;
+		for (unsigned int r = 0; r < k_frameBusMaxReaders; r++)
+		{
+			const FrameBusReaderEntry & entry = m_header->readers[r];
+			if (entry.processId.load() == 0)
+				continue;
+			readers << ", reader '" << std::string(entry.name, strnlen(entry.name, sizeof(entry.name))) << "' " << entry.numAcquired.load()
+				<< " read, " << entry.numSkipped.load() << " skipped, " << entry.numRevoked.load() << " revoked";
+		}
+
+		CAPTURE_LOG(Log_Info) << "[" << m_serialNumber << "] " << "Frame bus: " << m_numPublished << " published, "
+			<< (m_numPublished > 0 ? m_publishSeconds * 1000.0 / m_numPublished : 0.0) << " ms mean, " << m_maxPublishMs << " ms max, "
+			<< m_numBackoffs << " held slots passed over, " << m_numRevoked << " taken back from readers, " << m_numOversize << " too large" << readers.str();
+
+		m_header = NULL;
+		m_region.Close();
+	}
+
+private:
+	FrameBusWriter(const FrameBusWriter &);
+	FrameBusWriter & operator=(const FrameBusWriter &);
+
+	std::atomic<uint64_t>* GetIndex() const { return reinterpret_cast<std::atomic<uint64_t>*>(m_region.GetData() + m_header->indexOffset); }
+
+	FrameBusSlot* GetSlot(unsigned int slot) const
+	{
+		return reinterpret_cast<FrameBusSlot*>(m_region.GetData() + m_header->slotOffset + slot * m_header->slotSize);
+	}
+
+	static unsigned char* GetSlotData(FrameBusSlot* slot) { return reinterpret_cast<unsigned char*>(slot) + FrameBusAlignUp(sizeof(FrameBusSlot)); }
+
+	// Returns a slot with an odd generation, i.e. closed to readers: the
+	// oldest one nobody holds, else the oldest one
+	unsigned int TakeSlot(uint64_t frameNumber)
+	{
+		const unsigned int numSlots = m_header->numSlots;
+		for (unsigned int i = 1; i <= numSlots; i++)
+		{
+			const unsigned int slotIndex = (m_lastSlot + i) % numSlots;
+			FrameBusSlot* slot = GetSlot(slotIndex);
+			const uint64_t generation = slot->generation.load(std::memory_order_relaxed);
+			slot->generation.store(generation + 1);
+			if (slot->refCount.load() == 0)
+				return slotIndex;
+
+			slot->generation.store(generation);
+			m_numBackoffs++;
+		}
+
+		// Every slot is held; readers that still hold it will see the new generation
+		const unsigned int slotIndex = (m_lastSlot + 1) % numSlots;
+		GetSlot(slotIndex)->generation.fetch_add(1);
+		m_header->numRevoked.fetch_add(1);
+		m_numRevoked++;
+
+		CAPTURE_LOG_LIMITED(Log_Warning) << "[" << m_serialNumber << "] " << "Frame bus: all " << numSlots << " slots held, frame "
+			<< frameNumber << " overwrites frame " << GetSlot(slotIndex)->frameNumber << GetLaggingReaders(frameNumber);
+		return slotIndex;
+	}
+
+	std::string GetLaggingReaders(uint64_t frameNumber) const
+	{
+		std::ostringstream readers;
+		for (unsigned int r = 0; r < k_frameBusMaxReaders; r++)
+		{
+			const FrameBusReaderEntry & entry = m_header->readers[r];
+			if (entry.processId.load() != 0 && entry.nextFrame.load() + m_header->numSlots < frameNumber)
+				readers << (readers.tellp() == 0 ? ", lagging: " : " ") << std::string(entry.name, strnlen(entry.name, sizeof(entry.name)))
+					<< " (" << frameNumber - entry.nextFrame.load() << " behind)";
+		}
+		return readers.str();
+	}
+
+	SharedMemory m_region;
+	FrameBusHeader* m_header;
+	std::string m_serialNumber;
+	unsigned int m_lastSlot; // slot of the latest frame
+
+	uint64_t m_numPublished;
+	uint64_t m_numOversize;
+	uint64_t m_numRevoked;
+	uint64_t m_numBackoffs;
+	double m_publishSeconds;
+	double m_maxPublishMs;
+};
+
+
+// A frame held by a FrameBusReader; the pointers are valid until Release()
+struct FrameBusFrame {
+	const FrameBusSlot* slot; // metadata
+	const unsigned char* data;
+	uint64_t frameNumber;
+	uint64_t generation;
+
+	FrameBusFrame() : slot(NULL), data(NULL), frameNumber(0), generation(0) {}
+};
+
+
+class FrameBusReader
+{
+public:
+	FrameBusReader() : m_header(NULL), m_entry(NULL), m_nextFrame(0) {}
+	~FrameBusReader() { Close(); }
+
+	// Attaches to the bus of a running capture under a name the writer logs
+	// when this reader lags. Starts at the latest frame. Returns 0 on success,
+	// -1 if there is no such bus or all reader entries are taken.
+	int Open(const std::string & name, const std::string & readerName)
+	{
+		Close();
+		if (m_region.Open(name, true) < 0)
+			return -1;
+
+		FrameBusHeader* header = reinterpret_cast<FrameBusHeader*>(m_region.GetData());
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_region.GetSize() < sizeof(FrameBusHeader) || memcmp(header->magic, k_frameBusMagic, sizeof(k_frameBusMagic)) != 0 ||
+			header->numSlots == 0 || header->numSlots > k_frameBusMaxSlots || header->slotOffset + header->numSlots * header->slotSize > m_region.GetSize())
+		{
+			m_region.Close();
+			return -1;
+		}
+
+#if defined(_WIN32)
+		const uint32_t processId = GetCurrentProcessId();
+#else
+		const uint32_t processId = static_cast<uint32_t>(getpid());
+#endif
+
+		// Free the entries of readers that exited without Close()
+		for (unsigned int r = 0; r < k_frameBusMaxReaders; r++)
+		{
+			uint32_t owner = header->readers[r].processId.load();
+			if (owner != 0 && owner != processId && !FrameBusProcessExists(owner))
+				header->readers[r].processId.compare_exchange_strong(owner, 0);
+		}
+
+		for (unsigned int r = 0; r < k_frameBusMaxReaders && m_entry == NULL; r++)
+		{
+			uint32_t unused = 0;
+			if (header->readers[r].processId.compare_exchange_strong(unused, processId))
+				m_entry = &header->readers[r];
+		}
+		if (m_entry == NULL)
+		{
+			m_region.Close();
+			return -1;
+		}
+
+		m_header = header;
+		const uint64_t head = m_header->head.load(std::memory_order_acquire);
+		m_nextFrame = head > 0 ? head - 1 : 0;
+
+		memset(m_entry->name, 0, sizeof(m_entry->name));
+		strncpy(m_entry->name, readerName.c_str(), sizeof(m_entry->name) - 1);
+		m_entry->nextFrame.store(m_nextFrame);
+		m_entry->numAcquired.store(0);
+		m_entry->numSkipped.store(0);
+		m_entry->numRevoked.store(0);
+		return 0;
+	}
+
+	// Frees the reader entry; release held frames first
+	void Close()
+	{
+		if (m_entry != NULL)
+			m_entry->processId.store(0);
+		m_entry = NULL;
+		m_header = NULL;
+		m_region.Close();
+	}
+
+	// False once the capture process has closed the bus
+	bool IsPublishing() const { return m_header != NULL && m_header->publishing.load() != 0; }
+
+	std::string GetSerialNumber() const
+	{
+		return m_header != NULL ? std::string(m_header->serialNumber, strnlen(m_header->serialNumber, sizeof(m_header->serialNumber))) : std::string();
+	}
+
+	unsigned int GetNumSlots() const { return m_header != NULL ? m_header->numSlots : 0; }
+
+	// Frames this reader fell too far behind to read, or lost to a reused slot
+	uint64_t GetNumSkipped() const { return m_entry != NULL ? m_entry->numSkipped.load(std::memory_order_relaxed) : 0; }
+
+	// Frames published so far
+	uint64_t GetHead() const { return m_header != NULL ? m_header->head.load(std::memory_order_acquire) : 0; }
+
+	// Acquires the next frame after the previous one. A reader more than a
+	// ring behind skips to the oldest frame still in it. Returns false if
+	// there is no new frame.
+	bool AcquireNext(FrameBusFrame & frame)
+	{
+		const uint64_t head = GetHead();
+		while (m_nextFrame < head)
+		{
+			const uint64_t oldest = head > m_header->numSlots ? head - m_header->numSlots : 0;
+			if (m_nextFrame < oldest)
+			{
+				m_entry->numSkipped.fetch_add(oldest - m_nextFrame, std::memory_order_relaxed);
+				m_nextFrame = oldest;
+			}
+
+			const uint64_t frameNumber = m_nextFrame++;
+			m_entry->nextFrame.store(m_nextFrame, std::memory_order_relaxed);
+			if (Acquire(frameNumber, frame))
+				return true;
+			m_entry->numSkipped.fetch_add(1, std::memory_order_relaxed);
+		}
+		return false;
+	}
+
+	// Acquires the most recent frame, skipping everything before it
+	bool AcquireLatest(FrameBusFrame & frame)
+	{
+		const uint64_t head = GetHead();
+		if (head > m_nextFrame + 1)
+		{
+			m_entry->numSkipped.fetch_add(head - 1 - m_nextFrame, std::memory_order_relaxed);
+			m_nextFrame = head - 1;
+		}
+		return AcquireNext(frame);
+	}
+
+	// Acquires a frame by its bus frame number, if it is still in the ring
+	bool Acquire(uint64_t frameNumber, FrameBusFrame & frame)
+	{
+		if (m_header == NULL || frameNumber >= GetHead())
+			return false;
+
+		const std::atomic<uint64_t>* index = reinterpret_cast<const std::atomic<uint64_t>*>(m_region.GetData() + m_header->indexOffset);
+		for (int attempt = 0; attempt < 3; attempt++)
+		{
+			const uint64_t entry = index[frameNumber % m_header->indexSize].load(std::memory_order_acquire);
+			if (entry >> 8 != frameNumber || (entry & 0xFF) >= m_header->numSlots)
+				return false;
+
+			FrameBusSlot* slot = reinterpret_cast<FrameBusSlot*>(m_region.GetData() + m_header->slotOffset + (entry & 0xFF) * m_header->slotSize);
+			slot->refCount.fetch_add(1);
+			const uint64_t generation = slot->generation.load();
+			if ((generation & 1) == 0 && slot->frameNumber == frameNumber)
+			{
+				frame.slot = slot;
+				frame.data = reinterpret_cast<const unsigned char*>(slot) + FrameBusAlignUp(sizeof(FrameBusSlot));
+				frame.frameNumber = frameNumber;
+				frame.generation = generation;
+				m_entry->numAcquired.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+			slot->refCount.fetch_sub(1);
+
+			// An even generation with another frame: the slot was reused.
+			// Odd: the writer may only be probing it, look again.
+			if ((generation & 1) == 0)
+				return false;
+		}
+		return false;
+	}
+
+	// Unpins a frame. Returns true if it stayed intact while it was held,
+	// false if the writer took the slot back because it was held too long.
+	bool Release(FrameBusFrame & frame)
+	{
+		if (frame.slot == NULL)
+			return false;
+
+		FrameBusSlot* slot = const_cast<FrameBusSlot*>(frame.slot);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const bool intact = slot->generation.load(std::memory_order_relaxed) == frame.generation;
+		slot->refCount.fetch_sub(1, std::memory_order_release);
+		if (!intact && m_entry != NULL)
+			m_entry->numRevoked.fetch_add(1, std::memory_order_relaxed);
+
+		frame = FrameBusFrame();
+		return intact;
+	}
+
+private:
+	FrameBusReader(const FrameBusReader &);
+	FrameBusReader & operator=(const FrameBusReader &);
+
+	SharedMemory m_region;
+	FrameBusHeader* m_header;
+	FrameBusReaderEntry* m_entry;
+	uint64_t m_nextFrame;
+};
+
+#endif // FRAME_BUS_H
@@ -0,0 +1,99 @@
+//=============================================================================
+// FrameBusMonitor.cpp
+//
+// Attaches to one camera's frame bus (FrameBus.h) of a running capture and
+// prints once a second what a reader sees: frames read, taken back or
+// skipped, and the latency from grab to read. Also a starting point for
+// real consumers. Only needs the Spinnaker-free headers.
+//
+// Usage:
+//   FrameBusMonitor <serial> [--name <bus>] [--hold <ms>]
+//
+// --hold keeps every frame for that long before releasing it, to see how
+// the writer treats a slow reader.
+//=============================================================================
+
+#include "FrameBus.h"
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+const string defaultBusName = "MultiCameraFrames";
+
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		cout << "Usage: FrameBusMonitor <serial> [--name <bus>] [--hold <ms>]" << endl;
+		return 1;
+	}
+
+	string busName = defaultBusName;
+	int holdMs = 0;
+	for (int i = 2; i + 1 < argc; i += 2)
+	{
+		if (string(argv[i]) == "--name")
+			busName = argv[i + 1];
+		else if (string(argv[i]) == "--hold")
+			holdMs = atoi(argv[i + 1]);
+	}
+
+	const string regionName = busName + "-" + argv[1];
+	FrameBusReader reader;
+	if (reader.Open(regionName, "monitor") < 0)
+	{
+		cout << "No frame bus " << SharedMemory::GetPlatformName(regionName) << ", or no free reader entry" << endl;
+		return -1;
+	}
+	cout << "# " << reader.GetSerialNumber() << ", " << reader.GetNumSlots() << " slots" << endl;
+	cout << "frames\tintact\trevoked\tskipped\tlastFrameID\tlastSet\tmeanLatencyMs\tmaxLatencyMs" << endl;
+
+	uint64_t numRead = 0, numIntact = 0, numRevoked = 0, numSkipped = 0;
+	double latencySumMs = 0, latencyMaxMs = 0;
+	int64_t lastFrameID = -1, lastSet = -1;
+	std::chrono::steady_clock::time_point nextPrint = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+	while (reader.IsPublishing())
+	{
+		FrameBusFrame frame;
+		if (reader.AcquireNext(frame))
+		{
+			// Grab time and now are on the same monotonic clock
+			const double latencyMs = (FrameBusNowNs() - frame.slot->record.hostTimestamp) / 1e6;
+			latencySumMs += latencyMs;
+			latencyMaxMs = max(latencyMaxMs, latencyMs);
+			lastFrameID = frame.slot->record.frameID;
+			lastSet = frame.slot->setId;
+			numRead++;
+
+			if (holdMs > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(holdMs));
+
+			if (reader.Release(frame))
+				numIntact++;
+			else
+				numRevoked++;
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		if (std::chrono::steady_clock::now() >= nextPrint)
+		{
+			cout << numRead << "\t" << numIntact << "\t" << numRevoked << "\t" << reader.GetNumSkipped() - numSkipped << "\t" << lastFrameID << "\t" << lastSet << "\t"
+				<< (numRead > 0 ? latencySumMs / numRead : 0.0) << "\t" << latencyMaxMs << endl;
+			numRead = numIntact = numRevoked = 0;
+			numSkipped = reader.GetNumSkipped();
+			latencySumMs = latencyMaxMs = 0;
+			nextPrint += std::chrono::seconds(1);
+		}
+	}
+
+	cout << "# capture closed the bus" << endl;
+	return 0;
+}
@@ -0,0 +1,571 @@
+//=============================================================================
+// FrameContainer.h
+//
+// Single-file multi-camera recording. All cameras append their frames to one
+// file as self-describing chunks (frame header with the frame's chunk log
+// record, then the encoded image). Closing the file appends an index:
+//   - per camera, the chunk offset of every frame by capture index
+//   - a dense table [set][camera] of chunk offsets by synchronized frame set
+// followed by a fixed-size trailer at the very end of the file. The reader
+// maps the file and resolves a (set, camera) or (camera, capture index) to a
+// pointer into the mapping in O(1), without copying. A file without trailer
+// (e.g. after a crash) is indexed by scanning its chunks.
+//
+// Only needs ChunkLog.h, no Spinnaker, so offline tools can use the reader.
+//=============================================================================
+
+#ifndef FRAME_CONTAINER_H
+#define FRAME_CONTAINER_H
+
+#include "ChunkLog.h"
+#include "StorageScheduler.h"
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+const char k_containerMagic[8] = { 'M', 'C', 'A', 'M', 'R', 'E', 'C', '1' };
+const char k_containerFrameMagic[4] = { 'F', 'R', 'A', 'M' };
+const char k_containerIndexMagic[8] = { 'M', 'C', 'A', 'M', 'I', 'D', 'X', '1' };
+const uint32_t k_containerVersion = 2; // 2: ChunkLogRecord version 2
+const unsigned int k_containerMaxCameras = 16;
+const size_t k_containerWriteBuffer = 8 << 20;
+
+enum ContainerEncoding
+{
+	Container_Raw = 0, // uncompressed pixels, rows packed
+	Container_Jpeg = 1,
+	Container_Lossless = 2 // see LosslessCodec.h
+};
+
+// Pixel layout of the frame (of the decoded frame for JPEG)
+enum ContainerPixelFormat
+{
+	ContainerPixel_Mono8 = 0,
+	ContainerPixel_BGR8,
+	ContainerPixel_RGB8,
+	ContainerPixel_BayerRG8,
+	ContainerPixel_BayerGR8,
+	ContainerPixel_BayerGB8,
+	ContainerPixel_BayerBG8
+};
+
+struct ContainerFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t numCameras;
+	uint32_t reserved;
+	double frameRate;
+	uint64_t createdUnixTime;
+	char serialNumbers[k_containerMaxCameras][32];
+};
+
+struct ContainerFrameHeader {
+	char magic[4];
+	uint32_t headerSize;
+	uint32_t cameraIndex;
+	uint32_t encoding; // ContainerEncoding
+	int64_t setId; // synchronized frame set, see FrameSetAssembler
+	uint64_t payloadSize; // bytes of image data after this header, before padding
+	uint32_t width;
+	uint32_t height;
+	uint32_t pixelFormat; // ContainerPixelFormat
+	uint32_t reserved;
+	ChunkLogRecord record;
+};
+
+struct ContainerTrailer {
+	char magic[8];
+	uint64_t indexOffset;
+	int64_t firstSetId;
+	uint64_t numSets;
+	uint64_t numFrames[k_containerMaxCameras]; // per camera, by capture index
+};
+
+static_assert(sizeof(ContainerFileHeader) == 552, "ContainerFileHeader layout is part of the file format");
+static_assert(sizeof(ContainerFrameHeader) == 128, "ContainerFrameHeader layout is part of the file format");
+static_assert(sizeof(ContainerTrailer) == 160, "ContainerTrailer layout is part of the file format");
+
+// Chunks start on 8-byte boundaries
+inline uint64_t ContainerPadding(uint64_t size) { return (8 - (size & 7)) & 7; }
+
+const int64_t k_containerNoSet = std::numeric_limits<int64_t>::min();
+
+
+// Appends frames of all cameras to one container file. Append() may be
+// called from several writer threads at once; the payload must be ready
+// (encoded) before the call, only the copy into the write buffer is serialized.
+class FrameContainerWriter
+{
+public:
+	FrameContainerWriter() : m_numCameras(0) {}
+	~FrameContainerWriter() { Close(); }
+
+	// Returns 0 on success, -1 if the file cannot be created.
+	int Open(const std::string & filename, const std::vector<std::string> & serialNumbers, double frameRate)
+	{
+		Close();
+
+		if (serialNumbers.empty() || serialNumbers.size() > k_containerMaxCameras)
+			return -1;
+		if (m_file.Open(filename, k_containerWriteBuffer) < 0)
+			return -1;
+
+		ContainerFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, k_containerMagic, sizeof(header.magic));
+		header.version = k_containerVersion;
+		header.headerSize = sizeof(ContainerFileHeader);
+		header.numCameras = static_cast<uint32_t>(serialNumbers.size());
+		header.frameRate = frameRate;
+		header.createdUnixTime = static_cast<uint64_t>(time(NULL));
+		for (size_t i = 0; i < serialNumbers.size(); i++)
+			strncpy(header.serialNumbers[i], serialNumbers[i].c_str(), sizeof(header.serialNumbers[i]) - 1);
+
+		m_numCameras = header.numCameras;
+		m_frameOffsets.assign(m_numCameras, std::vector<uint64_t>());
+		m_setEntries.clear();
+
+		return m_file.Write(&header, sizeof(header));
+	}
+
+	// This function appends one frame. setId is the frame's synchronized
+	// frame set, k_containerNoSet if it has none. The frame is indexed by
+	// record.captureIndex. Returns 0 on success, -1 on error.
+	int Append(uint32_t cameraIndex, int64_t setId, const ChunkLogRecord & record, ContainerEncoding encoding,
+		ContainerPixelFormat pixelFormat, uint32_t width, uint32_t height, const void* payload, uint64_t payloadSize)
+	{
+		if (cameraIndex >= m_numCameras)
+			return -1;
+
+		ContainerFrameHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, k_containerFrameMagic, sizeof(header.magic));
+		header.headerSize = sizeof(ContainerFrameHeader);
+		header.cameraIndex = cameraIndex;
+		header.encoding = encoding;
+		header.setId = setId;
+		header.payloadSize = payloadSize;
+		header.width = width;
+		header.height = height;
+		header.pixelFormat = pixelFormat;
+		header.record = record;
+
+		static const char zeros[8] = { 0 };
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_file.IsOpen())
+			return -1;
+
+		const uint64_t offset = m_file.GetBytesWritten();
+		if (m_file.Write(&header, sizeof(header)) < 0 ||
+			m_file.Write(payload, static_cast<size_t>(payloadSize)) < 0 ||
+			m_file.Write(zeros, static_cast<size_t>(ContainerPadding(payloadSize))) < 0)
+			return -1;
+
+		std::vector<uint64_t> & offsets = m_frameOffsets[cameraIndex];
+		if (record.captureIndex >= offsets.size())
+			offsets.resize(record.captureIndex + 1, 0);
+		offsets[record.captureIndex] = offset;
+
+		if (setId != k_containerNoSet)
+		{
+			SetEntry entry = { setId, cameraIndex, offset };
+			m_setEntries.push_back(entry);
+		}
+
+		return 0;
+	}
+
+	// Writes the index and the trailer and closes the file.
+	int Close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_file.IsOpen())
+			return 0;
+
+		int result = 0;
+
+		ContainerTrailer trailer;
+		memset(&trailer, 0, sizeof(trailer));
+		memcpy(trailer.magic, k_containerIndexMagic, sizeof(trailer.magic));
+		trailer.indexOffset = m_file.GetBytesWritten();
+
+		for (uint32_t c = 0; c < m_numCameras; c++)
+		{
+			trailer.numFrames[c] = m_frameOffsets[c].size();
+			if (!m_frameOffsets[c].empty() && m_file.Write(&m_frameOffsets[c][0], m_frameOffsets[c].size() * sizeof(uint64_t)) < 0)
+				result = -1;
+		}
+
+		// Dense set table between the lowest and highest set, 0 where a camera is missing
+		std::vector<uint64_t> setTable;
+		BuildSetTable(trailer.firstSetId, trailer.numSets, setTable);
+		if (!setTable.empty() && m_file.Write(&setTable[0], setTable.size() * sizeof(uint64_t)) < 0)
+			result = -1;
+
+		if (m_file.Write(&trailer, sizeof(trailer)) < 0)
+			result = -1;
+		if (m_file.Close() < 0)
+			result = -1;
+
+		return result;
+	}
+
+	bool IsOpen() const { return m_file.IsOpen(); }
+
+private:
+	struct SetEntry {
+		int64_t setId;
+		uint32_t cameraIndex;
+		uint64_t offset;
+	};
+
+	FrameContainerWriter(const FrameContainerWriter &);
+	FrameContainerWriter & operator=(const FrameContainerWriter &);
+
+	void BuildSetTable(int64_t & firstSetId, uint64_t & numSets, std::vector<uint64_t> & setTable) const
+	{
+		firstSetId = 0;
+		numSets = 0;
+		if (m_setEntries.empty())
+			return;
+
+		int64_t minSet = m_setEntries[0].setId;
+		int64_t maxSet = m_setEntries[0].setId;
+		for (size_t i = 1; i < m_setEntries.size(); i++)
+		{
+			if (m_setEntries[i].setId < minSet) minSet = m_setEntries[i].setId;
+			if (m_setEntries[i].setId > maxSet) maxSet = m_setEntries[i].setId;
+		}
+
+		firstSetId = minSet;
+		numSets = static_cast<uint64_t>(maxSet - minSet) + 1;
+		setTable.assign(static_cast<size_t>(numSets * m_numCameras), 0);
+		for (size_t i = 0; i < m_setEntries.size(); i++)
+			setTable[static_cast<size_t>(m_setEntries[i].setId - minSet) * m_numCameras + m_setEntries[i].cameraIndex] = m_setEntries[i].offset;
+	}
+
+	std::mutex m_mutex;
+	AlignedFileWriter m_file;
+	uint32_t m_numCameras;
+	std::vector<std::vector<uint64_t> > m_frameOffsets;
+	std::vector<SetEntry> m_setEntries;
+};
+
+
+// A frame inside a mapped container. Pointers stay valid while the reader is open.
+struct ContainerFrame {
+	const ContainerFrameHeader* header;
+	const unsigned char* payload;
+
+	ContainerFrame() : header(NULL), payload(NULL) {}
+};
+
+
+// Read-only, memory-mapped access to a container file.
+class FrameContainerReader
+{
+public:
+	FrameContainerReader() : m_data(NULL), m_size(0), m_header(NULL), m_setTable(NULL),
+		m_firstSetId(0), m_numSets(0), m_recovered(false)
+	{
+#if defined(_WIN32)
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = NULL;
+#endif
+	}
+
+	~FrameContainerReader() { Close(); }
+
+	// Returns 0 on success, -1 on error (see GetError()).
+	int Open(const std::string & filename)
+	{
+		Close();
+		m_error.clear();
+
+		if (Map(filename) < 0)
+			return Fail("cannot map " + filename);
+
+		if (m_size < sizeof(ContainerFileHeader))
+			return Fail("file too short for a container header");
+
+		m_header = reinterpret_cast<const ContainerFileHeader*>(m_data);
+		if (memcmp(m_header->magic, k_containerMagic, sizeof(k_containerMagic)) != 0)
+			return Fail("not a container file");
+		if (m_header->numCameras == 0 || m_header->numCameras > k_containerMaxCameras || m_header->headerSize > m_size)
+			return Fail("corrupt container header");
+
+		if (ReadIndex() < 0 && ScanChunks() < 0)
+			return -1;
+
+		return 0;
+	}
+
+	void Close()
+	{
+#if defined(_WIN32)
+		if (m_data != NULL) UnmapViewOfFile(m_data);
+		if (m_mapping != NULL) CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+		m_mapping = NULL;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data != NULL) munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+		m_data = NULL;
+		m_size = 0;
+		m_header = NULL;
+		m_setTable = NULL;
+		m_frameTables.clear();
+		m_ownedFrameTables.clear();
+		m_ownedSetTable.clear();
+		m_firstSetId = 0;
+		m_numSets = 0;
+		m_recovered = false;
+	}
+
+	unsigned int GetNumCameras() const { return m_header->numCameras; }
+	std::string GetSerialNumber(unsigned int camera) const
+	{
+		return std::string(m_header->serialNumbers[camera], strnlen(m_header->serialNumbers[camera], sizeof(m_header->serialNumbers[camera])));
+	}
+	double GetFrameRate() const { return m_header->frameRate; }
+
+	int64_t GetFirstSetId() const { return m_firstSetId; }
+	uint64_t GetNumSets() const { return m_numSets; }
+	uint64_t GetNumFrames(unsigned int camera) const { return camera < m_frameTables.size() ? m_frameTables[camera].count : 0; }
+
+	// True if the file had no index and was indexed by scanning
+	bool IsRecovered() const { return m_recovered; }
+	const std::string & GetError() const { return m_error; }
+
+	// Frame of a camera in a synchronized frame set; false if the camera has none.
+	bool GetFrameInSet(int64_t setId, unsigned int camera, ContainerFrame & frame) const
+	{
+		if (setId < m_firstSetId || static_cast<uint64_t>(setId - m_firstSetId) >= m_numSets || camera >= GetNumCameras())
+			return false;
+
+		return FrameAt(m_setTable[static_cast<size_t>(setId - m_firstSetId) * GetNumCameras() + camera], frame);
+	}
+
+	// Frame of a camera by capture index (img_%06d)
+	bool GetFrame(unsigned int camera, uint64_t captureIndex, ContainerFrame & frame) const
+	{
+		if (camera >= m_frameTables.size() || captureIndex >= m_frameTables[camera].count)
+			return false;
+
+		return FrameAt(m_frameTables[camera].offsets[captureIndex], frame);
+	}
+
+private:
+	struct FrameTable {
+		const uint64_t* offsets;
+		uint64_t count;
+	};
+
+	FrameContainerReader(const FrameContainerReader &);
+	FrameContainerReader & operator=(const FrameContainerReader &);
+
+	int Fail(const std::string & error)
+	{
+		Close();
+		m_error = error;
+		return -1;
+	}
+
+	int Map(const std::string & filename)
+	{
+#if defined(_WIN32)
+		m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return -1;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(m_file, &fileSize) || fileSize.QuadPart == 0)
+			return -1;
+		m_size = static_cast<size_t>(fileSize.QuadPart);
+
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_mapping == NULL)
+			return -1;
+
+		m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+		return m_data != NULL ? 0 : -1;
+#else
+		int file = open(filename.c_str(), O_RDONLY);
+		if (file < 0)
+			return -1;
+
+		struct stat stats;
+		if (fstat(file, &stats) != 0 || stats.st_size == 0)
+		{
+			close(file);
+			return -1;
+		}
+		m_size = static_cast<size_t>(stats.st_size);
+
+		void* data = mmap(NULL, m_size, PROT_READ, MAP_SHARED, file, 0);
+		close(file);
+		if (data == MAP_FAILED)
+			return -1;
+
+		m_data = static_cast<const unsigned char*>(data);
+		return 0;
+#endif
+	}
+
+	// Returns the frame header at offset if it is a frame chunk whose header
+	// and payload lie inside the file, NULL otherwise. Sizes are compared
+	// against the room left, so corrupt sizes cannot wrap.
+	const ContainerFrameHeader* ChunkAt(uint64_t offset) const
+	{
+		if (offset == 0 || offset >= m_size || m_size - offset < sizeof(ContainerFrameHeader))
+			return NULL;
+
+		const ContainerFrameHeader* header = reinterpret_cast<const ContainerFrameHeader*>(m_data + offset);
+		const uint64_t room = m_size - offset;
+		if (memcmp(header->magic, k_containerFrameMagic, sizeof(k_containerFrameMagic)) != 0 ||
+			header->cameraIndex >= m_header->numCameras || header->headerSize < sizeof(ContainerFrameHeader) ||
+			header->headerSize > room || header->payloadSize > room - header->headerSize)
+			return NULL;
+		return header;
+	}
+
+	bool FrameAt(uint64_t offset, ContainerFrame & frame) const
+	{
+		const ContainerFrameHeader* header = ChunkAt(offset);
+		if (header == NULL)
+			return false;
+
+		frame.header = header;
+		frame.payload = m_data + offset + header->headerSize;
+		return true;
+	}
+
+	// Uses the index written by Close(). Returns -1 if there is none.
+	int ReadIndex()
+	{
+		if (m_size < m_header->headerSize + sizeof(ContainerTrailer))
+			return -1;
+
+		const ContainerTrailer* trailer = reinterpret_cast<const ContainerTrailer*>(m_data + m_size - sizeof(ContainerTrailer));
+		if (memcmp(trailer->magic, k_containerIndexMagic, sizeof(k_containerIndexMagic)) != 0)
+			return -1;
+
+		uint64_t tableEntries = trailer->numSets * m_header->numCameras;
+		for (unsigned int c = 0; c < m_header->numCameras; c++)
+			tableEntries += trailer->numFrames[c];
+		if (trailer->indexOffset + tableEntries * sizeof(uint64_t) + sizeof(ContainerTrailer) != m_size)
+			return -1;
+
+		const uint64_t* table = reinterpret_cast<const uint64_t*>(m_data + trailer->indexOffset);
+		m_frameTables.resize(m_header->numCameras);
+		for (unsigned int c = 0; c < m_header->numCameras; c++)
+		{
+			m_frameTables[c].offsets = table;
+			m_frameTables[c].count = trailer->numFrames[c];
+			table += trailer->numFrames[c];
+		}
+
+		m_setTable = table;
+		m_firstSetId = trailer->firstSetId;
+		m_numSets = trailer->numSets;
+
+		return 0;
+	}
+
+	// Rebuilds the index from the chunks, up to the first damaged one.
+	int ScanChunks()
+	{
+		const unsigned int numCameras = m_header->numCameras;
+		m_ownedFrameTables.assign(numCameras, std::vector<uint64_t>());
+
+		int64_t minSet = 0, maxSet = -1;
+		std::vector<std::pair<int64_t, uint64_t> > setFrames; // (set * cameras + camera, offset)
+
+		// No camera can have more frames than there are chunk headers in the file
+		const uint64_t maxFrames = m_size / sizeof(ContainerFrameHeader);
+
+		uint64_t offset = m_header->headerSize;
+		while (offset + sizeof(ContainerFrameHeader) <= m_size)
+		{
+			const ContainerFrameHeader* header = ChunkAt(offset);
+			if (header == NULL || header->record.captureIndex >= maxFrames)
+				break;
+
+			const uint64_t next = offset + header->headerSize + header->payloadSize + ContainerPadding(header->payloadSize);
+			if (next <= offset || next > m_size)
+				break;
+
+			std::vector<uint64_t> & offsets = m_ownedFrameTables[header->cameraIndex];
+			if (header->record.captureIndex >= offsets.size())
+				offsets.resize(header->record.captureIndex + 1, 0);
+			offsets[header->record.captureIndex] = offset;
+
+			if (header->setId != k_containerNoSet)
+			{
+				if (maxSet < minSet) minSet = maxSet = header->setId;
+				if (header->setId < minSet) minSet = header->setId;
+				if (header->setId > maxSet) maxSet = header->setId;
+				setFrames.push_back(std::make_pair(header->setId * numCameras + header->cameraIndex, offset));
+			}
+
+			offset = next;
+		}
+
+		if (offset == m_header->headerSize)
+			return Fail("container has no readable frames");
+
+		m_frameTables.resize(numCameras);
+		for (unsigned int c = 0; c < numCameras; c++)
+		{
+			m_frameTables[c].offsets = m_ownedFrameTables[c].empty() ? NULL : &m_ownedFrameTables[c][0];
+			m_frameTables[c].count = m_ownedFrameTables[c].size();
+		}
+
+		if (maxSet >= minSet)
+		{
+			m_firstSetId = minSet;
+			m_numSets = static_cast<uint64_t>(maxSet - minSet) + 1;
+			m_ownedSetTable.assign(static_cast<size_t>(m_numSets * numCameras), 0);
+			for (size_t i = 0; i < setFrames.size(); i++)
+				m_ownedSetTable[static_cast<size_t>(setFrames[i].first - minSet * numCameras)] = setFrames[i].second;
+			m_setTable = &m_ownedSetTable[0];
+		}
+
+		m_recovered = true;
+		return 0;
+	}
+
+#if defined(_WIN32)
+	HANDLE m_file;
+	HANDLE m_mapping;
+#endif
+	const unsigned char* m_data;
+	size_t m_size;
+	const ContainerFileHeader* m_header;
+
+	std::vector<FrameTable> m_frameTables;
+	const uint64_t* m_setTable;
+	int64_t m_firstSetId;
+	uint64_t m_numSets;
+
+	// Index built by ScanChunks() for files without one
+	std::vector<std::vector<uint64_t> > m_ownedFrameTables;
+	std::vector<uint64_t> m_ownedSetTable;
+	bool m_recovered;
+
+	std::string m_error;
+};
+
+#endif // FRAME_CONTAINER_H
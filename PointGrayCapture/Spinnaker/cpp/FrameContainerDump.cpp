@@ -0,0 +1,151 @@
+//=============================================================================
+// FrameContainerDump.cpp
+//
+// Inspects a multi-camera recording container (Recording.mcr) written by
+// AcquisitionMultipleThread with RECORD_CONTAINER. Only needs
+// FrameContainer.h and LosslessCodec.h, no Spinnaker.
+//
+// Usage:
+//   FrameContainerDump <Recording.mcr>                      summary
+//   FrameContainerDump <Recording.mcr> --sets               one line per frame set
+//   FrameContainerDump <Recording.mcr> --extract <set> <dir> write one set's frames
+//=============================================================================
+
+#include "FrameContainer.h"
+#include "LosslessCodec.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+// This function prints the cameras and frame counts of the container
+void DumpSummary(const FrameContainerReader & reader)
+{
+	cout << "# " << reader.GetNumCameras() << " cameras, " << reader.GetFrameRate() << " fps, sets "
+		<< reader.GetFirstSetId() << " to " << reader.GetFirstSetId() + static_cast<int64_t>(reader.GetNumSets()) - 1
+		<< (reader.IsRecovered() ? " (no index, recovered by scanning)" : "") << endl;
+
+	for (unsigned int c = 0; c < reader.GetNumCameras(); c++)
+	{
+		uint64_t bytes = 0;
+		uint64_t numFrames = 0;
+		for (uint64_t i = 0; i < reader.GetNumFrames(c); i++)
+		{
+			ContainerFrame frame;
+			if (reader.GetFrame(c, i, frame))
+			{
+				numFrames++;
+				bytes += frame.header->payloadSize;
+			}
+		}
+
+		cout << reader.GetSerialNumber(c) << "\t" << numFrames << " frames\t"
+			<< (numFrames > 0 ? bytes / numFrames / 1024 : 0) << " KB/frame" << endl;
+	}
+}
+
+
+// This function prints the capture index of every camera for every frame set,
+// in the same layout as SyncIndex.csv (-1 where a camera is missing)
+void DumpSets(const FrameContainerReader & reader)
+{
+	cout << "# set";
+	for (unsigned int c = 0; c < reader.GetNumCameras(); c++)
+		cout << "," << reader.GetSerialNumber(c);
+	cout << endl;
+
+	for (uint64_t s = 0; s < reader.GetNumSets(); s++)
+	{
+		const int64_t setId = reader.GetFirstSetId() + static_cast<int64_t>(s);
+		cout << setId;
+		for (unsigned int c = 0; c < reader.GetNumCameras(); c++)
+		{
+			ContainerFrame frame;
+			if (reader.GetFrameInSet(setId, c, frame))
+				cout << "," << frame.header->record.captureIndex;
+			else
+				cout << ",-1";
+		}
+		cout << "\n";
+	}
+}
+
+
+// This function writes the frames of one set as <dir>/<serial>_set<id>.jpg
+// (or .raw for uncompressed and lossless frames, rows packed)
+int ExtractSet(const FrameContainerReader & reader, int64_t setId, const string & folder)
+{
+	int numWritten = 0;
+	for (unsigned int c = 0; c < reader.GetNumCameras(); c++)
+	{
+		ContainerFrame frame;
+		if (!reader.GetFrameInSet(setId, c, frame))
+		{
+			cout << reader.GetSerialNumber(c) << ": missing" << endl;
+			continue;
+		}
+
+		char buffer[64]; sprintf(buffer, "_set%lld", static_cast<long long>(setId));
+		string filename = folder + "/" + reader.GetSerialNumber(c) + buffer +
+			(frame.header->encoding == Container_Jpeg ? ".jpg" : ".raw");
+
+		const unsigned char* data = frame.payload;
+		size_t dataSize = static_cast<size_t>(frame.header->payloadSize);
+		vector<unsigned char> pixels;
+		if (frame.header->encoding == Container_Lossless)
+		{
+			if (DecodeLosslessFrame(frame, pixels) < 0)
+			{
+				cout << reader.GetSerialNumber(c) << ": damaged lossless frame" << endl;
+				continue;
+			}
+			data = &pixels[0];
+			dataSize = pixels.size();
+		}
+
+		FILE* file = fopen(filename.c_str(), "wb");
+		if (file == NULL || fwrite(data, 1, dataSize, file) != dataSize)
+		{
+			cout << "Unable to write " << filename << endl;
+			if (file != NULL) fclose(file);
+			continue;
+		}
+		fclose(file);
+
+		cout << reader.GetSerialNumber(c) << ": " << filename << " (" << frame.header->width << "x" << frame.header->height
+			<< ", frame ID " << frame.header->record.frameID << ", capture index " << frame.header->record.captureIndex << ")" << endl;
+		numWritten++;
+	}
+
+	return numWritten;
+}
+
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		cout << "Usage: FrameContainerDump <Recording.mcr> [--sets | --extract <set> <dir>]" << endl;
+		return 1;
+	}
+
+	FrameContainerReader reader;
+	if (reader.Open(argv[1]) < 0)
+	{
+		cout << "Error: " << reader.GetError() << endl;
+		return -1;
+	}
+
+	if (argc > 2 && string(argv[2]) == "--sets")
+		DumpSets(reader);
+	else if (argc > 4 && string(argv[2]) == "--extract")
+		return ExtractSet(reader, atoll(argv[3]), argv[4]) > 0 ? 0 : -1;
+	else
+		DumpSummary(reader);
+
+	return 0;
+}
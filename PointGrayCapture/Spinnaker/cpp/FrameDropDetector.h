@@ -0,0 +1,218 @@
+//=============================================================================
+// FrameDropDetector.h
+//
+// Online check of one camera's frame stream, run on the grab thread. Every
+// grabbed frame's chunk FrameID and device timestamp are compared with the
+// previous one and the expected frame period, and anything unexpected is
+// classified:
+//
+//   incomplete    the image arrived incomplete (transfer error)
+//   driver drop   FrameIDs were skipped: the camera sent frames the host
+//                 never got, overwritten in the stream buffers or lost
+//   trigger miss  FrameIDs are continuous but the timestamps skipped whole
+//                 periods: the camera did not expose on some triggers
+//   timing        the timestamp delta is off the period grid
+//
+// Events raise an operator alarm (a console banner with the events of the
+// last few seconds and running totals), rate-limited per camera.
+//=============================================================================
+
+#ifndef FRAME_DROP_DETECTOR_H
+#define FRAME_DROP_DETECTOR_H
+
+#include "CaptureLog.h"
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <sstream>
+#include <string>
+
+// Fraction of a frame period a timestamp delta may be off the period grid
+const double k_frameTimingTolerance = 0.25;
+
+enum FrameEventType
+{
+	FrameEvent_Incomplete,
+	FrameEvent_DriverDrop,
+	FrameEvent_TriggerMiss,
+	FrameEvent_Timing,
+	k_numFrameEventTypes
+};
+
+inline const char* GetFrameEventName(int type)
+{
+	static const char* names[k_numFrameEventTypes] = { "incomplete", "driver drop", "trigger miss", "timing" };
+	return type >= 0 && type < k_numFrameEventTypes ? names[type] : "unknown";
+}
+
+// What the operator should look at for each event type
+inline const char* GetFrameEventHint(int type)
+{
+	static const char* hints[k_numFrameEventTypes] = {
+		"transfer errors, check the cable and the NIC/USB port",
+		"host not consuming fast enough or link overloaded, see the Stream: lines",
+		"camera skipped triggers, check the trigger cable and the primary camera",
+		"irregular trigger timing"
+	};
+	return type >= 0 && type < k_numFrameEventTypes ? hints[type] : "";
+}
+
+
+class FrameDropDetector
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// frameRate is the rate frames are expected at (the trigger rate for
+	// triggered cameras). Events within windowSeconds are shown together;
+	// an alarm is printed at most every repeatSeconds.
+	FrameDropDetector(const std::string & serialNumber, double frameRate, double windowSeconds = 10.0, double repeatSeconds = 5.0) :
+		m_serialNumber(serialNumber),
+		m_periodNs(frameRate > 0 ? 1e9 / frameRate : 0.0),
+		m_window(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(windowSeconds))),
+		m_repeat(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(repeatSeconds))),
+		m_lastFrameID(-1), m_lastTimestamp(0), m_incompleteSinceFrame(0), m_missingFrameIDs(0), m_numAlarms(0),
+		m_alarmPrinted(false), m_alarmPending(false)
+	{
+		for (int i = 0; i < k_numFrameEventTypes; i++)
+			m_totals[i] = 0;
+	}
+
+	void OnIncomplete(Clock::time_point now)
+	{
+		m_incompleteSinceFrame++;
+		Raise(FrameEvent_Incomplete, 1, now);
+	}
+
+	void OnFrame(int64_t frameID, uint64_t deviceTimestamp, Clock::time_point now)
+	{
+		if (m_lastFrameID < 0 || frameID <= m_lastFrameID)
+		{
+			// First frame, or the camera restarted its counter
+			Reset(frameID, deviceTimestamp);
+			return;
+		}
+
+		// Incomplete images used up FrameIDs too; they were reported already
+		const int64_t skipped = frameID - m_lastFrameID - 1;
+		m_missingFrameIDs += static_cast<uint64_t>(skipped);
+		const int64_t dropped = skipped - static_cast<int64_t>(m_incompleteSinceFrame);
+		if (dropped > 0)
+			Raise(FrameEvent_DriverDrop, static_cast<uint64_t>(dropped), now);
+
+		if (m_periodNs > 0 && deviceTimestamp > m_lastTimestamp)
+		{
+			const double periods = (deviceTimestamp - m_lastTimestamp) / m_periodNs;
+			const double wholePeriods = std::floor(periods + 0.5);
+			const int64_t expected = skipped + 1;
+
+			if (std::fabs(periods - wholePeriods) > k_frameTimingTolerance || wholePeriods < 1)
+				Raise(FrameEvent_Timing, 1, now);
+			else if (static_cast<int64_t>(wholePeriods) > expected)
+				Raise(FrameEvent_TriggerMiss, static_cast<uint64_t>(wholePeriods) - expected, now);
+		}
+
+		Reset(frameID, deviceTimestamp);
+	}
+
+	// Prints an alarm held back by the rate limit once it may be shown; call
+	// this regularly so the last events of a burst are not left unreported.
+	void Poll(Clock::time_point now)
+	{
+		if (m_alarmPending && now - m_lastAlarm >= m_repeat)
+			PrintAlarm(now);
+	}
+
+	uint64_t GetTotal(FrameEventType type) const { return m_totals[type]; }
+	uint64_t GetMissingFrameIDs() const { return m_missingFrameIDs; }
+	uint64_t GetNumAlarms() const { return m_numAlarms; }
+
+	// Running totals, e.g. "0 incomplete, 3 driver drop, 0 trigger miss, 0 timing"
+	std::string GetTotalsText() const
+	{
+		std::ostringstream text;
+		for (int i = 0; i < k_numFrameEventTypes; i++)
+			text << (i > 0 ? ", " : "") << m_totals[i] << " " << GetFrameEventName(i);
+		return text.str();
+	}
+
+private:
+	struct Event {
+		Clock::time_point time;
+		FrameEventType type;
+		uint64_t count;
+	};
+
+	void Reset(int64_t frameID, uint64_t deviceTimestamp)
+	{
+		m_lastFrameID = frameID;
+		m_lastTimestamp = deviceTimestamp;
+		m_incompleteSinceFrame = 0;
+	}
+
+	void Raise(FrameEventType type, uint64_t count, Clock::time_point now)
+	{
+		m_totals[type] += count;
+
+		Event event;
+		event.time = now;
+		event.type = type;
+		event.count = count;
+		m_recent.push_back(event);
+		while (!m_recent.empty() && now - m_recent.front().time > m_window)
+			m_recent.pop_front();
+
+		if (m_alarmPrinted && now - m_lastAlarm < m_repeat)
+		{
+			m_alarmPending = true;
+			return;
+		}
+		PrintAlarm(now);
+	}
+
+	void PrintAlarm(Clock::time_point now)
+	{
+		while (!m_recent.empty() && now - m_recent.front().time > m_window)
+			m_recent.pop_front();
+
+		m_alarmPrinted = true;
+		m_alarmPending = false;
+		m_lastAlarm = now;
+		m_numAlarms++;
+
+		uint64_t inWindow[k_numFrameEventTypes] = { 0 };
+		for (size_t i = 0; i < m_recent.size(); i++)
+			inWindow[m_recent[i].type] += m_recent[i].count;
+
+		std::ostringstream alarm;
+		alarm << "!!! [" << m_serialNumber << "] FRAME ALARM, last "
+			<< std::chrono::duration_cast<std::chrono::seconds>(m_window).count() << " s:";
+		for (int i = 0; i < k_numFrameEventTypes; i++)
+		{
+			if (inWindow[i] > 0)
+				alarm << " " << inWindow[i] << " " << GetFrameEventName(i) << " (" << GetFrameEventHint(i) << ");";
+		}
+		alarm << " totals: " << GetTotalsText() << "\n";
+		CAPTURE_LOG(Log_Warning) << alarm.str();
+	}
+
+	std::string m_serialNumber;
+	double m_periodNs;
+	Clock::duration m_window;
+	Clock::duration m_repeat;
+
+	int64_t m_lastFrameID;
+	uint64_t m_lastTimestamp;
+	uint64_t m_incompleteSinceFrame;
+
+	uint64_t m_totals[k_numFrameEventTypes];
+	uint64_t m_missingFrameIDs;
+	uint64_t m_numAlarms;
+	std::deque<Event> m_recent;
+	bool m_alarmPrinted;
+	bool m_alarmPending;
+	Clock::time_point m_lastAlarm;
+};
+
+#endif // FRAME_DROP_DETECTOR_H
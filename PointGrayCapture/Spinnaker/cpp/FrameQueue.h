@@ -0,0 +1,116 @@
+//=============================================================================
+// FrameQueue.h
+//
+// Bounded single-producer/single-consumer ring used to hand grabbed frames
+// from a camera's grab thread to its writer thread. Push never blocks: when
+// the ring is full the frame is dropped and counted, so a stalled encoder or
+// disk costs frames on the host side instead of delaying GetNextImage().
+// The producer may raise the capacity at runtime up to the maximum given at
+// construction.
+//=============================================================================
+
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+template <typename T>
+class FrameQueue
+{
+public:
+	// One slot is kept empty to tell a full ring from an empty one.
+	explicit FrameQueue(unsigned int capacity, unsigned int maxCapacity = 0) :
+		m_slots((maxCapacity > capacity ? maxCapacity : capacity) + 1), m_capacity(capacity),
+		m_head(0), m_tail(0), m_closed(false), m_pushed(0), m_dropped(0), m_highWater(0) {}
+
+	// Producer side. Returns false and counts a drop when the ring is full.
+	bool TryPush(const T & item)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		const size_t next = Next(tail);
+		if (next == m_head.load(std::memory_order_acquire) || Size() >= m_capacity)
+		{
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		m_slots[tail] = item;
+		m_tail.store(next, std::memory_order_release);
+		m_pushed.fetch_add(1, std::memory_order_relaxed);
+
+		unsigned int depth = Size();
+		if (depth > m_highWater.load(std::memory_order_relaxed))
+			m_highWater.store(depth, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	// Consumer side. Returns false when the ring is empty.
+	bool TryPop(T & item)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+
+		item = m_slots[head];
+		// Drop the slot's own reference so the frame is freed by the consumer
+		m_slots[head] = T();
+		m_head.store(Next(head), std::memory_order_release);
+
+		return true;
+	}
+
+	// Producer side. Raises (or lowers) the number of frames the ring accepts,
+	// clamped to the maximum capacity. Returns the new capacity.
+	unsigned int SetCapacity(unsigned int capacity)
+	{
+		m_capacity = capacity < MaxCapacity() ? capacity : MaxCapacity();
+		return m_capacity;
+	}
+
+	// Called by the producer once no more frames will be pushed.
+	void Close() { m_closed.store(true, std::memory_order_release); }
+
+	// True once the producer has closed the ring and every frame was popped.
+	bool IsDrained() const
+	{
+		return m_closed.load(std::memory_order_acquire) &&
+			m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+	}
+
+	unsigned int Size() const
+	{
+		const size_t head = m_head.load(std::memory_order_acquire);
+		const size_t tail = m_tail.load(std::memory_order_acquire);
+		return static_cast<unsigned int>((tail + m_slots.size() - head) % m_slots.size());
+	}
+
+	unsigned int Capacity() const { return m_capacity; }
+	unsigned int MaxCapacity() const { return static_cast<unsigned int>(m_slots.size() - 1); }
+	uint64_t PushedCount() const { return m_pushed.load(std::memory_order_relaxed); }
+	uint64_t DroppedCount() const { return m_dropped.load(std::memory_order_relaxed); }
+	unsigned int HighWaterMark() const { return m_highWater.load(std::memory_order_relaxed); }
+
+private:
+	FrameQueue(const FrameQueue &);
+	FrameQueue & operator=(const FrameQueue &);
+
+	size_t Next(size_t index) const { return (index + 1) % m_slots.size(); }
+
+	std::vector<T> m_slots;
+	unsigned int m_capacity; // producer only
+
+	// Keep the consumer and producer indices on separate cache lines
+	alignas(64) std::atomic<size_t> m_head;
+	alignas(64) std::atomic<size_t> m_tail;
+
+	std::atomic<bool> m_closed;
+	std::atomic<uint64_t> m_pushed;
+	std::atomic<uint64_t> m_dropped;
+	std::atomic<unsigned int> m_highWater;
+};
+
+#endif // FRAME_QUEUE_H
@@ -0,0 +1,305 @@
+//=============================================================================
+// FrameSetAssembler.h
+//
+// Online cross-camera frame-set assembly. Every camera's writer thread
+// reports (camera, FrameID, host timestamp, common timestamp, capture index)
+// for each recorded frame; frames with the same trigger pulse are collected into a frame set,
+// and each set is written to a synced-set index as soon as it is complete or
+// can no longer become complete.
+//
+// A set is identified by the trigger pulse number. A camera's first frame is
+// placed on the pulse grid by its frame time, so a camera that missed the
+// first pulses is still aligned; after that its FrameID deltas give the pulse.
+// The frame time is the common timestamp (device clock mapped to the host
+// clock, see DeviceClock.h) when the camera has one, else the host grab time;
+// set skew is measured on the same times.
+//=============================================================================
+
+#ifndef FRAME_SET_ASSEMBLER_H
+#define FRAME_SET_ASSEMBLER_H
+
+#include "CaptureLog.h"
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <limits>
+
+class FrameSetAssembler
+{
+public:
+	// frameRate sets the pulse grid; a complete set whose frame times
+	// spread more than skewToleranceUs is flagged as skewed. A set that is
+	// still incomplete maxWaitMs after its first frame is given up.
+	FrameSetAssembler(const std::vector<std::string> & serialNumbers, double frameRate,
+		double skewToleranceUs, double maxWaitMs) :
+		m_serialNumbers(serialNumbers),
+		m_periodNs(1e9 / frameRate),
+		m_skewToleranceNs(skewToleranceUs * 1000.0),
+		m_maxWaitNs(maxWaitMs * 1e6),
+		m_cameras(serialNumbers.size()),
+		m_haveReference(false),
+		m_referenceTime(0),
+		m_nextSetId(std::numeric_limits<int64_t>::min()),
+		m_indexFile(NULL),
+		m_numComplete(0), m_numSkewed(0), m_numIncomplete(0), m_numLateFrames(0), m_maxSkewNs(0), m_sumSkewNs(0) {}
+
+	~FrameSetAssembler() { Close(); }
+
+	// Returns 0 on success, -1 if the index file cannot be created.
+	int Open(const std::string & indexFilename)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_indexFile = fopen(indexFilename.c_str(), "w");
+		if (m_indexFile == NULL)
+			return -1;
+
+		fprintf(m_indexFile, "# set,status,skew_us");
+		for (size_t i = 0; i < m_serialNumbers.size(); i++)
+			fprintf(m_indexFile, ",%s", m_serialNumbers[i].c_str());
+		fprintf(m_indexFile, "\n");
+
+		return 0;
+	}
+
+	int GetCameraIndex(const std::string & serialNumber) const
+	{
+		for (size_t i = 0; i < m_serialNumbers.size(); i++)
+		{
+			if (m_serialNumbers[i] == serialNumber)
+				return static_cast<int>(i);
+		}
+		return -1;
+	}
+
+	// Reports one recorded frame and returns the frame set it belongs to.
+	// commonTimestamp is 0 if the camera has no clock model. Frames of a
+	// camera must arrive in order.
+	int64_t AddFrame(int cameraIndex, int64_t frameID, uint64_t hostTimestamp, uint64_t commonTimestamp, uint32_t captureIndex)
+	{
+		if (cameraIndex < 0 || cameraIndex >= static_cast<int>(m_cameras.size()))
+			return std::numeric_limits<int64_t>::min();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		CameraState & camera = m_cameras[cameraIndex];
+		const uint64_t frameTime = commonTimestamp != 0 ? commonTimestamp : hostTimestamp;
+
+		if (!m_haveReference)
+		{
+			m_haveReference = true;
+			m_referenceTime = frameTime;
+		}
+
+		if (!camera.started)
+		{
+			camera.started = true;
+			camera.firstFrameID = frameID;
+			camera.firstSetId = static_cast<int64_t>(floor((static_cast<double>(frameTime) - static_cast<double>(m_referenceTime)) / m_periodNs + 0.5));
+		}
+
+		int64_t setId = camera.firstSetId + (frameID - camera.firstFrameID);
+		camera.lastSetId = setId;
+
+		if (setId < m_nextSetId)
+		{
+			// The set was already written out as incomplete
+			m_numLateFrames++;
+		}
+		else
+		{
+			PendingSet & set = m_pending[setId];
+			if (set.captureIndices.empty())
+			{
+				set.captureIndices.assign(m_cameras.size(), -1);
+				set.minFrameTime = frameTime;
+				set.maxFrameTime = frameTime;
+				set.firstArrival = hostTimestamp;
+			}
+
+			if (set.captureIndices[cameraIndex] < 0)
+				set.numFrames++;
+			set.captureIndices[cameraIndex] = static_cast<int64_t>(captureIndex);
+			if (frameTime < set.minFrameTime) set.minFrameTime = frameTime;
+			if (frameTime > set.maxFrameTime) set.maxFrameTime = frameTime;
+		}
+
+		EmitReadySets(hostTimestamp, false);
+
+		return setId;
+	}
+
+	// A finished camera no longer holds back sets it is missing from.
+	void CameraFinished(int cameraIndex)
+	{
+		if (cameraIndex < 0 || cameraIndex >= static_cast<int>(m_cameras.size()))
+			return;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cameras[cameraIndex].finished = true;
+		EmitReadySets(0, false);
+	}
+
+	// Writes out every pending set and prints the session summary.
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_indexFile == NULL)
+			return;
+
+		EmitReadySets(0, true);
+
+		fclose(m_indexFile);
+		m_indexFile = NULL;
+
+		CAPTURE_LOG(Log_Info) << "[sync] Frame sets: " << m_numComplete << " complete, " << m_numSkewed << " skewed, "
+			<< m_numIncomplete << " incomplete, " << m_numLateFrames << " late frames, skew mean "
+			<< GetMeanSkewUs() << " us, max " << m_maxSkewNs / 1000 << " us";
+	}
+
+	uint64_t GetNumComplete() const { return m_numComplete; }
+	uint64_t GetNumSkewed() const { return m_numSkewed; }
+	uint64_t GetNumIncomplete() const { return m_numIncomplete; }
+	double GetMeanSkewUs() const
+	{
+		const uint64_t numSets = m_numComplete + m_numSkewed;
+		return numSets > 0 ? m_sumSkewNs / 1000.0 / numSets : 0.0;
+	}
+
+private:
+	struct CameraState {
+		bool started;
+		bool finished;
+		int64_t firstFrameID;
+		int64_t firstSetId;
+		int64_t lastSetId;
+
+		CameraState() : started(false), finished(false), firstFrameID(0), firstSetId(0),
+			lastSetId(std::numeric_limits<int64_t>::min()) {}
+	};
+
+	struct PendingSet {
+		std::vector<int64_t> captureIndices; // -1 while missing
+		size_t numFrames;
+		uint64_t minFrameTime;
+		uint64_t maxFrameTime;
+		uint64_t firstArrival; // host timestamp
+
+		PendingSet() : numFrames(0), minFrameTime(0), maxFrameTime(0), firstArrival(0) {}
+	};
+
+	// A missing camera can still deliver the set unless it has already moved
+	// past it or has finished.
+	bool CanStillComplete(int64_t setId, const PendingSet & set) const
+	{
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			if (set.captureIndices[i] >= 0)
+				continue;
+
+			const CameraState & camera = m_cameras[i];
+			if (!camera.finished && camera.lastSetId < setId)
+				return true;
+		}
+		return false;
+	}
+
+	// Writes sets in order, oldest first, while the oldest one is decided.
+	void EmitReadySets(uint64_t now, bool flushAll)
+	{
+		while (!m_pending.empty())
+		{
+			std::map<int64_t, PendingSet>::iterator it = m_pending.begin();
+			const PendingSet & set = it->second;
+
+			const bool complete = set.numFrames == m_cameras.size();
+			const bool timedOut = now > set.firstArrival && (now - set.firstArrival) > m_maxWaitNs;
+			if (!complete && !flushAll && !timedOut && CanStillComplete(it->first, set))
+				break;
+
+			WriteSet(it->first, set, complete);
+
+			m_nextSetId = it->first + 1;
+			m_pending.erase(it);
+		}
+	}
+
+	void WriteSet(int64_t setId, const PendingSet & set, bool complete)
+	{
+		const uint64_t skew = set.maxFrameTime - set.minFrameTime;
+		const char* status = "incomplete";
+
+		if (!complete)
+		{
+			m_numIncomplete++;
+
+			// Report immediately, but do not flood the console if a camera is gone
+			if (m_numIncomplete <= 10 || m_numIncomplete % 100 == 0)
+			{
+				std::string missing;
+				for (size_t i = 0; i < m_cameras.size(); i++)
+				{
+					if (set.captureIndices[i] < 0)
+						missing += " " + m_serialNumbers[i];
+				}
+				CAPTURE_LOG(Log_Warning) << "[sync] Frame set " << setId << " incomplete, missing" << missing << " (" << m_numIncomplete << " incomplete so far)";
+			}
+		}
+		else if (skew > m_skewToleranceNs)
+		{
+			status = "skewed";
+			m_numSkewed++;
+
+			if (m_numSkewed <= 10 || m_numSkewed % 100 == 0)
+				CAPTURE_LOG(Log_Warning) << "[sync] Frame set " << setId << " skewed by " << skew / 1000 << " us (" << m_numSkewed << " skewed so far)";
+		}
+		else
+		{
+			status = "complete";
+			m_numComplete++;
+		}
+
+		if (complete && skew > m_maxSkewNs)
+			m_maxSkewNs = skew;
+		if (complete)
+			m_sumSkewNs += skew;
+
+		if (m_indexFile == NULL)
+			return;
+
+		fprintf(m_indexFile, "%lld,%s,%llu", static_cast<long long>(setId), status,
+			static_cast<unsigned long long>(complete ? skew / 1000 : 0));
+		for (size_t i = 0; i < set.captureIndices.size(); i++)
+			fprintf(m_indexFile, ",%lld", static_cast<long long>(set.captureIndices[i]));
+		fprintf(m_indexFile, "\n");
+	}
+
+	FrameSetAssembler(const FrameSetAssembler &);
+	FrameSetAssembler & operator=(const FrameSetAssembler &);
+
+	std::mutex m_mutex;
+	std::vector<std::string> m_serialNumbers;
+	double m_periodNs;
+	double m_skewToleranceNs;
+	double m_maxWaitNs;
+
+	std::vector<CameraState> m_cameras;
+	bool m_haveReference;
+	uint64_t m_referenceTime;
+
+	std::map<int64_t, PendingSet> m_pending;
+	int64_t m_nextSetId;
+	FILE* m_indexFile;
+
+	uint64_t m_numComplete;
+	uint64_t m_numSkewed;
+	uint64_t m_numIncomplete;
+	uint64_t m_numLateFrames;
+	uint64_t m_maxSkewNs;
+	uint64_t m_sumSkewNs;
+};
+
+#endif // FRAME_SET_ASSEMBLER_H
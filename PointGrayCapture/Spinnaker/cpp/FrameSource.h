@@ -0,0 +1,336 @@
+//=============================================================================
+// FrameSource.h
+//
+// Frame-source interface behind the grab loop. SpinnakerFrameSource wraps a
+// physical camera; SyntheticFrameSource produces paced frames with realistic
+// chunk data so the capture pipeline can be benchmarked without hardware.
+//=============================================================================
+
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include "Spinnaker.h"
+#include "StreamBuffers.h"
+#include "CaptureLog.h"
+#include <chrono>
+#include <thread>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock HostClock;
+
+// Chunk data of one frame, copied out of the image on the grab thread so it
+// can be logged after the camera buffer has been released.
+struct FrameChunkData {
+	int64_t frameID;
+	uint64_t timestamp; // device clock, nanoseconds
+	double exposureTime; // microseconds
+	double gain; // decibels
+	int64_t width;
+	int64_t height;
+	int64_t offsetX;
+	int64_t offsetY;
+	int64_t sequencerSetActive;
+	bool valid; // false if the chunk data could not be read
+
+	FrameChunkData() : frameID(0), timestamp(0), exposureTime(0), gain(0),
+		width(0), height(0), offsetX(0), offsetY(0), sequencerSetActive(0), valid(false) {}
+};
+
+// A frame retrieved from a frame source. Hand it back with ReleaseFrame().
+struct SourceFrame {
+	Spinnaker::ImagePtr image;
+	FrameChunkData chunkData;
+	bool incomplete;
+	int imageStatus;
+
+	SourceFrame() : incomplete(false), imageStatus(0) {}
+};
+
+
+class FrameSource
+{
+public:
+	virtual ~FrameSource() {}
+
+	virtual std::string GetSerialNumber() = 0;
+	virtual float GetFrameRate() = 0;
+	virtual unsigned int GetWidth() = 0;
+	virtual unsigned int GetHeight() = 0;
+
+	virtual void BeginAcquisition() = 0;
+	virtual void EndAcquisition() = 0;
+
+	// Blocks until the next frame arrives; throws Spinnaker::Exception on failure.
+	virtual void GrabNextFrame(SourceFrame & frame) = 0;
+	virtual void ReleaseFrame(SourceFrame & frame) = 0;
+
+	// Driver-side stream counters; false if the source has none.
+	virtual bool GetStreamStats(StreamStats &) { return false; }
+
+	// Latches and reads the device clock the chunk Timestamp counts in,
+	// nanoseconds; false if the source cannot.
+	virtual bool LatchDeviceClock(uint64_t &) { return false; }
+};
+
+
+// Frames from a Spinnaker camera. The camera must already be initialized and
+// configured; this only covers the acquisition part.
+class SpinnakerFrameSource : public FrameSource
+{
+public:
+	SpinnakerFrameSource(Spinnaker::CameraPtr pCam, const std::string & serialNumber) :
+		m_pCam(pCam), m_serialNumber(serialNumber) {}
+
+	std::string GetSerialNumber() { return m_serialNumber; }
+
+	float GetFrameRate()
+	{
+		Spinnaker::GenApi::CFloatPtr ptrAcquisitionFrameRate = m_pCam->GetNodeMap().GetNode("AcquisitionFrameRate");
+		if (!Spinnaker::GenApi::IsAvailable(ptrAcquisitionFrameRate) || !Spinnaker::GenApi::IsReadable(ptrAcquisitionFrameRate))
+			return 0.0f;
+
+		return static_cast<float>(ptrAcquisitionFrameRate->GetValue());
+	}
+
+	unsigned int GetWidth() { return GetIntegerValue("Width"); }
+	unsigned int GetHeight() { return GetIntegerValue("Height"); }
+
+	void BeginAcquisition() { m_pCam->BeginAcquisition(); }
+	void EndAcquisition() { m_pCam->EndAcquisition(); }
+
+	void GrabNextFrame(SourceFrame & frame)
+	{
+		frame.image = m_pCam->GetNextImage();
+		frame.incomplete = frame.image->IsIncomplete();
+		frame.imageStatus = static_cast<int>(frame.image->GetImageStatus());
+		frame.chunkData = FrameChunkData();
+
+		if (frame.incomplete)
+			return;
+
+		try
+		{
+			const Spinnaker::ChunkData & chunkData = frame.image->GetChunkData();
+
+			frame.chunkData.frameID = chunkData.GetFrameID();
+			frame.chunkData.timestamp = chunkData.GetTimestamp();
+			frame.chunkData.exposureTime = static_cast<double>(chunkData.GetExposureTime());
+			frame.chunkData.gain = static_cast<double>(chunkData.GetGain());
+			frame.chunkData.width = chunkData.GetWidth();
+			frame.chunkData.height = chunkData.GetHeight();
+			frame.chunkData.offsetX = chunkData.GetOffsetX();
+			frame.chunkData.offsetY = chunkData.GetOffsetY();
+			frame.chunkData.sequencerSetActive = chunkData.GetSequencerSetActive();
+			frame.chunkData.valid = true;
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			CAPTURE_LOG(Log_Error) << "[" << m_serialNumber << "] " << "Chunk data error: " << e.what();
+		}
+	}
+
+	void ReleaseFrame(SourceFrame & frame)
+	{
+		// Return the buffer to the stream
+		frame.image->Release();
+		frame.image = Spinnaker::ImagePtr();
+	}
+
+	bool GetStreamStats(StreamStats & stats) { return ReadStreamStats(m_pCam->GetTLStreamNodeMap(), stats); }
+
+	// SFNC cameras latch with TimestampLatch, older GigE models with
+	// GevTimestampControlLatch
+	bool LatchDeviceClock(uint64_t & deviceNs)
+	{
+		try
+		{
+			Spinnaker::GenApi::INodeMap & nodeMap = m_pCam->GetNodeMap();
+			Spinnaker::GenApi::CCommandPtr ptrLatch = nodeMap.GetNode("TimestampLatch");
+			Spinnaker::GenApi::CIntegerPtr ptrValue = nodeMap.GetNode("TimestampLatchValue");
+			if (!Spinnaker::GenApi::IsAvailable(ptrLatch))
+			{
+				ptrLatch = nodeMap.GetNode("GevTimestampControlLatch");
+				ptrValue = nodeMap.GetNode("GevTimestampValue");
+			}
+			if (!Spinnaker::GenApi::IsAvailable(ptrLatch) || !Spinnaker::GenApi::IsWritable(ptrLatch) ||
+				!Spinnaker::GenApi::IsAvailable(ptrValue) || !Spinnaker::GenApi::IsReadable(ptrValue))
+				return false;
+
+			ptrLatch->Execute();
+			deviceNs = static_cast<uint64_t>(ptrValue->GetValue());
+			return true;
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			CAPTURE_LOG(Log_Error) << "[" << m_serialNumber << "] " << "Timestamp latch error: " << e.what();
+			return false;
+		}
+	}
+
+private:
+	unsigned int GetIntegerValue(const char* name)
+	{
+		Spinnaker::GenApi::CIntegerPtr ptrNode = m_pCam->GetNodeMap().GetNode(name);
+		if (!Spinnaker::GenApi::IsAvailable(ptrNode) || !Spinnaker::GenApi::IsReadable(ptrNode))
+			return 0;
+
+		return static_cast<unsigned int>(ptrNode->GetValue());
+	}
+
+	Spinnaker::CameraPtr m_pCam;
+	std::string m_serialNumber;
+};
+
+
+struct SyntheticCameraOptions {
+	std::string serialNumber;
+	unsigned int width;
+	unsigned int height;
+	Spinnaker::PixelFormatEnums pixelFormat; // PixelFormat_BGR8 or a Bayer 8 format
+	float frameRate;
+	double exposureTime; // microseconds
+	double gain; // decibels
+	double clockDriftPpm; // device clock drift against the host clock
+
+	SyntheticCameraOptions() : width(1280), height(1024), pixelFormat(Spinnaker::PixelFormat_BGR8),
+		frameRate(20.0f), exposureTime(15000.0), gain(6.8), clockDriftPpm(25.0) {}
+};
+
+
+// Frames paced at the configured rate from a small set of pre-generated
+// noisy patterns, so encoders see realistic content without per-frame cost on
+// the grab thread. If the consumer falls behind by more than one period the
+// missed frames are skipped and their FrameIDs are lost, as they would be
+// with an OldestFirstOverwrite stream on a real camera.
+class SyntheticFrameSource : public FrameSource
+{
+public:
+	explicit SyntheticFrameSource(const SyntheticCameraOptions & options) :
+		m_options(options), m_frameID(0), m_skippedFrames(0)
+	{
+		const unsigned int bytesPerPixel = (options.pixelFormat == Spinnaker::PixelFormat_BGR8 ||
+			options.pixelFormat == Spinnaker::PixelFormat_RGB8) ? 3 : 1;
+		const size_t frameSize = static_cast<size_t>(options.width) * options.height * bytesPerPixel;
+
+		std::minstd_rand rng(static_cast<unsigned int>(std::hash<std::string>()(options.serialNumber)));
+		m_patterns.resize(k_numPatterns);
+		for (unsigned int p = 0; p < k_numPatterns; p++)
+		{
+			m_patterns[p].resize(frameSize);
+			for (unsigned int y = 0; y < options.height; y++)
+			{
+				unsigned char* row = &m_patterns[p][static_cast<size_t>(y) * options.width * bytesPerPixel];
+				for (unsigned int x = 0; x < options.width * bytesPerPixel; x++)
+				{
+					// Moving diagonal gradient plus sensor-like noise
+					int value = static_cast<int>((x / bytesPerPixel + y + p * 16) & 0xFF) + static_cast<int>(rng() % 17) - 8;
+					row[x] = static_cast<unsigned char>(value < 0 ? 0 : (value > 255 ? 255 : value));
+				}
+			}
+		}
+
+		// Each device clock starts at its own epoch
+		m_timestampEpoch = static_cast<uint64_t>(rng() % 1000) * 1000000000ULL;
+		m_clockStart = HostClock::now();
+	}
+
+	std::string GetSerialNumber() { return m_options.serialNumber; }
+	float GetFrameRate() { return m_options.frameRate; }
+	unsigned int GetWidth() { return m_options.width; }
+	unsigned int GetHeight() { return m_options.height; }
+
+	uint64_t GetSkippedFrames() const { return m_skippedFrames; }
+
+	void BeginAcquisition()
+	{
+		m_period = std::chrono::duration_cast<HostClock::duration>(std::chrono::duration<double>(1.0 / m_options.frameRate));
+		m_start = HostClock::now();
+		m_next = m_start;
+		m_frameID = 0;
+		m_skippedFrames = 0;
+	}
+
+	void EndAcquisition() {}
+
+	void GrabNextFrame(SourceFrame & frame)
+	{
+		std::this_thread::sleep_until(m_next);
+
+		// Frames whose exposure ended while we were not grabbing are overwritten
+		HostClock::time_point now = HostClock::now();
+		while (now >= m_next + m_period)
+		{
+			m_next += m_period;
+			m_frameID++;
+			m_skippedFrames++;
+		}
+
+		const std::vector<unsigned char> & pattern = m_patterns[m_frameID % k_numPatterns];
+		frame.image = Spinnaker::Image::Create(m_options.width, m_options.height, 0, 0, m_options.pixelFormat,
+			const_cast<unsigned char*>(&pattern[0]));
+		frame.incomplete = false;
+		frame.imageStatus = 0;
+
+		frame.chunkData.frameID = m_frameID;
+		frame.chunkData.timestamp = DeviceTime(m_next);
+		frame.chunkData.exposureTime = m_options.exposureTime;
+		frame.chunkData.gain = m_options.gain;
+		frame.chunkData.width = m_options.width;
+		frame.chunkData.height = m_options.height;
+		frame.chunkData.offsetX = 0;
+		frame.chunkData.offsetY = 0;
+		frame.chunkData.sequencerSetActive = 0;
+		frame.chunkData.valid = true;
+
+		m_next += m_period;
+		m_frameID++;
+	}
+
+	void ReleaseFrame(SourceFrame & frame)
+	{
+		frame.image = Spinnaker::ImagePtr();
+	}
+
+	// Skipped frames are what an overwriting driver would report
+	bool GetStreamStats(StreamStats & stats)
+	{
+		stats = StreamStats();
+		stats.delivered = m_frameID - static_cast<int64_t>(m_skippedFrames);
+		stats.overwritten = static_cast<int64_t>(m_skippedFrames);
+		stats.lost = 0;
+		stats.underruns = 0;
+		stats.failed = 0;
+		return true;
+	}
+
+	bool LatchDeviceClock(uint64_t & deviceNs)
+	{
+		deviceNs = DeviceTime(HostClock::now());
+		return true;
+	}
+
+private:
+	static const unsigned int k_numPatterns = 8;
+
+	// The simulated device clock runs from construction, like a camera's from power-on
+	uint64_t DeviceTime(HostClock::time_point time) const
+	{
+		const double elapsedNs = std::chrono::duration<double, std::nano>(time - m_clockStart).count();
+		return m_timestampEpoch + static_cast<uint64_t>(elapsedNs * (1.0 + m_options.clockDriftPpm * 1e-6));
+	}
+
+	SyntheticCameraOptions m_options;
+	std::vector<std::vector<unsigned char> > m_patterns;
+
+	HostClock::duration m_period;
+	HostClock::time_point m_clockStart;
+	HostClock::time_point m_start;
+	HostClock::time_point m_next;
+	uint64_t m_timestampEpoch;
+	int64_t m_frameID;
+	uint64_t m_skippedFrames;
+};
+
+#endif // FRAME_SOURCE_H
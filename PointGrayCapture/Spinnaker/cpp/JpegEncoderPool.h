@@ -0,0 +1,244 @@
+//=============================================================================
+// JpegEncoderPool.h
+//
+// Fixed pool of JPEG encoder threads shared by all cameras. Writer threads
+// submit (image, filename) jobs into one bounded queue; when the queue is
+// full Submit() blocks, so the backpressure ends up in the per-camera frame
+// queues, where drops are counted and logged, instead of in unbounded memory.
+//
+// Images are encoded with libjpeg-turbo when built with USE_TURBOJPEG,
+// otherwise with Spinnaker's Image::Save.
+//=============================================================================
+
+#ifndef JPEG_ENCODER_POOL_H
+#define JPEG_ENCODER_POOL_H
+
+#include "Spinnaker.h"
+#include "FrameBufferPool.h"
+#include "CaptureLog.h"
+#include "ThreadPlacement.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(USE_TURBOJPEG)
+#include <turbojpeg.h>
+
+// This function encodes an 8-bit BGR, RGB or mono image to memory with
+// libjpeg-turbo. Free *jpegBuffer with tjFree(). Returns 0 on success, -1 on
+// error and 1 if the pixel format is not supported.
+inline int CompressJpeg(tjhandle compressor, const Spinnaker::ImagePtr & image, unsigned int quality,
+	unsigned char** jpegBuffer, unsigned long* jpegSize)
+{
+	int pixelFormat;
+	int subsampling = TJSAMP_420;
+	switch (image->GetPixelFormat())
+	{
+	case Spinnaker::PixelFormat_BGR8: pixelFormat = TJPF_BGR; break;
+	case Spinnaker::PixelFormat_RGB8: pixelFormat = TJPF_RGB; break;
+	case Spinnaker::PixelFormat_Mono8: pixelFormat = TJPF_GRAY; subsampling = TJSAMP_GRAY; break;
+	default: return 1;
+	}
+
+	if (tjCompress2(compressor, static_cast<const unsigned char*>(image->GetData()),
+		static_cast<int>(image->GetWidth()), static_cast<int>(image->GetStride()),
+		static_cast<int>(image->GetHeight()), pixelFormat, jpegBuffer, jpegSize,
+		subsampling, static_cast<int>(quality), TJFLAG_FASTDCT) != 0)
+		return -1;
+
+	return 0;
+}
+#endif
+
+
+class JpegEncoderPool
+{
+public:
+	JpegEncoderPool(unsigned int numWorkers, unsigned int queueDepth, unsigned int quality) :
+		m_queueDepth(queueDepth > 0 ? queueDepth : 1),
+		m_quality(quality),
+		m_closed(false),
+		m_numSubmitted(0), m_numEncoded(0), m_numFailed(0), m_highWaterMark(0), m_blockedSeconds(0)
+	{
+		for (unsigned int i = 0; i < numWorkers; i++)
+			m_workers.push_back(std::thread(&JpegEncoderPool::WorkerLoop, this));
+	}
+
+	~JpegEncoderPool() { Close(); }
+
+	// Restricts the encoder workers to the given CPUs. Returns false if one
+	// could not be pinned.
+	bool SetWorkerAffinity(const std::vector<int> & cpus)
+	{
+		bool ok = true;
+		for (size_t i = 0; i < m_workers.size(); i++)
+			ok = PinThread(m_workers[i], cpus) && ok;
+		return ok;
+	}
+
+	// Queues one image for encoding. The image must not change afterwards,
+	// i.e. it has to be a copy owned by the caller; buffer keeps its pixels
+	// alive if they live in a FrameBufferPool. Blocks while the queue is
+	// full. Returns false if the pool is closed.
+	bool Submit(const Spinnaker::ImagePtr & image, const std::string & filename, const FrameBufferRef & buffer = FrameBufferRef())
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if (m_jobs.size() >= m_queueDepth && !m_closed)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			m_notFull.wait(lock, [this] { return m_jobs.size() < m_queueDepth || m_closed; });
+			m_blockedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		if (m_closed)
+			return false;
+
+		Job job;
+		job.image = image;
+		job.filename = filename;
+		job.buffer = buffer;
+		m_jobs.push_back(job);
+		m_numSubmitted++;
+		if (m_jobs.size() > m_highWaterMark)
+			m_highWaterMark = m_jobs.size();
+
+		lock.unlock();
+		m_notEmpty.notify_one();
+
+		return true;
+	}
+
+	// Encodes everything still queued, stops the workers and prints a summary.
+	void Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_closed)
+				return;
+			m_closed = true;
+		}
+		m_notEmpty.notify_all();
+		m_notFull.notify_all();
+
+		for (size_t i = 0; i < m_workers.size(); i++)
+			m_workers[i].join();
+		m_workers.clear();
+
+		CAPTURE_LOG(Log_Info) << "[jpeg] " << m_numEncoded << " images encoded, " << m_numFailed << " failed, queue high-water mark "
+			<< m_highWaterMark << "/" << m_queueDepth << ", writers blocked " << m_blockedSeconds << " s";
+	}
+
+	uint64_t GetNumEncoded() const { std::lock_guard<std::mutex> lock(m_mutex); return m_numEncoded; }
+	uint64_t GetNumFailed() const { std::lock_guard<std::mutex> lock(m_mutex); return m_numFailed; }
+	size_t GetQueueSize() const { std::lock_guard<std::mutex> lock(m_mutex); return m_jobs.size(); }
+
+private:
+	struct Job {
+		Spinnaker::ImagePtr image;
+		std::string filename;
+		FrameBufferRef buffer;
+	};
+
+	JpegEncoderPool(const JpegEncoderPool &);
+	JpegEncoderPool & operator=(const JpegEncoderPool &);
+
+	void WorkerLoop()
+	{
+#if defined(USE_TURBOJPEG)
+		tjhandle compressor = tjInitCompress();
+#endif
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_notEmpty.wait(lock, [this] { return m_closed || !m_jobs.empty(); });
+				if (m_jobs.empty())
+					break; // closed and drained
+
+				job = m_jobs.front();
+				m_jobs.pop_front();
+			}
+			m_notFull.notify_one();
+
+			bool ok;
+#if defined(USE_TURBOJPEG)
+			ok = EncodeTurbo(compressor, job);
+#else
+			ok = EncodeSpinnaker(job);
+#endif
+			// Drop the image and return its buffer before taking the lock again
+			job.image = Spinnaker::ImagePtr();
+			job.buffer.Reset();
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (ok)
+				m_numEncoded++;
+			else if (m_numFailed++ < 10)
+				CAPTURE_LOG(Log_Warning) << "[jpeg] Unable to write " << job.filename;
+		}
+#if defined(USE_TURBOJPEG)
+		tjDestroy(compressor);
+#endif
+	}
+
+	bool EncodeSpinnaker(Job & job)
+	{
+		try
+		{
+			Spinnaker::JPEGOption option;
+			option.quality = m_quality;
+			job.image->Save(job.filename.c_str(), option);
+			return true;
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			CAPTURE_LOG(Log_Error) << "[jpeg] Save Error: " << e.what();
+			return false;
+		}
+	}
+
+#if defined(USE_TURBOJPEG)
+	bool EncodeTurbo(tjhandle compressor, Job & job)
+	{
+		unsigned char* jpegBuffer = NULL;
+		unsigned long jpegSize = 0;
+		int result = CompressJpeg(compressor, job.image, m_quality, &jpegBuffer, &jpegSize);
+		if (result > 0)
+			return EncodeSpinnaker(job);
+		if (result < 0)
+			return false;
+
+		FILE* file = fopen(job.filename.c_str(), "wb");
+		bool ok = file != NULL && fwrite(jpegBuffer, 1, jpegSize, file) == jpegSize;
+		if (file != NULL && fclose(file) != 0)
+			ok = false;
+
+		tjFree(jpegBuffer);
+		return ok;
+	}
+#endif
+
+	const size_t m_queueDepth;
+	const unsigned int m_quality;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_notEmpty;
+	std::condition_variable m_notFull;
+	std::deque<Job> m_jobs;
+	std::vector<std::thread> m_workers;
+	bool m_closed;
+
+	uint64_t m_numSubmitted;
+	uint64_t m_numEncoded;
+	uint64_t m_numFailed;
+	size_t m_highWaterMark;
+	double m_blockedSeconds;
+};
+
+#endif // JPEG_ENCODER_POOL_H
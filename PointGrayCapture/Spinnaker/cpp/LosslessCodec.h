@@ -0,0 +1,460 @@
+//=============================================================================
+// LosslessCodec.h
+//
+// Lossless compression of 8-bit frames for the recording container
+// (Container_Lossless), for sessions where JPEG artefacts are not acceptable,
+// e.g. calibration, whose checkerboard corners are refined to sub-pixel.
+//
+// Each sample is predicted from its left, upper and upper-left neighbours of
+// the same colour (the LOCO-I median predictor), and the residuals are Rice
+// coded with the parameter adapted per block of 16. With Bayer prediction the
+// neighbours of a raw Bayer frame are two samples away, so red is predicted
+// from red; interleaved BGR/RGB predicts each channel from itself.
+//
+// The frame is cut into stripes of rows that are coded independently, so
+// stripes are encoded and decoded in parallel. Payload layout:
+//
+//   LosslessFrameHeader
+//   uint32_t stripeSizes[numStripes]
+//   stripe data, in order
+//
+// Only needs FrameContainer.h, no Spinnaker, so offline tools can decode.
+//=============================================================================
+
+#ifndef LOSSLESS_CODEC_H
+#define LOSSLESS_CODEC_H
+
+#include "FrameContainer.h"
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+const char k_losslessMagic[4] = { 'L', 'S', 'L', '1' };
+const unsigned int k_losslessBlockSize = 16;
+const unsigned int k_losslessEscape = 15; // unary prefix of a residual stored as 8 raw bits
+
+struct LosslessFrameHeader {
+	char magic[4];
+	uint32_t headerSize;
+	uint32_t rowBytes; // coded bytes per row
+	uint32_t height;
+	uint16_t sampleStep; // distance to the left neighbour of the same colour
+	uint16_t rowStep; // distance to the upper neighbour of the same colour
+	uint32_t stripeRows; // rows per stripe, the last one may have fewer
+	uint32_t numStripes;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(LosslessFrameHeader) == 32, "LosslessFrameHeader layout is part of the file format");
+
+// Runs task(i) for every i in [0, count) and returns when all are done
+typedef std::function<void(unsigned int count, const std::function<void(unsigned int)> & task)> ParallelForFunction;
+
+// Maps a residual modulo 256 to 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+inline unsigned int ZigZagLossless(int residual)
+{
+	const int wrapped = static_cast<signed char>(static_cast<unsigned char>(residual));
+	return ((static_cast<unsigned int>(wrapped) << 1) ^ static_cast<unsigned int>(wrapped >> 7)) & 0xFF;
+}
+
+
+// Neighbour distances for a pixel format; bytesPerPixel is 3 for BGR8/RGB8
+inline void GetLosslessSteps(ContainerPixelFormat pixelFormat, bool bayerPrediction, unsigned int & sampleStep,
+	unsigned int & rowStep, unsigned int & bytesPerPixel)
+{
+	sampleStep = 1;
+	rowStep = 1;
+	bytesPerPixel = 1;
+	switch (pixelFormat)
+	{
+	case ContainerPixel_BGR8:
+	case ContainerPixel_RGB8:
+		sampleStep = 3;
+		bytesPerPixel = 3;
+		break;
+	case ContainerPixel_BayerRG8:
+	case ContainerPixel_BayerGR8:
+	case ContainerPixel_BayerGB8:
+	case ContainerPixel_BayerBG8:
+		if (bayerPrediction)
+		{
+			sampleStep = 2;
+			rowStep = 2;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+
+// LOCO-I median edge detector: the median of left, up and left + up - upLeft
+inline int PredictLossless(int left, int up, int upLeft)
+{
+	const int low = left < up ? left : up;
+	const int high = left < up ? up : left;
+	const int gradient = left + up - upLeft;
+	return gradient < low ? low : (gradient > high ? high : gradient);
+}
+
+
+// Residuals of one row of a stripe as zig-zag values; rows above the stripe
+// are not used
+inline void ComputeLosslessResiduals(const unsigned char* top, size_t stride, uint32_t rowBytes, uint32_t y,
+	unsigned int sampleStep, unsigned int rowStep, unsigned char* residuals)
+{
+	const unsigned char* row = top + y * stride;
+	const uint32_t firstPredicted = sampleStep < rowBytes ? sampleStep : rowBytes;
+
+	if (y < rowStep)
+	{
+		for (uint32_t x = 0; x < firstPredicted; x++)
+			residuals[x] = static_cast<unsigned char>(ZigZagLossless(row[x]));
+		for (uint32_t x = firstPredicted; x < rowBytes; x++)
+			residuals[x] = static_cast<unsigned char>(ZigZagLossless(row[x] - row[x - sampleStep]));
+		return;
+	}
+
+	const unsigned char* upRow = row - rowStep * stride;
+	for (uint32_t x = 0; x < firstPredicted; x++)
+		residuals[x] = static_cast<unsigned char>(ZigZagLossless(row[x] - upRow[x]));
+	for (uint32_t x = firstPredicted; x < rowBytes; x++)
+		residuals[x] = static_cast<unsigned char>(ZigZagLossless(row[x] - PredictLossless(row[x - sampleStep], upRow[x], upRow[x - sampleStep])));
+}
+
+
+// Writes little-endian bit fields into a buffer large enough for the stripe
+class LosslessBitWriter
+{
+public:
+	explicit LosslessBitWriter(unsigned char* out) : m_out(out), m_size(0), m_bits(0), m_numBits(0) {}
+
+	// n <= 32
+	void Put(uint32_t value, unsigned int n)
+	{
+		m_bits |= static_cast<uint64_t>(value) << m_numBits;
+		m_numBits += n;
+		if (m_numBits >= 32)
+		{
+			for (int i = 0; i < 4; i++)
+				m_out[m_size++] = static_cast<unsigned char>(m_bits >> (8 * i));
+			m_bits >>= 32;
+			m_numBits -= 32;
+		}
+	}
+
+	// Returns the number of bytes written
+	size_t Flush()
+	{
+		while (m_numBits > 0)
+		{
+			m_out[m_size++] = static_cast<unsigned char>(m_bits);
+			m_bits >>= 8;
+			m_numBits = m_numBits > 8 ? m_numBits - 8 : 0;
+		}
+		return m_size;
+	}
+
+private:
+	unsigned char* m_out;
+	size_t m_size;
+	uint64_t m_bits;
+	unsigned int m_numBits;
+};
+
+
+class LosslessBitReader
+{
+public:
+	LosslessBitReader(const unsigned char* data, size_t size) : m_data(data), m_size(size), m_position(0), m_bits(0), m_numBits(0), m_numRead(0) {}
+
+	// n <= 24; past the end reads zeros, see IsOverrun()
+	uint32_t Get(unsigned int n)
+	{
+		Fill();
+		const uint32_t value = static_cast<uint32_t>(m_bits & ((1u << n) - 1));
+		Consume(n);
+		return value;
+	}
+
+	// One Rice-coded value with parameter k
+	uint32_t GetRice(unsigned int k)
+	{
+		Fill();
+		const unsigned int quotient = CountTrailingOnes(m_bits);
+		if (quotient < k_losslessEscape)
+		{
+			const uint32_t value = (quotient << k) | (static_cast<uint32_t>(m_bits >> (quotient + 1)) & ((1u << k) - 1));
+			Consume(quotient + 1 + k);
+			return value;
+		}
+
+		const uint32_t value = static_cast<uint32_t>(m_bits >> k_losslessEscape) & 0xFF;
+		Consume(k_losslessEscape + 8);
+		return value;
+	}
+
+	// True if more bits were read than the data holds
+	bool IsOverrun() const { return m_numRead > static_cast<uint64_t>(m_size) * 8; }
+
+private:
+	void Fill()
+	{
+		if (m_numBits > 32)
+			return;
+		while (m_numBits <= 56)
+		{
+			const uint64_t byte = m_position < m_size ? m_data[m_position] : 0;
+			m_position++;
+			m_bits |= byte << m_numBits;
+			m_numBits += 8;
+		}
+	}
+
+	void Consume(unsigned int n)
+	{
+		m_bits >>= n;
+		m_numBits -= n;
+		m_numRead += n;
+	}
+
+	// The escape is 15 ones, so only the low 16 bits matter
+	static unsigned int CountTrailingOnes(uint64_t bits)
+	{
+		const uint32_t zeros = (static_cast<uint32_t>(~bits) & 0xFFFF) | 0x10000;
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, zeros);
+		return static_cast<unsigned int>(index);
+#else
+		return static_cast<unsigned int>(__builtin_ctz(zeros));
+#endif
+	}
+
+	const unsigned char* m_data;
+	size_t m_size;
+	size_t m_position;
+	uint64_t m_bits;
+	unsigned int m_numBits;
+	uint64_t m_numRead;
+};
+
+
+// Compresses frames; keeps its stripe buffers between frames, so use one
+// encoder per writer thread.
+class LosslessEncoder
+{
+public:
+	// Returns the payload, valid until the next call. Rows are rowBytes long
+	// and stride apart.
+	const std::vector<unsigned char> & Encode(const unsigned char* pixels, size_t stride, uint32_t rowBytes, uint32_t height,
+		unsigned int sampleStep, unsigned int rowStep, unsigned int numStripes, const ParallelForFunction & parallelFor)
+	{
+		if (numStripes == 0)
+			numStripes = 1;
+
+		// Whole neighbour rows per stripe
+		uint32_t stripeRows = (height + numStripes - 1) / numStripes;
+		stripeRows = (stripeRows + rowStep - 1) / rowStep * rowStep;
+		if (stripeRows == 0)
+			stripeRows = rowStep;
+		numStripes = (height + stripeRows - 1) / stripeRows;
+
+		m_stripes.resize(numStripes);
+		m_residuals.resize(numStripes);
+		std::function<void(unsigned int)> encodeStripe = [&](unsigned int stripe)
+		{
+			const uint32_t firstRow = stripe * stripeRows;
+			const uint32_t numRows = firstRow + stripeRows <= height ? stripeRows : height - firstRow;
+			EncodeStripe(pixels + firstRow * stride, stride, rowBytes, numRows, sampleStep, rowStep, m_residuals[stripe], m_stripes[stripe]);
+		};
+		if (parallelFor && numStripes > 1)
+			parallelFor(numStripes, encodeStripe);
+		else
+			for (unsigned int i = 0; i < numStripes; i++)
+				encodeStripe(i);
+
+		LosslessFrameHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, k_losslessMagic, sizeof(header.magic));
+		header.headerSize = sizeof(LosslessFrameHeader);
+		header.rowBytes = rowBytes;
+		header.height = height;
+		header.sampleStep = static_cast<uint16_t>(sampleStep);
+		header.rowStep = static_cast<uint16_t>(rowStep);
+		header.stripeRows = stripeRows;
+		header.numStripes = numStripes;
+
+		m_payload.resize(sizeof(header) + numStripes * sizeof(uint32_t));
+		memcpy(&m_payload[0], &header, sizeof(header));
+		for (unsigned int i = 0; i < numStripes; i++)
+		{
+			const uint32_t stripeSize = static_cast<uint32_t>(m_stripes[i].size());
+			memcpy(&m_payload[sizeof(header) + i * sizeof(uint32_t)], &stripeSize, sizeof(stripeSize));
+		}
+		for (unsigned int i = 0; i < numStripes; i++)
+			m_payload.insert(m_payload.end(), m_stripes[i].begin(), m_stripes[i].end());
+
+		return m_payload;
+	}
+
+private:
+	static void EncodeStripe(const unsigned char* top, size_t stride, uint32_t rowBytes, uint32_t numRows,
+		unsigned int sampleStep, unsigned int rowStep, std::vector<unsigned char> & residuals, std::vector<unsigned char> & out)
+	{
+		// At most 23 bits per sample and 3 per block
+		out.resize(static_cast<size_t>(rowBytes) * numRows * 3 + 64);
+		LosslessBitWriter writer(&out[0]);
+
+		// Blocks run across row ends; the tail of a row waits for the next one
+		residuals.resize(rowBytes + k_losslessBlockSize);
+		uint32_t numPending = 0;
+		for (uint32_t y = 0; y < numRows; y++)
+		{
+			ComputeLosslessResiduals(top, stride, rowBytes, y, sampleStep, rowStep, &residuals[numPending]);
+			const uint32_t numValues = numPending + rowBytes;
+			const uint32_t numBlocked = numValues / k_losslessBlockSize * k_losslessBlockSize;
+			for (uint32_t i = 0; i < numBlocked; i += k_losslessBlockSize)
+				PutBlock(writer, &residuals[i], k_losslessBlockSize);
+
+			numPending = numValues - numBlocked;
+			if (numPending > 0)
+				memmove(&residuals[0], &residuals[numBlocked], numPending);
+		}
+		if (numPending > 0)
+			PutBlock(writer, &residuals[0], numPending);
+
+		out.resize(writer.Flush());
+	}
+
+	// Rice parameter in 3 bits, then each value as unary quotient and k bits,
+	// or the escape prefix and 8 raw bits
+	static void PutBlock(LosslessBitWriter & writer, const unsigned char* values, unsigned int count)
+	{
+		uint32_t sum = 0;
+		for (unsigned int i = 0; i < count; i++)
+			sum += values[i];
+		unsigned int k = 0;
+		while (k < 7 && (count << (k + 1)) <= sum)
+			k++;
+		writer.Put(k, 3);
+
+		for (unsigned int i = 0; i < count; i++)
+		{
+			const uint32_t quotient = values[i] >> k;
+			if (quotient < k_losslessEscape)
+				writer.Put(((1u << quotient) - 1) | ((values[i] & ((1u << k) - 1)) << (quotient + 1)), quotient + 1 + k);
+			else
+				writer.Put(((1u << k_losslessEscape) - 1) | (static_cast<uint32_t>(values[i]) << k_losslessEscape), k_losslessEscape + 8);
+		}
+	}
+
+	std::vector<std::vector<unsigned char> > m_stripes;
+	std::vector<std::vector<unsigned char> > m_residuals;
+	std::vector<unsigned char> m_payload;
+};
+
+
+// This function decodes a Container_Lossless payload into rows stride apart.
+// Returns 0 on success, -1 if the payload is damaged or the frame does not
+// have rowBytes x height.
+inline int DecodeLosslessFrame(const unsigned char* payload, uint64_t payloadSize, unsigned char* pixels, size_t stride,
+	uint32_t rowBytes, uint32_t height, const ParallelForFunction & parallelFor = ParallelForFunction())
+{
+	LosslessFrameHeader header;
+	if (payloadSize < sizeof(header))
+		return -1;
+	memcpy(&header, payload, sizeof(header));
+	if (memcmp(header.magic, k_losslessMagic, sizeof(k_losslessMagic)) != 0 || header.headerSize < sizeof(header) ||
+		header.rowBytes != rowBytes || header.height != height || header.sampleStep == 0 || header.rowStep == 0 ||
+		header.stripeRows == 0 || header.numStripes != (height + header.stripeRows - 1) / header.stripeRows ||
+		header.headerSize + static_cast<uint64_t>(header.numStripes) * sizeof(uint32_t) > payloadSize)
+		return -1;
+
+	std::vector<uint64_t> stripeOffsets(header.numStripes + 1);
+	stripeOffsets[0] = header.headerSize + static_cast<uint64_t>(header.numStripes) * sizeof(uint32_t);
+	for (uint32_t i = 0; i < header.numStripes; i++)
+	{
+		uint32_t stripeSize;
+		memcpy(&stripeSize, payload + header.headerSize + i * sizeof(uint32_t), sizeof(stripeSize));
+		stripeOffsets[i + 1] = stripeOffsets[i] + stripeSize;
+	}
+	if (stripeOffsets[header.numStripes] > payloadSize)
+		return -1;
+
+	std::vector<char> damaged(header.numStripes, 0);
+	std::function<void(unsigned int)> decodeStripe = [&](unsigned int stripe)
+	{
+		const uint32_t firstRow = stripe * header.stripeRows;
+		const uint32_t numRows = firstRow + header.stripeRows <= height ? header.stripeRows : height - firstRow;
+		unsigned char* top = pixels + firstRow * stride;
+		LosslessBitReader reader(payload + stripeOffsets[stripe], static_cast<size_t>(stripeOffsets[stripe + 1] - stripeOffsets[stripe]));
+
+		unsigned int blockLeft = 0;
+		unsigned int k = 0;
+		for (uint32_t y = 0; y < numRows; y++)
+		{
+			unsigned char* row = top + y * stride;
+			const unsigned char* upRow = y >= header.rowStep ? row - header.rowStep * stride : NULL;
+			for (uint32_t x = 0; x < rowBytes; x++)
+			{
+				if (blockLeft == 0)
+				{
+					k = reader.Get(3);
+					blockLeft = k_losslessBlockSize;
+				}
+				blockLeft--;
+
+				const uint32_t value = reader.GetRice(k);
+				const int residual = static_cast<int>(value >> 1) ^ -static_cast<int>(value & 1);
+
+				int prediction;
+				if (x >= header.sampleStep)
+					prediction = upRow != NULL ? PredictLossless(row[x - header.sampleStep], upRow[x], upRow[x - header.sampleStep]) : row[x - header.sampleStep];
+				else
+					prediction = upRow != NULL ? upRow[x] : 0;
+				row[x] = static_cast<unsigned char>(prediction + residual);
+			}
+		}
+		if (reader.IsOverrun())
+			damaged[stripe] = 1;
+	};
+	if (parallelFor && header.numStripes > 1)
+		parallelFor(header.numStripes, decodeStripe);
+	else
+		for (unsigned int i = 0; i < header.numStripes; i++)
+			decodeStripe(i);
+
+	for (uint32_t i = 0; i < header.numStripes; i++)
+	{
+		if (damaged[i])
+			return -1;
+	}
+	return 0;
+}
+
+
+// This function decodes a Container_Lossless frame of a container into
+// pixels (rows packed). Returns 0 on success, -1 on error.
+inline int DecodeLosslessFrame(const ContainerFrame & frame, std::vector<unsigned char> & pixels,
+	const ParallelForFunction & parallelFor = ParallelForFunction())
+{
+	if (frame.header == NULL || frame.header->encoding != Container_Lossless)
+		return -1;
+
+	unsigned int sampleStep, rowStep, bytesPerPixel;
+	GetLosslessSteps(static_cast<ContainerPixelFormat>(frame.header->pixelFormat), false, sampleStep, rowStep, bytesPerPixel);
+	const uint32_t rowBytes = frame.header->width * bytesPerPixel;
+	pixels.resize(static_cast<size_t>(rowBytes) * frame.header->height);
+	if (pixels.empty())
+		return -1;
+
+	return DecodeLosslessFrame(frame.payload, frame.header->payloadSize, &pixels[0], rowBytes, rowBytes, frame.header->height, parallelFor);
+}
+
+#endif // LOSSLESS_CODEC_H
@@ -0,0 +1,698 @@
+//=============================================================================
+// PreviewPublisher.h
+//
+// Live preview of all cameras while capturing. Every Nth frame of a camera
+// is offered by its grab thread; one background thread downscales it with a
+// box (area) filter to at most the preview size and publishes it into a
+// named shared-memory region (SharedMemory.h) that a viewer in another
+// process maps, e.g. PreviewSnapshot.
+//
+// The preview never holds up the recording: Offer() only takes a reference
+// to the frame's pool buffer and returns, and drops the frame instead if the
+// preview thread is busy taking a frame, has a newer frame of the camera
+// pending (the newer one wins), or is over its CPU budget. The thread spends
+// at most cpuBudget of a core on average; the cost of every frame is
+// measured and the totals are logged at Close().
+//
+// The vertical pass of the filter, which reads every source byte, sums rows
+// with SSE2 (AVX2 when the CPU has it); the horizontal pass works on the
+// already reduced rows. Colour frames are published as BGR8, raw Bayer
+// frames as BGR8 from the 2x2 quads (each output pixel averages its block's
+// samples of each colour), Mono8 as Mono8.
+//
+// Region layout: PreviewRegionHeader, then one slot per camera at
+// slotOffset + camera * slotSize. A slot is a PreviewSlotHeader followed by
+// two image buffers of bufferSize bytes, each a PreviewImageHeader and the
+// pixels. The publisher writes image k into buffer k & 1 while the slot's
+// sequence is 2k - 1 and sets it to 2k when done, so the latest complete
+// image is always sequence / 2; see PreviewReader::Read().
+//=============================================================================
+
+#ifndef PREVIEW_PUBLISHER_H
+#define PREVIEW_PUBLISHER_H
+
+#include "CaptureLog.h"
+#include "ColorEngine.h"
+#include "FrameBufferPool.h"
+#include "FrameContainer.h"
+#include "SharedMemory.h"
+#include "ThreadPlacement.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+const char k_previewMagic[8] = { 'M', 'C', 'P', 'R', 'E', 'V', '0', '1' };
+const unsigned int k_previewMaxCameras = 32;
+const unsigned int k_previewMaxFactor = 64; // keeps the row sums in 16 bits
+const size_t k_previewAlignment = 64;
+
+inline size_t PreviewAlignUp(size_t size) { return (size + k_previewAlignment - 1) & ~(k_previewAlignment - 1); }
+
+struct PreviewRegionHeader {
+	char magic[8];
+	uint32_t numCameras;
+	uint32_t maxWidth; // of a published image
+	uint32_t maxHeight;
+	uint32_t reserved;
+	uint64_t slotOffset;
+	uint64_t slotSize;
+	uint64_t bufferSize; // image header and pixels of one buffer
+	std::atomic<uint32_t> publishing; // 0 once the capture process has closed the region
+};
+
+struct PreviewSlotHeader {
+	std::atomic<uint64_t> sequence;
+	char serialNumber[16];
+};
+
+struct PreviewImageHeader {
+	uint64_t frameID;
+	uint64_t hostTimestamp; // grab time, ns on the host's steady clock
+	uint32_t grabIndex;
+	uint32_t sourceWidth;
+	uint32_t sourceHeight;
+	uint32_t factor; // box size in source pixels
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels; // 1: Mono8, 3: BGR8; rows are width * channels bytes
+	uint32_t reserved;
+};
+
+
+// Box filter of the preview. Holds the row sums, so one per thread.
+class PreviewDownscaler
+{
+public:
+	PreviewDownscaler() : m_useAvx2(ColorEngine::CpuHasAvx2()) {}
+
+	// Allows forcing the SSE2 or scalar path, e.g. for benchmarking.
+	void SetUseAvx2(bool useAvx2) { m_useAvx2 = useAvx2 && ColorEngine::CpuHasAvx2(); }
+
+	// Smallest box size that fits width x height into maxWidth x maxHeight;
+	// even for Bayer frames so every box holds whole 2x2 quads. 0 if the
+	// frame would need a box larger than k_previewMaxFactor.
+	static unsigned int GetFactor(unsigned int width, unsigned int height, unsigned int maxWidth, unsigned int maxHeight, ContainerPixelFormat format)
+	{
+		unsigned int factor = std::max(1u, std::max((width + maxWidth - 1) / maxWidth, (height + maxHeight - 1) / maxHeight));
+		if (IsBayer(format))
+			factor = (factor + 1) & ~1u;
+		return (factor <= k_previewMaxFactor && factor <= width && factor <= height) ? factor : 0;
+	}
+
+	static unsigned int GetChannels(ContainerPixelFormat format) { return format == ContainerPixel_Mono8 ? 1 : 3; }
+
+	static bool IsBayer(ContainerPixelFormat format)
+	{
+		return format == ContainerPixel_BayerRG8 || format == ContainerPixel_BayerGR8 ||
+			format == ContainerPixel_BayerGB8 || format == ContainerPixel_BayerBG8;
+	}
+
+	// Writes the (width / factor) x (height / factor) preview of an image
+	// to out, rows packed; the partial boxes at the right and bottom are left
+	// out. factor must come from GetFactor().
+	void Downscale(const unsigned char* src, size_t srcStride, unsigned int width, unsigned int height,
+		ContainerPixelFormat format, unsigned int factor, unsigned char* out)
+	{
+		const unsigned int outWidth = width / factor;
+		const unsigned int outHeight = height / factor;
+
+		if (IsBayer(format))
+		{
+			// Colour (0: R, 1: G, 2: B) of the site at (row & 1, column & 1)
+			static const int k_siteColors[4][4] = { { 0, 1, 1, 2 }, { 1, 0, 2, 1 }, { 1, 2, 0, 1 }, { 2, 1, 1, 0 } };
+			const int* siteColors = k_siteColors[format - ContainerPixel_BayerRG8];
+
+			const unsigned int half = factor / 2;
+			const uint32_t siteScale = Reciprocal(half * half);
+			const uint32_t greenScale = Reciprocal(half * half * 2);
+
+			m_sums.resize(static_cast<size_t>(width) * 2);
+			uint16_t* evenSums = &m_sums[0];
+			uint16_t* oddSums = &m_sums[width];
+			for (unsigned int y = 0; y < outHeight; y++)
+			{
+				const unsigned char* rows = src + static_cast<size_t>(y) * factor * srcStride;
+				SumRows(rows, srcStride * 2, half, outWidth * factor, evenSums);
+				SumRows(rows + srcStride, srcStride * 2, half, outWidth * factor, oddSums);
+
+				unsigned char* dst = out + static_cast<size_t>(y) * outWidth * 3;
+				for (unsigned int x = 0; x < outWidth; x++, dst += 3)
+				{
+					uint32_t sites[4] = { 0, 0, 0, 0 };
+					const uint16_t* even = evenSums + x * factor;
+					const uint16_t* odd = oddSums + x * factor;
+					for (unsigned int k = 0; k < factor; k += 2)
+					{
+						sites[0] += even[k];
+						sites[1] += even[k + 1];
+						sites[2] += odd[k];
+						sites[3] += odd[k + 1];
+					}
+
+					uint32_t colors[3] = { 0, 0, 0 };
+					for (int s = 0; s < 4; s++)
+						colors[siteColors[s]] += sites[s];
+
+					dst[0] = Scale(colors[2], siteScale);
+					dst[1] = Scale(colors[1], greenScale);
+					dst[2] = Scale(colors[0], siteScale);
+				}
+			}
+			return;
+		}
+
+		const unsigned int channels = GetChannels(format);
+		const uint32_t scale = Reciprocal(factor * factor);
+		// Output BGR from RGB input
+		const unsigned int outIndex[3] = { format == ContainerPixel_RGB8 ? 2u : 0u, 1u, format == ContainerPixel_RGB8 ? 0u : 2u };
+
+		m_sums.resize(static_cast<size_t>(width) * channels);
+		uint16_t* sums = &m_sums[0];
+		const unsigned int rowStep = factor * channels;
+		for (unsigned int y = 0; y < outHeight; y++)
+		{
+			SumRows(src + static_cast<size_t>(y) * factor * srcStride, srcStride, factor, static_cast<size_t>(outWidth) * rowStep, sums);
+
+			unsigned char* dst = out + static_cast<size_t>(y) * outWidth * channels;
+			if (channels == 1)
+			{
+				for (unsigned int x = 0; x < outWidth; x++)
+				{
+					const uint16_t* box = sums + x * rowStep;
+					uint32_t sum = 0;
+					for (unsigned int k = 0; k < factor; k++)
+						sum += box[k];
+					dst[x] = Scale(sum, scale);
+				}
+				continue;
+			}
+
+			for (unsigned int x = 0; x < outWidth; x++, dst += 3)
+			{
+				const uint16_t* box = sums + x * rowStep;
+				uint32_t sum0 = 0, sum1 = 0, sum2 = 0;
+				for (unsigned int k = 0; k < rowStep; k += 3)
+				{
+					sum0 += box[k];
+					sum1 += box[k + 1];
+					sum2 += box[k + 2];
+				}
+				dst[outIndex[0]] = Scale(sum0, scale);
+				dst[outIndex[1]] = Scale(sum1, scale);
+				dst[outIndex[2]] = Scale(sum2, scale);
+			}
+		}
+	}
+
+private:
+	// 8.24 fixed-point 1 / count, exact to the rounding for any box size
+	static uint32_t Reciprocal(uint32_t count) { return ((1u << 24) + count / 2) / count; }
+
+	static unsigned char Scale(uint32_t sum, uint32_t scale)
+	{
+		const uint64_t value = (static_cast<uint64_t>(sum) * scale + (1u << 23)) >> 24;
+		return static_cast<unsigned char>(value < 255 ? value : 255);
+	}
+
+	// Adds numRows rows, rowStride bytes apart, into sums[0, count)
+	void SumRows(const unsigned char* src, size_t rowStride, unsigned int numRows, size_t count, uint16_t* sums) const
+	{
+		size_t i = 0;
+
+#if defined(COLOR_ENGINE_X86)
+		if (m_useAvx2)
+			i = SumRowsAvx2(src, rowStride, numRows, count, sums);
+
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i low = zero;
+			__m128i high = zero;
+			const unsigned char* p = src + i;
+			for (unsigned int r = 0; r < numRows; r++, p += rowStride)
+			{
+				const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+				low = _mm_add_epi16(low, _mm_unpacklo_epi8(bytes, zero));
+				high = _mm_add_epi16(high, _mm_unpackhi_epi8(bytes, zero));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i), low);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i + 8), high);
+		}
+#endif
+
+		for (; i < count; i++)
+		{
+			uint32_t sum = 0;
+			const unsigned char* p = src + i;
+			for (unsigned int r = 0; r < numRows; r++, p += rowStride)
+				sum += *p;
+			sums[i] = static_cast<uint16_t>(sum);
+		}
+	}
+
+#if defined(COLOR_ENGINE_X86)
+	// Sums 32 columns per step and returns the first column it left out
+	static COLOR_ENGINE_AVX2_TARGET size_t SumRowsAvx2(const unsigned char* src, size_t rowStride, unsigned int numRows, size_t count, uint16_t* sums)
+	{
+		size_t i = 0;
+		for (; i + 32 <= count; i += 32)
+		{
+			__m256i low = _mm256_setzero_si256();
+			__m256i high = _mm256_setzero_si256();
+			const unsigned char* p = src + i;
+			for (unsigned int r = 0; r < numRows; r++, p += rowStride)
+			{
+				low = _mm256_add_epi16(low, _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+				high = _mm256_add_epi16(high, _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16))));
+			}
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + i), low);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + i + 16), high);
+		}
+		return i;
+	}
+#endif
+
+	bool m_useAvx2;
+	std::vector<uint16_t> m_sums;
+};
+
+
+class PreviewPublisher
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// everyN: offer every Nth frame of a camera. cpuBudget: cores the preview
+	// thread may use on average.
+	PreviewPublisher(const std::vector<std::string> & serialNumbers, unsigned int everyN,
+		unsigned int maxWidth, unsigned int maxHeight, double cpuBudget) :
+		m_everyN(everyN > 0 ? everyN : 1), m_maxWidth(maxWidth), m_maxHeight(maxHeight),
+		m_cpuBudget(cpuBudget > 0 ? cpuBudget : 0.01), m_header(NULL), m_cameras(serialNumbers.size()),
+		m_stop(false), m_overBudget(false), m_busySeconds(0), m_maxCostMs(0), m_numBudgetWaits(0)
+	{
+		for (size_t i = 0; i < serialNumbers.size(); i++)
+			m_cameras[i].serialNumber = serialNumbers[i];
+	}
+
+	~PreviewPublisher() { Close(); }
+
+	// Pins the preview thread; call before Open()
+	void SetWorkerCpus(const std::vector<int> & cpus) { m_workerCpus = cpus; }
+
+	// Creates the shared-memory region and starts the preview thread.
+	// Returns 0 on success, -1 on error (the preview stays off).
+	int Open(const std::string & name)
+	{
+		if (m_cameras.empty() || m_cameras.size() > k_previewMaxCameras || m_maxWidth == 0 || m_maxHeight == 0)
+			return -1;
+
+		const size_t bufferSize = PreviewAlignUp(sizeof(PreviewImageHeader) + static_cast<size_t>(m_maxWidth) * m_maxHeight * 3);
+		const size_t slotSize = PreviewAlignUp(sizeof(PreviewSlotHeader)) + 2 * bufferSize;
+		const size_t slotOffset = PreviewAlignUp(sizeof(PreviewRegionHeader));
+		if (m_region.Create(name, slotOffset + m_cameras.size() * slotSize) < 0)
+		{
+			CAPTURE_LOG(Log_Warning) << "[preview] Unable to create shared memory " << SharedMemory::GetPlatformName(name);
+			return -1;
+		}
+
+		m_header = reinterpret_cast<PreviewRegionHeader*>(m_region.GetData());
+		m_header->numCameras = static_cast<uint32_t>(m_cameras.size());
+		m_header->maxWidth = m_maxWidth;
+		m_header->maxHeight = m_maxHeight;
+		m_header->slotOffset = slotOffset;
+		m_header->slotSize = slotSize;
+		m_header->bufferSize = bufferSize;
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			PreviewSlotHeader* slot = GetSlot(static_cast<unsigned int>(i));
+			strncpy(slot->serialNumber, m_cameras[i].serialNumber.c_str(), sizeof(slot->serialNumber) - 1);
+		}
+
+		// Readers check the magic last
+		m_header->publishing.store(1);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(m_header->magic, k_previewMagic, sizeof(k_previewMagic));
+
+		m_stop = false;
+		m_start = Clock::now();
+		m_worker = std::thread(&PreviewPublisher::WorkerLoop, this);
+
+		CAPTURE_LOG(Log_Info) << "[preview] Publishing every " << m_everyN << " frame(s) of " << m_cameras.size() << " cameras at up to "
+			<< m_maxWidth << "x" << m_maxHeight << " to " << SharedMemory::GetPlatformName(name) << ", budget " << m_cpuBudget << " cores";
+		return 0;
+	}
+
+	int GetCameraIndex(const std::string & serialNumber) const
+	{
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			if (m_cameras[i].serialNumber == serialNumber)
+				return static_cast<int>(i);
+		}
+		return -1;
+	}
+
+	// Offers a frame held in a pool buffer, from the camera's grab thread.
+	// Never blocks; returns true if the frame was taken for the preview. The
+	// buffer reference keeps the frame alive until it is published.
+	bool Offer(int cameraIndex, const FrameBufferRef & buffer, size_t stride, unsigned int width, unsigned int height,
+		ContainerPixelFormat format, uint64_t frameID, uint64_t hostTimestamp, uint32_t grabIndex)
+	{
+		if (m_header == NULL || cameraIndex < 0 || cameraIndex >= static_cast<int>(m_cameras.size()) || !buffer.IsValid())
+			return false;
+
+		// Only the camera's grab thread counts its frames
+		Camera & camera = m_cameras[cameraIndex];
+		if (camera.numSeen++ % m_everyN != 0)
+			return false;
+
+		if (m_overBudget.load(std::memory_order_relaxed))
+		{
+			camera.numOverBudget++;
+			return false;
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+		if (!lock.owns_lock())
+		{
+			camera.numBusy++;
+			return false;
+		}
+
+		PendingFrame & pending = camera.pending;
+		if (pending.buffer.IsValid())
+			camera.numSuperseded++;
+		pending.buffer = buffer;
+		pending.stride = stride;
+		pending.width = width;
+		pending.height = height;
+		pending.format = format;
+		pending.frameID = frameID;
+		pending.hostTimestamp = hostTimestamp;
+		pending.grabIndex = grabIndex;
+		lock.unlock();
+
+		m_wake.notify_one();
+		return true;
+	}
+
+	// Stops the preview thread, marks the region closed and logs the cost
+	void Close()
+	{
+		if (m_header == NULL)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		if (m_worker.joinable())
+			m_worker.join();
+
+		const double elapsed = std::chrono::duration<double>(Clock::now() - m_start).count();
+		uint64_t numPublished = 0, numDropped = 0;
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			Camera & camera = m_cameras[i];
+			camera.pending.buffer.Reset();
+			numPublished += camera.numPublished;
+			numDropped += camera.numBusy + camera.numSuperseded + camera.numOverBudget + camera.numFailed;
+			CAPTURE_LOG(Log_Info) << "[preview] [" << camera.serialNumber << "] " << camera.numPublished << " published, skipped "
+				<< camera.numOverBudget << " over budget, " << camera.numBusy << " busy, " << camera.numSuperseded << " superseded, "
+				<< camera.numFailed << " unsupported";
+		}
+		CAPTURE_LOG(Log_Info) << "[preview] " << numPublished << " frames published, " << numDropped << " skipped, "
+			<< (numPublished > 0 ? m_busySeconds * 1000.0 / numPublished : 0.0) << " ms mean, " << m_maxCostMs << " ms max per frame, "
+			<< (elapsed > 0 ? m_busySeconds / elapsed : 0.0) << " cores used of " << m_cpuBudget << ", " << m_numBudgetWaits << " budget waits";
+
+		m_header->publishing.store(0);
+		m_header = NULL;
+		m_region.Close();
+	}
+
+private:
+	struct PendingFrame {
+		FrameBufferRef buffer; // empty if none
+		size_t stride;
+		unsigned int width;
+		unsigned int height;
+		ContainerPixelFormat format;
+		uint64_t frameID;
+		uint64_t hostTimestamp;
+		uint32_t grabIndex;
+
+		PendingFrame() : stride(0), width(0), height(0), format(ContainerPixel_Mono8), frameID(0), hostTimestamp(0), grabIndex(0) {}
+	};
+
+	struct Camera {
+		std::string serialNumber;
+		uint64_t numSeen; // grab thread only
+		PendingFrame pending; // guarded by m_mutex
+		// Totals, read at Close()
+		uint64_t numPublished;
+		uint64_t numOverBudget;
+		uint64_t numBusy;
+		uint64_t numSuperseded;
+		uint64_t numFailed;
+
+		Camera() : numSeen(0), numPublished(0), numOverBudget(0), numBusy(0), numSuperseded(0), numFailed(0) {}
+	};
+
+	PreviewPublisher(const PreviewPublisher &);
+	PreviewPublisher & operator=(const PreviewPublisher &);
+
+	PreviewSlotHeader* GetSlot(unsigned int camera) const
+	{
+		return reinterpret_cast<PreviewSlotHeader*>(m_region.GetData() + m_header->slotOffset + camera * m_header->slotSize);
+	}
+
+	// Downscales a frame into the slot's free buffer and publishes it
+	bool Publish(unsigned int cameraIndex, const PendingFrame & frame)
+	{
+		const unsigned int factor = PreviewDownscaler::GetFactor(frame.width, frame.height, m_maxWidth, m_maxHeight, frame.format);
+		if (factor == 0)
+			return false;
+
+		PreviewSlotHeader* slot = GetSlot(cameraIndex);
+		const uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+		const uint64_t next = sequence / 2 + 1;
+		unsigned char* buffer = reinterpret_cast<unsigned char*>(slot) + PreviewAlignUp(sizeof(PreviewSlotHeader)) + (next & 1) * m_header->bufferSize;
+
+		slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		PreviewImageHeader* image = reinterpret_cast<PreviewImageHeader*>(buffer);
+		image->frameID = frame.frameID;
+		image->hostTimestamp = frame.hostTimestamp;
+		image->grabIndex = frame.grabIndex;
+		image->sourceWidth = frame.width;
+		image->sourceHeight = frame.height;
+		image->factor = factor;
+		image->width = frame.width / factor;
+		image->height = frame.height / factor;
+		image->channels = PreviewDownscaler::GetChannels(frame.format);
+		m_downscaler.Downscale(frame.buffer.GetData(), frame.stride, frame.width, frame.height, frame.format, factor,
+			buffer + sizeof(PreviewImageHeader));
+
+		slot->sequence.store(sequence + 2, std::memory_order_release);
+		return true;
+	}
+
+	void WorkerLoop()
+	{
+		if (!m_workerCpus.empty())
+			PinCurrentThread(m_workerCpus);
+
+		// Token bucket in seconds of preview work; a short burst is allowed
+		const double maxCredit = 0.05;
+		double credit = maxCredit;
+		Clock::time_point lastRefill = Clock::now();
+		unsigned int nextCamera = 0;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_wake.wait(lock, [this] { return m_stop || HasPending(); });
+			if (m_stop)
+				break;
+
+			// Round-robin, so a fast camera cannot starve the others
+			unsigned int cameraIndex = nextCamera;
+			while (!m_cameras[cameraIndex].pending.buffer.IsValid())
+				cameraIndex = (cameraIndex + 1) % m_cameras.size();
+			nextCamera = static_cast<unsigned int>((cameraIndex + 1) % m_cameras.size());
+
+			PendingFrame frame;
+			std::swap(frame, m_cameras[cameraIndex].pending);
+			lock.unlock();
+
+			const Clock::time_point start = Clock::now();
+			const bool published = Publish(cameraIndex, frame);
+			frame.buffer.Reset();
+			const Clock::time_point end = Clock::now();
+			const double cost = std::chrono::duration<double>(end - start).count();
+
+			m_busySeconds += cost;
+			m_maxCostMs = std::max(m_maxCostMs, cost * 1000.0);
+
+			credit = std::min(maxCredit, credit + m_cpuBudget * std::chrono::duration<double>(end - lastRefill).count()) - cost;
+			lastRefill = end;
+
+			lock.lock();
+			if (published)
+				m_cameras[cameraIndex].numPublished++;
+			else
+				m_cameras[cameraIndex].numFailed++;
+
+			// Over budget: refuse frames until the bucket is refilled
+			if (credit < 0)
+			{
+				m_overBudget.store(true, std::memory_order_relaxed);
+				m_numBudgetWaits++;
+				m_wake.wait_for(lock, std::chrono::duration<double>(-credit / m_cpuBudget), [this] { return m_stop; });
+				m_overBudget.store(false, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool HasPending() const
+	{
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			if (m_cameras[i].pending.buffer.IsValid())
+				return true;
+		}
+		return false;
+	}
+
+	unsigned int m_everyN;
+	unsigned int m_maxWidth;
+	unsigned int m_maxHeight;
+	double m_cpuBudget;
+	std::vector<int> m_workerCpus;
+
+	SharedMemory m_region;
+	PreviewRegionHeader* m_header;
+	std::vector<Camera> m_cameras;
+	PreviewDownscaler m_downscaler; // preview thread only
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_stop;
+	std::atomic<bool> m_overBudget;
+	std::thread m_worker;
+
+	// Preview thread cost
+	Clock::time_point m_start;
+	double m_busySeconds;
+	double m_maxCostMs;
+	uint64_t m_numBudgetWaits;
+};
+
+
+// Viewer side: maps the region of a running capture and copies out the
+// latest preview image of a camera.
+class PreviewReader
+{
+public:
+	PreviewReader() : m_header(NULL) {}
+
+	// Returns 0 on success, -1 if no capture is publishing under that name
+	int Open(const std::string & name)
+	{
+		m_header = NULL;
+		if (m_region.Open(name, false) < 0)
+			return -1;
+
+		const PreviewRegionHeader* header = reinterpret_cast<const PreviewRegionHeader*>(m_region.GetData());
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_region.GetSize() < sizeof(PreviewRegionHeader) || memcmp(header->magic, k_previewMagic, sizeof(k_previewMagic)) != 0 ||
+			header->numCameras > k_previewMaxCameras || header->slotOffset + header->numCameras * header->slotSize > m_region.GetSize())
+		{
+			m_region.Close();
+			return -1;
+		}
+
+		m_header = header;
+		return 0;
+	}
+
+	void Close()
+	{
+		m_header = NULL;
+		m_region.Close();
+	}
+
+	// False once the capture process has closed the region; reopen to follow
+	// the next run
+	bool IsPublishing() const { return m_header != NULL && m_header->publishing.load() != 0; }
+
+	unsigned int GetNumCameras() const { return m_header != NULL ? m_header->numCameras : 0; }
+
+	std::string GetSerialNumber(unsigned int camera) const
+	{
+		const PreviewSlotHeader* slot = GetSlot(camera);
+		return std::string(slot->serialNumber, strnlen(slot->serialNumber, sizeof(slot->serialNumber)));
+	}
+
+	// Number of images the camera has published so far
+	uint64_t GetNumPublished(unsigned int camera) const { return GetSlot(camera)->sequence.load(std::memory_order_acquire) / 2; }
+
+	// Copies the latest image of a camera. Returns false if it has none yet,
+	// or if the publisher kept overwriting it while it was copied.
+	bool Read(unsigned int camera, PreviewImageHeader & image, std::vector<unsigned char> & pixels) const
+	{
+		if (camera >= GetNumCameras())
+			return false;
+
+		const PreviewSlotHeader* slot = GetSlot(camera);
+		const size_t bufferSize = static_cast<size_t>(m_header->bufferSize);
+		for (int attempt = 0; attempt < 4; attempt++)
+		{
+			const uint64_t before = slot->sequence.load(std::memory_order_acquire);
+			const uint64_t latest = before / 2;
+			if (latest == 0)
+				return false;
+
+			const unsigned char* buffer = reinterpret_cast<const unsigned char*>(slot) +
+				PreviewAlignUp(sizeof(PreviewSlotHeader)) + (latest & 1) * bufferSize;
+			memcpy(&image, buffer, sizeof(image));
+			const size_t size = static_cast<size_t>(image.width) * image.height * image.channels;
+			if (size <= bufferSize - sizeof(PreviewImageHeader))
+			{
+				pixels.resize(size);
+				if (size > 0)
+					memcpy(&pixels[0], buffer + sizeof(PreviewImageHeader), size);
+			}
+
+			// Buffer latest & 1 is written again for image latest + 2
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const uint64_t after = slot->sequence.load(std::memory_order_relaxed);
+			if (after <= latest * 2 + 2 && size <= bufferSize - sizeof(PreviewImageHeader))
+				return true;
+		}
+		return false;
+	}
+
+private:
+	PreviewReader(const PreviewReader &);
+	PreviewReader & operator=(const PreviewReader &);
+
+	const PreviewSlotHeader* GetSlot(unsigned int camera) const
+	{
+		return reinterpret_cast<const PreviewSlotHeader*>(m_region.GetData() + m_header->slotOffset + camera * m_header->slotSize);
+	}
+
+	SharedMemory m_region;
+	const PreviewRegionHeader* m_header;
+};
+
+#endif // PREVIEW_PUBLISHER_H
@@ -0,0 +1,138 @@
+//=============================================================================
+// PreviewSnapshot.cpp
+//
+// Minimal viewer of the live preview that AcquisitionMultipleThread
+// publishes while capturing (PreviewPublisher.h). Only needs the
+// Spinnaker-free headers.
+//
+// Usage:
+//   PreviewSnapshot [--name <region>]                    one status line per camera
+//   PreviewSnapshot [--name <region>] <dir>              write <dir>/<serial>.ppm (.pgm for mono)
+//   PreviewSnapshot [--name <region>] <dir> --every <ms> keep overwriting them until capture ends
+//=============================================================================
+
+#include "PreviewPublisher.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const string defaultRegionName = "MultiCameraPreview";
+
+
+// This function prints what each camera has published and how old its
+// latest preview is
+void PrintStatus(const PreviewReader & reader)
+{
+	const uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+
+	for (unsigned int c = 0; c < reader.GetNumCameras(); c++)
+	{
+		PreviewImageHeader image;
+		vector<unsigned char> pixels;
+		cout << reader.GetSerialNumber(c) << "\t" << reader.GetNumPublished(c) << " published";
+		if (reader.Read(c, image, pixels))
+		{
+			cout << "\t" << image.width << "x" << image.height << " of " << image.sourceWidth << "x" << image.sourceHeight
+				<< "\tframe ID " << image.frameID << "\t" << (now > image.hostTimestamp ? (now - image.hostTimestamp) / 1000000 : 0) << " ms old";
+		}
+		cout << endl;
+	}
+}
+
+
+// This function writes the latest preview of every camera as a binary
+// PPM/PGM; BGR is swapped to the format's RGB
+int WriteSnapshots(const PreviewReader & reader, const string & folder)
+{
+	int numWritten = 0;
+	for (unsigned int c = 0; c < reader.GetNumCameras(); c++)
+	{
+		PreviewImageHeader image;
+		vector<unsigned char> pixels;
+		if (!reader.Read(c, image, pixels))
+			continue;
+
+		if (image.channels == 3)
+		{
+			for (size_t i = 0; i + 2 < pixels.size(); i += 3)
+				swap(pixels[i], pixels[i + 2]);
+		}
+
+		// Written aside and renamed, so an image viewer never shows half a file
+		const string filename = folder + "/" + reader.GetSerialNumber(c) + (image.channels == 3 ? ".ppm" : ".pgm");
+		const string partName = filename + ".part";
+		FILE* file = fopen(partName.c_str(), "wb");
+		if (file == NULL)
+		{
+			cout << "Unable to write " << partName << endl;
+			continue;
+		}
+		fprintf(file, "P%d\n%u %u\n255\n", image.channels == 3 ? 6 : 5, image.width, image.height);
+		const bool ok = pixels.empty() || fwrite(&pixels[0], 1, pixels.size(), file) == pixels.size();
+		fclose(file);
+
+		remove(filename.c_str());
+		if (!ok || rename(partName.c_str(), filename.c_str()) != 0)
+		{
+			cout << "Unable to write " << filename << endl;
+			continue;
+		}
+		numWritten++;
+	}
+
+	return numWritten;
+}
+
+
+int main(int argc, char** argv)
+{
+	string regionName = defaultRegionName;
+	string folder;
+	int everyMs = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		const string arg = argv[i];
+		if (arg == "--name" && i + 1 < argc)
+			regionName = argv[++i];
+		else if (arg == "--every" && i + 1 < argc)
+			everyMs = atoi(argv[++i]);
+		else if (folder.empty() && arg.compare(0, 2, "--") != 0)
+			folder = arg;
+		else
+		{
+			cout << "Usage: PreviewSnapshot [--name <region>] [<dir> [--every <ms>]]" << endl;
+			return 1;
+		}
+	}
+
+	PreviewReader reader;
+	if (reader.Open(regionName) < 0)
+	{
+		cout << "No capture is publishing a preview as " << SharedMemory::GetPlatformName(regionName) << endl;
+		return -1;
+	}
+
+	if (folder.empty())
+	{
+		PrintStatus(reader);
+		return 0;
+	}
+
+	do
+	{
+		if (WriteSnapshots(reader, folder) == 0 && everyMs <= 0)
+		{
+			cout << "No preview images yet" << endl;
+			return -1;
+		}
+		if (everyMs > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(everyMs));
+	} while (everyMs > 0 && reader.IsPublishing());
+
+	return 0;
+}
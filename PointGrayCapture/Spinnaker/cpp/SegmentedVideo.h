@@ -0,0 +1,428 @@
+//=============================================================================
+// SegmentedVideo.h
+//
+// One camera's video, written as a series of fixed-length segments instead
+// of one SpinVideo that splits on file size. A segment is a SpinVideo file or
+// a file of another encoder backend (X264Encoder.h). A segment covers a fixed number
+// of trigger pulses, so the cameras of a rig roll over on the same frame set
+// and segment N of every camera holds the same stretch of time.
+//
+// The writer thread only appends. A background thread opens every segment,
+// the next one ahead of time, and closes the previous one after a rollover,
+// so neither file creation nor finalization lands on the writer thread.
+//
+// The manifest lists each segment as it is closed, in order:
+//
+//   # segment first_frame num_frames first_position file
+//   0 0 1200 0 D:\temp\18565847-0000
+//
+// Frame f of the camera (its capture index, img_%06d downstream) is in the
+// segment with first_frame <= f < first_frame + num_frames, at local index
+// f - first_frame. The backend adds the file extension to the file name.
+//=============================================================================
+
+#ifndef SEGMENTED_VIDEO_H
+#define SEGMENTED_VIDEO_H
+
+#include "Spinnaker.h"
+#include "SpinVideo.h"
+#include "CaptureLog.h"
+#include "ThreadPlacement.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Position of a frame that is not on the pulse grid; it stays in the
+// current segment
+const int64_t k_segmentNoPosition = std::numeric_limits<int64_t>::min();
+
+// One file of a segmented video
+class VideoSegment
+{
+public:
+	virtual ~VideoSegment() {}
+
+	virtual void Append(const Spinnaker::ImagePtr & image) = 0;
+
+	// Finalizes the file; runs on the background thread
+	virtual void Close() = 0;
+
+	// Closes and deletes the file, for a segment opened ahead that was
+	// never used
+	virtual void Discard() = 0;
+};
+
+
+class SpinVideoSegment : public VideoSegment
+{
+public:
+	// filename is the name the video is opened under, extension the one
+	// SpinVideo adds for the chosen option
+	SpinVideoSegment(const std::string & filename, const std::string & extension) : m_filename(filename), m_extension(extension) {}
+
+	// Open the video through this before the segment is used
+	Spinnaker::Video::SpinVideo & GetVideo() { return m_video; }
+
+	void Append(const Spinnaker::ImagePtr & image) { m_video.Append(image); }
+	void Close() { m_video.Close(); }
+
+	// With a maximum file size set, SpinVideo may add its own split index
+	// to the name, so both names are tried
+	void Discard()
+	{
+		m_video.Close();
+		if (remove((m_filename + m_extension).c_str()) != 0)
+			remove((m_filename + "-0000" + m_extension).c_str());
+	}
+
+private:
+	Spinnaker::Video::SpinVideo m_video;
+	std::string m_filename;
+	std::string m_extension;
+};
+
+
+class SegmentedVideo
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// Opens a segment under the given file name, without extension. Returns
+	// NULL or throws Spinnaker::Exception on failure.
+	typedef std::function<VideoSegment*(const std::string & filename)> OpenFunction;
+
+	SegmentedVideo() :
+		m_positionsPerSegment(0),
+		m_current(NULL), m_segmentIndex(0), m_segmentKey(0), m_haveKey(false), m_firstFrame(0), m_firstPosition(k_segmentNoPosition), m_numFrames(0),
+		m_next(NULL), m_nextFailed(false), m_manifestFile(NULL), m_closing(false),
+		m_numSegments(0), m_numRolloverWaits(0), m_maxRolloverWaitMs(0), m_maxCloseMs(0) {}
+
+	~SegmentedVideo() { Close(); }
+
+	// Restricts the background thread to the given CPUs; call before Open().
+	// Encoder threads it starts inherit the affinity on Linux.
+	void SetWorkerCpus(const std::vector<int> & cpus) { m_workerCpus = cpus; }
+
+	// Opens the first segment and starts preparing the next one.
+	// positionsPerSegment is the segment length in trigger pulses, 0 writes a
+	// single segment. Returns 0 on success, -1 if the first segment or the
+	// manifest cannot be created.
+	int Open(const std::string & basename, const std::string & manifestFilename, int64_t positionsPerSegment, OpenFunction openVideo)
+	{
+		m_basename = basename;
+		m_positionsPerSegment = positionsPerSegment;
+		m_openVideo = openVideo;
+
+		m_manifestFile = fopen(manifestFilename.c_str(), "w");
+		if (m_manifestFile == NULL)
+		{
+			CAPTURE_LOG(Log_Error) << "Unable to create video manifest " << manifestFilename;
+			return -1;
+		}
+		fprintf(m_manifestFile, "# segment first_frame num_frames first_position file\n");
+		fflush(m_manifestFile);
+
+		// The worker opens the first segment as well, so that the threads of
+		// every encoder are started the same way
+		m_worker = std::thread(&SegmentedVideo::WorkerLoop, this);
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_changed.wait(lock, [this] { return m_next != NULL || m_nextFailed; });
+			m_current = m_next;
+			m_next = NULL;
+			m_nextFailed = false;
+			if (m_current == NULL)
+				m_closing = true;
+		}
+		m_changed.notify_all();
+
+		if (m_current == NULL)
+		{
+			m_worker.join();
+			return -1;
+		}
+		return 0;
+	}
+
+	bool IsOpen() const { return m_current != NULL; }
+
+	// Appends one frame. position is the frame's trigger pulse (its frame
+	// set), or its capture index when the camera is not in frame-set
+	// assembly; the segment rolls over when the position enters the next
+	// segment's range.
+	void Append(const Spinnaker::ImagePtr & image, int64_t position)
+	{
+		if (m_current == NULL)
+			return;
+
+		if (position != k_segmentNoPosition)
+		{
+			const int64_t key = m_positionsPerSegment > 0 ? FloorDiv(position, m_positionsPerSegment) : 0;
+			if (!m_haveKey)
+			{
+				m_segmentKey = key;
+				m_haveKey = true;
+			}
+			else if (key > m_segmentKey && m_numFrames > m_firstFrame)
+			{
+				Rollover(key);
+			}
+			if (m_firstPosition == k_segmentNoPosition)
+				m_firstPosition = position;
+		}
+
+		m_current->Append(image);
+		m_numFrames++;
+	}
+
+	// Finalizes the last segment and waits until every segment is closed.
+	void Close()
+	{
+		if (m_current != NULL)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_toClose.push_back(ClosingSegment(m_current, m_segmentIndex, m_firstFrame, m_numFrames - m_firstFrame, m_firstPosition));
+			m_current = NULL;
+			m_closing = true;
+		}
+		m_changed.notify_all();
+
+		if (m_worker.joinable())
+		{
+			m_worker.join();
+
+			CAPTURE_LOG(Log_Info) << "Video " << m_basename << ": " << m_numFrames << " frames in " << m_numSegments
+				<< " segments, " << m_numRolloverWaits << " rollovers waited for the next segment (longest "
+				<< static_cast<int>(m_maxRolloverWaitMs) << " ms), slowest close " << static_cast<int>(m_maxCloseMs) << " ms";
+		}
+
+		if (m_next != NULL)
+		{
+			// Prepared but never used; its empty file is not in the manifest
+			DiscardVideo(m_next);
+			m_next = NULL;
+		}
+
+		if (m_manifestFile != NULL)
+		{
+			fclose(m_manifestFile);
+			m_manifestFile = NULL;
+		}
+	}
+
+	uint64_t GetNumFrames() const { return m_numFrames; }
+
+private:
+	SegmentedVideo(const SegmentedVideo &);
+	SegmentedVideo & operator=(const SegmentedVideo &);
+
+	struct ClosingSegment {
+		VideoSegment* video;
+		unsigned int index;
+		uint64_t firstFrame;
+		uint64_t numFrames;
+		int64_t firstPosition;
+
+		ClosingSegment(VideoSegment* _video, unsigned int _index, uint64_t _firstFrame, uint64_t _numFrames, int64_t _firstPosition) :
+			video(_video), index(_index), firstFrame(_firstFrame), numFrames(_numFrames), firstPosition(_firstPosition) {}
+	};
+
+	static int64_t FloorDiv(int64_t a, int64_t b)
+	{
+		int64_t q = a / b;
+		if ((a % b != 0) && ((a < 0) != (b < 0)))
+			q--;
+		return q;
+	}
+
+	std::string GetSegmentName(unsigned int index) const
+	{
+		char buffer[16]; sprintf(buffer, "-%04u", index);
+		return m_basename + buffer;
+	}
+
+	// Returns NULL if the segment cannot be opened
+	VideoSegment* OpenSegment(unsigned int index)
+	{
+		VideoSegment* video = NULL;
+		try
+		{
+			video = m_openVideo(GetSegmentName(index));
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			CAPTURE_LOG(Log_Error) << "Unable to open video segment " << GetSegmentName(index) << ": " << e.what();
+			return NULL;
+		}
+		if (video == NULL)
+			CAPTURE_LOG(Log_Error) << "Unable to open video segment " << GetSegmentName(index);
+		return video;
+	}
+
+	static void CloseVideo(VideoSegment* video)
+	{
+		try
+		{
+			video->Close();
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			CAPTURE_LOG(Log_Error) << "Unable to close video segment: " << e.what();
+		}
+		delete video;
+	}
+
+	static void DiscardVideo(VideoSegment* video)
+	{
+		try
+		{
+			video->Discard();
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			CAPTURE_LOG(Log_Error) << "Unable to remove unused video segment: " << e.what();
+		}
+		delete video;
+	}
+
+	// Hands the current segment to the worker and continues in the prepared
+	// one. Waits only if the worker has not opened it yet; if that failed,
+	// the current segment simply grows and the next rollover tries again.
+	void Rollover(int64_t key)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_next == NULL && !m_nextFailed)
+			{
+				const Clock::time_point waitStart = Clock::now();
+				m_changed.wait(lock, [this] { return m_next != NULL || m_nextFailed; });
+				const double waitMs = std::chrono::duration<double, std::milli>(Clock::now() - waitStart).count();
+				m_numRolloverWaits++;
+				if (waitMs > m_maxRolloverWaitMs)
+					m_maxRolloverWaitMs = waitMs;
+			}
+
+			if (m_next == NULL)
+			{
+				m_nextFailed = false;
+				m_segmentKey = key;
+				lock.unlock();
+				m_changed.notify_all();
+				CAPTURE_LOG(Log_Warning) << "Video " << m_basename << ": next segment not available, continuing segment " << m_segmentIndex;
+				return;
+			}
+
+			m_toClose.push_back(ClosingSegment(m_current, m_segmentIndex, m_firstFrame, m_numFrames - m_firstFrame, m_firstPosition));
+			m_current = m_next;
+			m_next = NULL;
+			m_segmentIndex++;
+		}
+		m_changed.notify_all();
+
+		m_segmentKey = key;
+		m_firstFrame = m_numFrames;
+		m_firstPosition = k_segmentNoPosition;
+	}
+
+	// Closes queued segments and records them in the manifest
+	void FinishClosing()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (!m_toClose.empty())
+		{
+			ClosingSegment segment = m_toClose.front();
+			m_toClose.pop_front();
+			lock.unlock();
+
+			const Clock::time_point closeStart = Clock::now();
+			CloseVideo(segment.video);
+			const double closeMs = std::chrono::duration<double, std::milli>(Clock::now() - closeStart).count();
+
+			if (m_manifestFile != NULL)
+			{
+				fprintf(m_manifestFile, "%u %llu %llu %lld %s\n", segment.index, static_cast<unsigned long long>(segment.firstFrame),
+					static_cast<unsigned long long>(segment.numFrames),
+					static_cast<long long>(segment.firstPosition != k_segmentNoPosition ? segment.firstPosition : -1),
+					GetSegmentName(segment.index).c_str());
+				fflush(m_manifestFile);
+			}
+
+			lock.lock();
+			m_numSegments++;
+			if (closeMs > m_maxCloseMs)
+				m_maxCloseMs = closeMs;
+		}
+	}
+
+	void WorkerLoop()
+	{
+		if (!m_workerCpus.empty())
+			PinCurrentThread(m_workerCpus);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			// The first segment, then the next one while segments roll over
+			m_changed.wait(lock, [this] { return !m_toClose.empty() || m_closing ||
+				(m_next == NULL && !m_nextFailed && (m_current == NULL || m_positionsPerSegment > 0)); });
+
+			// Finalize first, it frees the memory of the previous segment
+			if (!m_toClose.empty())
+			{
+				lock.unlock();
+				FinishClosing();
+				lock.lock();
+				continue;
+			}
+
+			if (m_closing)
+				break;
+
+			const unsigned int index = m_current == NULL ? 0 : m_segmentIndex + 1;
+			lock.unlock();
+			VideoSegment* video = OpenSegment(index);
+			lock.lock();
+			m_next = video;
+			m_nextFailed = video == NULL;
+			m_changed.notify_all();
+		}
+	}
+
+	std::string m_basename;
+	int64_t m_positionsPerSegment;
+	OpenFunction m_openVideo;
+	std::vector<int> m_workerCpus;
+
+	// Writer thread state; m_current is only swapped under m_mutex
+	VideoSegment* m_current;
+	unsigned int m_segmentIndex;
+	int64_t m_segmentKey;
+	bool m_haveKey;
+	uint64_t m_firstFrame;
+	int64_t m_firstPosition;
+	uint64_t m_numFrames;
+
+	std::mutex m_mutex;
+	std::condition_variable m_changed;
+	VideoSegment* m_next; // opened ahead by the worker
+	bool m_nextFailed;
+	std::deque<ClosingSegment> m_toClose;
+	FILE* m_manifestFile; // written by the worker
+	bool m_closing;
+	std::thread m_worker;
+
+	unsigned int m_numSegments;
+	unsigned int m_numRolloverWaits;
+	double m_maxRolloverWaitMs;
+	double m_maxCloseMs;
+};
+
+#endif // SEGMENTED_VIDEO_H
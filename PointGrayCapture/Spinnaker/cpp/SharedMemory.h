@@ -0,0 +1,181 @@
+//=============================================================================
+// SharedMemory.h
+//
+// Named shared-memory region that other processes on the machine can map,
+// e.g. a live viewer. The capture process creates the region; readers open
+// it by the same name. On Windows it is a pagefile-backed file mapping in the
+// session namespace ("Local\<name>"), which goes away with its last handle.
+// On Linux it is a POSIX shm object ("/<name>", under /dev/shm), which the
+// creator removes when it closes the region.
+//
+// Create() hands out a zero-filled region on both platforms.
+//=============================================================================
+
+#ifndef SHARED_MEMORY_H
+#define SHARED_MEMORY_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class SharedMemory
+{
+public:
+	SharedMemory() : m_data(NULL), m_size(0), m_owner(false)
+	{
+#if defined(_WIN32)
+		m_mapping = NULL;
+#endif
+	}
+
+	~SharedMemory() { Close(); }
+
+	// Creates the region with size bytes, replacing a stale region of the same
+	// name left by a crashed run. Returns 0 on success, -1 on error.
+	int Create(const std::string & name, size_t size)
+	{
+		Close();
+		m_name = GetPlatformName(name);
+
+#if defined(_WIN32)
+		const uint64_t size64 = size;
+		m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+			static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64 & 0xFFFFFFFF), m_name.c_str());
+		if (m_mapping == NULL)
+			return -1;
+
+		// A reader still holding the previous run's region keeps it alive; it is
+		// reused if large enough (the view fails otherwise) and cleared
+		const bool existed = GetLastError() == ERROR_ALREADY_EXISTS;
+		m_data = static_cast<unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+		if (m_data != NULL && existed)
+			memset(m_data, 0, size);
+#else
+		shm_unlink(m_name.c_str());
+		int file = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+		if (file < 0)
+			return -1;
+
+		if (ftruncate(file, static_cast<off_t>(size)) != 0)
+		{
+			close(file);
+			shm_unlink(m_name.c_str());
+			return -1;
+		}
+
+		void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		close(file);
+		if (data == MAP_FAILED)
+		{
+			shm_unlink(m_name.c_str());
+			return -1;
+		}
+		m_data = static_cast<unsigned char*>(data);
+#endif
+		m_size = size;
+		m_owner = true;
+
+		if (m_data == NULL)
+		{
+			Close();
+			return -1;
+		}
+		return 0;
+	}
+
+	// Maps a region another process created. Returns 0 on success, -1 if
+	// there is no region of that name or it cannot be mapped.
+	int Open(const std::string & name, bool writable)
+	{
+		Close();
+		m_name = GetPlatformName(name);
+
+#if defined(_WIN32)
+		m_mapping = OpenFileMappingA(writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, FALSE, m_name.c_str());
+		if (m_mapping == NULL)
+			return -1;
+
+		m_data = static_cast<unsigned char*>(MapViewOfFile(m_mapping, writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0));
+		MEMORY_BASIC_INFORMATION info;
+		if (m_data == NULL || VirtualQuery(m_data, &info, sizeof(info)) == 0)
+		{
+			Close();
+			return -1;
+		}
+		m_size = info.RegionSize;
+#else
+		int file = shm_open(m_name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+		if (file < 0)
+			return -1;
+
+		struct stat stats;
+		if (fstat(file, &stats) != 0 || stats.st_size == 0)
+		{
+			close(file);
+			return -1;
+		}
+
+		void* data = mmap(NULL, static_cast<size_t>(stats.st_size), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+		close(file);
+		if (data == MAP_FAILED)
+			return -1;
+
+		m_data = static_cast<unsigned char*>(data);
+		m_size = static_cast<size_t>(stats.st_size);
+#endif
+		return 0;
+	}
+
+	// Unmaps the region; the creator also removes its name, so readers that
+	// still have it mapped keep their view but new readers cannot open it
+	void Close()
+	{
+#if defined(_WIN32)
+		if (m_data != NULL) UnmapViewOfFile(m_data);
+		if (m_mapping != NULL) CloseHandle(m_mapping);
+		m_mapping = NULL;
+#else
+		if (m_data != NULL) munmap(m_data, m_size);
+		if (m_owner) shm_unlink(m_name.c_str());
+#endif
+		m_data = NULL;
+		m_size = 0;
+		m_owner = false;
+	}
+
+	bool IsOpen() const { return m_data != NULL; }
+	unsigned char* GetData() const { return m_data; }
+	size_t GetSize() const { return m_size; }
+
+	static std::string GetPlatformName(const std::string & name)
+	{
+#if defined(_WIN32)
+		return "Local\\" + name;
+#else
+		return "/" + name;
+#endif
+	}
+
+private:
+	SharedMemory(const SharedMemory &);
+	SharedMemory & operator=(const SharedMemory &);
+
+#if defined(_WIN32)
+	HANDLE m_mapping;
+#endif
+	unsigned char* m_data;
+	size_t m_size;
+	bool m_owner;
+	std::string m_name;
+};
+
+#endif // SHARED_MEMORY_H
@@ -0,0 +1,130 @@
+//=============================================================================
+// StartBarrier.h
+//
+// Armed-state barrier in front of the primary camera's trigger. Every camera
+// thread calls Arm() once its acquisition has started and its trigger is
+// configured, i.e. once it would capture the first trigger pulse. The primary
+// waits in WaitForAll() and only switches its trigger off, which starts the
+// rig, when every camera is armed, so no secondary misses the first frames.
+//
+// A camera thread that gives up before arming must report it, or the primary
+// would wait for the timeout; StartBarrierGuard does that on every early
+// return.
+//=============================================================================
+
+#ifndef START_BARRIER_H
+#define START_BARRIER_H
+
+#include "CaptureLog.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class StartBarrier
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// Arm latencies are measured from construction, i.e. from the start of
+	// the camera threads
+	explicit StartBarrier(unsigned int numCameras) : m_numCameras(numCameras), m_start(Clock::now()) {}
+
+	void Arm(const std::string & serialNumber)
+	{
+		const double ms = std::chrono::duration<double, std::milli>(Clock::now() - m_start).count();
+		size_t numArmed;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_armed.push_back(std::make_pair(serialNumber, ms));
+			numArmed = m_armed.size();
+		}
+		m_changed.notify_all();
+
+		CAPTURE_LOG(Log_Info) << "[" << serialNumber << "] " << "Armed after " << static_cast<int>(ms) << " ms (" << numArmed << "/" << m_numCameras << ")";
+	}
+
+	void Fail(const std::string & serialNumber)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_failed.push_back(serialNumber);
+		}
+		m_changed.notify_all();
+
+		CAPTURE_LOG(Log_Error) << "[" << serialNumber << "] " << "Camera failed before arming";
+	}
+
+	// Blocks until every camera is armed or has failed, or timeoutMs passed.
+	// Returns true if all cameras are armed, and logs the outcome.
+	bool WaitForAll(unsigned int timeoutMs)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return m_armed.size() + m_failed.size() >= m_numCameras; });
+
+		std::ostringstream summary;
+		const bool allArmed = m_armed.size() >= m_numCameras;
+		if (allArmed)
+		{
+			summary << "[start] All " << m_numCameras << " cameras armed after " << static_cast<int>(m_armed.back().second)
+				<< " ms, last " << m_armed.back().first;
+		}
+		else
+		{
+			summary << "[start] " << m_armed.size() << " of " << m_numCameras << " cameras armed";
+			for (size_t i = 0; i < m_failed.size(); i++)
+				summary << (i == 0 ? ", failed: " : " ") << m_failed[i];
+			if (m_armed.size() + m_failed.size() < m_numCameras)
+				summary << ", " << m_numCameras - m_armed.size() - m_failed.size() << " not ready after " << timeoutMs << " ms";
+		}
+		CAPTURE_LOG(allArmed ? Log_Info : Log_Warning) << summary.str();
+
+		return allArmed;
+	}
+
+private:
+	StartBarrier(const StartBarrier &);
+	StartBarrier & operator=(const StartBarrier &);
+
+	size_t m_numCameras;
+	Clock::time_point m_start;
+
+	std::mutex m_mutex;
+	std::condition_variable m_changed;
+	std::vector<std::pair<std::string, double> > m_armed;
+	std::vector<std::string> m_failed;
+};
+
+
+// Reports the camera as failed if its thread leaves before Arm()
+class StartBarrierGuard
+{
+public:
+	StartBarrierGuard(StartBarrier* barrier, const std::string & serialNumber) :
+		m_barrier(barrier), m_serialNumber(serialNumber), m_armed(false) {}
+
+	~StartBarrierGuard()
+	{
+		if (m_barrier != NULL && !m_armed)
+			m_barrier->Fail(m_serialNumber);
+	}
+
+	void Arm()
+	{
+		if (m_barrier != NULL && !m_armed)
+			m_barrier->Arm(m_serialNumber);
+		m_armed = true;
+	}
+
+private:
+	StartBarrierGuard(const StartBarrierGuard &);
+	StartBarrierGuard & operator=(const StartBarrierGuard &);
+
+	StartBarrier* m_barrier;
+	std::string m_serialNumber;
+	bool m_armed;
+};
+
+#endif // START_BARRIER_H
@@ -0,0 +1,423 @@
+//=============================================================================
+// StorageScheduler.h
+//
+// Throughput-aware placement of camera streams on the output volumes.
+// Every volume is probed for free space and sustained write bandwidth (large
+// aligned writes that bypass the page cache, so the number reflects the disk
+// and not RAM), then each stream is placed on a volume that can sustain it
+// for the planned capture duration. A stream stays on its preferred volume
+// while that volume has headroom, so healthy setups keep their usual layout.
+//
+// AlignedFileWriter is the direct-I/O writer used for the probe; it can be
+// used for any large sequential file written by the capture program.
+//=============================================================================
+
+#ifndef STORAGE_SCHEDULER_H
+#define STORAGE_SCHEDULER_H
+
+#include "CaptureLog.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#endif
+
+
+// Sequential file writer with unbuffered, aligned writes (FILE_FLAG_NO_BUFFERING
+// on Windows, O_DIRECT elsewhere). Data is collected in an aligned buffer and
+// written in full buffer-sized blocks; Close() pads the last block and then
+// truncates the file to the bytes actually written.
+class AlignedFileWriter
+{
+public:
+	static const size_t k_alignment = 4096; // covers 512e and 4Kn sectors
+
+	AlignedFileWriter() : m_buffer(NULL), m_bufferSize(0), m_used(0), m_bytesWritten(0)
+	{
+#if defined(_WIN32)
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		m_file = -1;
+#endif
+	}
+
+	~AlignedFileWriter() { Close(); }
+
+	// bufferSize is rounded up to the alignment. Returns 0 on success, -1 on error.
+	int Open(const std::string & filename, size_t bufferSize)
+	{
+		Close();
+
+		m_bufferSize = (bufferSize + k_alignment - 1) / k_alignment * k_alignment;
+		if (m_bufferSize == 0)
+			m_bufferSize = k_alignment;
+
+#if defined(_WIN32)
+		m_buffer = static_cast<unsigned char*>(_aligned_malloc(m_bufferSize, k_alignment));
+		if (m_buffer == NULL)
+			return -1;
+
+		m_file = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+		if (m_file == INVALID_HANDLE_VALUE)
+		{
+			Close();
+			return -1;
+		}
+#else
+		void* buffer = NULL;
+		if (posix_memalign(&buffer, k_alignment, m_bufferSize) != 0)
+			return -1;
+		m_buffer = static_cast<unsigned char*>(buffer);
+
+		int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(O_DIRECT)
+		flags |= O_DIRECT;
+#endif
+		m_file = open(filename.c_str(), flags, 0644);
+		if (m_file < 0)
+		{
+			Close();
+			return -1;
+		}
+#endif
+
+		m_used = 0;
+		m_bytesWritten = 0;
+
+		return 0;
+	}
+
+	int Write(const void* data, size_t size)
+	{
+		if (!IsOpen())
+			return -1;
+
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		while (size > 0)
+		{
+			size_t chunk = std::min(size, m_bufferSize - m_used);
+			memcpy(m_buffer + m_used, bytes, chunk);
+			m_used += chunk;
+			bytes += chunk;
+			size -= chunk;
+
+			if (m_used == m_bufferSize && WriteBlock(m_bufferSize) < 0)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	int Close()
+	{
+		int result = 0;
+
+		if (IsOpen())
+		{
+			const uint64_t fileSize = m_bytesWritten + m_used;
+
+			// The last block goes out padded, then the file is cut to size
+			if (m_used > 0)
+			{
+				size_t padded = (m_used + k_alignment - 1) / k_alignment * k_alignment;
+				memset(m_buffer + m_used, 0, padded - m_used);
+				if (WriteBlock(padded) < 0)
+					result = -1;
+			}
+
+#if defined(_WIN32)
+			LARGE_INTEGER position;
+			position.QuadPart = static_cast<LONGLONG>(fileSize);
+			if (!SetFilePointerEx(m_file, position, NULL, FILE_BEGIN) || !SetEndOfFile(m_file))
+				result = -1;
+			CloseHandle(m_file);
+			m_file = INVALID_HANDLE_VALUE;
+#else
+			if (ftruncate(m_file, static_cast<off_t>(fileSize)) != 0)
+				result = -1;
+			close(m_file);
+			m_file = -1;
+#endif
+			m_bytesWritten = fileSize;
+		}
+
+		if (m_buffer != NULL)
+		{
+#if defined(_WIN32)
+			_aligned_free(m_buffer);
+#else
+			free(m_buffer);
+#endif
+			m_buffer = NULL;
+		}
+
+		return result;
+	}
+
+	bool IsOpen() const
+	{
+#if defined(_WIN32)
+		return m_file != INVALID_HANDLE_VALUE;
+#else
+		return m_file >= 0;
+#endif
+	}
+
+	uint64_t GetBytesWritten() const { return m_bytesWritten + m_used; }
+
+private:
+	AlignedFileWriter(const AlignedFileWriter &);
+	AlignedFileWriter & operator=(const AlignedFileWriter &);
+
+	int WriteBlock(size_t size)
+	{
+#if defined(_WIN32)
+		DWORD written = 0;
+		if (!WriteFile(m_file, m_buffer, static_cast<DWORD>(size), &written, NULL) || written != size)
+			return -1;
+#else
+		ssize_t written = write(m_file, m_buffer, size);
+		if (written < 0 || static_cast<size_t>(written) != size)
+			return -1;
+#endif
+		m_bytesWritten += m_used;
+		m_used = 0;
+		return 0;
+	}
+
+#if defined(_WIN32)
+	HANDLE m_file;
+#else
+	int m_file;
+#endif
+	unsigned char* m_buffer;
+	size_t m_bufferSize;
+	size_t m_used;
+	uint64_t m_bytesWritten;
+};
+
+
+// Free bytes available to this process on the volume holding folder, 0 if unknown
+inline uint64_t GetVolumeFreeBytes(const std::string & folder)
+{
+#if defined(_WIN32)
+	ULARGE_INTEGER freeBytes;
+	if (!GetDiskFreeSpaceExA(folder.c_str(), &freeBytes, NULL, NULL))
+		return 0;
+	return freeBytes.QuadPart;
+#else
+	struct statvfs stats;
+	if (statvfs(folder.c_str(), &stats) != 0)
+		return 0;
+	return static_cast<uint64_t>(stats.f_bavail) * stats.f_frsize;
+#endif
+}
+
+
+// This function writes probeBytes to a temporary file in folder with direct
+// I/O and returns the sustained rate in bytes/s, or 0 if the folder is not
+// writable. The file is deleted afterwards.
+inline double MeasureWriteBandwidth(const std::string & folder, uint64_t probeBytes)
+{
+	const size_t k_blockSize = 4 << 20;
+	const std::string probeFilename = folder + "storage_probe.tmp";
+
+	std::vector<unsigned char> block(k_blockSize);
+	for (size_t i = 0; i < block.size(); i++)
+		block[i] = static_cast<unsigned char>(i * 131 + (i >> 12)); // not trivially compressible
+
+	AlignedFileWriter writer;
+	if (writer.Open(probeFilename, k_blockSize) < 0)
+		return 0.0;
+
+	bool ok = true;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint64_t written = 0; written < probeBytes && ok; written += k_blockSize)
+		ok = writer.Write(&block[0], k_blockSize) == 0;
+	ok = writer.Close() == 0 && ok;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	remove(probeFilename.c_str());
+
+	if (!ok || seconds <= 0)
+		return 0.0;
+
+	return static_cast<double>(writer.GetBytesWritten()) / seconds;
+}
+
+
+struct StorageVolume {
+	std::string folder;
+	uint64_t freeBytes;
+	double writeBytesPerSecond; // measured, 0 if the volume is unusable
+	double assignedBytesPerSecond;
+	unsigned int numStreams;
+
+	StorageVolume() : freeBytes(0), writeBytesPerSecond(0), assignedBytesPerSecond(0), numStreams(0) {}
+};
+
+struct StorageStream {
+	std::string name;
+	double bytesPerSecond; // expected write rate of the stream
+	int preferredVolume; // -1 for no preference
+	int volume; // assigned volume, -1 if none is usable
+
+	StorageStream() : bytesPerSecond(0), preferredVolume(-1), volume(-1) {}
+};
+
+
+class StorageScheduler
+{
+public:
+	// folders are output folders, one per volume, ending with a separator
+	explicit StorageScheduler(const std::vector<std::string> & folders)
+	{
+		for (size_t i = 0; i < folders.size(); i++)
+		{
+			StorageVolume volume;
+			volume.folder = folders[i];
+			m_volumes.push_back(volume);
+		}
+	}
+
+	// Measures all volumes in parallel; each writes probeBytes.
+	void Probe(uint64_t probeBytes)
+	{
+		std::vector<std::thread> probes;
+		for (size_t i = 0; i < m_volumes.size(); i++)
+		{
+			probes.push_back(std::thread([this, i, probeBytes]
+			{
+				m_volumes[i].freeBytes = GetVolumeFreeBytes(m_volumes[i].folder);
+				m_volumes[i].writeBytesPerSecond = MeasureWriteBandwidth(m_volumes[i].folder, probeBytes);
+			}));
+		}
+		for (size_t i = 0; i < probes.size(); i++)
+			probes[i].join();
+	}
+
+	// This function places every stream on a volume. Only the fraction
+	// headroom of a volume's measured bandwidth is planned with, and its free
+	// space must hold durationSeconds of all streams placed on it. Returns 0
+	// if every stream fits, -1 if some had to go to an overloaded volume.
+	int Assign(std::vector<StorageStream> & streams, double durationSeconds, double headroom)
+	{
+		for (size_t v = 0; v < m_volumes.size(); v++)
+		{
+			m_volumes[v].assignedBytesPerSecond = 0;
+			m_volumes[v].numStreams = 0;
+		}
+
+		// Biggest streams first, they are the hardest to place
+		std::vector<size_t> order(streams.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&streams](size_t a, size_t b) { return streams[a].bytesPerSecond > streams[b].bytesPerSecond; });
+
+		int result = 0;
+		for (size_t n = 0; n < order.size(); n++)
+		{
+			StorageStream & stream = streams[order[n]];
+
+			int best = -1;
+			if (stream.preferredVolume >= 0 && stream.preferredVolume < static_cast<int>(m_volumes.size()) &&
+				Headroom(stream.preferredVolume, stream, durationSeconds, headroom) >= 0)
+			{
+				best = stream.preferredVolume;
+			}
+			else
+			{
+				// Most remaining bandwidth wins; a volume that cannot hold the
+				// stream is only taken if no volume can
+				double bestHeadroom = 0;
+				for (size_t v = 0; v < m_volumes.size(); v++)
+				{
+					if (m_volumes[v].writeBytesPerSecond <= 0)
+						continue;
+
+					double h = Headroom(static_cast<int>(v), stream, durationSeconds, headroom);
+					if (best < 0 || h > bestHeadroom)
+					{
+						best = static_cast<int>(v);
+						bestHeadroom = h;
+					}
+				}
+
+				if (best < 0 || bestHeadroom < 0)
+					result = -1;
+			}
+
+			stream.volume = best;
+			if (best >= 0)
+			{
+				m_volumes[best].assignedBytesPerSecond += stream.bytesPerSecond;
+				m_volumes[best].numStreams++;
+			}
+		}
+
+		return result;
+	}
+
+	void PrintReport(const std::vector<StorageStream> & streams, double durationSeconds) const
+	{
+		CAPTURE_LOG(Log_Info) << "[storage] Volumes:";
+		for (size_t v = 0; v < m_volumes.size(); v++)
+		{
+			const StorageVolume & volume = m_volumes[v];
+			const char* note = "";
+			if (volume.writeBytesPerSecond <= 0)
+				note = " (not writable)";
+			else if (volume.assignedBytesPerSecond * durationSeconds > volume.freeBytes)
+				note = " (runs out of space)";
+			CAPTURE_LOG(Log_Info) << "[storage]   " << std::left << std::setw(28) << volume.folder << std::right << std::fixed << std::setprecision(1)
+				<< std::setw(8) << volume.writeBytesPerSecond / 1e6 << " MB/s, "
+				<< std::setw(8) << volume.freeBytes / 1e9 << " GB free, "
+				<< volume.numStreams << " streams, " << volume.assignedBytesPerSecond / 1e6 << " MB/s planned" << note;
+		}
+
+		for (size_t i = 0; i < streams.size(); i++)
+		{
+			const bool moved = streams[i].volume != streams[i].preferredVolume && streams[i].volume >= 0;
+			CAPTURE_LOG(Log_Info) << "[storage]   " << streams[i].name << " -> "
+				<< (streams[i].volume >= 0 ? m_volumes[streams[i].volume].folder : std::string("none")) << (moved ? " (moved)" : "");
+		}
+	}
+
+	const std::vector<StorageVolume> & GetVolumes() const { return m_volumes; }
+
+private:
+	// Bandwidth left on the volume after adding the stream, negative if the
+	// stream does not fit in bandwidth or in space
+	double Headroom(int v, const StorageStream & stream, double durationSeconds, double headroom) const
+	{
+		const StorageVolume & volume = m_volumes[v];
+		if (volume.writeBytesPerSecond <= 0)
+			return -1e300;
+
+		const double bandwidthLeft = volume.writeBytesPerSecond * headroom - volume.assignedBytesPerSecond - stream.bytesPerSecond;
+		const double spaceNeeded = (volume.assignedBytesPerSecond + stream.bytesPerSecond) * durationSeconds;
+		if (spaceNeeded > static_cast<double>(volume.freeBytes))
+			return bandwidthLeft - 1e15;
+
+		return bandwidthLeft;
+	}
+
+	std::vector<StorageVolume> m_volumes;
+};
+
+#endif // STORAGE_SCHEDULER_H
@@ -0,0 +1,171 @@
+//=============================================================================
+// StreamBuffers.h
+//
+// Sizing of the frame buffers between camera and disk, and the driver's
+// stream statistics.
+//
+// PlanStreamBuffers() turns frame size, frame rate, a measured encode latency
+// and the free RAM into a stream (driver) buffer count and a host frame-queue
+// depth. The driver buffers cover grab-thread hiccups; the host queue covers
+// encoder and disk stalls and may grow at runtime up to maxQueueDepth.
+//
+// ReadStreamStats() samples the counters of a camera's TL stream nodemap so
+// frames the driver overwrote or lost before we grabbed them become visible.
+//=============================================================================
+
+#ifndef STREAM_BUFFERS_H
+#define STREAM_BUFFERS_H
+
+#include "Spinnaker.h"
+#include "CaptureLog.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+// Physical memory currently available to new allocations, 0 if unknown
+inline uint64_t GetAvailablePhysicalMemory()
+{
+#if defined(_WIN32)
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	if (!GlobalMemoryStatusEx(&status))
+		return 0;
+	return status.ullAvailPhys;
+#else
+	long pages = sysconf(_SC_AVPHYS_PAGES);
+	long pageSize = sysconf(_SC_PAGESIZE);
+	if (pages <= 0 || pageSize <= 0)
+		return 0;
+	return static_cast<uint64_t>(pages) * static_cast<uint64_t>(pageSize);
+#endif
+}
+
+
+struct StreamBufferOptions {
+	unsigned int minDriverBuffers; // never fewer stream buffers than this
+	unsigned int maxDriverBuffers; // driver limit, see StreamBufferCountManual max
+	double driverSlackSeconds; // grab-thread stall the driver buffers must cover
+	double hostSlackSeconds; // encoder/disk stall the host queue must cover
+	double maxQueueGrowth; // runtime limit of the host queue, as a multiple of the planned depth
+	double ramFraction; // share of the available RAM all cameras together may use
+
+	StreamBufferOptions() : minDriverBuffers(10), maxDriverBuffers(1000), driverSlackSeconds(1.0),
+		hostSlackSeconds(3.0), maxQueueGrowth(4.0), ramFraction(0.5) {}
+};
+
+
+struct StreamBufferPlan {
+	unsigned int driverBuffers;
+	unsigned int queueDepth;
+	unsigned int maxQueueDepth;
+	uint64_t ramBudgetBytes; // per camera
+	bool ramLimited;
+
+	StreamBufferPlan() : driverBuffers(10), queueDepth(40), maxQueueDepth(40), ramBudgetBytes(0), ramLimited(false) {}
+};
+
+
+// This function sizes the driver and host buffers of one camera. The encode
+// latency adds to both slacks, since a frame holds its buffer while it is
+// encoded. availableRam of 0 disables the RAM limit.
+inline StreamBufferPlan PlanStreamBuffers(size_t frameBytes, float frameRate, double encodeLatencyMs,
+	uint64_t availableRam, unsigned int numCameras, const StreamBufferOptions & options = StreamBufferOptions())
+{
+	StreamBufferPlan plan;
+	if (frameBytes == 0 || frameRate <= 0 || numCameras == 0)
+		return plan;
+
+	const double encodeSeconds = std::max(encodeLatencyMs, 0.0) / 1000.0;
+	double driverBuffers = std::ceil(frameRate * (options.driverSlackSeconds + encodeSeconds));
+	double queueDepth = std::ceil(frameRate * (options.hostSlackSeconds + encodeSeconds));
+	double maxQueueDepth = std::ceil(queueDepth * options.maxQueueGrowth);
+
+	driverBuffers = std::min(std::max(driverBuffers, static_cast<double>(options.minDriverBuffers)), static_cast<double>(options.maxDriverBuffers));
+
+	if (availableRam > 0)
+	{
+		plan.ramBudgetBytes = static_cast<uint64_t>(availableRam * options.ramFraction / numCameras);
+		const double budgetFrames = static_cast<double>(plan.ramBudgetBytes / frameBytes);
+
+		// Keep the driver minimum, then give the host queue what is left
+		if (driverBuffers + queueDepth > budgetFrames)
+		{
+			plan.ramLimited = true;
+			const double scale = budgetFrames / (driverBuffers + queueDepth);
+			driverBuffers = std::max(std::floor(driverBuffers * scale), static_cast<double>(options.minDriverBuffers));
+			queueDepth = std::max(budgetFrames - driverBuffers, 1.0);
+		}
+		maxQueueDepth = std::max(std::min(maxQueueDepth, budgetFrames - driverBuffers), queueDepth);
+	}
+
+	plan.driverBuffers = static_cast<unsigned int>(driverBuffers);
+	plan.queueDepth = static_cast<unsigned int>(queueDepth);
+	plan.maxQueueDepth = static_cast<unsigned int>(maxQueueDepth);
+	return plan;
+}
+
+
+inline void PrintStreamBufferPlan(const std::string & serialNumber, const StreamBufferPlan & plan, size_t frameBytes, float frameRate, double encodeLatencyMs)
+{
+	CAPTURE_LOG(Log_Info) << "[" << serialNumber << "] " << "Stream buffers: " << plan.driverBuffers << " driver buffers ("
+		<< plan.driverBuffers / frameRate << " s), frame queue " << plan.queueDepth << " frames ("
+		<< plan.queueDepth / frameRate << " s, up to " << plan.maxQueueDepth << "), "
+		<< static_cast<uint64_t>(plan.driverBuffers + plan.maxQueueDepth) * frameBytes / (1 << 20) << " MB per camera at most, encode latency "
+		<< encodeLatencyMs << " ms" << (plan.ramLimited ? ", limited by available RAM" : "");
+}
+
+
+// Cumulative stream counters since acquisition began; -1 where the driver has
+// no such node.
+struct StreamStats {
+	int64_t delivered; // StreamDeliveredFrameCount
+	int64_t lost; // StreamLostFrameCount: never received completely
+	int64_t overwritten; // StreamDroppedFrameCount: overwritten before we grabbed them
+	int64_t underruns; // StreamBufferUnderrunCount: no free buffer for an arriving frame
+	int64_t failed; // StreamFailedBufferCount
+	int64_t pending; // StreamOutputBufferCount: filled buffers waiting for GetNextImage
+
+	StreamStats() : delivered(-1), lost(-1), overwritten(-1), underruns(-1), failed(-1), pending(-1) {}
+};
+
+
+inline int64_t ReadStreamCounter(Spinnaker::GenApi::INodeMap & sNodeMap, const char* name)
+{
+	Spinnaker::GenApi::CIntegerPtr ptrCounter = sNodeMap.GetNode(name);
+	if (!Spinnaker::GenApi::IsAvailable(ptrCounter) || !Spinnaker::GenApi::IsReadable(ptrCounter))
+		return -1;
+	return ptrCounter->GetValue();
+}
+
+
+// This function reads the stream counters from a camera's TL stream nodemap.
+// Returns false if none of them is available.
+inline bool ReadStreamStats(Spinnaker::GenApi::INodeMap & sNodeMap, StreamStats & stats)
+{
+	try
+	{
+		stats.delivered = ReadStreamCounter(sNodeMap, "StreamDeliveredFrameCount");
+		stats.lost = ReadStreamCounter(sNodeMap, "StreamLostFrameCount");
+		stats.overwritten = ReadStreamCounter(sNodeMap, "StreamDroppedFrameCount");
+		stats.underruns = ReadStreamCounter(sNodeMap, "StreamBufferUnderrunCount");
+		stats.failed = ReadStreamCounter(sNodeMap, "StreamFailedBufferCount");
+		stats.pending = ReadStreamCounter(sNodeMap, "StreamOutputBufferCount");
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		CAPTURE_LOG(Log_Error) << "Stream statistics error: " << e.what();
+		return false;
+	}
+
+	return stats.delivered >= 0 || stats.lost >= 0 || stats.overwritten >= 0 || stats.underruns >= 0 || stats.failed >= 0;
+}
+
+#endif // STREAM_BUFFERS_H
@@ -0,0 +1,568 @@
+//=============================================================================
+// ThreadPlacement.h
+//
+// CPU and NUMA placement of the capture threads. On a multi-socket machine a
+// grab thread that migrates between cores, or whose buffers sit on the other
+// socket's memory, shows up as timing jitter and lost frames.
+//
+// ThreadPlacementPlan gives every camera a NUMA node (the node of its USB
+// controller where that can be found, else from the placement file, else
+// round-robin) and a dedicated grab core on that node. The writer thread
+// runs on the rest of the node and the shared encoder workers on the cores
+// no grab thread uses. Frame buffers are allocated and touched by the pinned
+// grab thread, so the OS's first-touch policy puts them on the camera's
+// node. Grab threads can optionally run under SCHED_FIFO (Linux) or at
+// time-critical priority (Windows).
+//
+// Placement file, one entry per line, '#' starts a comment:
+//
+//   camera    18565848  1  auto   # serial, NUMA node (auto), grab core (auto)
+//   encoders  all                 # NUMA node of the encoder workers, or all
+//   realtime  50                  # SCHED_FIFO priority of grab threads, 0: off
+//
+// Windows placement covers the first processor group (64 logical CPUs).
+//=============================================================================
+
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include "CaptureLog.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+
+// Logical CPUs with their NUMA node and SMT siblings
+struct CpuTopology {
+	std::vector<int> nodeOfCpu; // -1 for CPUs that are not online
+	std::vector<std::vector<int> > siblingsOfCpu; // including the CPU itself
+	int numNodes;
+
+	CpuTopology() : numNodes(1) {}
+
+	int GetNumCpus() const { return static_cast<int>(nodeOfCpu.size()); }
+};
+
+
+#if !defined(_WIN32)
+// Parses a sysfs CPU list such as "0-3,8-11"
+inline std::vector<int> ParseCpuList(const std::string & text)
+{
+	std::vector<int> cpus;
+	std::istringstream ranges(text);
+	std::string range;
+	while (std::getline(ranges, range, ','))
+	{
+		int first = 0, last = 0;
+		const int numParsed = sscanf(range.c_str(), "%d-%d", &first, &last);
+		if (numParsed < 1)
+			continue;
+		if (numParsed == 1)
+			last = first;
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+inline std::string ReadSysfsLine(const std::string & path)
+{
+	std::ifstream file(path.c_str());
+	std::string line;
+	std::getline(file, line);
+	return line;
+}
+#endif
+
+
+inline CpuTopology GetCpuTopology()
+{
+	CpuTopology topology;
+
+#if defined(_WIN32)
+	DWORD size = 0;
+	GetLogicalProcessorInformation(NULL, &size);
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION) + 1);
+	if (size == 0 || !GetLogicalProcessorInformation(&infos[0], &size))
+		infos.clear();
+	else
+		infos.resize(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	const int numCpus = std::min(static_cast<int>(systemInfo.dwNumberOfProcessors), static_cast<int>(sizeof(ULONG_PTR) * 8));
+	topology.nodeOfCpu.assign(numCpus, 0);
+	topology.siblingsOfCpu.assign(numCpus, std::vector<int>());
+
+	for (size_t i = 0; i < infos.size(); i++)
+	{
+		std::vector<int> cpus;
+		for (int cpu = 0; cpu < numCpus; cpu++)
+		{
+			if (infos[i].ProcessorMask & (static_cast<ULONG_PTR>(1) << cpu))
+				cpus.push_back(cpu);
+		}
+
+		if (infos[i].Relationship == RelationNumaNode)
+		{
+			const int node = static_cast<int>(infos[i].NumaNode.NodeNumber);
+			for (size_t c = 0; c < cpus.size(); c++)
+				topology.nodeOfCpu[cpus[c]] = node;
+			topology.numNodes = std::max(topology.numNodes, node + 1);
+		}
+		else if (infos[i].Relationship == RelationProcessorCore)
+		{
+			for (size_t c = 0; c < cpus.size(); c++)
+				topology.siblingsOfCpu[cpus[c]] = cpus;
+		}
+	}
+#else
+	const long numCpus = sysconf(_SC_NPROCESSORS_CONF);
+	topology.nodeOfCpu.assign(numCpus > 0 ? numCpus : 1, -1);
+	topology.siblingsOfCpu.assign(topology.nodeOfCpu.size(), std::vector<int>());
+
+	// Machines without NUMA have no node directories; all CPUs are node 0
+	bool haveNodes = false;
+	for (int node = 0; node < 1024; node++)
+	{
+		char path[96];
+		sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+		std::ifstream file(path);
+		if (!file.is_open())
+			continue;
+
+		std::string line;
+		std::getline(file, line);
+		const std::vector<int> cpus = ParseCpuList(line);
+		for (size_t c = 0; c < cpus.size(); c++)
+		{
+			if (cpus[c] < topology.GetNumCpus())
+				topology.nodeOfCpu[cpus[c]] = node;
+		}
+		topology.numNodes = node + 1;
+		haveNodes = true;
+	}
+
+	const std::vector<int> online = ParseCpuList(ReadSysfsLine("/sys/devices/system/cpu/online"));
+	for (int cpu = 0; cpu < topology.GetNumCpus(); cpu++)
+	{
+		const bool isOnline = online.empty() || std::find(online.begin(), online.end(), cpu) != online.end();
+		if (!isOnline)
+			topology.nodeOfCpu[cpu] = -1;
+		else if (!haveNodes)
+			topology.nodeOfCpu[cpu] = 0;
+	}
+#endif
+
+	for (int cpu = 0; cpu < topology.GetNumCpus(); cpu++)
+	{
+#if !defined(_WIN32)
+		char path[96];
+		sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+		topology.siblingsOfCpu[cpu] = ParseCpuList(ReadSysfsLine(path));
+#endif
+		if (topology.siblingsOfCpu[cpu].empty())
+			topology.siblingsOfCpu[cpu].push_back(cpu);
+	}
+
+	return topology;
+}
+
+
+// This function finds the NUMA node of the USB controller a camera is
+// attached to, by its USB serial string. Returns -1 if unknown (always on
+// Windows).
+inline int FindUsbNumaNode(const std::string & serialNumber)
+{
+#if defined(_WIN32)
+	return -1;
+#else
+	const std::string usbDevices = "/sys/bus/usb/devices/";
+	DIR* dir = opendir(usbDevices.c_str());
+	if (dir == NULL)
+		return -1;
+
+	int node = -1;
+	for (struct dirent* entry = readdir(dir); entry != NULL && node < 0; entry = readdir(dir))
+	{
+		const std::string device = usbDevices + entry->d_name;
+		if (entry->d_name[0] == '.' || ReadSysfsLine(device + "/serial") != serialNumber)
+			continue;
+
+		// Walk up from the USB device to the PCI controller that has a node
+		char resolved[PATH_MAX];
+		if (realpath(device.c_str(), resolved) == NULL)
+			continue;
+		std::string path = resolved;
+		while (path.size() > 1 && node < 0)
+		{
+			std::ifstream numaFile((path + "/numa_node").c_str());
+			if (numaFile >> node)
+				break;
+			path = path.substr(0, path.rfind('/'));
+		}
+	}
+	closedir(dir);
+	return node;
+#endif
+}
+
+
+#if defined(_WIN32)
+typedef HANDLE NativeThreadHandle;
+#else
+typedef pthread_t NativeThreadHandle;
+#endif
+
+// This function restricts a thread to the given CPUs. Returns false if the
+// list is empty or the OS refused.
+inline bool PinThread(NativeThreadHandle thread, const std::vector<int> & cpus)
+{
+	if (cpus.empty())
+		return false;
+
+#if defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for (size_t i = 0; i < cpus.size(); i++)
+	{
+		if (cpus[i] >= 0 && cpus[i] < static_cast<int>(sizeof(DWORD_PTR) * 8))
+			mask |= static_cast<DWORD_PTR>(1) << cpus[i];
+	}
+	return mask != 0 && SetThreadAffinityMask(thread, mask) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (size_t i = 0; i < cpus.size(); i++)
+	{
+		if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+			CPU_SET(cpus[i], &set);
+	}
+	return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#endif
+}
+
+// std::thread's handle is a HANDLE with MSVC and a pthread_t elsewhere;
+// MinGW's winpthreads cannot set affinities
+inline bool PinThread(std::thread & thread, const std::vector<int> & cpus)
+{
+#if defined(_MSC_VER) || !defined(_WIN32)
+	return PinThread(static_cast<NativeThreadHandle>(thread.native_handle()), cpus);
+#else
+	return false;
+#endif
+}
+
+inline bool PinCurrentThread(const std::vector<int> & cpus)
+{
+#if defined(_WIN32)
+	return PinThread(GetCurrentThread(), cpus);
+#else
+	return PinThread(pthread_self(), cpus);
+#endif
+}
+
+// Runs the calling thread under SCHED_FIFO at priority (Linux, needs
+// CAP_SYS_NICE) or at time-critical priority (Windows). Returns false if the
+// OS refused.
+inline bool SetCurrentThreadRealtime(int priority)
+{
+#if defined(_WIN32)
+	return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+	sched_param param;
+	param.sched_priority = std::min(std::max(priority, sched_get_priority_min(SCHED_FIFO)), sched_get_priority_max(SCHED_FIFO));
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#endif
+}
+
+inline std::string FormatCpuList(const std::vector<int> & cpus)
+{
+	std::ostringstream text;
+	for (size_t i = 0; i < cpus.size(); i++)
+	{
+		// Collapse runs into ranges
+		size_t last = i;
+		while (last + 1 < cpus.size() && cpus[last + 1] == cpus[last] + 1)
+			last++;
+		text << (i > 0 ? "," : "") << cpus[i];
+		if (last > i)
+			text << "-" << cpus[last];
+		i = last;
+	}
+	return cpus.empty() ? std::string("any") : text.str();
+}
+
+
+struct CameraPlacement {
+	std::string serialNumber;
+	int node; // -1: not pinned to a node
+	const char* nodeSource; // "usb", "file", "auto"
+	int grabCpu; // dedicated core, -1: none
+	std::vector<int> grabCpus; // grabCpu, or the node's CPUs when cores are shared
+	std::vector<int> writerCpus;
+
+	CameraPlacement() : node(-1), nodeSource("auto"), grabCpu(-1) {}
+};
+
+
+class ThreadPlacementPlan
+{
+public:
+	ThreadPlacementPlan() : m_encoderNode(-1), m_realtimePriority(0), m_dedicatedCores(false) {}
+
+	// This function reads the placement file. Returns the number of entries,
+	// -1 if the file cannot be opened (the plan is then fully automatic).
+	int Load(const std::string & filename)
+	{
+		std::ifstream placementFile(filename.c_str());
+		if (!placementFile.is_open())
+			return -1;
+
+		int numEntries = 0;
+		std::string line;
+		for (int lineNumber = 1; std::getline(placementFile, line); lineNumber++)
+		{
+			std::string::size_type comment = line.find('#');
+			if (comment != std::string::npos)
+				line.erase(comment);
+
+			std::istringstream columns(line);
+			std::string keyword, value;
+			if (!(columns >> keyword))
+				continue;
+
+			bool ok = true;
+			if (keyword == "camera")
+			{
+				ConfiguredCamera camera;
+				std::string node, cpu;
+				ok = static_cast<bool>(columns >> camera.serialNumber >> node >> cpu);
+				camera.node = node == "auto" ? -1 : atoi(node.c_str());
+				camera.grabCpu = cpu == "auto" ? -1 : atoi(cpu.c_str());
+				if (ok)
+					m_configured.push_back(camera);
+			}
+			else if (keyword == "encoders")
+			{
+				ok = static_cast<bool>(columns >> value);
+				m_encoderNode = value == "all" ? -1 : atoi(value.c_str());
+			}
+			else if (keyword == "realtime")
+			{
+				ok = static_cast<bool>(columns >> m_realtimePriority);
+			}
+			else
+			{
+				ok = false;
+			}
+
+			if (!ok)
+				CAPTURE_LOG(Log_Warning) << filename << ":" << lineNumber << ": expected camera/encoders/realtime entry, line ignored";
+			else
+				numEntries++;
+		}
+
+		return numEntries;
+	}
+
+	// This function assigns nodes and cores to the cameras. Grab threads
+	// only get dedicated cores if at least half of the CPUs stay for the
+	// writers and encoders; otherwise they share their node's CPUs.
+	void Plan(const CpuTopology & topology, const std::vector<std::string> & serialNumbers)
+	{
+		m_topology = topology;
+		m_cameras.clear();
+
+		std::vector<int> cpusPerNode(topology.numNodes, 0);
+		int numOnline = 0;
+		for (int cpu = 0; cpu < topology.GetNumCpus(); cpu++)
+		{
+			if (topology.nodeOfCpu[cpu] >= 0)
+			{
+				cpusPerNode[topology.nodeOfCpu[cpu]]++;
+				numOnline++;
+			}
+		}
+		const int coreSize = static_cast<int>(topology.siblingsOfCpu.empty() ? 1 : topology.siblingsOfCpu[0].size());
+		m_dedicatedCores = static_cast<int>(serialNumbers.size()) * coreSize * 2 <= numOnline;
+
+		std::vector<bool> reserved(topology.GetNumCpus(), false);
+		int nextNode = 0;
+		for (size_t i = 0; i < serialNumbers.size(); i++)
+		{
+			CameraPlacement camera;
+			camera.serialNumber = serialNumbers[i];
+
+			const ConfiguredCamera* configured = FindConfigured(serialNumbers[i]);
+			camera.node = FindUsbNumaNode(serialNumbers[i]);
+			camera.nodeSource = "usb";
+			if (configured != NULL && configured->node >= 0)
+			{
+				camera.node = configured->node;
+				camera.nodeSource = "file";
+			}
+			if (camera.node < 0 || camera.node >= topology.numNodes || cpusPerNode[camera.node] == 0)
+			{
+				// Spread cameras of unknown placement over the nodes
+				do { camera.node = nextNode++ % topology.numNodes; } while (cpusPerNode[camera.node] == 0);
+				camera.nodeSource = "auto";
+			}
+
+			if (m_dedicatedCores)
+			{
+				camera.grabCpu = configured != NULL ? configured->grabCpu : -1;
+				if (camera.grabCpu < 0 || camera.grabCpu >= topology.GetNumCpus() || reserved[camera.grabCpu])
+					camera.grabCpu = PickFreeCpu(camera.node, reserved);
+				if (camera.grabCpu >= 0)
+				{
+					// Keep the SMT siblings free, they share the core's execution units
+					const std::vector<int> & siblings = topology.siblingsOfCpu[camera.grabCpu];
+					for (size_t s = 0; s < siblings.size(); s++)
+						reserved[siblings[s]] = true;
+					camera.grabCpus.push_back(camera.grabCpu);
+				}
+			}
+			m_cameras.push_back(camera);
+		}
+
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			m_cameras[i].writerCpus = CpusOf(m_cameras[i].node, reserved);
+			if (m_cameras[i].grabCpus.empty())
+				m_cameras[i].grabCpus = m_cameras[i].writerCpus;
+		}
+		m_encoderCpus = CpusOf(m_encoderNode < topology.numNodes ? m_encoderNode : -1, reserved);
+	}
+
+	// Placement of a camera, NULL if it was not planned
+	const CameraPlacement* Find(const std::string & serialNumber) const
+	{
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			if (m_cameras[i].serialNumber == serialNumber)
+				return &m_cameras[i];
+		}
+		return NULL;
+	}
+
+	const std::vector<int> & GetEncoderCpus() const { return m_encoderCpus; }
+	int GetRealtimePriority() const { return m_realtimePriority; }
+
+	// This function pins the calling grab thread and sets its priority, and
+	// logs the result.
+	void ApplyToGrabThread(const std::string & serialNumber) const
+	{
+		const CameraPlacement* camera = Find(serialNumber);
+		if (camera == NULL)
+			return;
+
+		const bool pinned = PinCurrentThread(camera->grabCpus);
+		std::ostringstream realtime;
+		if (m_realtimePriority > 0)
+		{
+			if (SetCurrentThreadRealtime(m_realtimePriority))
+				realtime << ", realtime priority " << m_realtimePriority;
+			else
+				realtime << ", realtime priority refused (needs CAP_SYS_NICE or an rtprio limit)";
+		}
+		CAPTURE_LOG(pinned ? Log_Info : Log_Warning) << "[" << serialNumber << "] " << "Grab thread "
+			<< (pinned ? "on CPU " : "could not be pinned to CPU ") << FormatCpuList(camera->grabCpus) << " (node " << camera->node << ")" << realtime.str();
+	}
+
+	void ApplyToWriterThread(const std::string & serialNumber) const
+	{
+		const CameraPlacement* camera = Find(serialNumber);
+		if (camera != NULL && !PinCurrentThread(camera->writerCpus))
+			CAPTURE_LOG(Log_Warning) << "[" << serialNumber << "] " << "Writer thread could not be pinned to CPU " << FormatCpuList(camera->writerCpus);
+	}
+
+	void Print() const
+	{
+		CAPTURE_LOG(Log_Info) << "[placement] " << m_topology.GetNumCpus() << " CPUs, " << m_topology.numNodes << " NUMA nodes, "
+			<< (m_dedicatedCores ? "dedicated grab cores" : "grab threads share their node's CPUs (too few cores to dedicate)");
+		for (int node = 0; node < m_topology.numNodes; node++)
+		{
+			std::vector<int> cpus;
+			for (int cpu = 0; cpu < m_topology.GetNumCpus(); cpu++)
+			{
+				if (m_topology.nodeOfCpu[cpu] == node)
+					cpus.push_back(cpu);
+			}
+			CAPTURE_LOG(Log_Info) << "[placement]   node " << node << ": CPU " << FormatCpuList(cpus);
+		}
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			const CameraPlacement & camera = m_cameras[i];
+			CAPTURE_LOG(Log_Info) << "[placement]   " << camera.serialNumber << ": node " << camera.node << " (" << camera.nodeSource
+				<< "), grab CPU " << FormatCpuList(camera.grabCpus) << ", writer CPU " << FormatCpuList(camera.writerCpus);
+		}
+		CAPTURE_LOG(Log_Info) << "[placement]   encoders: CPU " << FormatCpuList(m_encoderCpus)
+			<< (m_realtimePriority > 0 ? ", grab threads realtime" : "");
+	}
+
+private:
+	struct ConfiguredCamera {
+		std::string serialNumber;
+		int node;
+		int grabCpu;
+	};
+
+	const ConfiguredCamera* FindConfigured(const std::string & serialNumber) const
+	{
+		for (size_t i = 0; i < m_configured.size(); i++)
+		{
+			if (m_configured[i].serialNumber == serialNumber)
+				return &m_configured[i];
+		}
+		return NULL;
+	}
+
+	// Highest free CPU of the node; the low ones take most device interrupts
+	int PickFreeCpu(int node, const std::vector<bool> & reserved) const
+	{
+		for (int cpu = m_topology.GetNumCpus() - 1; cpu >= 0; cpu--)
+		{
+			if (m_topology.nodeOfCpu[cpu] == node && !reserved[cpu])
+				return cpu;
+		}
+		return -1;
+	}
+
+	// Online CPUs of a node (-1: all nodes) that no grab thread reserved
+	std::vector<int> CpusOf(int node, const std::vector<bool> & reserved) const
+	{
+		std::vector<int> cpus;
+		for (int cpu = 0; cpu < m_topology.GetNumCpus(); cpu++)
+		{
+			if (m_topology.nodeOfCpu[cpu] >= 0 && (node < 0 || m_topology.nodeOfCpu[cpu] == node) && !reserved[cpu])
+				cpus.push_back(cpu);
+		}
+		return cpus;
+	}
+
+	CpuTopology m_topology;
+	std::vector<ConfiguredCamera> m_configured;
+	int m_encoderNode;
+	int m_realtimePriority;
+	bool m_dedicatedCores;
+
+	std::vector<CameraPlacement> m_cameras;
+	std::vector<int> m_encoderCpus;
+};
+
+#endif // THREAD_PLACEMENT_H
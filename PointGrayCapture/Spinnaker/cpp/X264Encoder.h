@@ -0,0 +1,409 @@
+//=============================================================================
+// X264Encoder.h
+//
+// Software H.264 video segments encoded with libx264, built with USE_X264.
+// At 1280x1024 a CRF-encoded stream is a fraction of the size of MJPEG at
+// the same visual quality, for the price of CPU time, so the encoders of all
+// cameras share a fixed core budget.
+//
+// Preset, rate control and threading are set per camera in a text file, one
+// camera per line, '#' starts a comment:
+//
+//   # serial   preset     crf   bitrateKbps  threading
+//   *          veryfast   23    0            frame
+//   18565848   faster     20    0            slice
+//
+// "*" is the default for cameras without a line of their own. bitrateKbps 0
+// uses constant quality (crf), otherwise average bitrate. "frame" threading
+// encodes several frames in parallel and gives the best throughput; "slice"
+// splits each frame and adds no frames of latency.
+//
+// Each segment is a raw Annex B stream (<name>.h264) from its own encoder
+// instance, so every segment starts with an IDR frame and decodes on its
+// own. Frames are converted to I420 (BT.601, limited range); mono and raw
+// Bayer frames are stored as luma only, scaled to the same 16-235 range.
+//=============================================================================
+
+#ifndef X264_ENCODER_H
+#define X264_ENCODER_H
+
+#include "Spinnaker.h"
+#include "SegmentedVideo.h"
+#include "CaptureLog.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(USE_X264)
+extern "C" {
+#include <x264.h>
+}
+#endif
+
+
+struct EncoderSettings {
+	std::string serialNumber; // "*" for the default
+	std::string preset;
+	double crf;
+	unsigned int bitrateKbps; // 0: constant quality
+	bool slicedThreads;
+	unsigned int threads; // share of the core budget, 0: libx264 decides
+
+	EncoderSettings() : serialNumber("*"), preset("veryfast"), crf(23), bitrateKbps(0), slicedThreads(false), threads(0) {}
+};
+
+
+// Returns the number of settings lines read, -1 if the file cannot be opened
+inline int LoadEncoderSettings(const std::string & filename, std::vector<EncoderSettings> & settings)
+{
+	settings.clear();
+
+	std::ifstream settingsFile(filename.c_str());
+	if (!settingsFile.is_open())
+		return -1;
+
+	std::string line;
+	for (int lineNumber = 1; std::getline(settingsFile, line); lineNumber++)
+	{
+		std::string::size_type comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream columns(line);
+		EncoderSettings entry;
+		if (!(columns >> entry.serialNumber))
+			continue; // blank line
+
+		std::string threading;
+		if (!(columns >> entry.preset >> entry.crf >> entry.bitrateKbps >> threading) ||
+			entry.crf < 0 || entry.crf > 51 || (threading != "frame" && threading != "slice"))
+		{
+			CAPTURE_LOG(Log_Warning) << filename << ":" << lineNumber << ": expected serial preset crf bitrateKbps frame|slice, line ignored";
+			continue;
+		}
+		entry.slicedThreads = threading == "slice";
+		settings.push_back(entry);
+	}
+
+	return static_cast<int>(settings.size());
+}
+
+
+// Returns the settings for serialNumber, the "*" settings, or the defaults
+inline EncoderSettings FindEncoderSettings(const std::vector<EncoderSettings> & settings, const std::string & serialNumber)
+{
+	EncoderSettings found;
+	for (size_t i = 0; i < settings.size(); i++)
+	{
+		if (settings[i].serialNumber == serialNumber)
+			return settings[i];
+		if (settings[i].serialNumber == "*")
+			found = settings[i];
+	}
+	return found;
+}
+
+
+// This function shares coreBudget encoder threads between the streams: one
+// each, the rest in proportion to their pixel rates (width x height x fps).
+// Each stream's share is stored in settings[i].threads. Returns 0, or -1 if
+// the budget is smaller than the number of streams; each stream then still
+// gets the one thread it cannot encode without.
+inline int PlanEncoderThreads(unsigned int coreBudget, const std::vector<double> & pixelRates, std::vector<EncoderSettings> & settings)
+{
+	const size_t numStreams = pixelRates.size();
+	double totalRate = 0;
+	for (size_t i = 0; i < numStreams; i++)
+		totalRate += pixelRates[i];
+	if (numStreams == 0 || totalRate <= 0)
+		return 0;
+
+	// Largest remainder, so the shares add up to the budget
+	const unsigned int spare = coreBudget > numStreams ? coreBudget - static_cast<unsigned int>(numStreams) : 0;
+	std::vector<unsigned int> shares(numStreams);
+	std::vector<double> remainders(numStreams);
+	unsigned int assigned = 0;
+	for (size_t i = 0; i < numStreams; i++)
+	{
+		const double exact = spare * pixelRates[i] / totalRate;
+		shares[i] = static_cast<unsigned int>(floor(exact));
+		remainders[i] = exact - shares[i];
+		assigned += shares[i];
+	}
+	while (assigned < spare)
+	{
+		size_t best = 0;
+		for (size_t i = 1; i < numStreams; i++)
+		{
+			if (remainders[i] > remainders[best])
+				best = i;
+		}
+		shares[best]++;
+		remainders[best] = -1;
+		assigned++;
+	}
+
+	for (size_t i = 0; i < numStreams && i < settings.size(); i++)
+		settings[i].threads = shares[i] + 1;
+	return coreBudget >= numStreams ? 0 : -1;
+}
+
+
+class X264Segment : public VideoSegment
+{
+public:
+	// Returns NULL if the encoder or the file cannot be created. Odd frame
+	// sizes are cropped by one pixel, I420 needs even ones.
+	static X264Segment* Open(const std::string & filename, unsigned int width, unsigned int height, float frameRate,
+		const EncoderSettings & settings)
+	{
+#if defined(USE_X264)
+		X264Segment* segment = new X264Segment();
+		if (segment->Init(filename + ".h264", width & ~1u, height & ~1u, frameRate, settings) < 0)
+		{
+			delete segment;
+			return NULL;
+		}
+		return segment;
+#else
+		(void)filename; (void)width; (void)height; (void)frameRate; (void)settings;
+		CAPTURE_LOG(Log_Error) << "Software H.264 needs a build with USE_X264";
+		return NULL;
+#endif
+	}
+
+	~X264Segment() { Close(); }
+
+	void Append(const Spinnaker::ImagePtr & image)
+	{
+#if defined(USE_X264)
+		if (m_encoder == NULL)
+			return;
+
+		ConvertToI420(image);
+		m_picture.i_pts = m_numFrames++;
+
+		x264_nal_t* nals;
+		int numNals;
+		x264_picture_t pictureOut;
+		const int size = x264_encoder_encode(m_encoder, &nals, &numNals, &m_picture, &pictureOut);
+		Write(nals, size);
+#else
+		(void)image;
+#endif
+	}
+
+	// Encodes the frames still in the encoder's pipeline and closes the file
+	void Close()
+	{
+#if defined(USE_X264)
+		if (m_encoder != NULL)
+		{
+			while (x264_encoder_delayed_frames(m_encoder) > 0)
+			{
+				x264_nal_t* nals;
+				int numNals;
+				x264_picture_t pictureOut;
+				const int size = x264_encoder_encode(m_encoder, &nals, &numNals, NULL, &pictureOut);
+				if (size < 0)
+					break;
+				Write(nals, size);
+			}
+			x264_encoder_close(m_encoder);
+			x264_picture_clean(&m_picture);
+			m_encoder = NULL;
+		}
+#endif
+		if (m_file != NULL)
+		{
+			if (fclose(m_file) != 0)
+				m_writeFailed = true;
+			m_file = NULL;
+			if (m_writeFailed)
+				CAPTURE_LOG(Log_Error) << "Unable to write video segment " << m_filename;
+		}
+	}
+
+	void Discard()
+	{
+		Close();
+		if (!m_filename.empty())
+			remove(m_filename.c_str());
+	}
+
+private:
+	X264Segment() :
+#if defined(USE_X264)
+		m_encoder(NULL), m_width(0), m_height(0),
+#endif
+		m_file(NULL), m_numFrames(0), m_writeFailed(false) {}
+
+	X264Segment(const X264Segment &);
+	X264Segment & operator=(const X264Segment &);
+
+#if defined(USE_X264)
+	int Init(const std::string & filename, unsigned int width, unsigned int height, float frameRate, const EncoderSettings & settings)
+	{
+		m_filename = filename;
+		m_width = static_cast<int>(width);
+		m_height = static_cast<int>(height);
+
+		x264_param_t param;
+		if (x264_param_default_preset(&param, settings.preset.c_str(), NULL) < 0)
+		{
+			CAPTURE_LOG(Log_Error) << "Unknown x264 preset " << settings.preset;
+			return -1;
+		}
+
+		param.i_log_level = X264_LOG_WARNING;
+		param.i_threads = settings.threads > 0 ? static_cast<int>(settings.threads) : X264_THREADS_AUTO;
+		param.b_sliced_threads = settings.slicedThreads ? 1 : 0;
+		param.i_width = static_cast<int>(width);
+		param.i_height = static_cast<int>(height);
+		param.i_csp = X264_CSP_I420;
+		param.i_fps_num = static_cast<uint32_t>(frameRate * 1000 + 0.5f);
+		param.i_fps_den = 1000;
+		param.b_vfr_input = 0;
+		param.i_keyint_max = static_cast<int>(frameRate * 2 + 0.5f); // seekable every 2 s
+		param.b_repeat_headers = 1;
+		param.b_annexb = 1;
+
+		if (settings.bitrateKbps > 0)
+		{
+			param.rc.i_rc_method = X264_RC_ABR;
+			param.rc.i_bitrate = static_cast<int>(settings.bitrateKbps);
+		}
+		else
+		{
+			param.rc.i_rc_method = X264_RC_CRF;
+			param.rc.f_rf_constant = static_cast<float>(settings.crf);
+		}
+
+		if (x264_param_apply_profile(&param, "high") < 0)
+			return -1;
+
+		if (x264_picture_alloc(&m_picture, X264_CSP_I420, param.i_width, param.i_height) < 0)
+			return -1;
+
+		m_encoder = x264_encoder_open(&param);
+		if (m_encoder == NULL)
+		{
+			CAPTURE_LOG(Log_Error) << "Unable to open the x264 encoder for " << filename;
+			x264_picture_clean(&m_picture);
+			return -1;
+		}
+
+		m_file = fopen(filename.c_str(), "wb");
+		if (m_file == NULL)
+		{
+			CAPTURE_LOG(Log_Error) << "Unable to create video segment " << filename;
+			return -1;
+		}
+
+		return 0;
+	}
+
+	void Write(x264_nal_t* nals, int size)
+	{
+		// The payloads of one call are contiguous
+		if (size > 0 && fwrite(nals[0].p_payload, static_cast<size_t>(size), 1, m_file) != 1)
+			m_writeFailed = true;
+	}
+
+	// Full-range values to limited-range luma, 0-255 to 16-235
+	static const uint8_t* GetLimitedRangeLuma()
+	{
+		struct Table {
+			uint8_t values[256];
+			Table() { for (int v = 0; v < 256; v++) values[v] = static_cast<uint8_t>((v * 219 + 127) / 255 + 16); }
+		};
+		static const Table table;
+		return table.values;
+	}
+
+	// BT.601 limited range; chroma from the average of each 2x2 block
+	void ConvertToI420(const Spinnaker::ImagePtr & image)
+	{
+		// A frame smaller than the encoder's leaves the rest of the picture
+		const int width = std::min(m_width, static_cast<int>(image->GetWidth()) & ~1);
+		const int height = std::min(m_height, static_cast<int>(image->GetHeight()) & ~1);
+		const unsigned char* src = static_cast<const unsigned char*>(image->GetData());
+		const size_t srcStride = image->GetStride();
+		const Spinnaker::PixelFormatEnums pixelFormat = image->GetPixelFormat();
+
+		uint8_t* planeY = m_picture.img.plane[0];
+		uint8_t* planeU = m_picture.img.plane[1];
+		uint8_t* planeV = m_picture.img.plane[2];
+		const int strideY = m_picture.img.i_stride[0];
+		const int strideU = m_picture.img.i_stride[1];
+		const int strideV = m_picture.img.i_stride[2];
+
+		if (pixelFormat != Spinnaker::PixelFormat_BGR8 && pixelFormat != Spinnaker::PixelFormat_RGB8)
+		{
+			// Mono and raw Bayer: the stored values as luma, no colour
+			const uint8_t* luma = GetLimitedRangeLuma();
+			for (int y = 0; y < height; y++)
+			{
+				const unsigned char* in = src + y * srcStride;
+				uint8_t* out = planeY + y * strideY;
+				for (int x = 0; x < width; x++)
+					out[x] = luma[in[x]];
+			}
+			for (int y = 0; y < height / 2; y++)
+			{
+				memset(planeU + y * strideU, 128, static_cast<size_t>(width / 2));
+				memset(planeV + y * strideV, 128, static_cast<size_t>(width / 2));
+			}
+			return;
+		}
+
+		const int indexR = pixelFormat == Spinnaker::PixelFormat_RGB8 ? 0 : 2;
+		const int indexB = 2 - indexR;
+		for (int y = 0; y < height; y += 2)
+		{
+			const unsigned char* row0 = src + y * srcStride;
+			const unsigned char* row1 = row0 + srcStride;
+			uint8_t* outY0 = planeY + y * strideY;
+			uint8_t* outY1 = outY0 + strideY;
+			uint8_t* outU = planeU + (y / 2) * strideU;
+			uint8_t* outV = planeV + (y / 2) * strideV;
+
+			for (int x = 0; x < width; x += 2)
+			{
+				int sumR = 0, sumG = 0, sumB = 0;
+				const unsigned char* pixels[4] = { row0 + x * 3, row0 + x * 3 + 3, row1 + x * 3, row1 + x * 3 + 3 };
+				uint8_t* outputs[4] = { outY0 + x, outY0 + x + 1, outY1 + x, outY1 + x + 1 };
+				for (int i = 0; i < 4; i++)
+				{
+					const int r = pixels[i][indexR];
+					const int g = pixels[i][1];
+					const int b = pixels[i][indexB];
+					*outputs[i] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+					sumR += r; sumG += g; sumB += b;
+				}
+				const int r = sumR / 4, g = sumG / 4, b = sumB / 4;
+				outU[x / 2] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+				outV[x / 2] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+			}
+		}
+	}
+
+	x264_t* m_encoder;
+	x264_picture_t m_picture;
+	int m_width;
+	int m_height;
+#endif
+
+	std::string m_filename;
+	FILE* m_file;
+	int64_t m_numFrames;
+	bool m_writeFailed;
+};
+
+#endif // X264_ENCODER_H
@@ -1,4 +1,5 @@
 import os
+import ntpath
 import subprocess
 from glob import glob
 
@@ -6,7 +7,8 @@ import argparse
 
 import pdb
 
-VIDEO_EXT = ".avi"
+VIDEO_EXTS = [".avi", ".mp4", ".h264"]
+MANIFEST_NAME_FORMAT = "VideoManifest%s.txt"
 IMG_EXT = ".jpg"
 IMG_NAME_FORMAT = "img_%06d"+IMG_EXT
 
@@ -18,6 +20,32 @@ def extract_images(video_file_name, tgt_folder, start_frame):
     subprocess.call(["ffmpeg", "-i", video_file_name, "-start_number", "%d"%start_frame, os.path.join(tgt_folder, IMG_NAME_FORMAT) ])
 
 
+def find_segment_files(root_folder, segment_name):
+    # The manifest names a segment without its extension, as written on the
+    # capture machine; the files are looked up next to the manifest
+    name = os.path.join(root_folder, ntpath.basename(segment_name))
+    for ext in VIDEO_EXTS:
+        if os.path.exists(name+ext):
+            return [name+ext]
+    files = []
+    for ext in VIDEO_EXTS:
+        files += glob(name+"-[0-9][0-9][0-9][0-9]"+ext)
+    return sorted(files)
+
+
+def read_manifest(manifest_file_name):
+    # Returns (first_frame, file) per segment, in segment order
+    segments = []
+    with open(manifest_file_name) as manifest:
+        for line in manifest:
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            index, first_frame, num_frames, first_position, segment_name = line.split(None, 4)
+            segments.append((int(index), int(first_frame), segment_name))
+    return [(first_frame, segment_name) for index, first_frame, segment_name in sorted(segments)]
+
+
 def extract_images_for_camera(root_folder, serial_number):
     img_folder = os.path.join(root_folder, serial_number)
     if not os.path.exists(img_folder):
@@ -25,8 +53,27 @@ def extract_images_for_camera(root_folder, serial_number):
     # else:
     #     print img_folder + " already extracted images"
     #     return
-    videos = sorted(glob(os.path.join(root_folder, serial_number+"*"+VIDEO_EXT)))
-    for video in videos:
+    manifest_file_name = os.path.join(root_folder, MANIFEST_NAME_FORMAT % serial_number)
+    if os.path.exists(manifest_file_name):
+        # Each segment starts at its first capture index, so img_%06d is the
+        # capture index even if a segment is missing
+        for first_frame, segment_name in read_manifest(manifest_file_name):
+            videos = find_segment_files(root_folder, segment_name)
+            if not videos:
+                print("Missing video segment " + segment_name)
+            # SpinVideo's own split files of one segment follow each other
+            start_number = first_frame
+            for video in videos:
+                num_images = len(glob(os.path.join(img_folder, "*"+IMG_EXT)))
+                extract_images(video, img_folder, start_number)
+                start_number += len(glob(os.path.join(img_folder, "*"+IMG_EXT))) - num_images
+        return
+
+    # Captures from before the manifest: one video split on size
+    videos = []
+    for ext in VIDEO_EXTS:
+        videos += glob(os.path.join(root_folder, serial_number+"*"+ext))
+    for video in sorted(videos):
         start_number = len(glob(os.path.join(img_folder, "*"+IMG_EXT)))
         extract_images(video, img_folder, start_number)
     
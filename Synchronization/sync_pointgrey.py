@@ -1,5 +1,6 @@
 import os
 import shutil
+import struct
 import subprocess
 from glob import glob
 from functools import reduce
@@ -12,6 +13,18 @@ import argparse
 IMG_EXT = ".jpg"
 IMG_NAME_FORMAT = "img_%06d"+IMG_EXT
 LOG_NAME_FORMAT = "Log%s.txt"
+BIN_LOG_NAME_FORMAT = "Log%s.bin"
+
+# Binary chunk log layout, see PointGrayCapture/Spinnaker/cpp/ChunkLog.h
+CHUNK_LOG_MAGIC = b"CHUNKLOG"
+CHUNK_LOG_HEADER = struct.Struct("<8sIIII32sQ")
+CHUNK_LOG_RECORD = struct.Struct("<IIqQQddIIIIIi")
+CHUNK_LOG_RECORD_V2 = struct.Struct("<IIqQQddIIIIIiQ")  # + commonTimestamp
+CHUNK_LOG_INCOMPLETE = 1
+CHUNK_LOG_NO_CHUNK_DATA = 4  # frameID is not the camera's
+
+# Frame sets assembled online by the capture program
+SYNC_INDEX_NAME = "SyncIndex.csv"
 
 SYNCED_FOLDER = "SyncData"
 
@@ -20,9 +33,43 @@ serial_numbers = ["18565847", "18565848", "18565849", "18565850", "18565851", "1
 #########################
 
 def read_frameid_for_camera(root_folder, serial_number):
+    binlog_name = os.path.join(root_folder, BIN_LOG_NAME_FORMAT%serial_number)
+    if os.path.exists(binlog_name):
+        return read_frameid_from_binary_log(binlog_name)
     logfile_name = os.path.join(root_folder, LOG_NAME_FORMAT%serial_number) 
     return read_frameid_from_file(logfile_name)
 
+def read_chunk_log(logfile_name):
+    """Returns (serial number, list of record tuples) of a binary chunk log.
+    Record fields: captureIndex, statusFlags, frameID, deviceTimestamp,
+    hostTimestamp, exposureTime, gain, width, height, offsetX, offsetY,
+    grabIndex, sequencerSetActive, and from version 2 commonTimestamp."""
+    with open(logfile_name, "rb") as f:
+        data = f.read()
+
+    magic, version, header_size, record_size, _, serial, _ = CHUNK_LOG_HEADER.unpack_from(data, 0)
+    if magic != CHUNK_LOG_MAGIC:
+        raise ValueError("%s is not a chunk log" % logfile_name)
+
+    # Newer versions only append fields, so read the ones we know
+    num_records = (len(data) - header_size) // record_size
+    record_struct = CHUNK_LOG_RECORD_V2 if version >= 2 else CHUNK_LOG_RECORD
+    records = [record_struct.unpack_from(data, header_size + i*record_size) for i in range(num_records)]
+    return serial.rstrip(b"\0").decode("ascii"), records
+
+def read_frameid_from_binary_log(logfile_name):
+    _, records = read_chunk_log(logfile_name)
+    records = [r for r in records if not r[1] & (CHUNK_LOG_INCOMPLETE | CHUNK_LOG_NO_CHUNK_DATA)]
+
+    frameids = {}  # physics: index
+    if not records: return frameids
+    startid = records[0][2]
+
+    for r in records:
+        frameids[r[2] - startid] = r[0]
+
+    return frameids
+
 def read_frameid_from_file(logfile_name):
     with open(logfile_name) as f:
         lines = f.readlines()
@@ -42,6 +89,25 @@ def read_frameid_from_file(logfile_name):
     return frameids
     
 
+def read_sync_index(index_name):
+    """Returns one {set id: capture index} dict per camera in serial_numbers,
+    holding only the sets that were recorded by every camera."""
+    with open(index_name) as f:
+        lines = f.readlines()
+
+    index_serials = lines[0].strip().split(",")[3:]
+    columns = [index_serials.index(serial_number) for serial_number in serial_numbers]
+
+    frame_ids = [{} for _ in serial_numbers]
+    for line in lines[1:]:
+        fields = line.strip().split(",")
+        if fields[1] == "incomplete": continue
+        set_id = int(fields[0])
+        for i, column in enumerate(columns):
+            frame_ids[i][set_id] = int(fields[3 + column])
+
+    return frame_ids
+
 def move_synced_images(src_folder, tgt_folder, synced_ids, frame_dict):
     for synced_id in synced_ids:
         src_img = os.path.join(src_folder, IMG_NAME_FORMAT % frame_dict[synced_id])
@@ -57,7 +123,11 @@ args = parser.parse_args()
 ##########################
 
 root_folder = args.folder
-frame_ids = [ read_frameid_for_camera(root_folder, serial_number) for serial_number in serial_numbers]
+sync_index_name = os.path.join(root_folder, SYNC_INDEX_NAME)
+if os.path.exists(sync_index_name):
+    frame_ids = read_sync_index(sync_index_name)
+else:
+    frame_ids = [ read_frameid_for_camera(root_folder, serial_number) for serial_number in serial_numbers]
 
 # physics ids
 frame_ids_set = [set(ids.keys()) for ids in frame_ids]